@@ -0,0 +1,149 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <future>
+#include <memory>
+#include <utility>
+#include <functional>
+
+#include <boost/utility.hpp>
+
+#include "blockrepository.hpp"
+#include "executor.hpp"
+
+namespace pipedb
+{
+
+/**
+ * @brief Asynchronous face of a block repository.
+ *
+ * Operations run on the workers of an executor, reads and writes in their
+ * own lane. Keys and input blocks only reference the caller memory: it must
+ * stay valid until the operation completes.
+ *
+ * When the executor is stopped, operations complete at once with
+ * Return::NOT_SUPPORTED.
+ */
+class AsyncRepo: private boost::noncopyable
+{
+public:
+  typedef std::function<void(const Return&)> callback_t;
+  typedef std::function<void(const Return&, OutputBlock&&)> get_callback_t;
+  typedef std::pair<Return, OutputBlock> get_result_t;
+
+  AsyncRepo(BlockRepository& repository, Executor& executor) :
+      _repository(repository), _executor(executor)
+  {
+  }
+
+  /**
+   * @brief Put a value, done is called from a worker thread.
+   */
+  void async_put(const Key& key, const InputBlock& value, callback_t&& done)
+  {
+    BlockRepository& repository = _repository;
+    const char* k = key.get_data();
+    const size_t ks = key.get_size();
+    const char* v = value.get_data();
+    const size_t vs = value.get_size();
+    submit(Executor::WRITE, [&repository, k, ks, v, vs, done]()
+    {
+      done(repository.put(Key(k, ks), InputBlock(v, vs)));
+    }, done);
+  }
+
+  std::future<Return> async_put(const Key& key, const InputBlock& value)
+  {
+    std::shared_ptr<std::promise<Return>> promise(new std::promise<Return>());
+    async_put(key, value, [promise](const Return& state)
+    {
+      promise->set_value(state);
+    });
+    return promise->get_future();
+  }
+
+  /**
+   * @brief Get a value, done is called from a worker thread.
+   */
+  void async_get(const Key& key, get_callback_t&& done)
+  {
+    BlockRepository& repository = _repository;
+    const char* k = key.get_data();
+    const size_t ks = key.get_size();
+    submit(Executor::READ, [&repository, k, ks, done]()
+    {
+      OutputBlock value;
+      const Return state = repository.get(Key(k, ks), value);
+      done(state, std::move(value));
+    }, [done](const Return& state)
+    {
+      done(state, OutputBlock());
+    });
+  }
+
+  std::future<get_result_t> async_get(const Key& key)
+  {
+    std::shared_ptr<std::promise<get_result_t>> promise(
+        new std::promise<get_result_t>());
+    async_get(key, [promise](const Return& state, OutputBlock&& value)
+    {
+      promise->set_value(get_result_t(state, std::move(value)));
+    });
+    return promise->get_future();
+  }
+
+  /**
+   * @brief Drop a key, done is called from a worker thread.
+   */
+  void async_drop(const Key& key, callback_t&& done)
+  {
+    BlockRepository& repository = _repository;
+    const char* k = key.get_data();
+    const size_t ks = key.get_size();
+    submit(Executor::WRITE, [&repository, k, ks, done]()
+    {
+      done(repository.drop(Key(k, ks)));
+    }, done);
+  }
+
+  std::future<Return> async_drop(const Key& key)
+  {
+    std::shared_ptr<std::promise<Return>> promise(new std::promise<Return>());
+    async_drop(key, [promise](const Return& state)
+    {
+      promise->set_value(state);
+    });
+    return promise->get_future();
+  }
+
+private:
+  void submit(const Executor::Lane lane, Executor::task_t&& task,
+      const callback_t& rejected)
+  {
+    if (_executor.submit(lane, std::move(task)) == false)
+    {
+      rejected(Return::NOT_SUPPORTED);
+    }
+  }
+
+  BlockRepository& _repository;
+  Executor& _executor;
+};
+
+}
@@ -17,12 +17,18 @@
  */
 #pragma once
 
+#include <memory>
+#include <string>
+#include <vector>
+
 #include <boost/utility.hpp>
 
 #include "returnstate.hpp"
 #include "key.hpp"
 #include "inputblock.hpp"
 #include "outputblock.hpp"
+#include "cursor.hpp"
+#include "snapshot.hpp"
 
 namespace pipedb
 {
@@ -68,16 +74,45 @@ public:
    */
   virtual Return put(const Key&& key, const InputBlock&& value) = 0;
 
+  /**
+   * @brief Put a value, durable before returning when sync is true.
+   *
+   * Block repositories without durability control ignore sync.
+   */
+  virtual Return put(const Key&& key, const InputBlock&& value, const bool sync)
+  {
+    (void) sync;
+    return put(std::move(key), std::move(value));
+  }
+
   /**
    * @brief Get a value from the block repository.
    */
   virtual Return get(const Key&& key, OutputBlock& value) = 0;
 
+  /**
+   * @brief Get a value as it was when the snapshot was taken.
+   *
+   * Return Return::NOT_SUPPORTED if the snapshot was not taken on this
+   * block repository.
+   */
+  virtual Return get(const Key&& key, OutputBlock& value,
+      const Snapshot& snapshot) = 0;
+
   /**
    * @brief Drop the key (and the associated value) from the block repository
    */
   virtual Return drop(const Key&& key) = 0;
 
+  /**
+   * @brief Drop a key, durable before returning when sync is true.
+   */
+  virtual Return drop(const Key&& key, const bool sync)
+  {
+    (void) sync;
+    return drop(std::move(key));
+  }
+
   /**
    * @brief Check that the key exists in the block repository
    */
@@ -88,9 +123,114 @@ public:
    */
   virtual bool excluded(const Key&& key) = 0;
 
+  /**
+   * @brief Put a batch of values in the block repository.
+   *
+   * keys[i] is associated to values[i], the i-th returned state is the
+   * result for keys[i].
+   */
+  virtual std::vector<Return> multi_put(const std::vector<Key>& keys,
+      const std::vector<InputBlock>& values) = 0;
+
+  /**
+   * @brief Put a batch of values, durable before returning when sync is
+   * true.
+   */
+  virtual std::vector<Return> multi_put(const std::vector<Key>& keys,
+      const std::vector<InputBlock>& values, const bool sync)
+  {
+    (void) sync;
+    return multi_put(keys, values);
+  }
+
+  /**
+   * @brief Get a batch of values from the block repository.
+   *
+   * values is resized to the number of keys, values[i] is filled when
+   * the i-th returned state is a success.
+   */
+  virtual std::vector<Return> multi_get(const std::vector<Key>& keys,
+      std::vector<OutputBlock>& values) = 0;
+
+  /**
+   * @brief Get a batch of values as they were when the snapshot was taken.
+   */
+  virtual std::vector<Return> multi_get(const std::vector<Key>& keys,
+      std::vector<OutputBlock>& values, const Snapshot& snapshot) = 0;
+
+  /**
+   * @brief Drop a batch of keys (and the associated values) from the block repository
+   */
+  virtual std::vector<Return> multi_drop(const std::vector<Key>& keys) = 0;
+
+  /**
+   * @brief Drop a batch of keys, durable before returning when sync is
+   * true.
+   */
+  virtual std::vector<Return> multi_drop(const std::vector<Key>& keys,
+      const bool sync)
+  {
+    (void) sync;
+    return multi_drop(keys);
+  }
+
+  /**
+   * @brief Check for each key that it exists in the block repository
+   */
+  virtual std::vector<bool> multi_included(const std::vector<Key>& keys) = 0;
+
+  /**
+   * @brief Check for each key that it does not exists in the block repository
+   */
+  virtual std::vector<bool> multi_excluded(const std::vector<Key>& keys) = 0;
+
+  /**
+   * @brief Iterate in key order over the entries with keys in [begin, end[.
+   *
+   * An empty begin starts at the first key, an empty end stops after the
+   * last one. The bounds are copied by the cursor.
+   */
+  virtual std::unique_ptr<Cursor> scan(const Key&& begin, const Key&& end,
+      const ScanOptions& options = ScanOptions()) = 0;
+
+  /**
+   * @brief Iterate in key order over the entries with keys starting with
+   * prefix.
+   */
+  std::unique_ptr<Cursor> scan_prefix(const Key&& prefix,
+      const ScanOptions& options = ScanOptions())
+  {
+    const std::string end = Cursor::successor(prefix);
+    return scan(std::move(prefix), Key(end), options);
+  }
+
+  /**
+   * @brief Take a consistent view of the block repository.
+   *
+   * Return NULL if the block repository is not opened.
+   */
+  virtual std::unique_ptr<Snapshot> snapshot() = 0;
+
+  /**
+   * @brief Live snapshots of this block repository.
+   */
+  const SnapshotTracker& snapshots() const noexcept
+  {
+    return *_snapshots;
+  }
+
 protected:
-  BlockRepository() = default;
+  BlockRepository() :
+      _snapshots(std::make_shared<SnapshotTracker>())
+  {
+  }
+
   virtual ~BlockRepository() {}
+
+  /**
+   * @brief Shared with the snapshots, that may outlive the repository.
+   */
+  std::shared_ptr<SnapshotTracker> _snapshots;
 };
 
 }
@@ -0,0 +1,415 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+#include <boost/utility.hpp>
+
+#include "ldbrepo.hpp"
+
+#include <leveldb/comparator.h>
+#include <leveldb/table_file_writer.h>
+
+namespace pipedb
+{
+
+/**
+ * @brief Load a large number of blocks into a LdbRepo without going
+ * through its log, memtable and compactions.
+ *
+ * The blocks are written to table files in temporary_directory, then
+ * finish() moves all of them into the repository at once. Tables
+ * overlapping nothing already stored go as they are to the last level,
+ * the ingestion is then nearly instant.
+ *
+ * When the keys are added in strictly increasing order (sorted), the
+ * tables are written as the blocks come. Otherwise the blocks are sorted
+ * in runs of memory_budget bytes, spilled to temporary_directory, and
+ * merged by finish(): the last block added for a key wins.
+ *
+ * The keys are added to the membership filter of the repository as they
+ * come. The blocks the repository keeps in its value logs are written to
+ * a value log along with each table, ingested with it. The repository
+ * shall outlive the loader, and shall not be a DedupRepo.
+ */
+class BulkLoader: boost::noncopyable
+{
+public:
+  static std::unique_ptr<BulkLoader> create(LdbRepo& repository,
+      const std::string& temporary_directory, const bool sorted = false,
+      const size_t memory_budget = 256 << 20, const size_t table_bytes =
+          64 << 20)
+  {
+    std::unique_ptr<BulkLoader> o(
+        new BulkLoader(repository, temporary_directory, sorted, memory_budget,
+            table_bytes));
+    return o;
+  }
+
+  virtual ~BulkLoader()
+  {
+    _table.reset();
+    for (const std::string& file : _tables)
+    {
+      ::remove(file.c_str());
+      ::remove(leveldb::TableFileWriter::ValueLogName(file).c_str());
+    }
+    removeRuns();
+  }
+
+  /**
+   * @brief Add a block to load.
+   *
+   * Return Return::NOT_SUPPORTED once finished, or when sorted and key
+   * is not after the previous one.
+   */
+  Return add(const Key&& key, const InputBlock&& value)
+  {
+    if (_finished)
+    {
+      return Return::NOT_SUPPORTED;
+    }
+    const leveldb::Slice k(key.get_data(), key.get_size());
+    const leveldb::Slice v(value.get_data(), value.get_size());
+    if (_sorted && _count > 0 && _comparator->Compare(k, _last) <= 0)
+    {
+      return Return::NOT_SUPPORTED;
+    }
+    if (_repository.membership)
+    {
+      _repository.membership->add(key);
+    }
+    _count++;
+    if (_sorted)
+    {
+      _last.assign(k.data(), k.size());
+      return write(k, v);
+    }
+    _buffer.push_back(Entry
+    { key.copy_as_string(), value.copy_as_string() });
+    _buffered += k.size() + v.size() + sizeof(Entry);
+    if (_buffered >= _memoryBudget)
+    {
+      return spill();
+    }
+    return Return::OK;
+  }
+
+  /**
+   * @brief Write the last tables and move all of them into the
+   * repository, which must be open.
+   *
+   * Nothing is loaded if an error is returned.
+   */
+  Return finish()
+  {
+    if (_finished || _repository.opened() == false)
+    {
+      return Return::NOT_SUPPORTED;
+    }
+    _finished = true;
+    if (_sorted == false)
+    {
+      const Return sorted = sortAll();
+      removeRuns();
+      if (sorted.success() == false)
+      {
+        return sorted;
+      }
+    }
+    const Return closed = closeTable();
+    if (closed.success() == false || _tables.empty())
+    {
+      return closed;
+    }
+    const Return state = _repository.fromStatus(
+        _repository.db->IngestTables(_tables));
+    if (state.success())
+    {
+      _tables.clear();
+    }
+    return state;
+  }
+
+  /**
+   * @brief Number of blocks added.
+   */
+  uint64_t count() const
+  {
+    return _count;
+  }
+
+protected:
+  BulkLoader(LdbRepo& repository, const std::string& temporary_directory,
+      const bool sorted, const size_t memory_budget, const size_t table_bytes) :
+      _repository(repository), _directory(temporary_directory), _sorted(
+          sorted), _memoryBudget(memory_budget), _tableBytes(table_bytes), _comparator(
+          repository.options.comparator), _finished(false), _count(0), _buffered(
+          0), _files(0)
+  {
+    boost::system::error_code ignored;
+    boost::filesystem::create_directories(_directory, ignored);
+  }
+
+  typedef typename std::unique_ptr<BulkLoader> befriended_deleter_t;
+  friend std::unique_ptr<BulkLoader>::deleter_type;
+
+private:
+  struct Entry
+  {
+    std::string key;
+    std::string value;
+  };
+
+  /**
+   * @brief A run of sorted blocks spilled to a file, read back by merge().
+   *
+   * The blocks are stored as their key size and value size on 32 bits,
+   * followed by the key and the value.
+   */
+  struct Run
+  {
+    std::ifstream in;
+    std::string key;
+    std::string value;
+    size_t index; /** Later runs win on equal keys */
+
+    bool next()
+    {
+      uint32_t sizes[2];
+      if (!in.read(reinterpret_cast<char*>(sizes), sizeof(sizes)))
+      {
+        return false;
+      }
+      key.resize(sizes[0]);
+      value.resize(sizes[1]);
+      in.read(&key[0], sizes[0]);
+      in.read(&value[0], sizes[1]);
+      return static_cast<bool>(in);
+    }
+  };
+
+  /**
+   * @brief Heap order of the runs: smallest key first, then latest run.
+   */
+  struct RunOrder
+  {
+    const leveldb::Comparator* comparator;
+
+    bool operator()(const Run* a, const Run* b) const
+    {
+      const int c = comparator->Compare(a->key, b->key);
+      return c > 0 || (c == 0 && a->index < b->index);
+    }
+  };
+
+  /**
+   * @brief Write the blocks added, in order, to the tables.
+   */
+  Return sortAll()
+  {
+    if (_runs.empty())
+    {
+      sortBuffer();
+      for (const Entry& entry : _buffer)
+      {
+        const Return state = write(entry.key, entry.value);
+        if (state.success() == false)
+        {
+          return state;
+        }
+      }
+      _buffer.clear();
+      return Return::OK;
+    }
+    const Return spilled = spill();
+    if (spilled.success() == false)
+    {
+      return spilled;
+    }
+    return merge();
+  }
+
+  std::string file(const std::string& prefix)
+  {
+    return _directory + "/" + prefix + std::to_string(_files++);
+  }
+
+  /**
+   * @brief Sort the buffer, keeping the last block added for each key.
+   */
+  void sortBuffer()
+  {
+    const leveldb::Comparator* comparator = _comparator;
+    std::stable_sort(_buffer.begin(), _buffer.end(),
+        [comparator](const Entry& a, const Entry& b)
+        {
+          return comparator->Compare(a.key, b.key) < 0;
+        });
+    size_t kept = 0;
+    for (size_t i = 0; i < _buffer.size(); i++)
+    {
+      if (i + 1 < _buffer.size() && _buffer[i].key == _buffer[i + 1].key)
+      {
+        continue;
+      }
+      if (kept != i)
+      {
+        _buffer[kept] = std::move(_buffer[i]);
+      }
+      kept++;
+    }
+    _buffer.resize(kept);
+  }
+
+  Return spill()
+  {
+    sortBuffer();
+    const std::string name = file("run-");
+    std::ofstream out(name, std::ios_base::binary | std::ios_base::trunc);
+    _runs.push_back(name);
+    for (const Entry& entry : _buffer)
+    {
+      const uint32_t sizes[2] =
+      { static_cast<uint32_t>(entry.key.size()), static_cast<uint32_t>(entry
+          .value.size()) };
+      out.write(reinterpret_cast<const char*>(sizes), sizeof(sizes));
+      out.write(entry.key.data(), entry.key.size());
+      out.write(entry.value.data(), entry.value.size());
+    }
+    out.close();
+    _buffer.clear();
+    _buffered = 0;
+    return out ? Return::OK : Return::BACKEND_ERROR;
+  }
+
+  /**
+   * @brief Merge the runs into the tables.
+   */
+  Return merge()
+  {
+    std::vector<std::unique_ptr<Run>> runs;
+    std::priority_queue<Run*, std::vector<Run*>, RunOrder> heap(RunOrder
+    { _comparator });
+    for (size_t i = 0; i < _runs.size(); i++)
+    {
+      runs.emplace_back(new Run());
+      Run* run = runs.back().get();
+      run->in.open(_runs[i], std::ios_base::binary);
+      run->index = i;
+      if (run->next())
+      {
+        heap.push(run);
+      }
+    }
+    std::string previous;
+    bool first = true;
+    while (heap.empty() == false)
+    {
+      Run* run = heap.top();
+      heap.pop();
+      // the latest run comes first, the others are overwritten
+      if (first || run->key != previous)
+      {
+        const Return state = write(run->key, run->value);
+        if (state.success() == false)
+        {
+          return state;
+        }
+        previous = run->key;
+        first = false;
+      }
+      if (run->next())
+      {
+        heap.push(run);
+      }
+    }
+    for (const std::unique_ptr<Run>& run : runs)
+    {
+      if (run->in.bad())
+      {
+        return Return::BACKEND_ERROR;
+      }
+    }
+    return Return::OK;
+  }
+
+  Return write(const leveldb::Slice& key, const leveldb::Slice& value)
+  {
+    if (!_table)
+    {
+      _tables.push_back(file("table-") + ".ldb");
+      _table.reset(
+          new leveldb::TableFileWriter(_repository.options, _tables.back()));
+    }
+    const Return state = _repository.fromStatus(_table->Add(key, value));
+    if (state.success()
+        && _table->FileSize() + _table->ValueLogSize() >= _tableBytes)
+    {
+      return closeTable();
+    }
+    return state;
+  }
+
+  Return closeTable()
+  {
+    if (!_table)
+    {
+      return Return::OK;
+    }
+    const Return state = _repository.fromStatus(_table->Finish());
+    _table.reset();
+    return state;
+  }
+
+  void removeRuns()
+  {
+    for (const std::string& run : _runs)
+    {
+      ::remove(run.c_str());
+    }
+    _runs.clear();
+  }
+
+  LdbRepo& _repository;
+  const std::string _directory;
+  const bool _sorted;
+  const size_t _memoryBudget;
+  const size_t _tableBytes;
+  const leveldb::Comparator* _comparator;
+  bool _finished;
+  uint64_t _count;
+  std::vector<Entry> _buffer; /** Blocks not yet sorted */
+  size_t _buffered; /** Bytes of _buffer */
+  std::vector<std::string> _runs; /** Files of the spilled runs */
+  std::vector<std::string> _tables; /** Table files written, to ingest */
+  std::unique_ptr<leveldb::TableFileWriter> _table; /** Table being written */
+  std::string _last; /** Last key added when sorted */
+  uint64_t _files;
+};
+
+}
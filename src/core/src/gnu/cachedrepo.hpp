@@ -0,0 +1,515 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include "blockrepository.hpp"
+
+namespace pipedb
+{
+
+/**
+ * @brief A block repository caching whole values of another one.
+ *
+ * Values read from the backend are kept in memory up to a byte budget and
+ * returned pinned on the cache, without copy. The cache is split in shards
+ * by lookup hash, each one evicting with the CLOCK policy under its own
+ * lock. Keys are invalidated when they are put or dropped through this
+ * repository; writes made directly to the backend are not seen.
+ */
+class CachedRepo: public BlockRepository
+{
+public:
+  /**
+   * @brief Cache up to capacity bytes (keys, values and bookkeeping) of
+   * the values of backend, over the given number of shards.
+   */
+  CachedRepo(BlockRepository& backend, const size_t capacity,
+      const size_t shards = 16) :
+      BlockRepository(), _backend(backend), _shards(), _hits(0), _misses(0)
+  {
+    const size_t count = shards == 0 ? 1 : shards;
+    for (size_t i = 0; i < count; ++i)
+    {
+      _shards.emplace_back(new Shard(capacity / count));
+    }
+  }
+
+  virtual ~CachedRepo()
+  {
+    clear();
+  }
+
+  virtual bool opened()
+  {
+    return _backend.opened();
+  }
+
+  virtual bool closed()
+  {
+    return _backend.closed();
+  }
+
+  virtual Return open()
+  {
+    return _backend.open();
+  }
+
+  virtual Return close()
+  {
+    clear();
+    return _backend.close();
+  }
+
+  virtual Return erase()
+  {
+    clear();
+    return _backend.erase();
+  }
+
+  virtual Return put(const Key&& key, const InputBlock&& value)
+  {
+    Return state = _backend.put(std::move(key), std::move(value));
+    shard(key).invalidate(key);
+    return state;
+  }
+
+  virtual Return put(const Key&& key, const InputBlock&& value, const bool sync)
+  {
+    Return state = _backend.put(std::move(key), std::move(value), sync);
+    shard(key).invalidate(key);
+    return state;
+  }
+
+  virtual Return get(const Key&& key, OutputBlock& value)
+  {
+    Shard& s = shard(key);
+    const uint64_t epoch = s.epoch();
+    if (s.lookup(key, value))
+    {
+      ++_hits;
+      return Return::OK;
+    }
+    ++_misses;
+    Return state = _backend.get(std::move(key), value);
+    if (state.success())
+    {
+      s.fill(key, value, epoch);
+    }
+    return state;
+  }
+
+  /**
+   * @brief Snapshot reads are served by the backend.
+   */
+  virtual Return get(const Key&& key, OutputBlock& value,
+      const Snapshot& snapshot)
+  {
+    return _backend.get(std::move(key), value, snapshot);
+  }
+
+  virtual Return drop(const Key&& key)
+  {
+    Return state = _backend.drop(std::move(key));
+    shard(key).invalidate(key);
+    return state;
+  }
+
+  virtual Return drop(const Key&& key, const bool sync)
+  {
+    Return state = _backend.drop(std::move(key), sync);
+    shard(key).invalidate(key);
+    return state;
+  }
+
+  /**
+   * @brief Cached keys are answered without a lookup in the backend.
+   */
+  virtual bool included(const Key&& key)
+  {
+    return shard(key).contains(key) || _backend.included(std::move(key));
+  }
+
+  virtual bool excluded(const Key&& key)
+  {
+    return !shard(key).contains(key) && _backend.excluded(std::move(key));
+  }
+
+  virtual std::vector<Return> multi_put(const std::vector<Key>& keys,
+      const std::vector<InputBlock>& values)
+  {
+    std::vector<Return> states = _backend.multi_put(keys, values);
+    invalidate(keys);
+    return states;
+  }
+
+  virtual std::vector<Return> multi_put(const std::vector<Key>& keys,
+      const std::vector<InputBlock>& values, const bool sync)
+  {
+    std::vector<Return> states = _backend.multi_put(keys, values, sync);
+    invalidate(keys);
+    return states;
+  }
+
+  /**
+   * @brief Only the keys missing from the cache are read from the backend,
+   * in one batch.
+   */
+  virtual std::vector<Return> multi_get(const std::vector<Key>& keys,
+      std::vector<OutputBlock>& values)
+  {
+    values.resize(keys.size());
+    std::vector<uint64_t> epochs;
+    std::vector<size_t> missing;
+    std::vector<Key> missingKeys;
+    epochs.reserve(keys.size());
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+      Shard& s = shard(keys[i]);
+      epochs.push_back(s.epoch());
+      if (s.lookup(keys[i], values[i]) == false)
+      {
+        missing.push_back(i);
+        missingKeys.emplace_back(keys[i].get_data(), keys[i].get_size());
+      }
+    }
+    _hits += keys.size() - missing.size();
+    _misses += missing.size();
+    if (missing.empty())
+    {
+      return std::vector<Return>(keys.size(), Return::OK);
+    }
+
+    std::vector<OutputBlock> missingValues;
+    const std::vector<Return> missingStates = _backend.multi_get(missingKeys,
+        missingValues);
+    std::vector<Return> states;
+    states.reserve(keys.size());
+    size_t m = 0;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+      if (m < missing.size() && missing[m] == i)
+      {
+        if (missingStates[m].success())
+        {
+          values[i] = std::move(missingValues[m]);
+          shard(keys[i]).fill(keys[i], values[i], epochs[i]);
+        }
+        states.push_back(missingStates[m]);
+        ++m;
+      }
+      else
+      {
+        states.push_back(Return::OK);
+      }
+    }
+    return states;
+  }
+
+  virtual std::vector<Return> multi_get(const std::vector<Key>& keys,
+      std::vector<OutputBlock>& values, const Snapshot& snapshot)
+  {
+    return _backend.multi_get(keys, values, snapshot);
+  }
+
+  virtual std::vector<Return> multi_drop(const std::vector<Key>& keys)
+  {
+    std::vector<Return> states = _backend.multi_drop(keys);
+    invalidate(keys);
+    return states;
+  }
+
+  virtual std::vector<Return> multi_drop(const std::vector<Key>& keys,
+      const bool sync)
+  {
+    std::vector<Return> states = _backend.multi_drop(keys, sync);
+    invalidate(keys);
+    return states;
+  }
+
+  virtual std::vector<bool> multi_included(const std::vector<Key>& keys)
+  {
+    std::vector<bool> res;
+    res.reserve(keys.size());
+    for (const Key& key : keys)
+    {
+      res.push_back(included(std::move(key)));
+    }
+    return res;
+  }
+
+  virtual std::vector<bool> multi_excluded(const std::vector<Key>& keys)
+  {
+    std::vector<bool> res;
+    res.reserve(keys.size());
+    for (const Key& key : keys)
+    {
+      res.push_back(excluded(std::move(key)));
+    }
+    return res;
+  }
+
+  /**
+   * @brief Scans are served by the backend and do not fill the cache.
+   */
+  virtual std::unique_ptr<Cursor> scan(const Key&& begin, const Key&& end,
+      const ScanOptions& options = ScanOptions())
+  {
+    return _backend.scan(std::move(begin), std::move(end), options);
+  }
+
+  /**
+   * @brief Snapshots of the backend, counted by the backend.
+   */
+  virtual std::unique_ptr<Snapshot> snapshot()
+  {
+    return _backend.snapshot();
+  }
+
+  /**
+   * @brief Number of reads served by the cache.
+   */
+  uint64_t hits() const noexcept
+  {
+    return _hits;
+  }
+
+  /**
+   * @brief Number of reads that went to the backend.
+   */
+  uint64_t misses() const noexcept
+  {
+    return _misses;
+  }
+
+  /**
+   * @brief Number of bytes charged to the cache.
+   */
+  size_t usage()
+  {
+    size_t bytes = 0;
+    for (std::unique_ptr<Shard>& s : _shards)
+    {
+      bytes += s->usage();
+    }
+    return bytes;
+  }
+
+  /**
+   * @brief Drop all the cached values.
+   */
+  void clear()
+  {
+    for (std::unique_ptr<Shard>& s : _shards)
+    {
+      s->clear();
+    }
+  }
+
+private:
+  /**
+   * @brief A CLOCK cache of values.
+   *
+   * Entries form a ring swept by the hand: a referenced entry gets a second
+   * chance, an unreferenced one is evicted. New entries are inserted behind
+   * the hand so they are swept last.
+   *
+   * Every invalidation bumps the epoch: a value read from the backend is not
+   * filled if the epoch changed since before the read, it may be older than
+   * a concurrent write.
+   */
+  class Shard: private boost::noncopyable
+  {
+  public:
+    Shard(const size_t capacity) :
+        _mutex(), _capacity(capacity), _usage(0), _epoch(0), _ring(), _hand(
+            _ring.end()), _index()
+    {
+    }
+
+    uint64_t epoch()
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      return _epoch;
+    }
+
+    bool lookup(const Key& key, OutputBlock& value)
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      auto found = _index.find(std::string(key.get_data(), key.get_size()));
+      if (found == _index.end())
+      {
+        return false;
+      }
+      Entry& entry = *found->second;
+      entry.referenced = true;
+      value.pin_data(entry.value->data(), entry.value->size(),
+          std::shared_ptr<const void>(entry.value));
+      return true;
+    }
+
+    bool contains(const Key& key)
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      return _index.count(std::string(key.get_data(), key.get_size())) != 0;
+    }
+
+    /**
+     * @brief Cache the value read from the backend and pin value on it.
+     */
+    void fill(const Key& key, OutputBlock& value, const uint64_t epoch)
+    {
+      const size_t charge = key.get_size() + value.get_size() + overhead;
+      if (charge > _capacity)
+      {
+        return;
+      }
+      std::shared_ptr<const std::string> cached = std::make_shared<
+          const std::string>(value.get_data(), value.get_size());
+      value.pin_data(cached->data(), cached->size(),
+          std::shared_ptr<const void>(cached));
+
+      std::string name(key.get_data(), key.get_size());
+      std::lock_guard<std::mutex> guard(_mutex);
+      if (epoch != _epoch || _index.count(name) != 0)
+      {
+        return;
+      }
+      while (_usage + charge > _capacity)
+      {
+        evict();
+      }
+      entry_t entry = _ring.insert(_hand, Entry());
+      entry->key = name;
+      entry->value = std::move(cached);
+      entry->charge = charge;
+      entry->referenced = false;
+      _index.emplace(std::move(name), entry);
+      _usage += charge;
+    }
+
+    void invalidate(const Key& key)
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      ++_epoch;
+      auto found = _index.find(std::string(key.get_data(), key.get_size()));
+      if (found != _index.end())
+      {
+        remove(found->second);
+      }
+    }
+
+    size_t usage()
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      return _usage;
+    }
+
+    void clear()
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      ++_epoch;
+      _index.clear();
+      _ring.clear();
+      _hand = _ring.end();
+      _usage = 0;
+    }
+
+  private:
+    struct Entry
+    {
+      std::string key;
+      std::shared_ptr<const std::string> value;
+      size_t charge;
+      bool referenced;
+    };
+    typedef std::list<Entry>::iterator entry_t;
+
+    /** Approximate bookkeeping bytes of an entry. */
+    static constexpr size_t overhead = 128;
+
+    void evict()
+    {
+      while (true)
+      {
+        if (_hand == _ring.end())
+        {
+          _hand = _ring.begin();
+        }
+        if (_hand->referenced)
+        {
+          _hand->referenced = false;
+          ++_hand;
+        }
+        else
+        {
+          remove(_hand);
+          return;
+        }
+      }
+    }
+
+    void remove(const entry_t entry)
+    {
+      if (_hand == entry)
+      {
+        ++_hand;
+      }
+      _usage -= entry->charge;
+      _index.erase(entry->key);
+      _ring.erase(entry);
+    }
+
+    std::mutex _mutex;
+    const size_t _capacity;
+    size_t _usage;
+    uint64_t _epoch;
+    std::list<Entry> _ring;
+    entry_t _hand;
+    std::unordered_map<std::string, entry_t> _index;
+  };
+
+  Shard& shard(const Key& key) noexcept
+  {
+    return *_shards[key.lookup_hash() % _shards.size()];
+  }
+
+  void invalidate(const std::vector<Key>& keys)
+  {
+    for (const Key& key : keys)
+    {
+      shard(key).invalidate(key);
+    }
+  }
+
+  BlockRepository& _backend;
+  std::vector<std::unique_ptr<Shard>> _shards;
+  std::atomic<uint64_t> _hits;
+  std::atomic<uint64_t> _misses;
+};
+
+}
@@ -15,18 +15,34 @@
  * See the License for the specific language governing permissions and
  * limitations under the License.
  */
+#include "asyncrepo.hpp"
 #include "blockrepository.hpp"
+#include "cachedrepo.hpp"
 #include "chunk.hpp"
+#include "cursor.hpp"
+#include "deduprepo.hpp"
+#include "digest.hpp"
+#include "enginestats.hpp"
+#include "executor.hpp"
+#include "histogram.hpp"
 #include "inputblock.hpp"
 #include "key.hpp"
 #include "ldbrepo.hpp"
 #include "managedtask.hpp"
+#include "membershipfilter.hpp"
+#include "memrepo.hpp"
+#include "meteredrepo.hpp"
 #include "outputblock.hpp"
 #include "pipe.hpp"
+#include "repositoryfactory.hpp"
 #include "returnstate.hpp"
 #include "rwlock.hpp"
 #include "settings.hpp"
 #include "settingsreloader.hpp"
+#include "shardedrepo.hpp"
+#include "snapshot.hpp"
+#include "statsreporter.hpp"
+#include "streamrepo.hpp"
 #include "tools.hpp"
 #include <string>
 
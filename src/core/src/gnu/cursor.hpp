@@ -0,0 +1,275 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include "returnstate.hpp"
+#include "key.hpp"
+#include "outputblock.hpp"
+#include "snapshot.hpp"
+
+namespace pipedb
+{
+
+/**
+ * @brief Options of a scan.
+ */
+struct ScanOptions
+{
+  /**
+   * @brief Only return the keys, values are left empty.
+   */
+  bool keys_only = false;
+
+  /**
+   * @brief Let the blocks read by the scan fill the backend cache.
+   * Off by default: a long scan would evict the hot blocks.
+   */
+  bool fill_cache = false;
+
+  /**
+   * @brief Maximum number of entries and of bytes buffered per batch.
+   * A cursor holds at most two batches.
+   */
+  size_t batch_entries = 256;
+  size_t batch_bytes = 1 << 20;
+
+  /**
+   * @brief Read the next batch in the background while the current one
+   * is consumed.
+   */
+  bool read_ahead = true;
+
+  /**
+   * @brief Scan the snapshot instead of the latest state.
+   * The snapshot must outlive the cursor.
+   */
+  const Snapshot* snapshot = nullptr;
+};
+
+/**
+ * @brief A streaming cursor over the entries of a scan, in key order.
+ *
+ * Entries are read from the backend in batches of bounded size. With
+ * read ahead, the next batch is read by another thread while the current
+ * one is consumed.
+ *
+ * Usage:
+ * std::unique_ptr<Cursor> cursor = repository.scan(Key(begin), Key(end));
+ * while (cursor->next())
+ * {
+ *   use(cursor->key(), cursor->value());
+ * }
+ * check(cursor->status());
+ */
+class Cursor: private boost::noncopyable
+{
+public:
+  /**
+   * @brief Entries read at once from a source.
+   */
+  struct Batch
+  {
+    std::vector<std::string> keys;
+    std::vector<OutputBlock> values;
+    size_t bytes = 0;
+    bool last = false; /** No entry after this batch */
+    Return::State state = Return::OK; /** Error stopping the scan */
+
+    /**
+     * @brief Is the batch over the limits of the options.
+     */
+    bool full(const ScanOptions& options) const noexcept
+    {
+      return keys.size() >= options.batch_entries
+          || bytes >= options.batch_bytes;
+    }
+
+    void clear() noexcept
+    {
+      keys.clear();
+      values.clear();
+      bytes = 0;
+      last = false;
+      state = Return::OK;
+    }
+  };
+
+  /**
+   * @brief The backend side of a cursor, reading the entries in order.
+   *
+   * read() is never called concurrently, but may be called from a thread
+   * other than the one of the cursor.
+   */
+  class Source: private boost::noncopyable
+  {
+  public:
+    virtual ~Source()
+    {
+    }
+
+    /**
+     * @brief Append the next entries to batch until it is full, set
+     * batch.last at the end of the scan.
+     */
+    virtual void read(Batch& batch, const ScanOptions& options) = 0;
+  };
+
+  Cursor(std::unique_ptr<Source>&& source, const ScanOptions& options) :
+      _source(std::move(source)), _options(options), _current(), _ahead(), _pending(), _next(
+          0), _state(Return::OK)
+  {
+    if (_options.batch_entries == 0)
+    {
+      _options.batch_entries = 1;
+    }
+  }
+
+  /**
+   * @brief A cursor with no entry, failed with state.
+   */
+  static std::unique_ptr<Cursor> failed(const Return::State state)
+  {
+    std::unique_ptr<Cursor> o(new Cursor(nullptr, ScanOptions()));
+    o->_current.last = true;
+    o->_current.state = state;
+    return o;
+  }
+
+  virtual ~Cursor()
+  {
+    // the source may still be read in the background
+    if (_pending.valid())
+    {
+      _pending.wait();
+    }
+  }
+
+  /**
+   * @brief Move to the next entry, the first call moves to the first one.
+   * @return false at the end of the scan or on error.
+   */
+  bool next()
+  {
+    while (_next >= _current.keys.size())
+    {
+      if (_current.last || _current.state != Return::OK)
+      {
+        _state = _current.state;
+        return false;
+      }
+      refill();
+    }
+    ++_next;
+    return true;
+  }
+
+  /**
+   * @brief The key of the current entry, valid until next() is called.
+   */
+  Key key() const noexcept
+  {
+    return Key(_current.keys[_next - 1]);
+  }
+
+  /**
+   * @brief The value of the current entry, valid until next() is called.
+   */
+  const OutputBlock& value() const noexcept
+  {
+    return _current.values[_next - 1];
+  }
+
+  /**
+   * @brief Move the value of the current entry out of the cursor.
+   */
+  OutputBlock take_value() noexcept
+  {
+    return std::move(_current.values[_next - 1]);
+  }
+
+  /**
+   * @brief Return::OK unless the scan stopped on an error.
+   */
+  Return status() const noexcept
+  {
+    return _state;
+  }
+
+  /**
+   * @brief Smallest key strictly greater than all the keys starting with
+   * prefix, empty if there is none.
+   */
+  static std::string successor(const Key& prefix)
+  {
+    std::string end(prefix.get_data(), prefix.get_size());
+    while (end.empty() == false)
+    {
+      const unsigned char c = static_cast<unsigned char>(end.back());
+      if (c != 0xff)
+      {
+        end.back() = static_cast<char>(c + 1);
+        break;
+      }
+      end.pop_back();
+    }
+    return end;
+  }
+
+private:
+  void refill()
+  {
+    if (_pending.valid())
+    {
+      _pending.get();
+      std::swap(_current, _ahead);
+    }
+    else
+    {
+      _current.clear();
+      _source->read(_current, _options);
+    }
+    _next = 0;
+    if (_options.read_ahead && _current.last == false
+        && _current.state == Return::OK)
+    {
+      _ahead.clear();
+      _pending = std::async(std::launch::async, [this]()
+      {
+        _source->read(_ahead, _options);
+      });
+    }
+  }
+
+  std::unique_ptr<Source> _source;
+  ScanOptions _options;
+  Batch _current;
+  Batch _ahead;
+  std::future<void> _pending;
+  size_t _next;
+  Return::State _state;
+};
+
+}
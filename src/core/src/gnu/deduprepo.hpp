@@ -0,0 +1,521 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "digest.hpp"
+#include "ldbrepo.hpp"
+
+namespace pipedb {
+
+/**
+ * @brief A leveldb repository storing each distinct value once.
+ *
+ * Values are addressed by their SHA-256 digest. The database holds three
+ * kinds of entries:
+ * - "k" + key: the digest of the value of key,
+ * - "c" + digest: the value,
+ * - "r" + digest: the number of keys referencing the value.
+ *
+ * A put or a drop updates all of them in a single leveldb write batch, a
+ * value is reclaimed when its last key is dropped or overwritten. A value
+ * already stored is never written again: put only writes the index and
+ * the reference count, and link() adds a key for a digest computed by the
+ * caller without sending the value at all.
+ */
+class DedupRepo: public LdbRepo {
+    public:
+        DedupRepo(const std::string& path) :
+        LdbRepo(path),
+        keyStripes(new std::mutex[stripes]),
+        digestStripes(new std::mutex[stripes]) {
+        }
+
+        virtual ~DedupRepo() {
+        }
+
+        /**
+         * @brief The digest addressing value.
+         */
+        static std::string digest(const InputBlock&& value) {
+            return Sha256::of(value.get_data(), value.get_size());
+        }
+
+        /**
+         * @brief Check that a value with this digest is stored, ie: that
+         * link() would succeed.
+         */
+        bool stored(const std::string& digest) {
+            if (isOpen) {
+                return db->Contains(readOptions, referenceKey(digest)).ok();
+            }
+            else {
+                return false;
+            }
+        }
+
+        /**
+         * @brief Associate key to the value already stored with digest.
+         *
+         * Return Return::KEY_NOT_PRESENT if no such value is stored, the
+         * value must then be put.
+         */
+        Return link(const Key&& key, const std::string& digest) {
+            if (isOpen) {
+                std::vector<Update> updates;
+                updates.push_back(Update { key.copy_as_string(), digest, NULL });
+                return apply(updates, writeOptions.sync);
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        /**
+         * @brief Number of keys referencing the value with digest, 0 if
+         * it can not be read.
+         */
+        uint64_t references(const std::string& digest) {
+            uint64_t count = 0;
+            if (isOpen && readCount(digest, readOptions, count).success()) {
+                return count;
+            }
+            else {
+                return 0;
+            }
+        }
+
+        using LdbRepo::put;
+        using LdbRepo::drop;
+        using LdbRepo::multi_put;
+        using LdbRepo::multi_drop;
+
+        virtual Return put(const Key&& key, const InputBlock&& value, const bool sync) {
+            if (isOpen) {
+                std::vector<Update> updates;
+                updates.push_back(Update { key.copy_as_string(), digest(std::move(value)), &value });
+                return apply(updates, sync);
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        virtual Return get(const Key&& key, OutputBlock& value) {
+            if (isOpen) {
+                // the index and the value are read on the same state
+                ImplicitSnapshot snapshot(db.get());
+                leveldb::ReadOptions snapshotOptions = readOptions;
+                snapshotOptions.snapshot = snapshot.snapshot;
+                return readValue(std::move(key), value, snapshotOptions);
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        virtual Return get(const Key&& key, OutputBlock& value, const Snapshot& snapshot) {
+            leveldb::ReadOptions snapshotOptions;
+            if (isOpen && resolve(snapshot, snapshotOptions)) {
+                return readValue(std::move(key), value, snapshotOptions);
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        virtual Return drop(const Key&& key, const bool sync) {
+            if (isOpen) {
+                std::vector<Update> updates;
+                updates.push_back(Update { key.copy_as_string(), std::string(), NULL });
+                return apply(updates, sync);
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        virtual bool included(const Key&& key) {
+            if (isOpen) {
+                return db->Contains(readOptions, indexKey(key)).ok();
+            }
+            else {
+                return false;
+            }
+        }
+
+        virtual bool excluded(const Key&& key) {
+            return isOpen && ! included(std::move(key));
+        }
+
+        virtual std::vector<Return> multi_put(const std::vector<Key>& keys,
+                                              const std::vector<InputBlock>& values, const bool sync) {
+            if (isOpen && keys.size() == values.size()) {
+                std::vector<Update> updates;
+                updates.reserve(keys.size());
+                for (size_t i = 0; i < keys.size(); ++i) {
+                    updates.push_back(Update { keys[i].copy_as_string(), digest(std::move(values[i])), &values[i] });
+                }
+                return std::vector<Return>(keys.size(), apply(updates, sync));
+            }
+            else {
+                return std::vector<Return>(keys.size(), Return::NOT_SUPPORTED);
+            }
+        }
+
+        virtual std::vector<Return> multi_get(const std::vector<Key>& keys,
+                                              std::vector<OutputBlock>& values) {
+            if (isOpen) {
+                ImplicitSnapshot snapshot(db.get());
+                leveldb::ReadOptions snapshotOptions = readOptions;
+                snapshotOptions.snapshot = snapshot.snapshot;
+                return multiReadValues(keys, values, snapshotOptions);
+            }
+            else {
+                values.resize(keys.size());
+                return std::vector<Return>(keys.size(), Return::NOT_SUPPORTED);
+            }
+        }
+
+        virtual std::vector<Return> multi_get(const std::vector<Key>& keys,
+                                              std::vector<OutputBlock>& values, const Snapshot& snapshot) {
+            leveldb::ReadOptions snapshotOptions;
+            if (isOpen && resolve(snapshot, snapshotOptions)) {
+                return multiReadValues(keys, values, snapshotOptions);
+            }
+            else {
+                values.resize(keys.size());
+                return std::vector<Return>(keys.size(), Return::NOT_SUPPORTED);
+            }
+        }
+
+        virtual std::vector<Return> multi_drop(const std::vector<Key>& keys, const bool sync) {
+            if (isOpen) {
+                std::vector<Update> updates;
+                updates.reserve(keys.size());
+                for (const Key& key : keys) {
+                    updates.push_back(Update { key.copy_as_string(), std::string(), NULL });
+                }
+                return std::vector<Return>(keys.size(), apply(updates, sync));
+            }
+            else {
+                return std::vector<Return>(keys.size(), Return::NOT_SUPPORTED);
+            }
+        }
+
+        virtual std::unique_ptr<Cursor> scan(const Key&& begin, const Key&& end,
+                                             const ScanOptions& scanOptions = ScanOptions()) {
+            leveldb::ReadOptions iteratorOptions = readOptions;
+            if (isOpen && (scanOptions.snapshot == nullptr || resolve(*scanOptions.snapshot, iteratorOptions))) {
+                iteratorOptions.fill_cache = scanOptions.fill_cache;
+                std::unique_ptr<Cursor::Source> source(new IndexSource(*this, iteratorOptions, begin, end));
+                return std::unique_ptr<Cursor>(new Cursor(std::move(source), scanOptions));
+            }
+            else {
+                return Cursor::failed(Return::NOT_SUPPORTED);
+            }
+        }
+
+    protected:
+        /**
+         * @brief A leveldb snapshot taken for a single call, not tracked.
+         */
+        class ImplicitSnapshot: private boost::noncopyable {
+            public:
+                ImplicitSnapshot(leveldb::DB* database) :
+                db(database),
+                snapshot(database->GetSnapshot()) {
+                }
+
+                ~ImplicitSnapshot() {
+                    db->ReleaseSnapshot(snapshot);
+                }
+
+                leveldb::DB* const db;
+                const leveldb::Snapshot* const snapshot;
+        };
+
+        /**
+         * @brief Set key to the value with digest, or drop it when the
+         * digest is empty. value is NULL when the value is not given.
+         */
+        struct Update {
+            std::string key;
+            std::string digest;
+            const InputBlock* value;
+        };
+
+        /**
+         * @brief Apply the updates in a single write batch.
+         *
+         * The stripes of the keys are locked first, then the stripes of the
+         * digests they reference before and after the updates, both in
+         * order to avoid dead locks.
+         */
+        Return apply(const std::vector<Update>& updates, const bool sync) {
+            std::vector<size_t> keyIndexes;
+            for (const Update& update : updates) {
+                keyIndexes.push_back(stripeIndex(update.key));
+            }
+            std::vector<std::unique_lock<std::mutex>> keyLocks = lockStripes(keyStripes, keyIndexes);
+
+            // the latest digest of each key, the reference count changes
+            // and the values to write
+            std::map<std::string, std::string> index;
+            std::map<std::string, int64_t> deltas;
+            std::map<std::string, const InputBlock*> values;
+            for (const Update& update : updates) {
+                auto known = index.find(update.key);
+                if (known == index.end()) {
+                    std::string previous;
+                    leveldb::Status status = db->Get(readOptions, indexKey(update.key), &previous);
+                    if (status.ok() == false && status.IsNotFound() == false) {
+                        return fromStatus(status);
+                    }
+                    known = index.insert(std::make_pair(update.key, previous)).first;
+                }
+                if (known->second == update.digest) {
+                    continue;
+                }
+                if (known->second.empty() == false) {
+                    --deltas[known->second];
+                }
+                if (update.digest.empty() == false) {
+                    ++deltas[update.digest];
+                    if (update.value != NULL) {
+                        values[update.digest] = update.value;
+                    }
+                }
+                known->second = update.digest;
+            }
+
+            std::vector<size_t> digestIndexes;
+            for (const auto& delta : deltas) {
+                digestIndexes.push_back(stripeIndex(delta.first));
+            }
+            std::vector<std::unique_lock<std::mutex>> digestLocks = lockStripes(digestStripes, digestIndexes);
+
+            leveldb::WriteBatch batch;
+            for (const auto& delta : deltas) {
+                uint64_t count = 0;
+                const Return read = readCount(delta.first, readOptions, count);
+                if (read.success() == false) {
+                    return read;
+                }
+                const int64_t next = static_cast<int64_t>(count) + delta.second;
+                if (next <= 0) {
+                    batch.Delete(referenceKey(delta.first));
+                    batch.Delete(contentKey(delta.first));
+                    continue;
+                }
+                if (count == 0) {
+                    const auto value = values.find(delta.first);
+                    if (value == values.end()) {
+                        // linked to a value that is not stored
+                        return Return::KEY_NOT_PRESENT;
+                    }
+                    batch.Put(contentKey(delta.first), toSlice(std::move(*value->second)));
+                }
+                batch.Put(referenceKey(delta.first), std::to_string(next));
+            }
+            for (const auto& entry : index) {
+                if (entry.second.empty()) {
+                    batch.Delete(indexKey(entry.first));
+                }
+                else {
+                    batch.Put(indexKey(entry.first), entry.second);
+                }
+            }
+            return fromStatus(db->Write(writeOptionsFor(sync), &batch));
+        }
+
+        Return readValue(const Key&& key, OutputBlock& value, const leveldb::ReadOptions& options) {
+            std::string digest;
+            Return state = fromStatus(db->Get(options, indexKey(key), &digest));
+            if (state.success()) {
+                const std::string content = contentKey(digest);
+                return read(Key(content), value, options);
+            }
+            return state;
+        }
+
+        std::vector<Return> multiReadValues(const std::vector<Key>& keys, std::vector<OutputBlock>& values,
+                                            const leveldb::ReadOptions& options) {
+            values.resize(keys.size());
+            std::vector<Return> states;
+            states.reserve(keys.size());
+            for (size_t i = 0; i < keys.size(); ++i) {
+                states.push_back(readValue(std::move(keys[i]), values[i], options));
+            }
+            return states;
+        }
+
+        /**
+         * @brief The reference count of a digest, 0 when absent. A count
+         * that is not a decimal number is reported as BACKEND_ERROR.
+         */
+        Return readCount(const std::string& digest, const leveldb::ReadOptions& options, uint64_t& count) {
+            std::string stored;
+            const leveldb::Status status = db->Get(options, referenceKey(digest), &stored);
+            count = 0;
+            if (status.IsNotFound()) {
+                return Return::OK;
+            }
+            if (status.ok() == false) {
+                return fromStatus(status);
+            }
+            if (stored.empty()) {
+                return Return::BACKEND_ERROR;
+            }
+            for (const char c : stored) {
+                if (c < '0' || c > '9') {
+                    return Return::BACKEND_ERROR;
+                }
+                const uint64_t digit = static_cast<uint64_t>(c - '0');
+                if (count > (std::numeric_limits<uint64_t>::max() - digit) / 10) {
+                    return Return::BACKEND_ERROR;
+                }
+                count = count * 10 + digit;
+            }
+            return Return::OK;
+        }
+
+        /**
+         * @brief The keys of the index in [begin, end[ with their values.
+         *
+         * Iterates on an implicit snapshot, the values are read on the
+         * same one.
+         */
+        class IndexSource: public Cursor::Source, public Reader {
+            public:
+                IndexSource(DedupRepo& repository, const leveldb::ReadOptions& options,
+                            const Key& from, const Key& to) :
+                Reader(repository.readers),
+                owner(repository),
+                reading(),
+                pinned(options.snapshot == NULL ? new ImplicitSnapshot(repository.db.get()) : NULL),
+                readOptions(options),
+                it(),
+                end(to.get_size() == 0 ? std::string(1, indexPrefix + 1) : indexKey(to)) {
+                    if (pinned) {
+                        readOptions.snapshot = pinned->snapshot;
+                    }
+                    it.reset(repository.db->NewIterator(readOptions));
+                    it->Seek(indexKey(from));
+                }
+
+                virtual ~IndexSource() {
+                    leave();
+                }
+
+                virtual void detach() {
+                    std::lock_guard<std::mutex> guard(reading);
+                    it.reset();
+                    pinned.reset();
+                }
+
+                virtual void read(Cursor::Batch& batch, const ScanOptions& options) {
+                    std::lock_guard<std::mutex> guard(reading);
+                    if (it == nullptr) {
+                        batch.last = true;
+                        batch.state = Return::NOT_SUPPORTED;
+                        return;
+                    }
+                    for (; it->Valid() && batch.full(options) == false; it->Next()) {
+                        const leveldb::Slice key = it->key();
+                        if (key.compare(end) >= 0) {
+                            batch.last = true;
+                            return;
+                        }
+                        batch.keys.emplace_back(key.data() + 1, key.size() - 1);
+                        batch.values.emplace_back();
+                        if (options.keys_only == false) {
+                            const std::string content = contentKey(it->value().ToString());
+                            Return state = owner.read(Key(content), batch.values.back(), readOptions);
+                            if (state.success() == false) {
+                                batch.state = Return::BACKEND_ERROR;
+                                batch.last = true;
+                                return;
+                            }
+                        }
+                        batch.bytes += batch.keys.back().size() + batch.values.back().get_size();
+                    }
+                    if (it->Valid() == false) {
+                        batch.last = true;
+                        if (it->status().ok() == false) {
+                            batch.state = Return::BACKEND_ERROR;
+                        }
+                    }
+                }
+
+            private:
+                DedupRepo& owner;
+                std::mutex reading; /** Held by a read, close waits for it */
+                std::unique_ptr<ImplicitSnapshot> pinned; /** Taken when no snapshot is given */
+                leveldb::ReadOptions readOptions;
+                std::unique_ptr<leveldb::Iterator> it; /** NULL once detached */
+                const std::string end;
+        };
+
+        static std::string indexKey(const Key& key) {
+            std::string o(1, indexPrefix);
+            o.append(key.get_data(), key.get_size());
+            return o;
+        }
+
+        static std::string contentKey(const std::string& digest) {
+            return contentPrefix + digest;
+        }
+
+        static std::string referenceKey(const std::string& digest) {
+            return referencePrefix + digest;
+        }
+
+        static size_t stripeIndex(const std::string& name) noexcept {
+            return Key(name).lookup_hash() % stripes;
+        }
+
+        static std::vector<std::unique_lock<std::mutex>> lockStripes(const std::unique_ptr<std::mutex[]>& mutexes,
+                                                                     std::vector<size_t>& indexes) {
+            std::sort(indexes.begin(), indexes.end());
+            indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+            std::vector<std::unique_lock<std::mutex>> locks;
+            for (size_t index : indexes) {
+                locks.emplace_back(mutexes[index]);
+            }
+            return locks;
+        }
+
+        static constexpr char indexPrefix = 'k';
+        static constexpr char contentPrefix = 'c';
+        static constexpr char referencePrefix = 'r';
+        static constexpr size_t stripes = 64;
+
+    private:
+        std::unique_ptr<std::mutex[]> keyStripes; /** Serialize the updates of a key */
+        std::unique_ptr<std::mutex[]> digestStripes; /** Serialize the reference count updates of a value */
+};
+
+} /* namespace pipedb */
@@ -0,0 +1,196 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <string.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace pipedb
+{
+
+/**
+ * @brief SHA-256 of a sequence of bytes (FIPS 180-4).
+ *
+ * Usage:
+ * Sha256 h;
+ * h.update(data, size);
+ * const std::string digest = h.finish(); // 32 raw bytes
+ */
+class Sha256
+{
+public:
+  static constexpr size_t size = 32;
+
+  Sha256() :
+      _length(0), _used(0)
+  {
+    static const uint32_t initial[8] =
+      { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c,
+          0x1f83d9ab, 0x5be0cd19 };
+    memcpy(_state, initial, sizeof(_state));
+  }
+
+  /**
+   * @brief Digest of data[0, length[.
+   */
+  static std::string of(const char* data, const size_t length)
+  {
+    Sha256 h;
+    h.update(data, length);
+    return h.finish();
+  }
+
+  void update(const char* data, size_t length)
+  {
+    _length += length;
+    while (length > 0)
+    {
+      const size_t n = std::min(length, sizeof(_block) - _used);
+      memcpy(_block + _used, data, n);
+      _used += n;
+      data += n;
+      length -= n;
+      if (_used == sizeof(_block))
+      {
+        compress(_block);
+        _used = 0;
+      }
+    }
+  }
+
+  /**
+   * @brief The raw digest, the hash shall not be updated anymore.
+   */
+  std::string finish()
+  {
+    const uint64_t bits = _length * 8;
+    _block[_used++] = 0x80;
+    if (_used > 56)
+    {
+      memset(_block + _used, 0, sizeof(_block) - _used);
+      compress(_block);
+      _used = 0;
+    }
+    memset(_block + _used, 0, 56 - _used);
+    for (size_t i = 0; i < 8; ++i)
+    {
+      _block[56 + i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+    }
+    compress(_block);
+    std::string digest(size, '\0');
+    for (size_t i = 0; i < 8; ++i)
+    {
+      digest[4 * i] = static_cast<char>(_state[i] >> 24);
+      digest[4 * i + 1] = static_cast<char>(_state[i] >> 16);
+      digest[4 * i + 2] = static_cast<char>(_state[i] >> 8);
+      digest[4 * i + 3] = static_cast<char>(_state[i]);
+    }
+    return digest;
+  }
+
+  /**
+   * @brief Lower case hexadecimal form of a raw digest.
+   */
+  static std::string hex(const std::string& digest)
+  {
+    static const char digits[] = "0123456789abcdef";
+    std::string o;
+    o.reserve(digest.size() * 2);
+    for (const char c : digest)
+    {
+      o.push_back(digits[static_cast<uint8_t>(c) >> 4]);
+      o.push_back(digits[static_cast<uint8_t>(c) & 0xf]);
+    }
+    return o;
+  }
+
+private:
+  static uint32_t rotr(const uint32_t x, const unsigned n) noexcept
+  {
+    return (x >> n) | (x << (32 - n));
+  }
+
+  void compress(const uint8_t* block) noexcept
+  {
+    static const uint32_t k[64] =
+      { 0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1,
+          0x923f82a4, 0xab1c5ed5, 0xd807aa98, 0x12835b01, 0x243185be,
+          0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+          0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f,
+          0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d,
+          0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351,
+          0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+          0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1,
+          0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624,
+          0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08, 0x2748774c,
+          0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+          0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa,
+          0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+    uint32_t w[64];
+    for (size_t i = 0; i < 16; ++i)
+    {
+      w[i] = (uint32_t(block[4 * i]) << 24) | (uint32_t(block[4 * i + 1]) << 16)
+          | (uint32_t(block[4 * i + 2]) << 8) | uint32_t(block[4 * i + 3]);
+    }
+    for (size_t i = 16; i < 64; ++i)
+    {
+      const uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18)
+          ^ (w[i - 15] >> 3);
+      const uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19)
+          ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = _state[0], b = _state[1], c = _state[2], d = _state[3];
+    uint32_t e = _state[4], f = _state[5], g = _state[6], h = _state[7];
+    for (size_t i = 0; i < 64; ++i)
+    {
+      const uint32_t s1 = rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25);
+      const uint32_t ch = (e & f) ^ (~e & g);
+      const uint32_t t1 = h + s1 + ch + k[i] + w[i];
+      const uint32_t s0 = rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22);
+      const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+      const uint32_t t2 = s0 + maj;
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    _state[0] += a;
+    _state[1] += b;
+    _state[2] += c;
+    _state[3] += d;
+    _state[4] += e;
+    _state[5] += f;
+    _state[6] += g;
+    _state[7] += h;
+  }
+
+  uint32_t _state[8];
+  uint64_t _length; /** Bytes hashed */
+  uint8_t _block[64];
+  size_t _used; /** Bytes of _block in use */
+};
+
+}
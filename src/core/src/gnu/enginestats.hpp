@@ -0,0 +1,128 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace pipedb
+{
+
+/**
+ * @brief Shape of a level of the storage engine, and the compactions
+ * writing in it.
+ */
+struct LevelShape
+{
+  uint64_t files = 0;
+  uint64_t bytes = 0;
+  uint64_t compaction_micros = 0;
+  uint64_t compaction_bytes_read = 0;
+  uint64_t compaction_bytes_written = 0; /** Including the memtable flushes */
+};
+
+/**
+ * @brief Statistics of the storage engine of a repository, since it was
+ * opened.
+ */
+struct EngineStats
+{
+  std::vector<LevelShape> levels;
+  uint64_t user_bytes_written = 0; /** Bytes of the write batches */
+  uint64_t stall_micros = 0; /** Time writes were delayed or blocked */
+  uint64_t slowdown_stalls = 0; /** Writes delayed, too many level 0 files */
+  uint64_t memtable_stalls = 0; /** Writes blocked on a memtable flush */
+  uint64_t level0_stalls = 0; /** Writes blocked on a level 0 compaction */
+  uint64_t memtable_bytes = 0;
+  uint64_t block_cache_bytes = 0;
+  uint64_t value_log_files = 0;
+  uint64_t value_log_bytes = 0;
+  uint64_t value_log_garbage_bytes = 0; /** Not yet reclaimed by the rewrites */
+
+  uint64_t compaction_bytes_read() const noexcept
+  {
+    uint64_t bytes = 0;
+    for (const LevelShape& level : levels)
+    {
+      bytes += level.compaction_bytes_read;
+    }
+    return bytes;
+  }
+
+  uint64_t compaction_bytes_written() const noexcept
+  {
+    uint64_t bytes = 0;
+    for (const LevelShape& level : levels)
+    {
+      bytes += level.compaction_bytes_written;
+    }
+    return bytes;
+  }
+
+  /**
+   * @brief Bytes written to disk (log and tables) per byte written by the
+   * users, zero before the first write.
+   */
+  double write_amplification() const noexcept
+  {
+    if (user_bytes_written == 0)
+    {
+      return 0.0;
+    }
+    return static_cast<double>(user_bytes_written + compaction_bytes_written())
+        / user_bytes_written;
+  }
+
+  /**
+   * @brief One "name value" line per statistic.
+   */
+  std::string to_string() const
+  {
+    std::ostringstream o;
+    for (size_t i = 0; i < levels.size(); ++i)
+    {
+      const std::string prefix = "level" + std::to_string(i) + ".";
+      o << prefix << "files " << levels[i].files << "\n";
+      o << prefix << "bytes " << levels[i].bytes << "\n";
+      o << prefix << "compaction_micros " << levels[i].compaction_micros
+          << "\n";
+      o << prefix << "compaction_bytes_read "
+          << levels[i].compaction_bytes_read << "\n";
+      o << prefix << "compaction_bytes_written "
+          << levels[i].compaction_bytes_written << "\n";
+    }
+    o << "compaction_bytes_read " << compaction_bytes_read() << "\n";
+    o << "compaction_bytes_written " << compaction_bytes_written() << "\n";
+    o << "user_bytes_written " << user_bytes_written << "\n";
+    o << "write_amplification " << write_amplification() << "\n";
+    o << "stall_micros " << stall_micros << "\n";
+    o << "slowdown_stalls " << slowdown_stalls << "\n";
+    o << "memtable_stalls " << memtable_stalls << "\n";
+    o << "level0_stalls " << level0_stalls << "\n";
+    o << "memtable_bytes " << memtable_bytes << "\n";
+    o << "block_cache_bytes " << block_cache_bytes << "\n";
+    o << "value_log_files " << value_log_files << "\n";
+    o << "value_log_bytes " << value_log_bytes << "\n";
+    o << "value_log_garbage_bytes " << value_log_garbage_bytes << "\n";
+    return o.str();
+  }
+};
+
+}
@@ -0,0 +1,235 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <memory>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <limits>
+
+#include <boost/utility.hpp>
+
+#include "managedtask.hpp"
+
+namespace pipedb
+{
+
+/**
+ * @brief Options of an Executor.
+ */
+struct ExecutorOptions
+{
+  /**
+   * @brief Number of worker threads.
+   */
+  size_t threads = 4;
+
+  /**
+   * @brief Maximum number of pending tasks per lane.
+   * Submitting to a full lane blocks until a task is picked.
+   */
+  size_t queue_depth = 1024;
+
+  /**
+   * @brief Out of read_weight + write_weight picks, read_weight go to the
+   * read lane when both lanes have pending tasks.
+   */
+  size_t read_weight = 1;
+  size_t write_weight = 1;
+};
+
+/**
+ * @brief A bounded pool of ManagedTask workers with a read and a write lane.
+ */
+class Executor: private boost::noncopyable
+{
+public:
+  typedef std::function<void()> task_t;
+
+  enum Lane
+  {
+    READ, WRITE
+  };
+
+  static std::unique_ptr<Executor> create(const ExecutorOptions& options =
+      ExecutorOptions())
+  {
+    std::unique_ptr<Executor> o(new Executor(options));
+    return o;
+  }
+
+  /**
+   * @brief Start the worker threads.
+   */
+  void start()
+  {
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      _stopping = false;
+    }
+    for (std::unique_ptr<Worker>& worker : _workers)
+    {
+      worker->start();
+    }
+  }
+
+  /**
+   * @brief Run the pending tasks and stop the worker threads.
+   */
+  void stop()
+  {
+    {
+      std::lock_guard<std::mutex> guard(_mutex);
+      _stopping = true;
+    }
+    _not_empty.notify_all();
+    _not_full.notify_all();
+    for (std::unique_ptr<Worker>& worker : _workers)
+    {
+      worker->stop();
+    }
+  }
+
+  /**
+   * @brief Queue a task in a lane.
+   * @return false if the executor is stopped, the task is then dropped.
+   */
+  bool submit(const Lane lane, task_t&& task)
+  {
+    std::unique_lock<std::mutex> guard(_mutex);
+    std::deque<task_t>& queue = _lanes[lane];
+    _not_full.wait(guard, [this, &queue]()
+    {
+      return _stopping || queue.size() < _options.queue_depth;
+    });
+    if (_stopping)
+    {
+      return false;
+    }
+    queue.emplace_back(std::move(task));
+    guard.unlock();
+    _not_empty.notify_one();
+    return true;
+  }
+
+  /**
+   * @brief Number of tasks waiting in a lane.
+   */
+  size_t pending(const Lane lane)
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    return _lanes[lane].size();
+  }
+
+protected:
+  Executor(const ExecutorOptions& options) :
+      _options(options), _workers(), _mutex(), _not_empty(), _not_full(), _stopping(
+          true), _turn(0)
+  {
+    if (_options.read_weight + _options.write_weight == 0)
+    {
+      _options.read_weight = _options.write_weight = 1;
+    }
+    for (size_t i = 0; i < _options.threads; ++i)
+    {
+      _workers.emplace_back(new Worker(*this));
+    }
+  }
+
+  virtual ~Executor()
+  {
+    stop();
+  }
+
+  typedef typename std::unique_ptr<Executor> befriended_deleter_t;
+  friend std::unique_ptr<Executor>::deleter_type;
+
+  /**
+   * @brief Wait for the next task, an empty task means the worker shall stop.
+   */
+  task_t next()
+  {
+    std::unique_lock<std::mutex> guard(_mutex);
+    _not_empty.wait(guard, [this]()
+    {
+      return _stopping || !_lanes[READ].empty() || !_lanes[WRITE].empty();
+    });
+    task_t task;
+    const bool reads = !_lanes[READ].empty();
+    const bool writes = !_lanes[WRITE].empty();
+    if (reads || writes)
+    {
+      const size_t period = _options.read_weight + _options.write_weight;
+      const bool read_turn = (_turn++ % period) < _options.read_weight;
+      std::deque<task_t>& queue =
+          (reads && (read_turn || !writes)) ? _lanes[READ] : _lanes[WRITE];
+      task = std::move(queue.front());
+      queue.pop_front();
+      guard.unlock();
+      _not_full.notify_all();
+    }
+    return task;
+  }
+
+private:
+  /**
+   * @brief A worker thread running the tasks of the executor.
+   */
+  class Worker: public ManagedTask<std::numeric_limits<uint8_t>::max()>
+  {
+  public:
+    Worker(Executor& executor) :
+        ManagedTask(), _executor(executor)
+    {
+    }
+
+    virtual ~Worker()
+    {
+      stop();
+    }
+
+  protected:
+    virtual void create_thread()
+    {
+      _task = std::move(std::thread([](Worker& self) mutable
+      {
+        while(task_t task = self._executor.next())
+        {
+          task();
+        }
+      }, std::ref(*this)));
+    }
+
+  private:
+    Executor& _executor;
+  };
+
+  ExecutorOptions _options;
+  std::vector<std::unique_ptr<Worker>> _workers;
+  std::mutex _mutex;
+  std::condition_variable _not_empty;
+  std::condition_variable _not_full;
+  std::deque<task_t> _lanes[2];
+  bool _stopping;
+  size_t _turn;
+};
+
+}
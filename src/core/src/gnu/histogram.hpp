@@ -0,0 +1,167 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+namespace pipedb
+{
+
+/**
+ * @brief A histogram of durations in nanoseconds.
+ *
+ * Values below 16 have their own bucket, above each power of two is split
+ * in 4 buckets: the relative error of a percentile is below 25%. Values
+ * over 2^40 ns (about 18 minutes) fall in the last bucket.
+ */
+class Histogram
+{
+public:
+  static constexpr size_t buckets = 16 + (40 - 4) * 4;
+
+  Histogram() :
+      _counts(), _count(0), _sum(0), _max(0)
+  {
+    _counts.fill(0);
+  }
+
+  /**
+   * @brief Index of the bucket of value.
+   */
+  static size_t bucket(const uint64_t value) noexcept
+  {
+    if (value < 16)
+    {
+      return value;
+    }
+    size_t exponent = 63 - __builtin_clzll(value);
+    if (exponent >= 40)
+    {
+      return buckets - 1;
+    }
+    return 16 + (exponent - 4) * 4 + ((value >> (exponent - 2)) & 3);
+  }
+
+  /**
+   * @brief Smallest value of a bucket.
+   */
+  static uint64_t lower(const size_t index) noexcept
+  {
+    if (index < 16)
+    {
+      return index;
+    }
+    const size_t exponent = 4 + (index - 16) / 4;
+    return (uint64_t(4 + (index - 16) % 4)) << (exponent - 2);
+  }
+
+  /**
+   * @brief Smallest value of the next bucket.
+   */
+  static uint64_t upper(const size_t index) noexcept
+  {
+    return index + 1 < buckets ? lower(index + 1) : lower(index) * 2;
+  }
+
+  void add(const uint64_t value, const uint64_t times = 1) noexcept
+  {
+    _counts[bucket(value)] += times;
+    _count += times;
+    _sum += value * times;
+    _max = std::max(_max, value);
+  }
+
+  void merge(const Histogram& other) noexcept
+  {
+    for (size_t i = 0; i < buckets; ++i)
+    {
+      _counts[i] += other._counts[i];
+    }
+    _count += other._count;
+    _sum += other._sum;
+    _max = std::max(_max, other._max);
+  }
+
+  uint64_t count() const noexcept
+  {
+    return _count;
+  }
+
+  uint64_t max() const noexcept
+  {
+    return _max;
+  }
+
+  double mean() const noexcept
+  {
+    return _count == 0 ? 0.0 : static_cast<double>(_sum) / _count;
+  }
+
+  /**
+   * @brief Value below which p percent of the values fall, interpolated
+   * in its bucket.
+   */
+  double percentile(const double p) const noexcept
+  {
+    const double threshold = _count * (p / 100.0);
+    double cumulative = 0;
+    for (size_t i = 0; i < buckets; ++i)
+    {
+      if (_counts[i] == 0)
+      {
+        continue;
+      }
+      const double previous = cumulative;
+      cumulative += _counts[i];
+      if (cumulative >= threshold)
+      {
+        const double position = (threshold - previous) / _counts[i];
+        const double value = lower(i) + (upper(i) - lower(i)) * position;
+        return _max == 0 ? value : std::min(value, static_cast<double>(_max));
+      }
+    }
+    return static_cast<double>(_max);
+  }
+
+  double p50() const noexcept
+  {
+    return percentile(50);
+  }
+
+  double p99() const noexcept
+  {
+    return percentile(99);
+  }
+
+  double p999() const noexcept
+  {
+    return percentile(99.9);
+  }
+
+private:
+  friend class MeteredRepo; /** Aggregates its own counters */
+
+  std::array<uint64_t, buckets> _counts;
+  uint64_t _count;
+  uint64_t _sum;
+  uint64_t _max;
+};
+
+}
@@ -17,53 +17,128 @@
  */
 #pragma once
 
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <set>
+
 #include "blockrepository.hpp"
+#include "enginestats.hpp"
+#include "membershipfilter.hpp"
 #include "tools.hpp"
 
 #include <leveldb/db.h>
+#include <leveldb/iterator.h>
 #include <leveldb/slice.h>
 #include <leveldb/status.h>
 #include <leveldb/filter_policy.h>
 #include <leveldb/write_batch.h>
 #include <leveldb/cache.h>
+#include <leveldb/pinnable_slice.h>
+#include <leveldb/rate_limiter.h>
 
 namespace pipedb {
 
+/**
+ * @brief Durability of the writes of a LdbRepo.
+ *
+ * Synchronous writes are committed in groups: the first writer waits up
+ * to max_delay for the others, then a single fdatasync makes all of them
+ * durable.
+ */
+struct Durability {
+    bool sync = false; /** Default durability of put, drop and the batches */
+    std::chrono::microseconds max_delay = std::chrono::microseconds(0); /** Wait of a group for more writes */
+    size_t max_batch_bytes = 1 << 20; /** A group stops waiting once this many bytes are queued */
+};
+
+/**
+ * @brief Bandwidth of the background writes of a LdbRepo.
+ *
+ * The flushes and the compactions write at most bytes_per_second, so
+ * bursts of compactions leave the disk to the reads. With auto_tune, the
+ * rate moves between min_bytes_per_second and bytes_per_second: it drops
+ * while the reads of the tables are slower than target_read_latency, and
+ * rises while the compactions are more than max_pending_bytes behind.
+ */
+struct CompactionRate {
+    int64_t bytes_per_second = 0; /** Rate, or maximum rate with auto_tune. 0 for no limit */
+    bool auto_tune = false; /** Tune the rate from the load */
+    int64_t min_bytes_per_second = 8 << 20; /** Lowest tuned rate */
+    std::chrono::microseconds target_read_latency = std::chrono::microseconds(2000); /** Average table read latency to keep */
+    uint64_t max_pending_bytes = 1ull << 30; /** Compaction debt forcing the rate up */
+};
+
+class BulkLoader;
+
 class LdbRepo: public BlockRepository {
     public:
-        LdbRepo(const std::string& path) :
+        /**
+         * @brief Create a repository stored in path.
+         *
+         * When a membership filter is given, it is filled with the keys of
+         * the repository at open time and kept up to date by put and drop.
+         * A filter given to this repository only is saved at close and
+         * loaded back at open instead of scanning the keys. An open
+         * without a filter removes the saved one. A shared filter is only
+         * filled at the first open, the keys do not change while closed.
+         */
+        LdbRepo(const std::string& path, const std::shared_ptr<MembershipFilter>& membership = nullptr) :
         BlockRepository(), 
         isOpen(false), 
         db(), 
+        readers(new Readers()), 
         cache(), 
         filter(), 
+        limiter(), 
+        membership(membership),
+        membershipFilled(false),
         writeOptions(), 
         readOptions(), 
         options(), 
         leveldbPath(path) {
             options.create_if_missing = true;
             options.compression = leveldb::kSnappyCompression;
-            // improve read performance using a cache
+            if (membership) {
+                membership->attach();
+            }
+            // improve read performance using a cache, whose hits take
+            // no lock
             assert(isOpen == false);
-            cache.reset(leveldb::NewLRUCache(64 << 20));
+            cache.reset(leveldb::NewClockCache(64 << 20, options.block_size));
             assert(NULL != cache.get());
             options.block_cache = cache.get();
-            // use a bloom filters to reduce the disk lookups.
-            filter.reset(leveldb::NewBloomFilterPolicy(100));
-            assert(NULL != filter.get());
-            options.filter_policy = filter.get();
-	    // improve write performance using a write buffer
+            // use a bloom filters to reduce the disk lookups, one per
+            // table checked before its index
+            set_bloom_bits_per_key(16);
+            options.whole_table_filter = true;
+	    // improve write performance using a write buffer, filled by the
+            // writers of a group at once
             options.write_buffer_size = 64 << 20;
+            options.concurrent_memtable_writes = true;
+            // log the next group while the last one fills the buffer
+            options.pipelined_writes = true;
+            // compact disjoint ranges in parallel, the memtable flushes
+            // on its own thread
+            options.max_background_compactions = 4;
+            // and split the large compactions between threads
+            options.max_subcompactions = 4;
         }
 
         virtual ~LdbRepo() {
             // release allocated memory
             options.block_cache = NULL;
             options.filter_policy = NULL;
+            options.rate_limiter = NULL;
             close();
             db.reset();
             cache.reset();
             filter.reset();
+            limiter.reset();
+            if (membership) {
+                membership->detach();
+            }
         }
 
         virtual bool opened() {
@@ -75,9 +150,16 @@ class LdbRepo: public BlockRepository {
         }
 
         virtual Return close() {
-            // delete the associated leveldb instance to close
+            // delete the associated leveldb instance to close, the
+            // snapshots still alive no longer read it
             isOpen = false;
+            const bool wasOpen = (db != nullptr);
+            detachReaders();
             db.reset();
+            if (wasOpen && membership && membership->shared() == false) {
+                // read back at the next open, a failure only costs a scan
+                membership->save(membershipPath());
+            }
             return Return::OK;
         }
 
@@ -105,16 +187,139 @@ class LdbRepo: public BlockRepository {
                         return Return::NOT_SUPPORTED;
                     }
                     // pass the memory to the class
-                    // in the smart pointer
-                    db.reset(dbToAllocate);
+                    // in the smart pointer, the cache, the filter and the
+                    // rate limiter have to outlive the database
+                    std::shared_ptr<leveldb::Cache> dbCache = cache;
+                    std::shared_ptr<const leveldb::FilterPolicy> dbFilter = filter;
+                    std::shared_ptr<leveldb::RateLimiter> dbLimiter = limiter;
+                    db.reset(dbToAllocate, [dbCache, dbFilter, dbLimiter](leveldb::DB* d) {
+                        delete d;
+                    });
+                    if (membership) {
+                        return fillMembership();
+                    }
+                    // a filter saved before would miss the keys written now
+                    std::remove(membershipPath().c_str());
                     return Return::OK;
                 }
             }
         }
 
+        /**
+         * @brief Set the durability of the writes, only while closed.
+         */
+        Return set_durability(const Durability& durability) {
+            if (isOpen) {
+                return Return::NOT_SUPPORTED;
+            }
+            writeOptions.sync = durability.sync;
+            options.group_commit_delay_micros = durability.max_delay.count();
+            options.max_write_group_size = durability.max_batch_bytes;
+            return Return::OK;
+        }
+
+        /**
+         * @brief Set the size of the bloom filters of the tables, only while closed.
+         *
+         * The filters are cut in cache lines, a lookup of a missing key
+         * reads a single line: 10 bits per key give about 1% of false
+         * positives, 16 bits 0.1%. 0 disables the filters.
+         */
+        Return set_bloom_bits_per_key(const int bits_per_key) {
+            if (isOpen || bits_per_key < 0) {
+                return Return::NOT_SUPPORTED;
+            }
+            if (bits_per_key == 0) {
+                filter.reset();
+            }
+            else {
+                filter.reset(leveldb::NewBlockedBloomFilterPolicy(bits_per_key));
+                assert(NULL != filter.get());
+            }
+            options.filter_policy = filter.get();
+            return Return::OK;
+        }
+
+        /**
+         * @brief Set the size from which the blocks are kept out of the
+         * tables, only while closed.
+         *
+         * The tables then hold a handle to the block in a value log, the
+         * compactions only move the handles. A store holding such handles
+         * can not be opened by the versions without value logs. 0, the
+         * default, keeps all the blocks in the tables.
+         */
+        Return set_value_log_threshold(const size_t bytes) {
+            if (isOpen) {
+                return Return::NOT_SUPPORTED;
+            }
+            options.value_log_threshold = bytes;
+            return Return::OK;
+        }
+
+        /**
+         * @brief Set the size in bytes of the read block cache, also while open.
+         *
+         * A smaller cache evicts blocks at once, a larger one makes room
+         * for more blocks, dropping those in use at that moment.
+         */
+        Return set_block_cache_capacity(const size_t bytes) {
+            cache->SetCapacity(bytes);
+            return Return::OK;
+        }
+
+        /**
+         * @brief Size in bytes of the read block cache.
+         */
+        size_t block_cache_capacity() const {
+            return cache->GetCapacity();
+        }
+
+        /**
+         * @brief Set the bandwidth of the flushes and compactions, only while closed.
+         */
+        Return set_compaction_rate(const CompactionRate& rate) {
+            if (isOpen) {
+                return Return::NOT_SUPPORTED;
+            }
+            if (rate.bytes_per_second <= 0) {
+                limiter.reset();
+            }
+            else if (rate.auto_tune) {
+                limiter.reset(leveldb::NewAutoTunedRateLimiter(
+                    std::min(rate.min_bytes_per_second, rate.bytes_per_second),
+                    rate.bytes_per_second,
+                    rate.target_read_latency.count(),
+                    rate.max_pending_bytes));
+            }
+            else {
+                limiter.reset(leveldb::NewRateLimiter(rate.bytes_per_second));
+            }
+            options.rate_limiter = limiter.get();
+            return Return::OK;
+        }
+
+        /**
+         * @brief Current bandwidth of the flushes and compactions, 0 without limit.
+         */
+        int64_t compaction_rate() const {
+            return limiter ? limiter->GetBytesPerSecond() : 0;
+        }
+
         virtual Return put(const Key&& key, const InputBlock&& value) {
+            return put(std::move(key), std::move(value), writeOptions.sync);
+        }
+
+        /**
+         * @brief Put a value, durable before returning when sync is true.
+         */
+        virtual Return put(const Key&& key, const InputBlock&& value, const bool sync) {
             if (isOpen) {
-	      return fromStatus(db->Put(writeOptions, toSlice(std::move(key)), toSlice(std::move(value))));
+	      if (membership) {
+		// account for the key before it can be read
+		membership->add(key);
+	      }
+	      return fromStatus(db->Put(writeOptionsFor(sync), toSlice(std::move(key)), toSlice(std::move(value))));
             }
             else {
                 return Return::NOT_SUPPORTED;
@@ -123,12 +328,17 @@ class LdbRepo: public BlockRepository {
 
         virtual Return get(const Key&& key, OutputBlock& value) {
             if (isOpen) {
-	      std::string data;
-	      Return state = fromStatus(db->Get(readOptions, toSlice(std::move(key)), &data));
-	      if(state.success()) {
-		value.set_data(data);
-	      }
-	      return state;
+                return read(std::move(key), value, readOptions);
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        virtual Return get(const Key&& key, OutputBlock& value, const Snapshot& snapshot) {
+            leveldb::ReadOptions snapshotOptions;
+            if (isOpen && resolve(snapshot, snapshotOptions)) {
+                return read(std::move(key), value, snapshotOptions);
             }
             else {
                 return Return::NOT_SUPPORTED;
@@ -136,8 +346,28 @@ class LdbRepo: public BlockRepository {
         }
 
         virtual Return drop(const Key&& key) {
+            return drop(std::move(key), writeOptions.sync);
+        }
+
+        /**
+         * @brief Drop a key, durable before returning when sync is true.
+         */
+        virtual Return drop(const Key&& key, const bool sync) {
             if (isOpen) {
-	      return fromStatus(db->Delete(writeOptions, toSlice(std::move(key))));
+	      if (membership) {
+		if (membership->may_contain(key) == false) {
+		  // never written, nothing to delete
+		  return Return::OK;
+		}
+		std::lock_guard<std::mutex> guard(membership->stripe(key));
+		const bool present = db->Contains(readOptions, toSlice(std::move(key))).ok();
+		Return state = fromStatus(db->Delete(writeOptionsFor(sync), toSlice(std::move(key))));
+		if (present && state.success()) {
+		  membership->remove(key);
+		}
+		return state;
+	      }
+	      return fromStatus(db->Delete(writeOptionsFor(sync), toSlice(std::move(key))));
             }
             else {
                 return Return::NOT_SUPPORTED;
@@ -146,8 +376,11 @@ class LdbRepo: public BlockRepository {
 
         virtual bool included(const Key&& key) {
             if (isOpen) {
-                std::string value;
-                leveldb::Status status = db->Get(readOptions, toSlice(std::move(key)), &value);
+                if (membership && membership->may_contain(key) == false) {
+                    return false;
+                }
+                // never read nor decompress the value
+                leveldb::Status status = db->Contains(readOptions, toSlice(std::move(key)));
                 return status.ok();
             }
             else {
@@ -159,6 +392,159 @@ class LdbRepo: public BlockRepository {
 	  return isOpen && ! included(std::move(key));
         }
 
+        virtual std::vector<Return> multi_put(const std::vector<Key>& keys,
+                                              const std::vector<InputBlock>& values) {
+            return multi_put(keys, values, writeOptions.sync);
+        }
+
+        /**
+         * @brief Put a batch of values, durable before returning when sync
+         * is true.
+         */
+        virtual std::vector<Return> multi_put(const std::vector<Key>& keys,
+                                              const std::vector<InputBlock>& values, const bool sync) {
+            if (isOpen && keys.size() == values.size()) {
+                // a single batch takes the leveldb writer queue only once
+                leveldb::WriteBatch batch;
+                for (size_t i = 0; i < keys.size(); ++i) {
+                    if (membership) {
+                        membership->add(keys[i]);
+                    }
+                    batch.Put(toSlice(std::move(keys[i])), toSlice(std::move(values[i])));
+                }
+                const Return state = fromStatus(db->Write(writeOptionsFor(sync), &batch));
+                return std::vector<Return>(keys.size(), state);
+            }
+            else {
+                return std::vector<Return>(keys.size(), Return::NOT_SUPPORTED);
+            }
+        }
+
+        virtual std::vector<Return> multi_get(const std::vector<Key>& keys,
+                                              std::vector<OutputBlock>& values) {
+            if (isOpen) {
+                return multiRead(keys, values, readOptions);
+            }
+            else {
+                values.resize(keys.size());
+                return std::vector<Return>(keys.size(), Return::NOT_SUPPORTED);
+            }
+        }
+
+        virtual std::vector<Return> multi_get(const std::vector<Key>& keys,
+                                              std::vector<OutputBlock>& values, const Snapshot& snapshot) {
+            leveldb::ReadOptions snapshotOptions;
+            if (isOpen && resolve(snapshot, snapshotOptions)) {
+                return multiRead(keys, values, snapshotOptions);
+            }
+            else {
+                values.resize(keys.size());
+                return std::vector<Return>(keys.size(), Return::NOT_SUPPORTED);
+            }
+        }
+
+        virtual std::vector<Return> multi_drop(const std::vector<Key>& keys) {
+            return multi_drop(keys, writeOptions.sync);
+        }
+
+        /**
+         * @brief Drop a batch of keys, durable before returning when sync
+         * is true.
+         */
+        virtual std::vector<Return> multi_drop(const std::vector<Key>& keys, const bool sync) {
+            if (isOpen && membership) {
+                return filteredMultiDrop(keys, writeOptionsFor(sync));
+            }
+            else if (isOpen) {
+                leveldb::WriteBatch batch;
+                for (const Key& key : keys) {
+                    batch.Delete(toSlice(std::move(key)));
+                }
+                const Return state = fromStatus(db->Write(writeOptionsFor(sync), &batch));
+                return std::vector<Return>(keys.size(), state);
+            }
+            else {
+                return std::vector<Return>(keys.size(), Return::NOT_SUPPORTED);
+            }
+        }
+
+        virtual std::vector<bool> multi_included(const std::vector<Key>& keys) {
+            std::vector<bool> res;
+            res.reserve(keys.size());
+            for (const Key& key : keys) {
+                res.push_back(included(std::move(key)));
+            }
+            return res;
+        }
+
+        virtual std::vector<bool> multi_excluded(const std::vector<Key>& keys) {
+            std::vector<bool> res;
+            res.reserve(keys.size());
+            for (const Key& key : keys) {
+                res.push_back(excluded(std::move(key)));
+            }
+            return res;
+        }
+
+        virtual std::unique_ptr<Cursor> scan(const Key&& begin, const Key&& end,
+                                             const ScanOptions& scanOptions = ScanOptions()) {
+            leveldb::ReadOptions iteratorOptions = readOptions;
+            if (isOpen && (scanOptions.snapshot == nullptr || resolve(*scanOptions.snapshot, iteratorOptions))) {
+                iteratorOptions.fill_cache = scanOptions.fill_cache;
+                std::unique_ptr<Cursor::Source> source(new Source(readers, db.get(), iteratorOptions, begin, end));
+                return std::unique_ptr<Cursor>(new Cursor(std::move(source), scanOptions));
+            }
+            else {
+                return Cursor::failed(Return::NOT_SUPPORTED);
+            }
+        }
+
+        /**
+         * @brief Pin a leveldb snapshot, released with the handle or at close.
+         */
+        virtual std::unique_ptr<Snapshot> snapshot() {
+            if (isOpen) {
+                return std::unique_ptr<Snapshot>(new LdbSnapshot(_snapshots, readers, db.get()));
+            }
+            else {
+                return nullptr;
+            }
+        }
+
+        /**
+         * @brief Statistics of the leveldb instance.
+         */
+        Return stats(EngineStats& engine) {
+            if (isOpen) {
+                leveldb::DbStats dbStats;
+                db->GetStats(&dbStats);
+                engine.levels.clear();
+                for (const leveldb::LevelStats& level : dbStats.levels) {
+                    LevelShape shape;
+                    shape.files = level.files;
+                    shape.bytes = level.bytes;
+                    shape.compaction_micros = level.compaction_micros;
+                    shape.compaction_bytes_read = level.bytes_read;
+                    shape.compaction_bytes_written = level.bytes_written;
+                    engine.levels.push_back(shape);
+                }
+                engine.user_bytes_written = dbStats.user_bytes_written;
+                engine.stall_micros = dbStats.stall_micros;
+                engine.slowdown_stalls = dbStats.slowdown_stalls;
+                engine.memtable_stalls = dbStats.memtable_stalls;
+                engine.level0_stalls = dbStats.level0_stalls;
+                engine.memtable_bytes = dbStats.memtable_bytes;
+                engine.block_cache_bytes = dbStats.block_cache_bytes;
+                engine.value_log_files = dbStats.value_log_files;
+                engine.value_log_bytes = dbStats.value_log_bytes;
+                engine.value_log_garbage_bytes = dbStats.value_log_garbage_bytes;
+                return Return::OK;
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
         virtual Return erase()  {
             if (isOpen) {
                 return Return::NOT_SUPPORTED;
@@ -171,7 +557,301 @@ class LdbRepo: public BlockRepository {
             }
         }
     protected:
+        friend class BulkLoader;
+
+        class Reader;
+
+        /**
+         * @brief The snapshots and cursors reading the open database.
+         */
+        struct Readers {
+            std::mutex mutex;
+            std::set<Reader*> live;
+        };
+
+        /**
+         * @brief What keeps reading the database after the call creating
+         * it returned.
+         *
+         * A reader does not keep the database alive: close() detaches the
+         * live ones before deleting it, they then fail their reads.
+         */
+        class Reader {
+            public:
+                Reader(const std::shared_ptr<Readers>& all) :
+                readers(all) {
+                    std::lock_guard<std::mutex> guard(readers->mutex);
+                    readers->live.insert(this);
+                }
+
+                virtual ~Reader() {
+                }
+
+                /**
+                 * @brief Release what the reader holds in the database,
+                 * called once with the lock of the readers held.
+                 */
+                virtual void detach() = 0;
+
+            protected:
+                /**
+                 * @brief Detach unless close() did, from the destructor of
+                 * the subclass.
+                 */
+                void leave() {
+                    std::lock_guard<std::mutex> guard(readers->mutex);
+                    if (readers->live.erase(this) > 0) {
+                        detach();
+                    }
+                }
+
+            private:
+                const std::shared_ptr<Readers> readers;
+        };
+
+        /**
+         * @brief A leveldb snapshot, released with the handle or at close.
+         */
+        class LdbSnapshot: public Snapshot, public Reader {
+            public:
+                LdbSnapshot(const std::shared_ptr<SnapshotTracker>& tracker,
+                            const std::shared_ptr<Readers>& all, leveldb::DB* database) :
+                Snapshot(tracker),
+                Reader(all),
+                db(database),
+                snapshot(database->GetSnapshot()) {
+                }
+
+                virtual ~LdbSnapshot() {
+                    leave();
+                }
+
+                virtual void detach() {
+                    db->ReleaseSnapshot(snapshot);
+                    db = NULL;
+                    snapshot = NULL;
+                }
+
+                leveldb::DB* db; /** NULL once detached */
+                const leveldb::Snapshot* snapshot;
+        };
+
+        /**
+         * @brief Detach the live snapshots and cursors before the database
+         * is deleted.
+         */
+        void detachReaders() {
+            std::lock_guard<std::mutex> guard(readers->mutex);
+            for (Reader* reader : readers->live) {
+                reader->detach();
+            }
+            readers->live.clear();
+        }
+
+        /**
+         * @brief Read options reading the snapshot, false if it was not
+         * taken on the current database.
+         */
+        bool resolve(const Snapshot& snapshot, leveldb::ReadOptions& snapshotOptions) const noexcept {
+            const LdbSnapshot* taken = dynamic_cast<const LdbSnapshot*>(&snapshot);
+            if (taken == NULL || taken->db == NULL || taken->db != db.get()) {
+                return false;
+            }
+            snapshotOptions = readOptions;
+            snapshotOptions.snapshot = taken->snapshot;
+            return true;
+        }
+
+        Return read(const Key&& key, OutputBlock& value, const leveldb::ReadOptions& options) {
+	  std::unique_ptr<leveldb::PinnableSlice> data(new leveldb::PinnableSlice());
+	  Return state = fromStatus(db->GetPinned(options, toSlice(std::move(key)), data.get()));
+	  if(state.success()) {
+	    if(data->IsPinned()) {
+	      // reference the block cache entry, only the cache is kept
+	      // alive until the output block releases it: the database
+	      // may be closed and reopened meanwhile
+	      const leveldb::Slice slice = data->data();
+	      std::shared_ptr<leveldb::Cache> pinnedCache = cache;
+	      std::shared_ptr<const void> owner(data.release(), [pinnedCache](leveldb::PinnableSlice* p) {
+		  delete p;
+		});
+	      value.pin_data(slice.data(), slice.size(), std::move(owner));
+	    }
+	    else {
+	      value.set_data(std::move(*data->GetSelf()));
+	    }
+	  }
+	  return state;
+        }
+
+        std::vector<Return> multiRead(const std::vector<Key>& keys, std::vector<OutputBlock>& values,
+                                      const leveldb::ReadOptions& options) {
+            values.resize(keys.size());
+            std::vector<Return> states;
+            states.reserve(keys.size());
+            std::vector<std::string> data;
+            const std::vector<leveldb::Status> status = db->MultiGet(options, toSlices(keys), &data);
+            for (size_t i = 0; i < keys.size(); ++i) {
+                states.push_back(fromStatus(status[i]));
+                if (states.back().success()) {
+                    values[i].set_data(std::move(data[i]));
+                }
+            }
+            return states;
+        }
+
+        /**
+         * @brief Entries of a leveldb iterator in [begin, end[.
+         *
+         * The iterator is deleted at close, the next reads fail.
+         */
+        class Source: public Cursor::Source, public Reader {
+            public:
+                Source(const std::shared_ptr<Readers>& all, leveldb::DB* database,
+                       const leveldb::ReadOptions& options, const Key& from, const Key& to) :
+                Reader(all),
+                reading(),
+                it(database->NewIterator(options)),
+                end(to.copy_as_string()) {
+                    if (from.get_size() == 0) {
+                        it->SeekToFirst();
+                    }
+                    else {
+                        it->Seek(leveldb::Slice(from.get_data(), from.get_size()));
+                    }
+                }
+
+                virtual ~Source() {
+                    leave();
+                }
+
+                virtual void detach() {
+                    std::lock_guard<std::mutex> guard(reading);
+                    it.reset();
+                }
+
+                virtual void read(Cursor::Batch& batch, const ScanOptions& options) {
+                    std::lock_guard<std::mutex> guard(reading);
+                    if (it == nullptr) {
+                        batch.last = true;
+                        batch.state = Return::NOT_SUPPORTED;
+                        return;
+                    }
+                    for (; it->Valid() && batch.full(options) == false; it->Next()) {
+                        const leveldb::Slice key = it->key();
+                        if (end.empty() == false && key.compare(end) >= 0) {
+                            batch.last = true;
+                            return;
+                        }
+                        batch.keys.emplace_back(key.data(), key.size());
+                        batch.values.emplace_back();
+                        if (options.keys_only == false) {
+                            const leveldb::Slice value = it->value();
+                            batch.values.back().set_data(value.data(), value.size());
+                        }
+                        batch.bytes += batch.keys.back().size() + batch.values.back().get_size();
+                    }
+                    if (it->Valid() == false) {
+                        batch.last = true;
+                        if (it->status().ok() == false) {
+                            batch.state = Return::BACKEND_ERROR;
+                        }
+                    }
+                }
+
+            private:
+                std::mutex reading; /** Held by a read, close waits for it */
+                std::unique_ptr<leveldb::Iterator> it; /** NULL once detached */
+                const std::string end;
+        };
+
+        /**
+         * @brief Account for all the keys already stored.
+         *
+         * The filter saved at the last close is removed once read: after
+         * a crash the keys are scanned again rather than taken from a
+         * stale copy. The scan reads the keys only, the values kept in
+         * the value logs are not fetched. A shared filter can not be
+         * cleared: it still holds the keys of the previous open, scanning
+         * them again would count them twice.
+         */
+        Return fillMembership() {
+            const std::string saved = membershipPath();
+            const bool shared = membership->shared();
+            bool loaded = false;
+            if (shared == false) {
+                membership->clear();
+                loaded = membership->load(saved);
+            }
+            if (std::remove(saved.c_str()) != 0 && loaded) {
+                // a copy left behind could be read after a crash
+                membership->clear();
+                loaded = false;
+            }
+            if (loaded || (shared && membershipFilled)) {
+                membershipFilled = true;
+                return Return::OK;
+            }
+            leveldb::ReadOptions scanOptions;
+            scanOptions.fill_cache = false;
+            std::unique_ptr<leveldb::Iterator> it(db->NewIterator(scanOptions));
+            for (it->SeekToFirst(); it->Valid(); it->Next()) {
+                const leveldb::Slice key = it->key();
+                membership->add(Key(key.data(), key.size()));
+            }
+            membershipFilled = it->status().ok();
+            return fromStatus(it->status());
+        }
+
+        std::string membershipPath() const {
+            return leveldbPath + "/MEMBERSHIP";
+        }
+
+        /**
+         * @brief Drop a batch keeping the membership filter exact.
+         *
+         * The stripes of the keys are locked in order to avoid dead locks.
+         */
+        std::vector<Return> filteredMultiDrop(const std::vector<Key>& keys,
+                                              const leveldb::WriteOptions& batchOptions) {
+            std::vector<size_t> stripes;
+            std::vector<bool> present;
+            leveldb::WriteBatch batch;
+            for (const Key& key : keys) {
+                stripes.push_back(membership->stripe_index(key));
+            }
+            std::sort(stripes.begin(), stripes.end());
+            stripes.erase(std::unique(stripes.begin(), stripes.end()), stripes.end());
+            for (size_t stripe : stripes) {
+                membership->stripe_at(stripe).lock();
+            }
+            for (const Key& key : keys) {
+                const bool candidate = membership->may_contain(key);
+                present.push_back(candidate && db->Contains(readOptions, toSlice(std::move(key))).ok());
+                if (candidate) {
+                    batch.Delete(toSlice(std::move(key)));
+                }
+            }
+            const Return state = fromStatus(db->Write(batchOptions, &batch));
+            if (state.success()) {
+                for (size_t i = 0; i < keys.size(); ++i) {
+                    if (present[i]) {
+                        membership->remove(keys[i]);
+                    }
+                }
+            }
+            for (size_t stripe : stripes) {
+                membership->stripe_at(stripe).unlock();
+            }
+            return std::vector<Return>(keys.size(), state);
+        }
   
+        leveldb::WriteOptions writeOptionsFor(const bool sync) const noexcept {
+            leveldb::WriteOptions o = writeOptions;
+            o.sync = sync;
+            return o;
+        }
+
         Return fromStatus(const leveldb::Status& st) noexcept {
 	  if (st.ok()) {
 	    return Return::OK;
@@ -206,12 +886,25 @@ class LdbRepo: public BlockRepository {
         leveldb::Slice toSlice(const OutputBlock&& b) noexcept {
 	  return leveldb::Slice(b.get_data(), b.get_size());
 	}
+
+        std::vector<leveldb::Slice> toSlices(const std::vector<Key>& keys) {
+	  std::vector<leveldb::Slice> slices;
+	  slices.reserve(keys.size());
+	  for (const Key& key : keys) {
+	    slices.push_back(toSlice(std::move(key)));
+	  }
+	  return slices;
+	}
   
-    private:
+    protected:
         std::atomic<bool> isOpen; /** If the database is open */
-        std::unique_ptr<leveldb::DB> db; /** LevelDb instance. */
-        std::unique_ptr<leveldb::Cache> cache; /** LevelDb read block cache */
-        std::unique_ptr<const leveldb::FilterPolicy> filter; /** LevelDb filter */
+        std::shared_ptr<leveldb::DB> db; /** LevelDb instance. */
+        std::shared_ptr<Readers> readers; /** Live snapshots and cursors, detached at close */
+        std::shared_ptr<leveldb::Cache> cache; /** LevelDb read block cache */
+        std::shared_ptr<const leveldb::FilterPolicy> filter; /** LevelDb filter */
+        std::shared_ptr<leveldb::RateLimiter> limiter; /** Optional bandwidth limit of the background writes */
+        std::shared_ptr<MembershipFilter> membership; /** Optional in memory filter of the keys. */
+        bool membershipFilled; /** If the filter holds the keys of the repository */
         leveldb::WriteOptions writeOptions; /** Default write options. */
         leveldb::ReadOptions readOptions; /** Default read options. */
         leveldb::Options options; /** Leveldb options. Used at initialization time. */
@@ -0,0 +1,247 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <limits>
+#include <string>
+
+#include <boost/utility.hpp>
+
+#include "key.hpp"
+
+namespace pipedb
+{
+
+/**
+ * @brief In memory counting bloom filter over the keys of repositories.
+ *
+ * A negative answer of may_contain() is exact as long as every key written
+ * was added before being written, so a lookup for a key that was never
+ * written needs no I/O. Keys are removed when they are dropped. Counters
+ * are atomic: no lock is taken to add, remove or lookup a key.
+ *
+ * A single filter may be shared by several repositories holding disjoint
+ * key sets (ie: the shards of a ShardedRepo).
+ */
+class MembershipFilter: private boost::noncopyable
+{
+public:
+  typedef uint8_t counter_t;
+
+  static std::shared_ptr<MembershipFilter> create(const size_t expected_keys,
+      const size_t counters_per_key = 10)
+  {
+    std::shared_ptr<MembershipFilter> o(
+        new MembershipFilter(expected_keys, counters_per_key));
+    return o;
+  }
+
+  /**
+   * @brief Account for one more copy of key.
+   */
+  void add(const Key& key) noexcept
+  {
+    uint32_t h = key.lookup_hash();
+    const uint32_t delta = (h >> 17) | (h << 15);
+    for (size_t i = 0; i < _probes; ++i)
+    {
+      std::atomic<counter_t>& counter = _counters[h % _size];
+      counter_t c = counter.load(std::memory_order_relaxed);
+      // saturated counters stay saturated
+      while (c != saturated
+          && !counter.compare_exchange_weak(c, c + 1, std::memory_order_release,
+              std::memory_order_relaxed))
+      {
+      }
+      h += delta;
+    }
+  }
+
+  /**
+   * @brief Account for one less copy of key.
+   *
+   * Shall be called only for a key that was added and is still present.
+   */
+  void remove(const Key& key) noexcept
+  {
+    uint32_t h = key.lookup_hash();
+    const uint32_t delta = (h >> 17) | (h << 15);
+    for (size_t i = 0; i < _probes; ++i)
+    {
+      std::atomic<counter_t>& counter = _counters[h % _size];
+      counter_t c = counter.load(std::memory_order_relaxed);
+      while (c != saturated && c != 0
+          && !counter.compare_exchange_weak(c, c - 1, std::memory_order_release,
+              std::memory_order_relaxed))
+      {
+      }
+      h += delta;
+    }
+  }
+
+  /**
+   * @brief Return false if the key was never added (or was removed).
+   */
+  bool may_contain(const Key& key) const noexcept
+  {
+    uint32_t h = key.lookup_hash();
+    const uint32_t delta = (h >> 17) | (h << 15);
+    for (size_t i = 0; i < _probes; ++i)
+    {
+      if (_counters[h % _size].load(std::memory_order_acquire) == 0)
+      {
+        return false;
+      }
+      h += delta;
+    }
+    return true;
+  }
+
+  /**
+   * @brief Lock serializing the removals of keys sharing its stripe.
+   *
+   * Two concurrent drops of the same key must not both remove it.
+   */
+  std::mutex& stripe(const Key& key) noexcept
+  {
+    return _stripes[stripe_index(key)];
+  }
+
+  /**
+   * @brief Index of the stripe of a key, to lock several stripes in order.
+   */
+  size_t stripe_index(const Key& key) const noexcept
+  {
+    return key.lookup_hash() % stripes;
+  }
+
+  std::mutex& stripe_at(const size_t index) noexcept
+  {
+    return _stripes[index];
+  }
+
+  static constexpr size_t stripes = 64;
+
+  /**
+   * @brief Register a repository using the filter, until detach().
+   *
+   * Only a filter used by a single repository holds exactly its keys,
+   * and can be saved and loaded with them.
+   */
+  void attach() noexcept
+  {
+    _repositories.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  void detach() noexcept
+  {
+    _repositories.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  bool shared() const noexcept
+  {
+    return _repositories.load(std::memory_order_relaxed) > 1;
+  }
+
+  /**
+   * @brief Forget all the keys.
+   */
+  void clear() noexcept
+  {
+    for (size_t i = 0; i < _size; ++i)
+    {
+      _counters[i].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  /**
+   * @brief Write the counters to filename, replaced at once.
+   *
+   * No key shall be added or removed meanwhile.
+   */
+  bool save(const std::string& filename) const
+  {
+    const std::string temporary = filename + ".tmp";
+    {
+      std::ofstream out(temporary, std::ios_base::binary | std::ios_base::trunc);
+      const uint64_t header[2] = { _size, _probes };
+      out.write(reinterpret_cast<const char*>(header), sizeof(header));
+      for (size_t i = 0; i < _size && out; ++i)
+      {
+        out.put(static_cast<char>(_counters[i].load(std::memory_order_relaxed)));
+      }
+      if (!out)
+      {
+        std::remove(temporary.c_str());
+        return false;
+      }
+    }
+    return std::rename(temporary.c_str(), filename.c_str()) == 0;
+  }
+
+  /**
+   * @brief Replace the counters by the ones saved in filename, false
+   * (and the filter left as is) if it holds a filter of another shape.
+   */
+  bool load(const std::string& filename)
+  {
+    std::ifstream in(filename, std::ios_base::binary);
+    uint64_t header[2] = { 0, 0 };
+    in.read(reinterpret_cast<char*>(header), sizeof(header));
+    if (!in || header[0] != _size || header[1] != _probes)
+    {
+      return false;
+    }
+    std::unique_ptr<char[]> counters(new char[_size]);
+    in.read(counters.get(), _size);
+    if (!in)
+    {
+      return false;
+    }
+    for (size_t i = 0; i < _size; ++i)
+    {
+      _counters[i].store(static_cast<counter_t>(counters[i]), std::memory_order_relaxed);
+    }
+    return true;
+  }
+
+private:
+  MembershipFilter(const size_t expected_keys, const size_t counters_per_key) :
+      _size(std::max<size_t>(64, expected_keys * counters_per_key)), _probes(
+          std::min<size_t>(30, std::max<size_t>(1, counters_per_key * 69 / 100))), _counters(
+          new std::atomic<counter_t>[_size]), _stripes(new std::mutex[stripes]), _repositories(0)
+  {
+    clear();
+  }
+
+  static constexpr counter_t saturated = std::numeric_limits<counter_t>::max();
+
+  const size_t _size;
+  const size_t _probes; /** ln(2) * counters per key */
+  std::unique_ptr<std::atomic<counter_t>[]> _counters;
+  std::unique_ptr<std::mutex[]> _stripes;
+  std::atomic<size_t> _repositories; /** Repositories using the filter */
+};
+
+}
@@ -0,0 +1,628 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include "blockrepository.hpp"
+#include "rwlock.hpp"
+
+namespace pipedb {
+
+/**
+ * @brief A purely in memory block repository.
+ *
+ * Keys live in an open addressing hash table indexed by Key::lookup_hash.
+ * Reads take no lock: they follow atomic pointers to immutable keys and
+ * values allocated in an arena, and return values pinned in the arena.
+ * Writers claim slots with compare and swap and only share a lock with
+ * the resize of the table.
+ *
+ * The arena is only released by erase(), overwritten and dropped values
+ * are kept until then: it's meant for scratch repositories. The arena
+ * grows up to max_bytes, then put fails with BACKEND_ERROR until the
+ * repository is erased.
+ */
+class MemRepo: public BlockRepository {
+    public:
+        MemRepo(const size_t capacity = 1 << 16, const size_t max_bytes = size_t(1) << 30) :
+        BlockRepository(),
+        isOpen(false),
+        initialCapacity(capacity),
+        maxBytes(max_bytes),
+        generation(0),
+        arena(),
+        tables(),
+        table(NULL),
+        gate() {
+            reset();
+        }
+
+        virtual ~MemRepo() {
+            close();
+        }
+
+        virtual bool opened() {
+            return isOpen;
+        }
+
+        virtual bool closed() {
+            return ! isOpen;
+        }
+
+        virtual Return close() {
+            // data stays in memory until erased
+            isOpen = false;
+            return Return::OK;
+        }
+
+        virtual Return open() {
+            if (isOpen.exchange(true) == true) {
+                return Return::NOT_SUPPORTED;
+            }
+            return Return::OK;
+        }
+
+        using BlockRepository::put;
+        using BlockRepository::drop;
+        using BlockRepository::multi_put;
+        using BlockRepository::multi_drop;
+
+        virtual Return put(const Key&& key, const InputBlock&& value) {
+            if (isOpen) {
+                const uint32_t hash = key.lookup_hash();
+                const Blob* data = arena->copy(value.get_data(), value.get_size(), hash);
+                if (data == NULL) {
+                    return Return::BACKEND_ERROR;
+                }
+                const Blob* name = NULL;
+                while (true) {
+                    gate.lock_for_read();
+                    Table* t = table.load(std::memory_order_acquire);
+                    const size_t slot = claim(*t, key, hash, name);
+                    if (slot == nospace) {
+                        gate.unlock();
+                        return Return::BACKEND_ERROR;
+                    }
+                    if (slot != npos) {
+                        t->values[slot].store(data, std::memory_order_release);
+                        const bool crowded = t->crowded();
+                        gate.unlock();
+                        if (crowded) {
+                            grow(t);
+                        }
+                        return Return::OK;
+                    }
+                    gate.unlock();
+                    grow(t);
+                }
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        virtual Return get(const Key&& key, OutputBlock& value) {
+            if (isOpen) {
+                const Blob* data = find(key);
+                if (data == NULL) {
+                    return Return::KEY_NOT_PRESENT;
+                }
+                // the arena outlives the output block
+                value.pin_data(data->bytes(), data->size, std::shared_ptr<const void>(arena));
+                return Return::OK;
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        virtual Return get(const Key&& key, OutputBlock& value, const Snapshot& snapshot) {
+            const MemSnapshot* taken = resolve(snapshot);
+            if (isOpen && taken != NULL) {
+                auto found = std::lower_bound(taken->entries.begin(), taken->entries.end(), key,
+                    [](const Entry& entry, const Key& k) {
+                        return compare(entry.first, k.get_data(), k.get_size()) < 0;
+                    });
+                if (found == taken->entries.end() || compare(found->first, key.get_data(), key.get_size()) != 0) {
+                    return Return::KEY_NOT_PRESENT;
+                }
+                value.pin_data(found->second->bytes(), found->second->size, std::shared_ptr<const void>(taken->arena));
+                return Return::OK;
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        virtual Return drop(const Key&& key) {
+            if (isOpen) {
+                const uint32_t hash = key.lookup_hash();
+                gate.lock_for_read();
+                Table* t = table.load(std::memory_order_acquire);
+                const size_t slot = lookup(*t, key, hash);
+                if (slot != npos) {
+                    t->values[slot].store(NULL, std::memory_order_release);
+                }
+                gate.unlock();
+                return Return::OK;
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        virtual bool included(const Key&& key) {
+            return isOpen && find(key) != NULL;
+        }
+
+        virtual bool excluded(const Key&& key) {
+            return isOpen && find(key) == NULL;
+        }
+
+        virtual std::vector<Return> multi_put(const std::vector<Key>& keys,
+                                              const std::vector<InputBlock>& values) {
+            std::vector<Return> states;
+            states.reserve(keys.size());
+            for (size_t i = 0; i < keys.size(); ++i) {
+                if (keys.size() == values.size()) {
+                    states.push_back(put(std::move(keys[i]), std::move(values[i])));
+                }
+                else {
+                    states.push_back(Return::NOT_SUPPORTED);
+                }
+            }
+            return states;
+        }
+
+        virtual std::vector<Return> multi_get(const std::vector<Key>& keys,
+                                              std::vector<OutputBlock>& values) {
+            values.resize(keys.size());
+            std::vector<Return> states;
+            states.reserve(keys.size());
+            for (size_t i = 0; i < keys.size(); ++i) {
+                states.push_back(get(std::move(keys[i]), values[i]));
+            }
+            return states;
+        }
+
+        virtual std::vector<Return> multi_get(const std::vector<Key>& keys,
+                                              std::vector<OutputBlock>& values, const Snapshot& snapshot) {
+            values.resize(keys.size());
+            std::vector<Return> states;
+            states.reserve(keys.size());
+            for (size_t i = 0; i < keys.size(); ++i) {
+                states.push_back(get(std::move(keys[i]), values[i], snapshot));
+            }
+            return states;
+        }
+
+        virtual std::vector<Return> multi_drop(const std::vector<Key>& keys) {
+            std::vector<Return> states;
+            states.reserve(keys.size());
+            for (const Key& key : keys) {
+                states.push_back(drop(std::move(key)));
+            }
+            return states;
+        }
+
+        virtual std::vector<bool> multi_included(const std::vector<Key>& keys) {
+            std::vector<bool> res;
+            res.reserve(keys.size());
+            for (const Key& key : keys) {
+                res.push_back(included(std::move(key)));
+            }
+            return res;
+        }
+
+        virtual std::vector<bool> multi_excluded(const std::vector<Key>& keys) {
+            std::vector<bool> res;
+            res.reserve(keys.size());
+            for (const Key& key : keys) {
+                res.push_back(excluded(std::move(key)));
+            }
+            return res;
+        }
+
+        /**
+         * @brief The entries in range are collected and sorted when the scan
+         * starts, later writes are not seen.
+         */
+        virtual std::unique_ptr<Cursor> scan(const Key&& begin, const Key&& end,
+                                             const ScanOptions& options = ScanOptions()) {
+            const MemSnapshot* taken = options.snapshot == nullptr ? NULL : resolve(*options.snapshot);
+            if (isOpen && taken != NULL) {
+                std::unique_ptr<Source> source(new Source(taken->arena));
+                for (const Entry& entry : taken->entries) {
+                    if (inRange(entry.first, begin, end)) {
+                        source->entries.push_back(entry);
+                    }
+                }
+                return std::unique_ptr<Cursor>(new Cursor(std::move(source), options));
+            }
+            else if (isOpen && options.snapshot == nullptr) {
+                std::unique_ptr<Source> source(new Source(arena));
+                source->entries = collect(begin, end);
+                return std::unique_ptr<Cursor>(new Cursor(std::move(source), options));
+            }
+            else {
+                return Cursor::failed(Return::NOT_SUPPORTED);
+            }
+        }
+
+        /**
+         * @brief Copy the sorted entries while writers are excluded, it costs
+         * as much as a full scan.
+         */
+        virtual std::unique_ptr<Snapshot> snapshot() {
+            if (isOpen) {
+                std::unique_ptr<MemSnapshot> taken(new MemSnapshot(_snapshots, this, generation, arena));
+                gate.lock_for_write();
+                taken->entries = collect(Key(NULL, 0), Key(NULL, 0));
+                gate.unlock();
+                return std::move(taken);
+            }
+            else {
+                return nullptr;
+            }
+        }
+
+        virtual Return erase() {
+            if (isOpen) {
+                return Return::NOT_SUPPORTED;
+            }
+            else {
+                reset();
+                return Return::OK;
+            }
+        }
+
+        /**
+         * @brief Bytes allocated by the arena, at most max_bytes.
+         */
+        size_t memory_usage() const {
+            return arena->bytes();
+        }
+
+    protected:
+        static constexpr size_t npos = static_cast<size_t>(-1);
+        static constexpr size_t nospace = npos - 1;
+
+        /**
+         * @brief An immutable key or value allocated in the arena.
+         */
+        struct Blob {
+            size_t size;
+            uint32_t hash;
+
+            const char* bytes() const noexcept {
+                return reinterpret_cast<const char*>(this + 1);
+            }
+
+            bool equals(const Key& key, const uint32_t h) const noexcept {
+                return hash == h && size == key.get_size()
+                    && memcmp(bytes(), key.get_data(), size) == 0;
+            }
+        };
+
+        /**
+         * @brief Bump allocator of blobs, released at once.
+         */
+        class Arena: private boost::noncopyable {
+            public:
+                Arena(const size_t max_bytes) : mutex(), blocks(), current(NULL), remaining(0),
+                limit(max_bytes), allocated(0) {
+                }
+
+                /**
+                 * @brief NULL once the blocks would exceed the limit.
+                 */
+                const Blob* copy(const char* data, const size_t size, const uint32_t hash) {
+                    char* memory = allocate(sizeof(Blob) + size);
+                    if (memory == NULL) {
+                        return NULL;
+                    }
+                    Blob* blob = reinterpret_cast<Blob*>(memory);
+                    blob->size = size;
+                    blob->hash = hash;
+                    memcpy(memory + sizeof(Blob), data, size);
+                    return blob;
+                }
+
+                size_t bytes() {
+                    std::lock_guard<std::mutex> guard(mutex);
+                    return allocated;
+                }
+
+            private:
+                static constexpr size_t blockSize = 1 << 20;
+                static constexpr size_t alignment = sizeof(void*);
+
+                char* allocate(size_t bytes) {
+                    bytes = (bytes + alignment - 1) & ~(alignment - 1);
+                    std::lock_guard<std::mutex> guard(mutex);
+                    if (bytes > blockSize / 4) {
+                        // large values get their own block
+                        if (bytes > limit - std::min(limit, allocated)) {
+                            return NULL;
+                        }
+                        allocated += bytes;
+                        blocks.emplace_back(new char[bytes]);
+                        return blocks.back().get();
+                    }
+                    if (bytes > remaining) {
+                        if (blockSize > limit - std::min(limit, allocated)) {
+                            return NULL;
+                        }
+                        allocated += blockSize;
+                        blocks.emplace_back(new char[blockSize]);
+                        current = blocks.back().get();
+                        remaining = blockSize;
+                    }
+                    char* result = current;
+                    current += bytes;
+                    remaining -= bytes;
+                    return result;
+                }
+
+                std::mutex mutex;
+                std::vector<std::unique_ptr<char[]>> blocks;
+                char* current;
+                size_t remaining;
+                const size_t limit;
+                size_t allocated; /** Bytes of the blocks */
+        };
+
+        /**
+         * @brief Open addressing table, a slot keeps its key until the table is resized.
+         */
+        struct Table: private boost::noncopyable {
+            Table(const size_t capacity) :
+            mask(capacity - 1),
+            used(0),
+            keys(new std::atomic<const Blob*>[capacity]),
+            values(new std::atomic<const Blob*>[capacity]) {
+                for (size_t i = 0; i < capacity; ++i) {
+                    keys[i].store(NULL, std::memory_order_relaxed);
+                    values[i].store(NULL, std::memory_order_relaxed);
+                }
+            }
+
+            size_t capacity() const noexcept {
+                return mask + 1;
+            }
+
+            bool crowded() const noexcept {
+                return used.load(std::memory_order_relaxed) * 4 > capacity() * 3;
+            }
+
+            const size_t mask;
+            std::atomic<size_t> used;
+            std::unique_ptr<std::atomic<const Blob*>[]> keys;
+            std::unique_ptr<std::atomic<const Blob*>[]> values;
+        };
+
+        typedef std::pair<const Blob*, const Blob*> Entry;
+
+        /**
+         * @brief Sorted entries of a scan, values pinned in the arena.
+         */
+        class Source: public Cursor::Source {
+            public:
+                Source(const std::shared_ptr<Arena>& memory) :
+                entries(),
+                arena(memory),
+                position(0) {
+                }
+
+                virtual void read(Cursor::Batch& batch, const ScanOptions& options) {
+                    for (; position < entries.size() && batch.full(options) == false; ++position) {
+                        const Entry& entry = entries[position];
+                        batch.keys.emplace_back(entry.first->bytes(), entry.first->size);
+                        batch.values.emplace_back();
+                        if (options.keys_only == false) {
+                            batch.values.back().pin_data(entry.second->bytes(), entry.second->size,
+                                                         std::shared_ptr<const void>(arena));
+                        }
+                        batch.bytes += entry.first->size + batch.values.back().get_size();
+                    }
+                    batch.last = position == entries.size();
+                }
+
+                std::vector<Entry> entries;
+
+            private:
+                std::shared_ptr<Arena> arena;
+                size_t position;
+        };
+
+        /**
+         * @brief A sorted copy of the entries of the table.
+         */
+        class MemSnapshot: public Snapshot {
+            public:
+                MemSnapshot(const std::shared_ptr<SnapshotTracker>& tracker, const MemRepo* repository,
+                            const size_t taken, const std::shared_ptr<Arena>& memory) :
+                Snapshot(tracker),
+                owner(repository),
+                generation(taken),
+                arena(memory),
+                entries() {
+                }
+
+                const MemRepo* const owner;
+                const size_t generation;
+                const std::shared_ptr<Arena> arena;
+                std::vector<Entry> entries;
+        };
+
+        /**
+         * @brief The snapshot if it was taken on this repository since the
+         * last erase, NULL otherwise.
+         */
+        const MemSnapshot* resolve(const Snapshot& snapshot) const noexcept {
+            const MemSnapshot* taken = dynamic_cast<const MemSnapshot*>(&snapshot);
+            return (taken != NULL && taken->owner == this && taken->generation == generation) ? taken : NULL;
+        }
+
+        /**
+         * @brief The live entries in [begin, end[, sorted.
+         */
+        std::vector<Entry> collect(const Key& begin, const Key& end) const {
+            std::vector<Entry> entries;
+            const Table* t = table.load(std::memory_order_acquire);
+            for (size_t i = 0; i <= t->mask; ++i) {
+                const Blob* name = t->keys[i].load(std::memory_order_acquire);
+                const Blob* data = t->values[i].load(std::memory_order_acquire);
+                if (data != NULL && inRange(name, begin, end)) {
+                    entries.emplace_back(name, data);
+                }
+            }
+            std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+                return compare(a.first, b.first->bytes(), b.first->size) < 0;
+            });
+            return entries;
+        }
+
+        static int compare(const Blob* a, const char* b, const size_t size) noexcept {
+            const int c = memcmp(a->bytes(), b, std::min(a->size, size));
+            return c != 0 ? c : (a->size < size ? -1 : (a->size > size ? 1 : 0));
+        }
+
+        static bool inRange(const Blob* name, const Key& begin, const Key& end) noexcept {
+            return compare(name, begin.get_data(), begin.get_size()) >= 0
+                && (end.get_size() == 0 || compare(name, end.get_data(), end.get_size()) < 0);
+        }
+
+        /**
+         * @brief Find the slot of a key, npos if absent.
+         */
+        static size_t lookup(const Table& t, const Key& key, const uint32_t hash) noexcept {
+            for (size_t i = 0; i <= t.mask; ++i) {
+                const size_t slot = (hash + i) & t.mask;
+                const Blob* name = t.keys[slot].load(std::memory_order_acquire);
+                if (name == NULL) {
+                    return npos;
+                }
+                if (name->equals(key, hash)) {
+                    return slot;
+                }
+            }
+            return npos;
+        }
+
+        /**
+         * @brief Find or claim the slot of a key, npos if the table is full,
+         * nospace if the arena is.
+         * name is the copy of the key in the arena, allocated on first claim.
+         */
+        size_t claim(Table& t, const Key& key, const uint32_t hash, const Blob*& name) {
+            for (size_t i = 0; i <= t.mask; ++i) {
+                const size_t slot = (hash + i) & t.mask;
+                const Blob* current = t.keys[slot].load(std::memory_order_acquire);
+                if (current == NULL) {
+                    if (name == NULL) {
+                        name = arena->copy(key.get_data(), key.get_size(), hash);
+                        if (name == NULL) {
+                            return nospace;
+                        }
+                    }
+                    if (t.keys[slot].compare_exchange_strong(current, name,
+                            std::memory_order_acq_rel, std::memory_order_acquire)) {
+                        t.used.fetch_add(1, std::memory_order_relaxed);
+                        return slot;
+                    }
+                    // lost the race, current is the winner
+                }
+                if (current->equals(key, hash)) {
+                    return slot;
+                }
+            }
+            return npos;
+        }
+
+        const Blob* find(const Key& key) const noexcept {
+            const Table* t = table.load(std::memory_order_acquire);
+            const size_t slot = lookup(*t, key, key.lookup_hash());
+            return slot == npos ? NULL : t->values[slot].load(std::memory_order_acquire);
+        }
+
+        /**
+         * @brief Replace a crowded table by a table twice as large.
+         * Old tables are kept for the readers still walking them.
+         */
+        void grow(const Table* crowded) {
+            gate.lock_for_write();
+            if (table.load(std::memory_order_relaxed) == crowded) {
+                std::unique_ptr<Table> larger(new Table(crowded->capacity() * 2));
+                for (size_t i = 0; i <= crowded->mask; ++i) {
+                    const Blob* value = crowded->values[i].load(std::memory_order_relaxed);
+                    if (value != NULL) {
+                        const Blob* name = crowded->keys[i].load(std::memory_order_relaxed);
+                        for (size_t j = 0; j <= larger->mask; ++j) {
+                            const size_t slot = (name->hash + j) & larger->mask;
+                            if (larger->keys[slot].load(std::memory_order_relaxed) == NULL) {
+                                larger->keys[slot].store(name, std::memory_order_relaxed);
+                                larger->values[slot].store(value, std::memory_order_relaxed);
+                                larger->used.fetch_add(1, std::memory_order_relaxed);
+                                break;
+                            }
+                        }
+                    }
+                }
+                table.store(larger.get(), std::memory_order_release);
+                tables.emplace_back(std::move(larger));
+            }
+            gate.unlock();
+        }
+
+        /**
+         * @brief Drop all the data.
+         */
+        void reset() {
+            size_t capacity = 1;
+            while (capacity < initialCapacity) {
+                capacity <<= 1;
+            }
+            tables.clear();
+            tables.emplace_back(new Table(capacity));
+            table.store(tables.back().get(), std::memory_order_release);
+            // pinned output blocks keep the previous arena alive
+            arena.reset(new Arena(maxBytes));
+            ++generation;
+        }
+
+    private:
+        std::atomic<bool> isOpen; /** If the repository is open */
+        const size_t initialCapacity; /** Number of slots of the first table */
+        const size_t maxBytes; /** Limit of the arena */
+        size_t generation; /** Number of resets, snapshots do not survive them */
+        std::shared_ptr<Arena> arena; /** Memory of the keys and values */
+        std::vector<std::unique_ptr<Table>> tables; /** Current and retired tables */
+        std::atomic<Table*> table; /** Current table */
+        RWLock gate; /** Shared by writers, exclusive for resize */
+};
+
+}
@@ -0,0 +1,478 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include "blockrepository.hpp"
+#include "histogram.hpp"
+
+namespace pipedb
+{
+
+/**
+ * @brief Counters of one operation of a MeteredRepo, aggregated.
+ */
+struct OperationStats
+{
+  uint64_t calls = 0;
+  uint64_t errors = 0; /** Calls failed in the backend or not supported */
+  uint64_t hits = 0; /** Keys found by get or included */
+  uint64_t misses = 0; /** Keys not found by get or included */
+  uint64_t bytes_in = 0; /** Bytes of keys and values written */
+  uint64_t bytes_out = 0; /** Bytes of values read */
+  Histogram latency; /** Latency of the calls in nanoseconds */
+};
+
+/**
+ * @brief A block repository recording the latency, the traffic and the
+ * errors of the calls to another one.
+ *
+ * Each thread records in its own slot of counters, without lock nor
+ * contention, the slots are only summed when stats() is called. Batched
+ * calls are recorded apart from the single key ones, their latency is
+ * the one of the whole batch.
+ */
+class MeteredRepo: public BlockRepository
+{
+public:
+  enum Operation
+  {
+    PUT,
+    GET,
+    DROP,
+    INCLUDED,
+    MULTI_PUT,
+    MULTI_GET,
+    MULTI_DROP,
+    MULTI_INCLUDED,
+    OPERATIONS
+  };
+
+  MeteredRepo(BlockRepository& backend) :
+      BlockRepository(), _backend(backend), _slots(new Slot[slots])
+  {
+  }
+
+  virtual ~MeteredRepo()
+  {
+  }
+
+  virtual bool opened()
+  {
+    return _backend.opened();
+  }
+
+  virtual bool closed()
+  {
+    return _backend.closed();
+  }
+
+  virtual Return open()
+  {
+    return _backend.open();
+  }
+
+  virtual Return close()
+  {
+    return _backend.close();
+  }
+
+  virtual Return erase()
+  {
+    return _backend.erase();
+  }
+
+  virtual Return put(const Key&& key, const InputBlock&& value)
+  {
+    const clock_t::time_point start = clock_t::now();
+    Return state = _backend.put(std::move(key), std::move(value));
+    Counters& c = record(PUT, start, state);
+    add(c.bytes_in, key.get_size() + value.get_size());
+    return state;
+  }
+
+  virtual Return put(const Key&& key, const InputBlock&& value, const bool sync)
+  {
+    const clock_t::time_point start = clock_t::now();
+    Return state = _backend.put(std::move(key), std::move(value), sync);
+    Counters& c = record(PUT, start, state);
+    add(c.bytes_in, key.get_size() + value.get_size());
+    return state;
+  }
+
+  virtual Return get(const Key&& key, OutputBlock& value)
+  {
+    const clock_t::time_point start = clock_t::now();
+    Return state = _backend.get(std::move(key), value);
+    recordRead(record(GET, start, state), state, value);
+    return state;
+  }
+
+  virtual Return get(const Key&& key, OutputBlock& value,
+      const Snapshot& snapshot)
+  {
+    const clock_t::time_point start = clock_t::now();
+    Return state = _backend.get(std::move(key), value, snapshot);
+    recordRead(record(GET, start, state), state, value);
+    return state;
+  }
+
+  virtual Return drop(const Key&& key)
+  {
+    const clock_t::time_point start = clock_t::now();
+    Return state = _backend.drop(std::move(key));
+    Counters& c = record(DROP, start, state);
+    add(c.bytes_in, key.get_size());
+    return state;
+  }
+
+  virtual Return drop(const Key&& key, const bool sync)
+  {
+    const clock_t::time_point start = clock_t::now();
+    Return state = _backend.drop(std::move(key), sync);
+    Counters& c = record(DROP, start, state);
+    add(c.bytes_in, key.get_size());
+    return state;
+  }
+
+  virtual bool included(const Key&& key)
+  {
+    const clock_t::time_point start = clock_t::now();
+    const bool res = _backend.included(std::move(key));
+    add(record(INCLUDED, start, Return::OK), res ? &Counters::hits : &Counters::misses);
+    return res;
+  }
+
+  virtual bool excluded(const Key&& key)
+  {
+    const clock_t::time_point start = clock_t::now();
+    const bool res = _backend.excluded(std::move(key));
+    add(record(INCLUDED, start, Return::OK), res ? &Counters::misses : &Counters::hits);
+    return res;
+  }
+
+  virtual std::vector<Return> multi_put(const std::vector<Key>& keys,
+      const std::vector<InputBlock>& values)
+  {
+    const clock_t::time_point start = clock_t::now();
+    std::vector<Return> states = _backend.multi_put(keys, values);
+    add(record(MULTI_PUT, start, states).bytes_in, size(keys, values));
+    return states;
+  }
+
+  virtual std::vector<Return> multi_put(const std::vector<Key>& keys,
+      const std::vector<InputBlock>& values, const bool sync)
+  {
+    const clock_t::time_point start = clock_t::now();
+    std::vector<Return> states = _backend.multi_put(keys, values, sync);
+    add(record(MULTI_PUT, start, states).bytes_in, size(keys, values));
+    return states;
+  }
+
+  virtual std::vector<Return> multi_get(const std::vector<Key>& keys,
+      std::vector<OutputBlock>& values)
+  {
+    const clock_t::time_point start = clock_t::now();
+    std::vector<Return> states = _backend.multi_get(keys, values);
+    recordReads(record(MULTI_GET, start, states), states, values);
+    return states;
+  }
+
+  virtual std::vector<Return> multi_get(const std::vector<Key>& keys,
+      std::vector<OutputBlock>& values, const Snapshot& snapshot)
+  {
+    const clock_t::time_point start = clock_t::now();
+    std::vector<Return> states = _backend.multi_get(keys, values, snapshot);
+    recordReads(record(MULTI_GET, start, states), states, values);
+    return states;
+  }
+
+  virtual std::vector<Return> multi_drop(const std::vector<Key>& keys)
+  {
+    const clock_t::time_point start = clock_t::now();
+    std::vector<Return> states = _backend.multi_drop(keys);
+    add(record(MULTI_DROP, start, states).bytes_in, size(keys));
+    return states;
+  }
+
+  virtual std::vector<Return> multi_drop(const std::vector<Key>& keys,
+      const bool sync)
+  {
+    const clock_t::time_point start = clock_t::now();
+    std::vector<Return> states = _backend.multi_drop(keys, sync);
+    add(record(MULTI_DROP, start, states).bytes_in, size(keys));
+    return states;
+  }
+
+  virtual std::vector<bool> multi_included(const std::vector<Key>& keys)
+  {
+    const clock_t::time_point start = clock_t::now();
+    std::vector<bool> res = _backend.multi_included(keys);
+    recordLookups(record(MULTI_INCLUDED, start, Return::OK), res, true);
+    return res;
+  }
+
+  virtual std::vector<bool> multi_excluded(const std::vector<Key>& keys)
+  {
+    const clock_t::time_point start = clock_t::now();
+    std::vector<bool> res = _backend.multi_excluded(keys);
+    recordLookups(record(MULTI_INCLUDED, start, Return::OK), res, false);
+    return res;
+  }
+
+  /**
+   * @brief Scans are not recorded.
+   */
+  virtual std::unique_ptr<Cursor> scan(const Key&& begin, const Key&& end,
+      const ScanOptions& options = ScanOptions())
+  {
+    return _backend.scan(std::move(begin), std::move(end), options);
+  }
+
+  virtual std::unique_ptr<Snapshot> snapshot()
+  {
+    return _backend.snapshot();
+  }
+
+  /**
+   * @brief Sum of the counters of all the threads for an operation.
+   *
+   * Calls running concurrently may be partially accounted for.
+   */
+  OperationStats stats(const Operation operation) const
+  {
+    OperationStats o;
+    for (size_t s = 0; s < slots; ++s)
+    {
+      const Counters& c = _slots[s].operations[operation];
+      o.calls += c.calls.load(std::memory_order_relaxed);
+      o.errors += c.errors.load(std::memory_order_relaxed);
+      o.hits += c.hits.load(std::memory_order_relaxed);
+      o.misses += c.misses.load(std::memory_order_relaxed);
+      o.bytes_in += c.bytes_in.load(std::memory_order_relaxed);
+      o.bytes_out += c.bytes_out.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < Histogram::buckets; ++i)
+      {
+        const uint64_t n = c.buckets[i].load(std::memory_order_relaxed);
+        o.latency._counts[i] += n;
+        o.latency._count += n;
+      }
+      o.latency._sum += c.nanoseconds.load(std::memory_order_relaxed);
+      o.latency._max = std::max(o.latency._max,
+          c.max.load(std::memory_order_relaxed));
+    }
+    return o;
+  }
+
+  /**
+   * @brief Set all the counters to zero.
+   */
+  void reset()
+  {
+    for (size_t s = 0; s < slots; ++s)
+    {
+      for (Counters& c : _slots[s].operations)
+      {
+        c.reset();
+      }
+    }
+  }
+
+  static constexpr size_t slots = 16;
+
+private:
+  typedef std::chrono::steady_clock clock_t;
+
+  struct Counters
+  {
+    std::atomic<uint64_t> calls;
+    std::atomic<uint64_t> errors;
+    std::atomic<uint64_t> hits;
+    std::atomic<uint64_t> misses;
+    std::atomic<uint64_t> bytes_in;
+    std::atomic<uint64_t> bytes_out;
+    std::atomic<uint64_t> nanoseconds;
+    std::atomic<uint64_t> max;
+    std::atomic<uint64_t> buckets[Histogram::buckets];
+
+    Counters()
+    {
+      reset();
+    }
+
+    void reset()
+    {
+      calls = errors = hits = misses = bytes_in = bytes_out = nanoseconds =
+          max = 0;
+      for (std::atomic<uint64_t>& b : buckets)
+      {
+        b = 0;
+      }
+    }
+  };
+
+  /**
+   * @brief The counters written by the threads mapped on the slot, padded
+   * so that two slots never share a cache line.
+   */
+  struct Slot
+  {
+    Counters operations[OPERATIONS];
+    char padding[64];
+  };
+
+  /**
+   * @brief The slot of the calling thread, threads are given slots in
+   * turn: they only share one when there are more threads than slots.
+   */
+  Slot& slot() noexcept
+  {
+    static std::atomic<size_t> next(0);
+    static thread_local const size_t index = next++ % slots;
+    return _slots[index];
+  }
+
+  static void add(std::atomic<uint64_t>& counter, const uint64_t n) noexcept
+  {
+    counter.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  static void add(Counters& c, std::atomic<uint64_t> Counters::* counter) noexcept
+  {
+    add(c.*counter, 1);
+  }
+
+  static bool failed(const Return& state) noexcept
+  {
+    return state.success() == false && state.key_was_present() == false
+        && state.key_is_present() == false;
+  }
+
+  /**
+   * @brief Bytes of keys and values written by a batch.
+   */
+  static uint64_t size(const std::vector<Key>& keys,
+      const std::vector<InputBlock>& values) noexcept
+  {
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < keys.size() && i < values.size(); ++i)
+    {
+      bytes += keys[i].get_size() + values[i].get_size();
+    }
+    return bytes;
+  }
+
+  static uint64_t size(const std::vector<Key>& keys) noexcept
+  {
+    uint64_t bytes = 0;
+    for (const Key& key : keys)
+    {
+      bytes += key.get_size();
+    }
+    return bytes;
+  }
+
+  Counters& record(const Operation operation,
+      const clock_t::time_point start, const Return& state) noexcept
+  {
+    const uint64_t elapsed = std::chrono::duration_cast<
+        std::chrono::nanoseconds>(clock_t::now() - start).count();
+    Counters& c = slot().operations[operation];
+    add(c.calls, 1);
+    add(c.nanoseconds, elapsed);
+    add(c.buckets[Histogram::bucket(elapsed)], 1);
+    uint64_t max = c.max.load(std::memory_order_relaxed);
+    while (elapsed > max
+        && !c.max.compare_exchange_weak(max, elapsed, std::memory_order_relaxed))
+    {
+    }
+    if (failed(state))
+    {
+      add(c.errors, 1);
+    }
+    return c;
+  }
+
+  Counters& record(const Operation operation,
+      const clock_t::time_point start, const std::vector<Return>& states) noexcept
+  {
+    for (const Return& s : states)
+    {
+      if (failed(s))
+      {
+        return record(operation, start, s);
+      }
+    }
+    return record(operation, start, Return::OK);
+  }
+
+  static void recordRead(Counters& c, const Return& state,
+      const OutputBlock& value) noexcept
+  {
+    if (state.success())
+    {
+      add(c.hits, 1);
+      add(c.bytes_out, value.get_size());
+    }
+    else if (state.key_was_present())
+    {
+      add(c.misses, 1);
+    }
+  }
+
+  static void recordReads(Counters& c, const std::vector<Return>& states,
+      const std::vector<OutputBlock>& values) noexcept
+  {
+    uint64_t hits = 0, misses = 0, bytes = 0;
+    for (size_t i = 0; i < states.size(); ++i)
+    {
+      if (states[i].success())
+      {
+        ++hits;
+        bytes += values[i].get_size();
+      }
+      else if (states[i].key_was_present())
+      {
+        ++misses;
+      }
+    }
+    add(c.hits, hits);
+    add(c.misses, misses);
+    add(c.bytes_out, bytes);
+  }
+
+  static void recordLookups(Counters& c, const std::vector<bool>& res,
+      const bool found) noexcept
+  {
+    const uint64_t hits = std::count(res.begin(), res.end(), found);
+    add(c.hits, hits);
+    add(c.misses, res.size() - hits);
+  }
+
+  BlockRepository& _backend;
+  std::unique_ptr<Slot[]> _slots;
+};
+
+}
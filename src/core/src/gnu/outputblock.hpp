@@ -22,6 +22,7 @@
 #include <string>
 #include <cassert>
 #include <atomic>
+#include <memory>
 
 #include <boost/utility.hpp>
 
@@ -32,6 +33,10 @@ namespace pipedb
 
 /**
  * @brief Defines the output blocks for the API.
+ *
+ * An output block either owns its data or is pinned on memory held by the
+ * backend (ie: a block cache entry). Pinned memory is released when the
+ * output block dies or its data changes.
  */
 class OutputBlock: public Chunk
 {
@@ -39,14 +44,35 @@ public:
   /**
    * @brief Create an empty output block.
    */
-  OutputBlock() = default;
+  OutputBlock() :
+      _data(), _pinned(NULL), _pinned_size(0), _owner()
+  {
+  }
 
   /**
    * @brief Move constructor for effective call from methods
    */
-  OutputBlock(const OutputBlock&& d) :
-      _data(d._data)
+  OutputBlock(OutputBlock&& d) noexcept :
+      _data(std::move(d._data)), _pinned(d._pinned), _pinned_size(
+          d._pinned_size), _owner(std::move(d._owner))
+  {
+    d.unpin();
+  }
+
+  /**
+   * @brief Move assignment to store results in place
+   */
+  OutputBlock& operator=(OutputBlock&& d) noexcept
   {
+    if (this != &d)
+    {
+      _data = std::move(d._data);
+      _pinned = d._pinned;
+      _pinned_size = d._pinned_size;
+      _owner = std::move(d._owner);
+      d.unpin();
+    }
+    return *this;
   }
 
   /**
@@ -54,7 +80,7 @@ public:
    */
   virtual size_t get_size() const noexcept
   {
-    return _data.size();
+    return pinned() ? _pinned_size : _data.size();
   }
 
   /**
@@ -62,7 +88,15 @@ public:
    */
   virtual const char* get_data() const noexcept
   {
-    return _data.data();
+    return pinned() ? _pinned : _data.data();
+  }
+
+  /**
+   * @brief Is the data referencing memory held by the backend.
+   */
+  bool pinned() const noexcept
+  {
+    return _owner != nullptr;
   }
 
   /**
@@ -70,6 +104,7 @@ public:
    */
   void set_data(const char* d, const size_t s)
   {
+    unpin();
     _data.assign(d, s);
   }
 
@@ -78,9 +113,33 @@ public:
    */
   void set_data(const std::string& s)
   {
+    unpin();
     _data.assign(s.data(), s.size());
   }
 
+  /**
+   * @brief Change internal raw data, taking the buffer of s.
+   */
+  void set_data(std::string&& s)
+  {
+    unpin();
+    _data = std::move(s);
+  }
+
+  /**
+   * @brief Reference d[0,s[ without copying it.
+   *
+   * The memory must stay valid as long as owner is alive.
+   */
+  void pin_data(const char* d, const size_t s,
+      std::shared_ptr<const void>&& owner)
+  {
+    _data.clear();
+    _pinned = d;
+    _pinned_size = s;
+    _owner = std::move(owner);
+  }
+
   /**
    * @brief Conversion to a std::string
    *
@@ -88,7 +147,7 @@ public:
    */
   std::string copy_as_string() const noexcept
   {
-    return _data;
+    return std::string(get_data(), get_size());
   }
 
   /**
@@ -96,11 +155,22 @@ public:
    */
   bool operator==(const OutputBlock& d) const noexcept
   {
-    return _data == d._data;
+    return (get_size() == d.get_size())
+        && (memcmp(get_data(), d.get_data(), get_size()) == 0);
   }
 
 private:
+  void unpin() noexcept
+  {
+    _pinned = NULL;
+    _pinned_size = 0;
+    _owner.reset();
+  }
+
   std::string _data;
+  const char* _pinned;
+  size_t _pinned_size;
+  std::shared_ptr<const void> _owner;
 };
 
 }
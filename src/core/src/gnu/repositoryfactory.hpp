@@ -0,0 +1,106 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <memory>
+#include <string>
+
+#include <boost/filesystem.hpp>
+
+#include "blockrepository.hpp"
+#include "deduprepo.hpp"
+#include "ldbrepo.hpp"
+#include "memrepo.hpp"
+#include "settings.hpp"
+#include "shardedrepo.hpp"
+
+namespace pipedb
+{
+
+/**
+ * @brief Create the block repository selected by Settings::backend_type.
+ */
+class RepositoryFactory
+{
+public:
+  /**
+   * @brief Return NULL if the backend type is unknown, if the backend
+   * needs a persistence directory and none is set, or if its settings are
+   * invalid.
+   */
+  static std::shared_ptr<BlockRepository> create(const Settings& settings)
+  {
+    const std::vector<std::string>& directories =
+        settings.get_persistence_directories();
+    switch (settings.get_backend_type())
+    {
+    case Settings::LEVELDB_BACKEND:
+      if (directories.empty())
+      {
+        return nullptr;
+      }
+      {
+        std::shared_ptr<LdbRepo> repo = std::make_shared<LdbRepo>(
+            (boost::filesystem::path(directories.front()) / "pipedb").string());
+        if (repo->set_bloom_bits_per_key(settings.get_bloom_bits_per_key()).success() == false
+            || repo->set_value_log_threshold(settings.get_value_log_threshold()).success() == false)
+        {
+          return nullptr;
+        }
+        return repo;
+      }
+    case Settings::SHARDED_BACKEND:
+      if (directories.empty())
+      {
+        return nullptr;
+      }
+      {
+        std::shared_ptr<ShardedRepo> repo = std::make_shared<ShardedRepo>(settings);
+        if (repo->set_bloom_bits_per_key(settings.get_bloom_bits_per_key()).success() == false
+            || repo->set_value_log_threshold(settings.get_value_log_threshold()).success() == false)
+        {
+          return nullptr;
+        }
+        return repo;
+      }
+    case Settings::DEDUP_BACKEND:
+      if (directories.empty())
+      {
+        return nullptr;
+      }
+      {
+        // the entries of a plain store would be read as index, content
+        // and reference count records: keep the two apart
+        std::shared_ptr<DedupRepo> repo = std::make_shared<DedupRepo>(
+            (boost::filesystem::path(directories.front()) / "pipedb-dedup").string());
+        if (repo->set_bloom_bits_per_key(settings.get_bloom_bits_per_key()).success() == false
+            || repo->set_value_log_threshold(settings.get_value_log_threshold()).success() == false)
+        {
+          return nullptr;
+        }
+        return repo;
+      }
+    case Settings::MEMORY_BACKEND:
+      return std::make_shared<MemRepo>();
+    default:
+      return nullptr;
+    }
+  }
+};
+
+}
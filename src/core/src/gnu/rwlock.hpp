@@ -19,6 +19,8 @@
 
 #include <pthread.h>
 
+#include <boost/utility.hpp>
+
 namespace pipedb
 {
 
@@ -67,4 +69,25 @@ private:
   pthread_rwlock_t _impl;
 };
 
+/**
+ * @brief Hold a RWLock in read mode until the end of the scope
+ */
+class ReadLockGuard: private boost::noncopyable
+{
+public:
+  explicit ReadLockGuard(RWLock& lock) :
+      _lock(lock)
+  {
+    _lock.lock_for_read();
+  }
+
+  ~ReadLockGuard()
+  {
+    _lock.unlock();
+  }
+
+private:
+  RWLock& _lock;
+};
+
 }
@@ -18,7 +18,9 @@
 #pragma once
 
 #include <memory>
+#include <string>
 #include <vector>
+#include <algorithm>
 
 #include <boost/utility.hpp>
 #include <boost/property_tree/ptree.hpp>
@@ -33,7 +35,32 @@ class Settings: private boost::noncopyable
 {
 public:
   typedef uint8_t backend_t;
+
+  /**
+   * @brief Block repository implementations selectable with backend_type.
+   */
+  enum Backend
+  {
+    LEVELDB_BACKEND = 0, SHARDED_BACKEND = 1, MEMORY_BACKEND = 2, DEDUP_BACKEND = 3
+  };
   
+  /**
+   * @brief Bloom filters with about 0.1% of false positives.
+   */
+  enum
+  {
+    DEFAULT_BLOOM_BITS_PER_KEY = 16
+  };
+
+  /**
+   * @brief Blocks kept in the tables, readable by the versions without
+   * value logs.
+   */
+  enum
+  {
+    DEFAULT_VALUE_LOG_THRESHOLD = 0
+  };
+
   static std::unique_ptr<Settings> create(const std::string& filename)
   {
     std::unique_ptr<Settings> o(new Settings(filename));
@@ -51,7 +78,10 @@ public:
 
       _backend_type = static_cast<backend_t>(pt.get("backend_type", 0));
       _temporary_directory = pt.get < std::string > ("temporary_directory");
+      _bloom_bits_per_key = pt.get<int>("bloom_bits_per_key", DEFAULT_BLOOM_BITS_PER_KEY);
+      _value_log_threshold = pt.get<size_t>("value_log_threshold", DEFAULT_VALUE_LOG_THRESHOLD);
 
+      _persistence_directories.clear();
       for (ptree::value_type& v : pt.get_child("persistence_directories"))
       {
         _persistence_directories.emplace_back(v.second.data());
@@ -75,12 +105,17 @@ public:
 
       pt.put("backend_type", _backend_type);
       pt.put("temporary_directory", _temporary_directory);
+      pt.put("bloom_bits_per_key", _bloom_bits_per_key);
+      pt.put("value_log_threshold", _value_log_threshold);
 
       std::sort(_persistence_directories.begin(),
           _persistence_directories.end());
+      size_t index = 0;
       for (const std::string& name : _persistence_directories)
       {
-        pt.put("persistence_directories.directory", name);
+        // ini keys shall be unique in a section
+        pt.put("persistence_directories.directory" + std::to_string(index++),
+            name);
       }
 
       write_ini(_filename, pt);
@@ -137,9 +172,59 @@ public:
     return _filename;
   }
 
+  void set_temporary_directory(const std::string& directory)
+  {
+    _temporary_directory = directory;
+  }
+
+  std::string get_temporary_directory() const
+  {
+    return _temporary_directory;
+  }
+
+  /**
+   * @brief Bits per key of the bloom filters of the leveldb tables, 0 for none.
+   */
+  void set_bloom_bits_per_key(const int bits_per_key)
+  {
+    _bloom_bits_per_key = bits_per_key;
+  }
+
+  int get_bloom_bits_per_key() const
+  {
+    return _bloom_bits_per_key;
+  }
+
+  /**
+   * @brief Size from which the blocks go to the value logs of the leveldb
+   * tables, 0 to keep them in the tables.
+   */
+  void set_value_log_threshold(const size_t bytes)
+  {
+    _value_log_threshold = bytes;
+  }
+
+  size_t get_value_log_threshold() const
+  {
+    return _value_log_threshold;
+  }
+
+  void add_persistence_directory(const std::string& directory)
+  {
+    _persistence_directories.emplace_back(directory);
+    std::sort(_persistence_directories.begin(),
+        _persistence_directories.end());
+  }
+
+  const std::vector<std::string>& get_persistence_directories() const
+  {
+    return _persistence_directories;
+  }
+
 private:
   Settings(const std::string& filename) :
-      _filename(filename)
+      _filename(filename), _bloom_bits_per_key(DEFAULT_BLOOM_BITS_PER_KEY), _value_log_threshold(
+          DEFAULT_VALUE_LOG_THRESHOLD)
   {
   }
 
@@ -155,6 +240,8 @@ private:
   backend_t _backend_type;
   std::string _temporary_directory;
   std::vector<std::string> _persistence_directories;
+  int _bloom_bits_per_key;
+  size_t _value_log_threshold;
 };
 
 }
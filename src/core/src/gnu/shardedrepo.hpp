@@ -0,0 +1,605 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <boost/filesystem.hpp>
+
+#include "blockrepository.hpp"
+#include "ldbrepo.hpp"
+#include "membershipfilter.hpp"
+#include "rwlock.hpp"
+#include "settings.hpp"
+
+namespace pipedb {
+
+/**
+ * @brief A block repository spreading the key space over several LdbRepo.
+ *
+ * Each key is routed to a shard using its lookup hash. Shards are spread
+ * over the persistence directories, each one with its own leveldb, so that
+ * reads and writes on different shards proceed independently.
+ *
+ * Writes only exclude the taking of snapshots: a snapshot sees a write
+ * (or a batch) on all its shards or on none. Each shard has its own lock,
+ * shared by the writes on the shard, that snapshot() takes exclusive on
+ * all the shards in order.
+ */
+class ShardedRepo: public BlockRepository {
+    public:
+        /**
+         * @brief Create shards_per_directory shards in each directory.
+         *
+         * An optional membership filter is shared by all the shards.
+         */
+        ShardedRepo(const std::vector<std::string>& directories, const size_t shards_per_directory = 1,
+                    const std::shared_ptr<MembershipFilter>& membership = nullptr) :
+        BlockRepository(),
+        isOpen(false),
+        shards(),
+        writes() {
+            const size_t count = directories.size() * shards_per_directory;
+            shards.reserve(count);
+            writes.reserve(count);
+            for (size_t i = 0; i < count; ++i) {
+                const boost::filesystem::path directory(directories[i % directories.size()]);
+                const boost::filesystem::path path = directory / ("shard" + std::to_string(i));
+                shards.emplace_back(new LdbRepo(path.string(), membership));
+                writes.emplace_back(new RWLock());
+            }
+        }
+
+        /**
+         * @brief Create the shards in the persistence directories of the settings.
+         *
+         * The other settings are left to the setters, which report invalid values.
+         */
+        ShardedRepo(const Settings& settings, const size_t shards_per_directory = 1,
+                    const std::shared_ptr<MembershipFilter>& membership = nullptr) :
+        ShardedRepo(settings.get_persistence_directories(), shards_per_directory, membership) {
+        }
+
+        virtual ~ShardedRepo() {
+            close();
+            shards.clear();
+        }
+
+        virtual bool opened() {
+            return isOpen;
+        }
+
+        virtual bool closed() {
+            return ! isOpen;
+        }
+
+        /**
+         * @brief Set the bloom filters size of all the shards, only while closed.
+         */
+        Return set_bloom_bits_per_key(const int bits_per_key) {
+            if (isOpen) {
+                return Return::NOT_SUPPORTED;
+            }
+            return forEachShard([bits_per_key](LdbRepo& shard) {
+                return shard.set_bloom_bits_per_key(bits_per_key);
+            });
+        }
+
+        /**
+         * @brief Set the value log threshold of all the shards, only while closed.
+         */
+        Return set_value_log_threshold(const size_t bytes) {
+            if (isOpen) {
+                return Return::NOT_SUPPORTED;
+            }
+            return forEachShard([bytes](LdbRepo& shard) {
+                return shard.set_value_log_threshold(bytes);
+            });
+        }
+
+        virtual Return close() {
+            isOpen = false;
+            return forEachShard([](LdbRepo& shard) {
+                return shard.close();
+            });
+        }
+
+        virtual Return open() {
+            if (shards.empty() || isOpen.exchange(true) == true) {
+                return Return::NOT_SUPPORTED;
+            }
+            else {
+                Return state = forEachShard([](LdbRepo& shard) {
+                    return shard.open();
+                });
+                if (state.success() == false) {
+                    close();
+                }
+                return state;
+            }
+        }
+
+        virtual Return put(const Key&& key, const InputBlock&& value) {
+            if (isOpen) {
+                const size_t s = index(key);
+                ReadLockGuard guard(*writes[s]);
+                return shards[s]->put(std::move(key), std::move(value));
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        virtual Return put(const Key&& key, const InputBlock&& value, const bool sync) {
+            if (isOpen) {
+                const size_t s = index(key);
+                ReadLockGuard guard(*writes[s]);
+                return shards[s]->put(std::move(key), std::move(value), sync);
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        virtual Return get(const Key&& key, OutputBlock& value) {
+            if (isOpen) {
+                return shard(key).get(std::move(key), value);
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        virtual Return get(const Key&& key, OutputBlock& value, const Snapshot& snapshot) {
+            const ShardedSnapshot* taken = resolve(snapshot);
+            if (isOpen && taken != NULL) {
+                return shard(key).get(std::move(key), value, *taken->parts[index(key)]);
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        virtual Return drop(const Key&& key) {
+            if (isOpen) {
+                const size_t s = index(key);
+                ReadLockGuard guard(*writes[s]);
+                return shards[s]->drop(std::move(key));
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        virtual Return drop(const Key&& key, const bool sync) {
+            if (isOpen) {
+                const size_t s = index(key);
+                ReadLockGuard guard(*writes[s]);
+                return shards[s]->drop(std::move(key), sync);
+            }
+            else {
+                return Return::NOT_SUPPORTED;
+            }
+        }
+
+        virtual bool included(const Key&& key) {
+            return isOpen && shard(key).included(std::move(key));
+        }
+
+        virtual bool excluded(const Key&& key) {
+            return isOpen && shard(key).excluded(std::move(key));
+        }
+
+        virtual std::vector<Return> multi_put(const std::vector<Key>& keys,
+                                              const std::vector<InputBlock>& values) {
+            return multiPut(keys, values, [](LdbRepo& shard, const std::vector<Key>& shardKeys,
+                                             const std::vector<InputBlock>& shardValues) {
+                return shard.multi_put(shardKeys, shardValues);
+            });
+        }
+
+        virtual std::vector<Return> multi_put(const std::vector<Key>& keys,
+                                              const std::vector<InputBlock>& values, const bool sync) {
+            return multiPut(keys, values, [sync](LdbRepo& shard, const std::vector<Key>& shardKeys,
+                                                 const std::vector<InputBlock>& shardValues) {
+                return shard.multi_put(shardKeys, shardValues, sync);
+            });
+        }
+
+        virtual std::vector<Return> multi_get(const std::vector<Key>& keys,
+                                              std::vector<OutputBlock>& values) {
+            if (isOpen) {
+                return multiRead(keys, values, NULL);
+            }
+            else {
+                values.resize(keys.size());
+                return std::vector<Return>(keys.size(), Return::NOT_SUPPORTED);
+            }
+        }
+
+        virtual std::vector<Return> multi_get(const std::vector<Key>& keys,
+                                              std::vector<OutputBlock>& values, const Snapshot& snapshot) {
+            const ShardedSnapshot* taken = resolve(snapshot);
+            if (isOpen && taken != NULL) {
+                return multiRead(keys, values, taken);
+            }
+            else {
+                values.resize(keys.size());
+                return std::vector<Return>(keys.size(), Return::NOT_SUPPORTED);
+            }
+        }
+
+        virtual std::vector<Return> multi_drop(const std::vector<Key>& keys) {
+            return multiDrop(keys, [](LdbRepo& shard, const std::vector<Key>& shardKeys) {
+                return shard.multi_drop(shardKeys);
+            });
+        }
+
+        virtual std::vector<Return> multi_drop(const std::vector<Key>& keys, const bool sync) {
+            return multiDrop(keys, [sync](LdbRepo& shard, const std::vector<Key>& shardKeys) {
+                return shard.multi_drop(shardKeys, sync);
+            });
+        }
+
+        virtual std::vector<bool> multi_included(const std::vector<Key>& keys) {
+            std::vector<bool> res;
+            res.reserve(keys.size());
+            for (const Key& key : keys) {
+                res.push_back(included(std::move(key)));
+            }
+            return res;
+        }
+
+        virtual std::vector<bool> multi_excluded(const std::vector<Key>& keys) {
+            std::vector<bool> res;
+            res.reserve(keys.size());
+            for (const Key& key : keys) {
+                res.push_back(excluded(std::move(key)));
+            }
+            return res;
+        }
+
+        /**
+         * @brief Merge the scans of all the shards in key order.
+         */
+        virtual std::unique_ptr<Cursor> scan(const Key&& begin, const Key&& end,
+                                             const ScanOptions& options = ScanOptions()) {
+            const ShardedSnapshot* taken = options.snapshot == nullptr ? NULL : resolve(*options.snapshot);
+            if (isOpen && (options.snapshot == nullptr || taken != NULL)) {
+                std::unique_ptr<Source> source(new Source());
+                ScanOptions shardOptions = options;
+                for (size_t s = 0; s < shards.size(); ++s) {
+                    if (taken != NULL) {
+                        shardOptions.snapshot = taken->parts[s].get();
+                    }
+                    source->add(shards[s]->scan(Key(begin.get_data(), begin.get_size()),
+                                                Key(end.get_data(), end.get_size()), shardOptions));
+                }
+                return std::unique_ptr<Cursor>(new Cursor(std::move(source), options));
+            }
+            else {
+                return Cursor::failed(Return::NOT_SUPPORTED);
+            }
+        }
+
+        virtual Return erase() {
+            if (isOpen) {
+                return Return::NOT_SUPPORTED;
+            }
+            else {
+                return forEachShard([](LdbRepo& shard) {
+                    return shard.erase();
+                });
+            }
+        }
+
+        /**
+         * @brief Take a snapshot of every shard while no write is running.
+         */
+        virtual std::unique_ptr<Snapshot> snapshot() {
+            if (isOpen) {
+                std::unique_ptr<ShardedSnapshot> taken(new ShardedSnapshot(_snapshots, this));
+                {
+                    ShardLocks guard(writes, std::vector<bool>(shards.size(), true), true);
+                    for (const std::unique_ptr<LdbRepo>& s : shards) {
+                        taken->parts.push_back(s->snapshot());
+                    }
+                }
+                for (const std::unique_ptr<Snapshot>& part : taken->parts) {
+                    if (part == nullptr) {
+                        return nullptr;
+                    }
+                }
+                return std::move(taken);
+            }
+            else {
+                return nullptr;
+            }
+        }
+
+        /**
+         * @brief Number of shards (leveldb instances) of this repository.
+         */
+        size_t count() const noexcept {
+            return shards.size();
+        }
+
+    protected:
+        /** Shard index and index of the key in the shard batch. */
+        typedef std::pair<size_t, size_t> Location;
+
+        /**
+         * @brief One snapshot per shard.
+         */
+        class ShardedSnapshot: public Snapshot {
+            public:
+                ShardedSnapshot(const std::shared_ptr<SnapshotTracker>& tracker, const ShardedRepo* repository) :
+                Snapshot(tracker),
+                owner(repository),
+                parts() {
+                }
+
+                const ShardedRepo* const owner;
+                std::vector<std::unique_ptr<Snapshot>> parts;
+        };
+
+        const ShardedSnapshot* resolve(const Snapshot& snapshot) const noexcept {
+            const ShardedSnapshot* taken = dynamic_cast<const ShardedSnapshot*>(&snapshot);
+            return (taken != NULL && taken->owner == this) ? taken : NULL;
+        }
+
+        std::vector<Return> multiRead(const std::vector<Key>& keys, std::vector<OutputBlock>& values,
+                                      const ShardedSnapshot* taken) {
+            values.resize(keys.size());
+            std::vector<std::vector<Key>> shardKeys(shards.size());
+            const std::vector<Location> locations = dispatch(keys, shardKeys);
+            std::vector<std::vector<OutputBlock>> shardValues(shards.size());
+            std::vector<std::vector<Return>> shardStates(shards.size());
+            for (size_t s = 0; s < shards.size(); ++s) {
+                if (shardKeys[s].empty() == false) {
+                    shardStates[s] = taken == NULL ? shards[s]->multi_get(shardKeys[s], shardValues[s])
+                        : shards[s]->multi_get(shardKeys[s], shardValues[s], *taken->parts[s]);
+                }
+            }
+            for (size_t i = 0; i < keys.size(); ++i) {
+                values[i] = std::move(shardValues[locations[i].first][locations[i].second]);
+            }
+            return gather(locations, shardStates);
+        }
+
+        /**
+         * @brief K-way merge of the cursors of the shards.
+         */
+        class Source: public Cursor::Source {
+            public:
+                Source() : cursors(), heap(), state(Return::OK) {
+                }
+
+                void add(std::unique_ptr<Cursor>&& cursor) {
+                    if (cursor->next()) {
+                        heap.push_back(cursor.get());
+                        std::push_heap(heap.begin(), heap.end(), greater);
+                    }
+                    else if (cursor->status().success() == false && state == Return::OK) {
+                        state = Return::BACKEND_ERROR;
+                    }
+                    cursors.emplace_back(std::move(cursor));
+                }
+
+                virtual void read(Cursor::Batch& batch, const ScanOptions& options) {
+                    while (state == Return::OK && heap.empty() == false && batch.full(options) == false) {
+                        std::pop_heap(heap.begin(), heap.end(), greater);
+                        Cursor* cursor = heap.back();
+                        heap.pop_back();
+                        batch.keys.push_back(cursor->key().copy_as_string());
+                        batch.values.push_back(cursor->take_value());
+                        batch.bytes += batch.keys.back().size() + batch.values.back().get_size();
+                        if (cursor->next()) {
+                            heap.push_back(cursor);
+                            std::push_heap(heap.begin(), heap.end(), greater);
+                        }
+                        else if (cursor->status().success() == false) {
+                            state = Return::BACKEND_ERROR;
+                        }
+                    }
+                    batch.state = state;
+                    batch.last = heap.empty();
+                }
+
+            private:
+                static bool greater(const Cursor* a, const Cursor* b) noexcept {
+                    const Key ka = a->key();
+                    const Key kb = b->key();
+                    const int c = memcmp(ka.get_data(), kb.get_data(), std::min(ka.get_size(), kb.get_size()));
+                    return c != 0 ? c > 0 : ka.get_size() > kb.get_size();
+                }
+
+                std::vector<std::unique_ptr<Cursor>> cursors;
+                std::vector<Cursor*> heap; /** Cursors with a current entry, smallest key on top */
+                Return::State state;
+        };
+
+        size_t index(const Key& key) const noexcept {
+            return key.lookup_hash() % shards.size();
+        }
+
+        LdbRepo& shard(const Key& key) noexcept {
+            return *shards[index(key)];
+        }
+
+        /**
+         * @brief Run operation on all shards in parallel.
+         * Return the first failure or Return::OK.
+         */
+        template<typename Operation>
+        Return forEachShard(Operation operation) {
+            std::vector<std::future<Return>> results;
+            results.reserve(shards.size());
+            for (const std::unique_ptr<LdbRepo>& s : shards) {
+                LdbRepo& shard = *s;
+                results.emplace_back(std::async(std::launch::async, [&shard, operation]() {
+                    return operation(shard);
+                }));
+            }
+            std::vector<Return> states;
+            states.reserve(shards.size());
+            for (std::future<Return>& result : results) {
+                states.push_back(result.get());
+            }
+            for (const Return& state : states) {
+                if (state.success() == false) {
+                    return state;
+                }
+            }
+            return Return::OK;
+        }
+
+        /**
+         * @brief Put one batch per shard with write, under the locks of these shards.
+         */
+        template <typename Write>
+        std::vector<Return> multiPut(const std::vector<Key>& keys,
+                                     const std::vector<InputBlock>& values, const Write& write) {
+            if (isOpen && keys.size() == values.size()) {
+                std::vector<std::vector<Key>> shardKeys(shards.size());
+                std::vector<std::vector<InputBlock>> shardValues(shards.size());
+                const std::vector<Location> locations = dispatch(keys, shardKeys);
+                for (size_t i = 0; i < keys.size(); ++i) {
+                    shardValues[locations[i].first].emplace_back(values[i].get_data(), values[i].get_size());
+                }
+                std::vector<std::vector<Return>> shardStates(shards.size());
+                ShardLocks guard(writes, touched(shardKeys), false);
+                for (size_t s = 0; s < shards.size(); ++s) {
+                    if (shardKeys[s].empty() == false) {
+                        shardStates[s] = write(*shards[s], shardKeys[s], shardValues[s]);
+                    }
+                }
+                return gather(locations, shardStates);
+            }
+            else {
+                return std::vector<Return>(keys.size(), Return::NOT_SUPPORTED);
+            }
+        }
+
+        /**
+         * @brief Drop one batch per shard with write, under the locks of these shards.
+         */
+        template <typename Write>
+        std::vector<Return> multiDrop(const std::vector<Key>& keys, const Write& write) {
+            if (isOpen) {
+                std::vector<std::vector<Key>> shardKeys(shards.size());
+                const std::vector<Location> locations = dispatch(keys, shardKeys);
+                std::vector<std::vector<Return>> shardStates(shards.size());
+                ShardLocks guard(writes, touched(shardKeys), false);
+                for (size_t s = 0; s < shards.size(); ++s) {
+                    if (shardKeys[s].empty() == false) {
+                        shardStates[s] = write(*shards[s], shardKeys[s]);
+                    }
+                }
+                return gather(locations, shardStates);
+            }
+            else {
+                return std::vector<Return>(keys.size(), Return::NOT_SUPPORTED);
+            }
+        }
+
+        /**
+         * @brief Locks of some shards, taken in index order to avoid dead
+         * locks and released at the end of the scope.
+         */
+        class ShardLocks: private boost::noncopyable {
+            public:
+                ShardLocks(const std::vector<std::unique_ptr<RWLock>>& all, const std::vector<bool>& taken,
+                           const bool exclusive) :
+                locks() {
+                    for (size_t s = 0; s < all.size(); ++s) {
+                        if (taken[s]) {
+                            if (exclusive) {
+                                all[s]->lock_for_write();
+                            }
+                            else {
+                                all[s]->lock_for_read();
+                            }
+                            locks.push_back(all[s].get());
+                        }
+                    }
+                }
+
+                ~ShardLocks() {
+                    for (RWLock* lock : locks) {
+                        lock->unlock();
+                    }
+                }
+
+            private:
+                std::vector<RWLock*> locks;
+        };
+
+        /**
+         * @brief The shards with a batch.
+         */
+        static std::vector<bool> touched(const std::vector<std::vector<Key>>& shardKeys) {
+            std::vector<bool> taken;
+            taken.reserve(shardKeys.size());
+            for (const std::vector<Key>& keys : shardKeys) {
+                taken.push_back(keys.empty() == false);
+            }
+            return taken;
+        }
+
+        /**
+         * @brief Split keys in one batch per shard.
+         */
+        std::vector<Location> dispatch(const std::vector<Key>& keys,
+                                       std::vector<std::vector<Key>>& shardKeys) {
+            std::vector<Location> locations;
+            locations.reserve(keys.size());
+            for (const Key& key : keys) {
+                const size_t s = index(key);
+                locations.emplace_back(s, shardKeys[s].size());
+                shardKeys[s].emplace_back(key.get_data(), key.get_size());
+            }
+            return locations;
+        }
+
+        /**
+         * @brief Merge the results of the shard batches in the order of the keys.
+         */
+        static std::vector<Return> gather(const std::vector<Location>& locations,
+                                          const std::vector<std::vector<Return>>& shardStates) {
+            std::vector<Return> states;
+            states.reserve(locations.size());
+            for (const Location& location : locations) {
+                states.push_back(shardStates[location.first][location.second]);
+            }
+            return states;
+        }
+
+    private:
+        std::atomic<bool> isOpen; /** If the shards are open */
+        std::vector<std::unique_ptr<LdbRepo>> shards; /** One leveldb repository per shard. */
+        std::vector<std::unique_ptr<RWLock>> writes; /** One per shard, shared by its writes, exclusive to take snapshots. */
+};
+
+}
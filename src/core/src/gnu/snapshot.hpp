@@ -0,0 +1,148 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <set>
+
+#include <boost/utility.hpp>
+
+namespace pipedb
+{
+
+/**
+ * @brief Counts the live snapshots of a repository.
+ *
+ * A snapshot pins the data it sees: old values can not be compacted away
+ * while it is alive. Long lived snapshots are reported here.
+ */
+class SnapshotTracker: private boost::noncopyable
+{
+public:
+  typedef std::chrono::steady_clock clock_t;
+
+  SnapshotTracker() :
+      _mutex(), _created(), _taken(0)
+  {
+  }
+
+  /**
+   * @brief Number of live snapshots.
+   */
+  size_t live() const
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    return _created.size();
+  }
+
+  /**
+   * @brief Number of snapshots taken since the creation of the repository.
+   */
+  size_t taken() const
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    return _taken;
+  }
+
+  /**
+   * @brief Number of live snapshots older than age.
+   */
+  size_t older_than(const clock_t::duration age) const
+  {
+    const clock_t::time_point limit = clock_t::now() - age;
+    std::lock_guard<std::mutex> guard(_mutex);
+    size_t count = 0;
+    for (auto it = _created.begin(); it != _created.end() && *it < limit; ++it)
+    {
+      ++count;
+    }
+    return count;
+  }
+
+  /**
+   * @brief Age of the oldest live snapshot, zero if there is none.
+   */
+  clock_t::duration oldest() const
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    if (_created.empty())
+    {
+      return clock_t::duration::zero();
+    }
+    return clock_t::now() - *_created.begin();
+  }
+
+private:
+  friend class Snapshot;
+  typedef std::multiset<clock_t::time_point>::iterator entry_t;
+
+  entry_t add()
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    ++_taken;
+    return _created.insert(clock_t::now());
+  }
+
+  void remove(const entry_t entry)
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    _created.erase(entry);
+  }
+
+  mutable std::mutex _mutex;
+  std::multiset<clock_t::time_point> _created;
+  size_t _taken;
+};
+
+/**
+ * @brief A consistent read only view of a repository, released when the
+ * handle dies.
+ *
+ * A snapshot is only valid with the repository that created it. It may
+ * outlive the repository being closed, reads are then not supported.
+ */
+class Snapshot: private boost::noncopyable
+{
+public:
+  virtual ~Snapshot()
+  {
+    _tracker->remove(_entry);
+  }
+
+  /**
+   * @brief Time elapsed since the snapshot was taken.
+   */
+  SnapshotTracker::clock_t::duration age() const
+  {
+    return SnapshotTracker::clock_t::now() - *_entry;
+  }
+
+protected:
+  Snapshot(const std::shared_ptr<SnapshotTracker>& tracker) :
+      _tracker(tracker), _entry(_tracker->add())
+  {
+  }
+
+private:
+  std::shared_ptr<SnapshotTracker> _tracker;
+  SnapshotTracker::entry_t _entry;
+};
+
+}
@@ -0,0 +1,117 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <string>
+
+#include "ldbrepo.hpp"
+#include "managedtask.hpp"
+
+namespace pipedb
+{
+
+/**
+ * @brief Dump in background the engine statistics of a repository to a
+ * metrics file.
+ *
+ * The file is replaced at each period, readers never see a partial dump.
+ * The repository shall outlive the reporter.
+ */
+class StatsReporter: public ManagedTask<>
+{
+public:
+  static std::unique_ptr<StatsReporter> create(LdbRepo& repository,
+      const std::string& filename, const std::chrono::milliseconds period =
+          std::chrono::milliseconds(10000))
+  {
+    std::unique_ptr<StatsReporter> o(
+        new StatsReporter(repository, filename, period));
+    return o;
+  }
+
+  /**
+   * @brief Write the statistics now, false if the repository is closed
+   * or the file can not be written.
+   */
+  bool report()
+  {
+    EngineStats stats;
+    if (_repository.stats(stats).success() == false)
+    {
+      return false;
+    }
+    const std::string temporary = _filename + ".tmp";
+    {
+      std::ofstream ofs(temporary, std::ios_base::trunc);
+      ofs << stats.to_string();
+      if (!ofs)
+      {
+        return false;
+      }
+    }
+    return ::rename(temporary.c_str(), _filename.c_str()) == 0;
+  }
+
+protected:
+  StatsReporter(LdbRepo& repository, const std::string& filename,
+      const std::chrono::milliseconds period) :
+      ManagedTask(), _repository(repository), _filename(filename), _period(
+          period)
+  {
+  }
+
+  virtual ~StatsReporter()
+  {
+    stop();
+  }
+
+  typedef typename std::unique_ptr<StatsReporter> befriended_deleter_t;
+  friend std::unique_ptr<StatsReporter>::deleter_type;
+
+  virtual void create_thread()
+  {
+    _task = std::move(std::thread([](StatsReporter& self) mutable
+    {
+      do
+      {
+        self.report();
+        // wake up often enough to stop quickly
+        std::chrono::milliseconds waited(0);
+        while (self.started() && waited < self._period)
+        {
+          const std::chrono::milliseconds step = std::min(self._period - waited,
+              std::chrono::milliseconds(100));
+          std::this_thread::sleep_for(step);
+          waited += step;
+        }
+      }while(self.started());
+    }, std::ref(*this)));
+  }
+
+private:
+  LdbRepo& _repository;
+  const std::string _filename;
+  const std::chrono::milliseconds _period;
+};
+
+}
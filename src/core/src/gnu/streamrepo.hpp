@@ -0,0 +1,527 @@
+/*
+ * PipeDB
+ *
+ * Copyright (C) 2014-2015 Jean-Manuel CABA
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+#pragma once
+
+#include <errno.h>
+#include <unistd.h>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <boost/utility.hpp>
+
+#include "blockrepository.hpp"
+
+namespace pipedb
+{
+
+/**
+ * @brief Objects of any size stored as sub blocks of a block repository.
+ *
+ * An object is written as fixed size sub blocks under keys derived from its
+ * key, then a manifest under the key itself gives its size, its sub block
+ * size and the generation of its sub blocks. Writing the manifest makes the
+ * object visible at once: an overwritten object is replaced by a new
+ * generation, the sub blocks of the old one are dropped afterwards.
+ *
+ * The commits and drops of a key are serialized, so each one drops the sub
+ * blocks of the generation it replaces, including the ones of a concurrent
+ * writer that committed first.
+ *
+ * Reads given a snapshot see a single generation even while the object is
+ * overwritten. Other reads take no snapshot: they fail with KEY_NOT_PRESENT
+ * if the generation they read is replaced before its last sub block is
+ * read. Only one sub block is held in memory at a time on both sides.
+ */
+class StreamRepo: private boost::noncopyable
+{
+public:
+  typedef std::function<bool(const char* data, const size_t size)> sink_t;
+
+  static constexpr uint64_t npos = std::numeric_limits<uint64_t>::max();
+
+  /**
+   * @brief Incremental writer of an object, the object is replaced when
+   * committed. Sub blocks written by a writer that is not committed are
+   * dropped when it dies.
+   */
+  class Writer: private boost::noncopyable
+  {
+  public:
+    ~Writer()
+    {
+      if (_committed == false)
+      {
+        flush();
+        _owner.dropChunks(_key, _generation, _chunks);
+      }
+    }
+
+    /**
+     * @brief Append data to the object.
+     */
+    Return write(const char* data, size_t size)
+    {
+      while (size > 0)
+      {
+        const size_t n = std::min(size, _owner._chunkSize - _buffer.size());
+        _buffer.append(data, n);
+        data += n;
+        size -= n;
+        if (_buffer.size() == _owner._chunkSize)
+        {
+          Return state = flush();
+          if (state.success() == false)
+          {
+            return state;
+          }
+        }
+      }
+      return Return::OK;
+    }
+
+    /**
+     * @brief Write the manifest and drop the previous version of the object.
+     */
+    Return commit()
+    {
+      Return state = flush();
+      if (state.success() == false)
+      {
+        return state;
+      }
+      std::lock_guard<std::mutex> guard(_owner.stripe(Key(_key)));
+      Manifest previous;
+      const bool replaced = _owner.readManifest(Key(_key), NULL, previous);
+      const Manifest manifest =
+        { _size, _owner._chunkSize, _generation };
+      const std::string encoded = manifest.encode();
+      Return written = _owner._repository.put(Key(_key), InputBlock(encoded));
+      if (written.success() == false)
+      {
+        return written;
+      }
+      _committed = true;
+      if (replaced)
+      {
+        _owner.dropChunks(_key, previous.generation, previous.chunks());
+      }
+      return Return::OK;
+    }
+
+  private:
+    friend class StreamRepo;
+
+    Writer(StreamRepo& owner, const Key& key) :
+        _owner(owner), _key(key.copy_as_string()), _generation(
+            owner.generation()), _buffer(), _chunks(0), _size(0), _committed(
+            false)
+    {
+      _buffer.reserve(_owner._chunkSize);
+    }
+
+    Return flush()
+    {
+      if (_buffer.empty())
+      {
+        return Return::OK;
+      }
+      const std::string name = chunkKey(_key, _generation, _chunks);
+      Return state = _owner._repository.put(Key(name), InputBlock(_buffer));
+      if (state.success())
+      {
+        ++_chunks;
+        _size += _buffer.size();
+        _buffer.clear();
+      }
+      return state;
+    }
+
+    StreamRepo& _owner;
+    const std::string _key;
+    const uint64_t _generation;
+    std::string _buffer;
+    uint64_t _chunks;
+    uint64_t _size;
+    bool _committed;
+  };
+
+  /**
+   * @brief Store objects in repository, in sub blocks of chunk_size bytes.
+   */
+  StreamRepo(BlockRepository& repository, const size_t chunk_size = 1 << 20) :
+      _repository(repository), _chunkSize(chunk_size == 0 ? 1 : chunk_size), _mutex(), _random(
+          std::random_device()())
+  {
+  }
+
+  /**
+   * @brief Start writing an object.
+   */
+  std::unique_ptr<Writer> writer(const Key&& key)
+  {
+    return std::unique_ptr<Writer>(new Writer(*this, key));
+  }
+
+  /**
+   * @brief Write the object from the buffers, in order.
+   */
+  Return put(const Key&& key, const std::vector<InputBlock>& buffers)
+  {
+    std::unique_ptr<Writer> w = writer(std::move(key));
+    for (const InputBlock& buffer : buffers)
+    {
+      Return state = w->write(buffer.get_data(), buffer.get_size());
+      if (state.success() == false)
+      {
+        return state;
+      }
+    }
+    return w->commit();
+  }
+
+  /**
+   * @brief Write the object from fd, read until its end.
+   */
+  Return put(const Key&& key, const int fd)
+  {
+    std::unique_ptr<Writer> w = writer(std::move(key));
+    std::unique_ptr<char[]> buffer(new char[_chunkSize]);
+    while (true)
+    {
+      const ssize_t n = ::read(fd, buffer.get(), _chunkSize);
+      if (n < 0 && errno == EINTR)
+      {
+        continue;
+      }
+      if (n < 0)
+      {
+        return Return::BACKEND_ERROR;
+      }
+      if (n == 0)
+      {
+        return w->commit();
+      }
+      Return state = w->write(buffer.get(), static_cast<size_t>(n));
+      if (state.success() == false)
+      {
+        return state;
+      }
+    }
+  }
+
+  /**
+   * @brief Pass the bytes [offset, offset + length[ of the object to sink,
+   * one sub block at a time. Only the sub blocks covering the range are
+   * read. Stop with Return::INTERNAL_ERROR if sink returns false.
+   */
+  Return get(const Key&& key, const sink_t& sink, const uint64_t offset = 0,
+      const uint64_t length = npos)
+  {
+    return readRange(std::move(key), sink, offset, length, NULL);
+  }
+
+  /**
+   * @brief Same as get, reading the object as of snapshot, taken on the
+   * block repository.
+   */
+  Return get(const Key&& key, const sink_t& sink, const Snapshot& snapshot,
+      const uint64_t offset = 0, const uint64_t length = npos)
+  {
+    return readRange(std::move(key), sink, offset, length, &snapshot);
+  }
+
+  /**
+   * @brief Write the bytes [offset, offset + length[ of the object to fd.
+   */
+  Return get(const Key&& key, const int fd, const uint64_t offset = 0,
+      const uint64_t length = npos)
+  {
+    return get(std::move(key), [fd](const char* data, size_t size)
+    {
+      while (size > 0)
+      {
+        const ssize_t n = ::write(fd, data, size);
+        if (n < 0 && errno == EINTR)
+        {
+          continue;
+        }
+        if (n <= 0)
+        {
+          return false;
+        }
+        data += n;
+        size -= static_cast<size_t>(n);
+      }
+      return true;
+    }, offset, length);
+  }
+
+  /**
+   * @brief Read the bytes [offset, offset + length[ of the object in value.
+   */
+  Return read(const Key&& key, const uint64_t offset, const size_t length,
+      OutputBlock& value)
+  {
+    std::string data;
+    Return state = get(std::move(key), [&data](const char* d, const size_t s)
+    {
+      data.append(d, s);
+      return true;
+    }, offset, length);
+    if (state.success())
+    {
+      value.set_data(std::move(data));
+    }
+    return state;
+  }
+
+  /**
+   * @brief Size of the object in bytes.
+   */
+  Return size(const Key&& key, uint64_t& bytes)
+  {
+    Manifest manifest;
+    if (readManifest(std::move(key), NULL, manifest) == false)
+    {
+      return Return::KEY_NOT_PRESENT;
+    }
+    bytes = manifest.size;
+    return Return::OK;
+  }
+
+  /**
+   * @brief Drop the object and its sub blocks.
+   */
+  Return drop(const Key&& key)
+  {
+    std::lock_guard<std::mutex> guard(stripe(key));
+    Manifest manifest;
+    if (readManifest(std::move(key), NULL, manifest) == false)
+    {
+      return Return::OK;
+    }
+    Return state = _repository.drop(std::move(key));
+    if (state.success())
+    {
+      dropChunks(key.copy_as_string(), manifest.generation, manifest.chunks());
+    }
+    return state;
+  }
+
+private:
+  /**
+   * @brief Pass the range to sink, as of snapshot unless it is NULL.
+   */
+  Return readRange(const Key&& key, const sink_t& sink, const uint64_t offset,
+      const uint64_t length, const Snapshot* snapshot)
+  {
+    Manifest manifest;
+    if (readManifest(std::move(key), snapshot, manifest) == false)
+    {
+      return Return::KEY_NOT_PRESENT;
+    }
+    const std::string name = key.copy_as_string();
+    const uint64_t end =
+        (length == npos || offset + length > manifest.size) ?
+            manifest.size : offset + length;
+    for (uint64_t position = offset; position < end;)
+    {
+      const uint64_t index = position / manifest.chunk_size;
+      const uint64_t start = index * manifest.chunk_size;
+      const std::string chunk = chunkKey(name, manifest.generation, index);
+      OutputBlock block;
+      Return state =
+          snapshot == NULL ?
+              _repository.get(Key(chunk), block) :
+              _repository.get(Key(chunk), block, *snapshot);
+      if (state.key_was_present() && snapshot == NULL)
+      {
+        // dropped along with its generation if the object was replaced
+        Manifest current;
+        if (readManifest(std::move(key), NULL, current) == false
+            || current.generation != manifest.generation)
+        {
+          return Return::KEY_NOT_PRESENT;
+        }
+      }
+      if (state.success() == false)
+      {
+        return state.key_was_present() ? Return::BACKEND_ERROR : state;
+      }
+      const size_t from = static_cast<size_t>(position - start);
+      const size_t to = static_cast<size_t>(
+          std::min<uint64_t>(end - start, block.get_size()));
+      if (to <= from)
+      {
+        // the sub block is shorter than the manifest says
+        return Return::BACKEND_ERROR;
+      }
+      if (sink(block.get_data() + from, to - from) == false)
+      {
+        return Return::INTERNAL_ERROR;
+      }
+      position = start + to;
+    }
+    return Return::OK;
+  }
+
+  /**
+   * @brief Value stored under the key of an object.
+   */
+  struct Manifest
+  {
+    uint64_t size;
+    uint64_t chunk_size;
+    uint64_t generation;
+
+    static constexpr uint32_t magic = 0x53424450; /** "PDBS" */
+    static constexpr size_t encoded_size = 4 + 3 * 8;
+
+    uint64_t chunks() const noexcept
+    {
+      return (size + chunk_size - 1) / chunk_size;
+    }
+
+    std::string encode() const
+    {
+      std::string out;
+      put(out, magic, 4);
+      put(out, size, 8);
+      put(out, chunk_size, 8);
+      put(out, generation, 8);
+      return out;
+    }
+
+    bool decode(const char* data, const size_t length) noexcept
+    {
+      if (length != encoded_size || get(data, 4) != magic)
+      {
+        return false;
+      }
+      size = get(data + 4, 8);
+      chunk_size = get(data + 12, 8);
+      generation = get(data + 20, 8);
+      return chunk_size != 0;
+    }
+
+    static void put(std::string& out, const uint64_t value, const size_t bytes)
+    {
+      for (size_t i = 0; i < bytes; ++i)
+      {
+        out.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+      }
+    }
+
+    static uint64_t get(const char* data, const size_t bytes) noexcept
+    {
+      uint64_t value = 0;
+      for (size_t i = 0; i < bytes; ++i)
+      {
+        value |= static_cast<uint64_t>(static_cast<unsigned char>(data[i]))
+            << (8 * i);
+      }
+      return value;
+    }
+  };
+
+  /**
+   * @brief Key of a sub block: the key of the object, a separator, then the
+   * generation and the index in big endian so sub blocks sort in order.
+   */
+  static std::string chunkKey(const std::string& key, const uint64_t generation,
+      const uint64_t index)
+  {
+    std::string name(key);
+    name.push_back('\0');
+    name.push_back('#');
+    for (int shift = 56; shift >= 0; shift -= 8)
+    {
+      name.push_back(static_cast<char>((generation >> shift) & 0xff));
+    }
+    for (int shift = 56; shift >= 0; shift -= 8)
+    {
+      name.push_back(static_cast<char>((index >> shift) & 0xff));
+    }
+    return name;
+  }
+
+  bool readManifest(const Key&& key, const Snapshot* snapshot,
+      Manifest& manifest)
+  {
+    OutputBlock value;
+    Return state =
+        snapshot == NULL ?
+            _repository.get(std::move(key), value) :
+            _repository.get(std::move(key), value, *snapshot);
+    return state.success()
+        && manifest.decode(value.get_data(), value.get_size());
+  }
+
+  void dropChunks(const std::string& key, const uint64_t generation,
+      const uint64_t count)
+  {
+    const size_t batch = 256;
+    for (uint64_t first = 0; first < count; first += batch)
+    {
+      std::vector<std::string> names;
+      std::vector<Key> keys;
+      for (uint64_t i = first; i < std::min<uint64_t>(count, first + batch); ++i)
+      {
+        names.push_back(chunkKey(key, generation, i));
+      }
+      for (const std::string& name : names)
+      {
+        keys.emplace_back(name);
+      }
+      _repository.multi_drop(keys);
+    }
+  }
+
+  /**
+   * @brief Lock serializing the commits and drops of the keys of its stripe.
+   */
+  std::mutex& stripe(const Key& key) noexcept
+  {
+    return _stripes[key.lookup_hash() % stripes];
+  }
+
+  /**
+   * @brief A fresh generation, two writers of the same key never share one.
+   */
+  uint64_t generation()
+  {
+    std::lock_guard<std::mutex> guard(_mutex);
+    return _random();
+  }
+
+  static constexpr size_t stripes = 64;
+
+  BlockRepository& _repository;
+  const size_t _chunkSize;
+  std::mutex _mutex;
+  std::mt19937_64 _random;
+  std::mutex _stripes[stripes];
+};
+
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <atomic>
+#include <future>
+#include <string>
+#include <vector>
+#include "testsuite.hpp"
+
+#include "asyncrepo.hpp"
+#include "ldbrepo.hpp"
+
+#include <leveldb/env.h>
+#include <leveldb/comparator.h>
+
+namespace pipedb_testing {
+  using namespace pipedb;
+
+  class testAsyncRepo: public TestSuite {
+  protected:
+    virtual void SetUp() {
+      // leveldb lazily allocates its singletons once per process
+      leveldb::Env::Default();
+      leveldb::BytewiseComparator();
+      TestSuite::SetUp();
+    }
+  };
+
+  TEST_F(testAsyncRepo, Basic) {
+    const std::string path("/tmp/pipedb_testasyncrepo");
+    Tools::remove_all(path);
+    {
+      ExecutorOptions options;
+      options.threads = 2;
+      options.queue_depth = 4;
+      options.read_weight = 2;
+      auto executor = Executor::create(options);
+      LdbRepo repo(path);
+      AsyncRepo async(repo, *executor);
+      EXPECT_TRUE(repo.open().success());
+
+      // not started yet
+      EXPECT_TRUE(async.async_put(Key(path), InputBlock(path)).get().not_supported());
+      executor->start();
+
+      std::vector<std::string> names;
+      for (size_t i = 0; i < 32; ++i) {
+        names.push_back("key" + std::to_string(i));
+      }
+      std::vector<std::future<Return>> puts;
+      for (const std::string& name : names) {
+        puts.push_back(async.async_put(Key(name), InputBlock(name)));
+      }
+      for (std::future<Return>& put : puts) {
+        EXPECT_TRUE(put.get().success());
+      }
+
+      std::vector<std::future<AsyncRepo::get_result_t>> gets;
+      for (const std::string& name : names) {
+        gets.push_back(async.async_get(Key(name)));
+      }
+      for (size_t i = 0; i < names.size(); ++i) {
+        AsyncRepo::get_result_t result = gets[i].get();
+        EXPECT_TRUE(result.first.success());
+        EXPECT_EQ(names[i], result.second.copy_as_string());
+      }
+
+      std::atomic<size_t> dropped(0);
+      for (const std::string& name : names) {
+        async.async_drop(Key(name), [&dropped](const Return& state) {
+            if (state.success()) {
+              ++dropped;
+            }
+          });
+      }
+      executor->stop();
+      EXPECT_EQ(names.size(), dropped.load());
+      EXPECT_TRUE(repo.excluded(Key(names[0])));
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+  }
+
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "testsuite.hpp"
+
+#include "bulkloader.hpp"
+
+#include <boost/filesystem.hpp>
+#include <leveldb/env.h>
+#include <leveldb/comparator.h>
+
+namespace pipedb_testing {
+  using namespace pipedb;
+
+  class testBulkLoader: public TestSuite {
+  protected:
+    virtual void SetUp() {
+      // leveldb lazily allocates its singletons once per process
+      leveldb::Env::Default();
+      leveldb::BytewiseComparator();
+      TestSuite::SetUp();
+    }
+
+    static size_t files(const std::string& directory) {
+      size_t count = 0;
+      boost::filesystem::directory_iterator end;
+      for (boost::filesystem::directory_iterator it(directory); it != end; ++it) {
+        ++count;
+      }
+      return count;
+    }
+  };
+
+  TEST_F(testBulkLoader, Sorted) {
+    const std::string path("/tmp/pipedb_testbulkloader_sorted");
+    const std::string temporary("/tmp/pipedb_testbulkloader_sorted_tmp");
+    Tools::remove_all(path);
+    Tools::remove_all(temporary);
+    {
+      LdbRepo repo(path);
+      EXPECT_TRUE(repo.set_value_log_threshold(32 << 10).success());
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.put(Key("a"), InputBlock(std::string("put"))).success());
+      {
+        std::unique_ptr<BulkLoader> loader = BulkLoader::create(repo, temporary, true, 1 << 20, 16 << 10);
+        for (size_t i = 0; i < 1000; ++i) {
+          char name[16];
+          snprintf(name, sizeof(name), "k%04zu", i);
+          EXPECT_TRUE(loader->add(Key(name), InputBlock(std::string(100, 'a' + i % 26))).success());
+        }
+        EXPECT_TRUE(loader->add(Key("k0999"), InputBlock(std::string("again"))).not_supported());
+        // large blocks go to the value logs, as with put
+        EXPECT_TRUE(loader->add(Key("large"), InputBlock(std::string(64 << 10, 'l'))).success());
+        EXPECT_EQ(1001U, loader->count());
+        EXPECT_TRUE(loader->finish().success());
+        EXPECT_TRUE(loader->add(Key("z"), InputBlock(std::string("late"))).not_supported());
+      }
+      EXPECT_EQ(0U, files(temporary));
+
+      // overlapping nothing, the tables went to the last level
+      EngineStats stats;
+      EXPECT_TRUE(repo.stats(stats).success());
+      EXPECT_LT(1U, stats.levels.back().files);
+      EXPECT_EQ(1U, stats.value_log_files);
+      // and did not go through the write path
+      EXPECT_GT(1000U, stats.user_bytes_written);
+
+      OutputBlock block;
+      EXPECT_TRUE(repo.get(Key("k0042"), block).success());
+      EXPECT_EQ(std::string(100, 'a' + 42 % 26), block.copy_as_string());
+      EXPECT_TRUE(repo.get(Key("a"), block).success());
+      EXPECT_EQ("put", block.copy_as_string());
+      EXPECT_TRUE(repo.get(Key("large"), block).success());
+      EXPECT_EQ(std::string(64 << 10, 'l'), block.copy_as_string());
+      block = OutputBlock();
+
+      std::unique_ptr<Cursor> cursor = repo.scan(Key(""), Key(""));
+      size_t count = 0;
+      while (cursor->next()) {
+        ++count;
+      }
+      cursor.reset();
+      EXPECT_EQ(1002U, count);
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+    Tools::remove_all(temporary);
+  }
+
+  TEST_F(testBulkLoader, Unsorted) {
+    const std::string path("/tmp/pipedb_testbulkloader_unsorted");
+    const std::string temporary("/tmp/pipedb_testbulkloader_unsorted_tmp");
+    Tools::remove_all(path);
+    Tools::remove_all(temporary);
+    {
+      std::shared_ptr<MembershipFilter> membership = MembershipFilter::create(4096);
+      LdbRepo repo(path, membership);
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.put(Key("k0007"), InputBlock(std::string("old"))).success());
+      {
+        // runs of a few kilobytes, merged by finish
+        std::unique_ptr<BulkLoader> loader = BulkLoader::create(repo, temporary, false, 8 << 10, 4 << 10);
+        for (size_t round = 0; round < 2; ++round) {
+          for (size_t i = 0; i < 500; ++i) {
+            const size_t n = (i * 7919) % 500;
+            char name[16];
+            snprintf(name, sizeof(name), "k%04zu", n);
+            const std::string value = std::string(name) + (round == 0 ? "-first" : "-second");
+            EXPECT_TRUE(loader->add(Key(name), InputBlock(value)).success());
+          }
+        }
+        EXPECT_LT(0U, files(temporary));
+        // nothing is loaded before finish
+        EXPECT_FALSE(repo.included(Key("k0001")));
+        EXPECT_TRUE(loader->finish().success());
+      }
+      EXPECT_EQ(0U, files(temporary));
+
+      // the last block added wins, and is newer than the one put
+      OutputBlock block;
+      for (size_t i = 0; i < 500; ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "k%04zu", i);
+        EXPECT_TRUE(repo.get(Key(name), block).success());
+        EXPECT_EQ(std::string(name) + "-second", block.copy_as_string());
+      }
+      block = OutputBlock();
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.get(Key("k0007"), block).success());
+      EXPECT_EQ("k0007-second", block.copy_as_string());
+      block = OutputBlock();
+      EXPECT_TRUE(repo.included(Key("k0499")));
+      EXPECT_FALSE(repo.included(Key("k0500")));
+
+      EXPECT_TRUE(repo.close().success());
+      {
+        std::unique_ptr<BulkLoader> loader = BulkLoader::create(repo, temporary);
+        EXPECT_TRUE(loader->add(Key("x"), InputBlock(std::string("x"))).success());
+        EXPECT_TRUE(loader->finish().not_supported());
+      }
+      EXPECT_EQ(0U, files(temporary));
+      EXPECT_TRUE(repo.erase().success());
+    }
+    Tools::remove_all(temporary);
+  }
+}
@@ -0,0 +1,112 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "testsuite.hpp"
+
+#include "cachedrepo.hpp"
+#include "memrepo.hpp"
+
+namespace pipedb_testing {
+  using namespace pipedb;
+
+  class testCachedRepo: public TestSuite {
+  };
+
+  TEST_F(testCachedRepo, Basic) {
+    MemRepo backend;
+    CachedRepo repo(backend, 1 << 20, 4);
+    EXPECT_TRUE(repo.open().success());
+    EXPECT_TRUE(backend.opened());
+
+    EXPECT_TRUE(repo.put(Key("key"), InputBlock("value")).success());
+    OutputBlock block;
+    EXPECT_TRUE(repo.get(Key("key"), block).success());
+    EXPECT_EQ("value", block.copy_as_string());
+    EXPECT_EQ(1U, repo.misses());
+    EXPECT_TRUE(repo.get(Key("key"), block).success());
+    EXPECT_TRUE(block.pinned());
+    EXPECT_EQ("value", block.copy_as_string());
+    EXPECT_EQ(1U, repo.hits());
+
+    // cached keys are answered by the cache
+    EXPECT_TRUE(backend.drop(Key("key")).success());
+    EXPECT_TRUE(repo.included(Key("key")));
+
+    // writes through the cache invalidate it
+    EXPECT_TRUE(repo.put(Key("key"), InputBlock("other")).success());
+    OutputBlock other;
+    EXPECT_TRUE(repo.get(Key("key"), other).success());
+    EXPECT_EQ("other", other.copy_as_string());
+    EXPECT_EQ("value", block.copy_as_string());
+    EXPECT_TRUE(repo.drop(Key("key")).success());
+    EXPECT_TRUE(repo.excluded(Key("key")));
+    EXPECT_FALSE(repo.get(Key("key"), other).key_is_present());
+
+    std::vector<std::string> names;
+    for (size_t i = 0; i < 32; ++i) {
+      names.push_back("key" + std::to_string(i));
+    }
+    std::vector<Key> keys;
+    std::vector<InputBlock> values;
+    for (const std::string& name : names) {
+      keys.emplace_back(name);
+      values.emplace_back(name);
+    }
+    for (const Return& state : repo.multi_put(keys, values)) {
+      EXPECT_TRUE(state.success());
+    }
+    EXPECT_TRUE(repo.get(Key(names[3]), other).success());
+    const uint64_t hits = repo.hits();
+    std::vector<OutputBlock> blocks;
+    std::vector<Return> states = repo.multi_get(keys, blocks);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      EXPECT_TRUE(states[i].success());
+      EXPECT_EQ(names[i], blocks[i].copy_as_string());
+    }
+    EXPECT_EQ(hits + 1, repo.hits());
+    blocks.clear();
+    for (const Return& state : repo.multi_drop(keys)) {
+      EXPECT_TRUE(state.success());
+    }
+    for (bool excluded : repo.multi_excluded(keys)) {
+      EXPECT_TRUE(excluded);
+    }
+    EXPECT_TRUE(repo.close().success());
+    EXPECT_EQ(0U, repo.usage());
+  }
+
+  TEST_F(testCachedRepo, Eviction) {
+    MemRepo backend;
+    const size_t capacity = 16 * 1024;
+    CachedRepo repo(backend, capacity, 1);
+    EXPECT_TRUE(repo.open().success());
+
+    const std::string value(1024, 'v');
+    for (size_t i = 0; i < 64; ++i) {
+      const std::string name = "key" + std::to_string(i);
+      EXPECT_TRUE(repo.put(Key(name), InputBlock(value)).success());
+      OutputBlock block;
+      EXPECT_TRUE(repo.get(Key(name), block).success());
+      EXPECT_TRUE(repo.usage() <= capacity);
+      // keep the first key referenced
+      EXPECT_TRUE(repo.get(Key("key0"), block).success());
+    }
+    EXPECT_TRUE(repo.usage() > capacity / 2);
+    const uint64_t misses = repo.misses();
+    OutputBlock block;
+    EXPECT_TRUE(repo.get(Key("key0"), block).success());
+    EXPECT_EQ(misses, repo.misses());
+    EXPECT_TRUE(repo.get(Key("key1"), block).success());
+    EXPECT_EQ(misses + 1, repo.misses());
+
+    // values larger than the budget are never cached
+    const std::string large(2 * capacity, 'l');
+    EXPECT_TRUE(repo.put(Key("large"), InputBlock(large)).success());
+    EXPECT_TRUE(repo.get(Key("large"), block).success());
+    EXPECT_EQ(large, block.copy_as_string());
+    EXPECT_TRUE(repo.usage() <= capacity);
+    EXPECT_TRUE(repo.close().success());
+  }
+
+}
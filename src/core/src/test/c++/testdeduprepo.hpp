@@ -0,0 +1,215 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "testsuite.hpp"
+
+#include "deduprepo.hpp"
+#include "repositoryfactory.hpp"
+
+#include <leveldb/env.h>
+#include <leveldb/comparator.h>
+
+namespace pipedb_testing {
+  using namespace pipedb;
+
+  class testDedupRepo: public TestSuite {
+  protected:
+    virtual void SetUp() {
+      // leveldb lazily allocates its singletons once per process
+      leveldb::Env::Default();
+      leveldb::BytewiseComparator();
+      TestSuite::SetUp();
+    }
+  };
+
+  TEST_F(testDedupRepo, Digest) {
+    EXPECT_EQ("e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+              Sha256::hex(Sha256::of("", 0)));
+    const std::string abc("abc");
+    EXPECT_EQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+              Sha256::hex(Sha256::of(abc.data(), abc.size())));
+    // two blocks of padding, fed in pieces
+    const std::string two("abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq");
+    Sha256 h;
+    h.update(two.data(), 10);
+    h.update(two.data() + 10, two.size() - 10);
+    EXPECT_EQ("248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+              Sha256::hex(h.finish()));
+  }
+
+  TEST_F(testDedupRepo, References) {
+    const std::string path("/tmp/pipedb_testdeduprepo_references");
+    Tools::remove_all(path);
+    {
+      DedupRepo repo(path);
+      const std::string data(4096, 'x');
+      const std::string other("other");
+      const std::string hash = DedupRepo::digest(InputBlock(data));
+
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_FALSE(repo.stored(hash));
+      EXPECT_TRUE(repo.link(Key("a"), hash).key_was_present());
+      EXPECT_TRUE(repo.excluded(Key("a")));
+
+      EXPECT_TRUE(repo.put(Key("a"), InputBlock(data)).success());
+      EXPECT_TRUE(repo.put(Key("b"), InputBlock(data)).success());
+      EXPECT_TRUE(repo.stored(hash));
+      EXPECT_EQ(2U, repo.references(hash));
+
+      // already stored, the value is not sent again
+      EXPECT_TRUE(repo.link(Key("c"), hash).success());
+      EXPECT_EQ(3U, repo.references(hash));
+      // putting the same value again changes nothing
+      EXPECT_TRUE(repo.put(Key("c"), InputBlock(data)).success());
+      EXPECT_EQ(3U, repo.references(hash));
+
+      OutputBlock block;
+      EXPECT_TRUE(repo.get(Key("c"), block).success());
+      EXPECT_EQ(data, block.copy_as_string());
+
+      // overwriting releases the previous value
+      EXPECT_TRUE(repo.put(Key("a"), InputBlock(other)).success());
+      EXPECT_EQ(2U, repo.references(hash));
+      EXPECT_TRUE(repo.get(Key("a"), block).success());
+      EXPECT_EQ(other, block.copy_as_string());
+
+      std::unique_ptr<Snapshot> snapshot = repo.snapshot();
+      EXPECT_TRUE(repo.drop(Key("b")).success());
+      EXPECT_TRUE(repo.drop(Key("b")).success());
+      EXPECT_TRUE(repo.stored(hash));
+      EXPECT_TRUE(repo.drop(Key("c")).success());
+      // reclaimed with its last reference
+      EXPECT_FALSE(repo.stored(hash));
+      EXPECT_EQ(0U, repo.references(hash));
+      EXPECT_FALSE(repo.get(Key("c"), block).success());
+      // still seen by the snapshot
+      EXPECT_TRUE(repo.get(Key("c"), block, *snapshot).success());
+      EXPECT_EQ(data, block.copy_as_string());
+      snapshot.reset();
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+  }
+
+  TEST_F(testDedupRepo, CorruptReferenceCount) {
+    const std::string path("/tmp/pipedb_testdeduprepo_corrupt");
+    Tools::remove_all(path);
+    {
+      DedupRepo repo(path);
+      const std::string data(4096, 'x');
+      const std::string hash = DedupRepo::digest(InputBlock(data));
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.put(Key("a"), InputBlock(data)).success());
+      EXPECT_TRUE(repo.close().success());
+      {
+        leveldb::DB* db = NULL;
+        ASSERT_TRUE(leveldb::DB::Open(leveldb::Options(), path, &db).ok());
+        EXPECT_TRUE(db->Put(leveldb::WriteOptions(), "r" + hash, "1x").ok());
+        delete db;
+      }
+
+      // reported as an error instead of throwing
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_EQ(0U, repo.references(hash));
+      EXPECT_TRUE(repo.put(Key("b"), InputBlock(data)).backend_error());
+      EXPECT_TRUE(repo.drop(Key("a")).backend_error());
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+  }
+
+  TEST_F(testDedupRepo, Factory) {
+    const std::string path("/tmp/pipedb_testdeduprepo_factory");
+    Tools::remove_all(path);
+    boost::filesystem::create_directories(path);
+    auto settings = Settings::create(path + ".ini");
+    settings->add_persistence_directory(path);
+    {
+      settings->set_backend_type(Settings::LEVELDB_BACKEND);
+      std::shared_ptr<BlockRepository> repo = RepositoryFactory::create(*settings);
+      ASSERT_TRUE(repo != nullptr);
+      EXPECT_TRUE(repo->open().success());
+      EXPECT_TRUE(repo->put(Key("key"), InputBlock("plain")).success());
+      EXPECT_TRUE(repo->close().success());
+    }
+    {
+      // a plain store is not read as a deduplicated one
+      settings->set_backend_type(Settings::DEDUP_BACKEND);
+      std::shared_ptr<BlockRepository> repo = RepositoryFactory::create(*settings);
+      ASSERT_TRUE(repo != nullptr);
+      EXPECT_TRUE(repo->open().success());
+      EXPECT_TRUE(repo->excluded(Key("key")));
+      EXPECT_TRUE(repo->put(Key("key"), InputBlock("dedup")).success());
+      EXPECT_TRUE(repo->close().success());
+      EXPECT_TRUE(repo->erase().success());
+    }
+    Tools::remove_all(path);
+    Tools::remove_all(path + ".ini");
+  }
+
+  TEST_F(testDedupRepo, BatchAndScan) {
+    const std::string path("/tmp/pipedb_testdeduprepo_batch");
+    Tools::remove_all(path);
+    {
+      DedupRepo repo(path);
+      EXPECT_TRUE(repo.open().success());
+
+      std::vector<std::string> names;
+      std::vector<std::string> data;
+      for (size_t i = 0; i < 16; ++i) {
+        names.push_back("key" + std::to_string(10 + i));
+        data.push_back("value" + std::to_string(i % 4));
+      }
+      std::vector<Key> keys;
+      std::vector<InputBlock> values;
+      for (size_t i = 0; i < names.size(); ++i) {
+        keys.emplace_back(names[i]);
+        values.emplace_back(data[i]);
+      }
+      for (const Return& state : repo.multi_put(keys, values)) {
+        EXPECT_TRUE(state.success());
+      }
+      EXPECT_EQ(4U, repo.references(DedupRepo::digest(InputBlock(data[0]))));
+
+      std::vector<OutputBlock> blocks;
+      std::vector<Return> states = repo.multi_get(keys, blocks);
+      for (size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_TRUE(states[i].success());
+        EXPECT_EQ(data[i], blocks[i].copy_as_string());
+      }
+
+      std::unique_ptr<Cursor> cursor = repo.scan(Key("key12"), Key("key20"));
+      size_t i = 2;
+      while (cursor->next()) {
+        EXPECT_EQ(names[i], cursor->key().copy_as_string());
+        EXPECT_EQ(data[i], cursor->value().copy_as_string());
+        ++i;
+      }
+      EXPECT_TRUE(cursor->status().success());
+      EXPECT_EQ(10U, i);
+
+      // a cursor left open holds no lock on the database
+      cursor = repo.scan(Key(""), Key(""));
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_FALSE(cursor->next());
+      EXPECT_TRUE(cursor->status().not_supported());
+
+      for (const Return& state : repo.multi_drop(keys)) {
+        EXPECT_TRUE(state.success());
+      }
+      for (const std::string& value : data) {
+        EXPECT_FALSE(repo.stored(DedupRepo::digest(InputBlock(value))));
+      }
+      cursor = repo.scan(Key(""), Key(""));
+      EXPECT_FALSE(cursor->next());
+      cursor.reset();
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+  }
+
+}
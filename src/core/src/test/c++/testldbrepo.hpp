@@ -0,0 +1,713 @@
+#pragma once
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "testsuite.hpp"
+
+#include "ldbrepo.hpp"
+#include "memrepo.hpp"
+#include "statsreporter.hpp"
+
+#include <leveldb/env.h>
+#include <leveldb/comparator.h>
+
+namespace pipedb_testing {
+  using namespace pipedb;
+
+  class testLdbRepo: public TestSuite {
+  protected:
+    virtual void SetUp() {
+      // leveldb lazily allocates its singletons once per process
+      leveldb::Env::Default();
+      leveldb::BytewiseComparator();
+      TestSuite::SetUp();
+    }
+  };
+
+  TEST_F(testLdbRepo, Batch) {
+    const std::string path("/tmp/pipedb_testldbrepo_batch");
+    Tools::remove_all(path);
+    {
+      LdbRepo repo(path);
+      EXPECT_TRUE(repo.open().success());
+
+      std::vector<std::string> names;
+      for (size_t i = 0; i < 16; ++i) {
+        names.push_back("key" + std::to_string(i));
+      }
+      std::vector<Key> keys;
+      std::vector<InputBlock> values;
+      for (const std::string& name : names) {
+        keys.emplace_back(name);
+        values.emplace_back(name);
+      }
+
+      for (const Return& state : repo.multi_put(keys, values)) {
+        EXPECT_TRUE(state.success());
+      }
+      for (bool included : repo.multi_included(keys)) {
+        EXPECT_TRUE(included);
+      }
+
+      std::vector<OutputBlock> blocks;
+      std::vector<Return> states = repo.multi_get(keys, blocks);
+      ASSERT_EQ(keys.size(), states.size());
+      ASSERT_EQ(keys.size(), blocks.size());
+      for (size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_TRUE(states[i].success());
+        EXPECT_EQ(names[i], blocks[i].copy_as_string());
+      }
+
+      for (const Return& state : repo.multi_drop(keys)) {
+        EXPECT_TRUE(state.success());
+      }
+      for (bool excluded : repo.multi_excluded(keys)) {
+        EXPECT_TRUE(excluded);
+      }
+      for (const Return& state : repo.multi_get(keys, blocks)) {
+        EXPECT_FALSE(state.success());
+      }
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+  }
+
+  TEST_F(testLdbRepo, PinnedGet) {
+    const std::string path("/tmp/pipedb_testldbrepo_pinned");
+    Tools::remove_all(path);
+    {
+      LdbRepo repo(path);
+      const std::string name("key");
+      const std::string data(64 << 10, 'x');
+
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.put(Key(name), InputBlock(data)).success());
+
+      // memtable values are copied once
+      OutputBlock copied;
+      EXPECT_TRUE(repo.get(Key(name), copied).success());
+      EXPECT_FALSE(copied.pinned());
+      EXPECT_EQ(data, copied.copy_as_string());
+
+      // reopening flushes the memtable in a table
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.open().success());
+
+      OutputBlock block;
+      EXPECT_TRUE(repo.get(Key(name), block).success());
+      EXPECT_TRUE(block.pinned());
+      EXPECT_EQ(data, block.copy_as_string());
+
+      const char* pinned = block.get_data();
+      OutputBlock moved(std::move(block));
+      EXPECT_TRUE(moved.pinned());
+      EXPECT_EQ(pinned, moved.get_data());
+      EXPECT_FALSE(block.pinned());
+      EXPECT_EQ(0U, block.get_size());
+
+      moved.set_data(name);
+      EXPECT_FALSE(moved.pinned());
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+  }
+
+  TEST_F(testLdbRepo, PinnedGetOutlivesClose) {
+    const std::string path("/tmp/pipedb_testldbrepo_pinned_close");
+    Tools::remove_all(path);
+    {
+      LdbRepo repo(path);
+      const std::string name("key");
+      const std::string data(64 << 10, 'x');
+
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.put(Key(name), InputBlock(data)).success());
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.open().success());
+
+      OutputBlock block;
+      EXPECT_TRUE(repo.get(Key(name), block).success());
+      EXPECT_TRUE(block.pinned());
+
+      // the pinned block holds no lock on the database
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.open().success());
+      OutputBlock again;
+      EXPECT_TRUE(repo.get(Key(name), again).success());
+      EXPECT_EQ(data, again.copy_as_string());
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+
+      // and stays readable after the files are gone
+      EXPECT_TRUE(block.pinned());
+      EXPECT_EQ(data, block.copy_as_string());
+    }
+  }
+
+  TEST_F(testLdbRepo, ValueLog) {
+    const std::string path("/tmp/pipedb_testldbrepo_valuelog");
+    Tools::remove_all(path);
+    {
+      LdbRepo repo(path);
+      const std::string first(64 << 10, 'x');
+      const std::string second(128 << 10, 'y');
+
+      EXPECT_TRUE(repo.set_value_log_threshold(32 << 10).success());
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.set_value_log_threshold(0).not_supported());
+      for (size_t i = 0; i < 8; ++i) {
+        EXPECT_TRUE(repo.put(Key("key" + std::to_string(i)), InputBlock(first)).success());
+      }
+      // reopening flushes the blocks in a value log
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.open().success());
+      EngineStats stats;
+      EXPECT_TRUE(repo.stats(stats).success());
+      EXPECT_EQ(1U, stats.value_log_files);
+      EXPECT_LT(8U * first.size(), stats.value_log_bytes);
+
+      EXPECT_TRUE(repo.put(Key("key0"), InputBlock(second)).success());
+      EXPECT_TRUE(repo.drop(Key("key1")).success());
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.open().success());
+
+      OutputBlock block;
+      EXPECT_TRUE(repo.get(Key("key0"), block).success());
+      EXPECT_EQ(second, block.copy_as_string());
+      EXPECT_FALSE(repo.get(Key("key1"), block).success());
+      EXPECT_TRUE(repo.get(Key("key7"), block).success());
+      EXPECT_EQ(first, block.copy_as_string());
+
+      std::unique_ptr<Cursor> cursor = repo.scan(Key(""), Key(""));
+      size_t count = 0;
+      while (cursor->next()) {
+        EXPECT_EQ(count == 0 ? second : first, cursor->value().copy_as_string());
+        ++count;
+      }
+      EXPECT_TRUE(cursor->status().success());
+      EXPECT_EQ(7U, count);
+      cursor.reset();
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+  }
+
+  TEST_F(testLdbRepo, Durability) {
+    const std::string path("/tmp/pipedb_testldbrepo_durability");
+    Tools::remove_all(path);
+    {
+      LdbRepo repo(path);
+      Durability durability;
+      durability.sync = true;
+      durability.max_delay = std::chrono::microseconds(2000);
+      durability.max_batch_bytes = 256 << 10;
+
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.set_durability(durability).not_supported());
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.set_durability(durability).success());
+      EXPECT_TRUE(repo.open().success());
+
+      // the synchronous writes of the threads are committed in groups
+      const size_t writers = 4;
+      const size_t count = 50;
+      std::vector<std::thread> threads;
+      for (size_t w = 0; w < writers; ++w) {
+        threads.emplace_back([&repo, w, count]() {
+          for (size_t i = 0; i < count; ++i) {
+            const std::string name = std::to_string(w) + "/" + std::to_string(i);
+            EXPECT_TRUE(repo.put(Key(name), InputBlock(name)).success());
+          }
+        });
+      }
+      for (std::thread& thread : threads) {
+        thread.join();
+      }
+
+      // durability chosen per call
+      const std::string data("data");
+      EXPECT_TRUE(repo.put(Key("buffered"), InputBlock(data), false).success());
+      EXPECT_TRUE(repo.drop(Key("0/0"), true).success());
+      const std::vector<std::string> names { "a", "b" };
+      std::vector<Key> keys;
+      std::vector<InputBlock> values;
+      for (const std::string& name : names) {
+        keys.emplace_back(name);
+        values.emplace_back(name);
+      }
+      for (const Return& state : repo.multi_put(keys, values, true)) {
+        EXPECT_TRUE(state.success());
+      }
+      for (const Return& state : repo.multi_drop(keys, false)) {
+        EXPECT_TRUE(state.success());
+      }
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.open().success());
+      {
+        OutputBlock block;
+        EXPECT_TRUE(repo.get(Key("3/49"), block).success());
+        EXPECT_EQ("3/49", block.copy_as_string());
+        EXPECT_TRUE(repo.get(Key("buffered"), block).success());
+      }
+      EXPECT_TRUE(repo.excluded(Key("0/0")));
+      EXPECT_TRUE(repo.excluded(Key("a")));
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+  }
+
+  TEST_F(testLdbRepo, BloomBitsPerKey) {
+    const std::string path("/tmp/pipedb_testldbrepo_bloombitsperkey");
+    Tools::remove_all(path);
+    {
+      LdbRepo repo(path);
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.set_bloom_bits_per_key(10).not_supported());
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.set_bloom_bits_per_key(-1).not_supported());
+      EXPECT_TRUE(repo.set_bloom_bits_per_key(10).success());
+      EXPECT_TRUE(repo.open().success());
+
+      const std::string data(1024, 'x');
+      for (size_t i = 0; i < 1000; i += 2) {
+        EXPECT_TRUE(repo.put(Key(std::to_string(i)), InputBlock(data)).success());
+      }
+      // the memtable is flushed to a table with its filter at close
+      EXPECT_TRUE(repo.close().success());
+      for (const int bits : { 10, 0 }) {
+        EXPECT_TRUE(repo.set_bloom_bits_per_key(bits).success());
+        EXPECT_TRUE(repo.open().success());
+        for (size_t i = 0; i < 1000; ++i) {
+          OutputBlock block;
+          if (i % 2 == 0) {
+            EXPECT_TRUE(repo.get(Key(std::to_string(i)), block).success());
+            EXPECT_EQ(data, block.copy_as_string());
+          }
+          else {
+            EXPECT_FALSE(repo.get(Key(std::to_string(i)), block).success());
+          }
+        }
+        EXPECT_TRUE(repo.close().success());
+      }
+      EXPECT_TRUE(repo.erase().success());
+    }
+  }
+
+  TEST_F(testLdbRepo, BlockCacheCapacity) {
+    const std::string path("/tmp/pipedb_testldbrepo_blockcachecapacity");
+    Tools::remove_all(path);
+    {
+      LdbRepo repo(path);
+      EXPECT_EQ(64u << 20, repo.block_cache_capacity());
+      EXPECT_TRUE(repo.open().success());
+
+      const std::string data(1024, 'x');
+      for (size_t i = 0; i < 1000; ++i) {
+        EXPECT_TRUE(repo.put(Key(std::to_string(i)), InputBlock(data)).success());
+      }
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.open().success());
+      // resized while open, the reads go on
+      EXPECT_TRUE(repo.set_block_cache_capacity(64 << 10).success());
+      EXPECT_EQ(64u << 10, repo.block_cache_capacity());
+      EngineStats stats;
+      EXPECT_TRUE(repo.stats(stats).success());
+      EXPECT_GE(64u << 10, stats.block_cache_bytes);
+      for (size_t i = 0; i < 1000; ++i) {
+        OutputBlock block;
+        EXPECT_TRUE(repo.get(Key(std::to_string(i)), block).success());
+        EXPECT_EQ(data, block.copy_as_string());
+      }
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+  }
+
+  TEST_F(testLdbRepo, CompactionRate) {
+    const std::string path("/tmp/pipedb_testldbrepo_compactionrate");
+    Tools::remove_all(path);
+    {
+      LdbRepo repo(path);
+      EXPECT_EQ(0, repo.compaction_rate());
+      CompactionRate rate;
+      rate.bytes_per_second = 64 << 20;
+      rate.auto_tune = true;
+      rate.min_bytes_per_second = 4 << 20;
+
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.set_compaction_rate(rate).not_supported());
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.set_compaction_rate(rate).success());
+      EXPECT_EQ(64 << 20, repo.compaction_rate());
+      EXPECT_TRUE(repo.open().success());
+
+      const std::string data(4096, 'x');
+      for (size_t i = 0; i < 1000; ++i) {
+        EXPECT_TRUE(repo.put(Key(std::to_string(i)), InputBlock(data)).success());
+      }
+      // the memtable is flushed at close, through the limiter
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.open().success());
+      {
+        OutputBlock block;
+        EXPECT_TRUE(repo.get(Key("999"), block).success());
+        EXPECT_EQ(data, block.copy_as_string());
+      }
+      EXPECT_GE(repo.compaction_rate(), 4 << 20);
+      EXPECT_LE(repo.compaction_rate(), 64 << 20);
+
+      // back to no limit
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.set_compaction_rate(CompactionRate()).success());
+      EXPECT_EQ(0, repo.compaction_rate());
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+  }
+
+  TEST_F(testLdbRepo, Membership) {
+    const std::string path("/tmp/pipedb_testldbrepo_membership");
+    Tools::remove_all(path);
+    {
+      const std::string name("key");
+      const std::string other("other");
+      const std::string data("data");
+      {
+        LdbRepo repo(path, MembershipFilter::create(1024));
+        EXPECT_TRUE(repo.open().success());
+        EXPECT_TRUE(repo.put(Key(name), InputBlock(data)).success());
+        EXPECT_TRUE(repo.close().success());
+        EXPECT_TRUE(boost::filesystem::exists(path + "/MEMBERSHIP"));
+      }
+      {
+        // a filter of another size scans the stored keys
+        auto resized = MembershipFilter::create(2048);
+        LdbRepo repo(path, resized);
+        EXPECT_TRUE(repo.open().success());
+        EXPECT_FALSE(boost::filesystem::exists(path + "/MEMBERSHIP"));
+        EXPECT_TRUE(resized->may_contain(Key(name)));
+        EXPECT_FALSE(resized->may_contain(Key(other)));
+        EXPECT_TRUE(repo.close().success());
+      }
+      {
+        // without a saved filter, as after a crash, the keys are scanned
+        auto scanned = MembershipFilter::create(1024);
+        LdbRepo repo(path, scanned);
+        EXPECT_TRUE(repo.open().success());
+        EXPECT_TRUE(repo.close().success());
+        boost::filesystem::remove(path + "/MEMBERSHIP");
+        scanned->clear();
+        EXPECT_TRUE(repo.open().success());
+        EXPECT_TRUE(scanned->may_contain(Key(name)));
+        EXPECT_TRUE(repo.close().success());
+      }
+      {
+        // the filter saved before an open without one is not loaded
+        const std::string between("between");
+        {
+          LdbRepo plain(path);
+          EXPECT_TRUE(plain.open().success());
+          EXPECT_FALSE(boost::filesystem::exists(path + "/MEMBERSHIP"));
+          EXPECT_TRUE(plain.put(Key(between), InputBlock(data)).success());
+          EXPECT_TRUE(plain.close().success());
+        }
+        auto reopened = MembershipFilter::create(1024);
+        LdbRepo repo(path, reopened);
+        EXPECT_TRUE(repo.open().success());
+        EXPECT_TRUE(repo.included(Key(between)));
+        EXPECT_TRUE(repo.close().success());
+      }
+      {
+        // a shared filter counts the keys of a repository once, however
+        // often it is reopened
+        Tools::remove_all(path + "_first");
+        Tools::remove_all(path + "_second");
+        auto shared = MembershipFilter::create(1024);
+        LdbRepo first(path + "_first", shared);
+        LdbRepo second(path + "_second", shared);
+        EXPECT_TRUE(first.open().success());
+        EXPECT_TRUE(second.open().success());
+        EXPECT_TRUE(first.put(Key(other), InputBlock(data)).success());
+        for (size_t i = 0; i < 2; ++i) {
+          EXPECT_TRUE(first.close().success());
+          EXPECT_TRUE(first.open().success());
+        }
+        EXPECT_TRUE(shared->may_contain(Key(other)));
+        EXPECT_TRUE(first.drop(Key(other)).success());
+        EXPECT_FALSE(shared->may_contain(Key(other)));
+        EXPECT_TRUE(first.close().success());
+        EXPECT_TRUE(second.close().success());
+        EXPECT_TRUE(first.erase().success());
+        EXPECT_TRUE(second.erase().success());
+      }
+
+      // the filter saved at close holds the stored keys at open
+      auto membership = MembershipFilter::create(1024);
+      LdbRepo repo(path, membership);
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(membership->may_contain(Key(name)));
+      EXPECT_FALSE(membership->may_contain(Key(other)));
+      EXPECT_TRUE(repo.included(Key(name)));
+      EXPECT_TRUE(repo.excluded(Key(other)));
+
+      EXPECT_TRUE(repo.put(Key(other), InputBlock(data)).success());
+      EXPECT_TRUE(repo.included(Key(other)));
+
+      // dropping twice removes the key once
+      EXPECT_TRUE(repo.drop(Key(other)).success());
+      EXPECT_TRUE(repo.drop(Key(other)).success());
+      EXPECT_FALSE(membership->may_contain(Key(other)));
+      EXPECT_TRUE(repo.excluded(Key(other)));
+      EXPECT_TRUE(repo.included(Key(name)));
+
+      std::vector<Key> keys;
+      keys.emplace_back(name);
+      keys.emplace_back(other);
+      for (const Return& state : repo.multi_drop(keys)) {
+        EXPECT_TRUE(state.success());
+      }
+      EXPECT_FALSE(membership->may_contain(Key(name)));
+      EXPECT_TRUE(repo.excluded(Key(name)));
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+  }
+
+  TEST_F(testLdbRepo, Scan) {
+    const std::string path("/tmp/pipedb_testldbrepo_scan");
+    Tools::remove_all(path);
+    {
+      LdbRepo repo(path);
+      EXPECT_FALSE(repo.scan(Key(""), Key(""))->next());
+      EXPECT_TRUE(repo.open().success());
+
+      std::vector<std::string> names;
+      for (size_t i = 0; i < 500; ++i) {
+        char name[16];
+        snprintf(name, sizeof(name), "a%04zu", i);
+        names.push_back(name);
+        names.push_back(std::string("b") + (name + 1));
+      }
+      for (const std::string& name : names) {
+        EXPECT_TRUE(repo.put(Key(name), InputBlock(name + name)).success());
+      }
+
+      ScanOptions options;
+      options.batch_entries = 7;
+      std::unique_ptr<Cursor> cursor = repo.scan_prefix(Key("b"), options);
+      size_t count = 0;
+      std::string previous;
+      while (cursor->next()) {
+        const std::string key = cursor->key().copy_as_string();
+        EXPECT_EQ('b', key[0]);
+        EXPECT_LT(previous, key);
+        EXPECT_EQ(key + key, cursor->value().copy_as_string());
+        previous = key;
+        ++count;
+      }
+      EXPECT_TRUE(cursor->status().success());
+      EXPECT_EQ(500U, count);
+
+      options.keys_only = true;
+      options.read_ahead = false;
+      cursor = repo.scan(Key("a0100"), Key("a0200"), options);
+      count = 0;
+      while (cursor->next()) {
+        EXPECT_EQ(0U, cursor->value().get_size());
+        ++count;
+      }
+      EXPECT_EQ(100U, count);
+
+      // stop in the middle of a scan reading ahead
+      cursor = repo.scan(Key(""), Key(""));
+      EXPECT_TRUE(cursor->next());
+      EXPECT_EQ("a0000", cursor->key().copy_as_string());
+      cursor.reset();
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+  }
+
+  TEST_F(testLdbRepo, Snapshot) {
+    const std::string path("/tmp/pipedb_testldbrepo_snapshot");
+    Tools::remove_all(path);
+    {
+      LdbRepo repo(path);
+      EXPECT_TRUE(repo.snapshot() == nullptr);
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.put(Key("manifest"), InputBlock("v1")).success());
+      EXPECT_TRUE(repo.put(Key("block"), InputBlock("v1")).success());
+
+      std::unique_ptr<Snapshot> snapshot = repo.snapshot();
+      ASSERT_TRUE(snapshot != nullptr);
+      EXPECT_EQ(1U, repo.snapshots().live());
+      EXPECT_TRUE(repo.put(Key("manifest"), InputBlock("v2")).success());
+      EXPECT_TRUE(repo.drop(Key("block")).success());
+      EXPECT_TRUE(repo.put(Key("other"), InputBlock("v2")).success());
+
+      OutputBlock block;
+      EXPECT_TRUE(repo.get(Key("manifest"), block, *snapshot).success());
+      EXPECT_EQ("v1", block.copy_as_string());
+      EXPECT_TRUE(repo.get(Key("manifest"), block).success());
+      EXPECT_EQ("v2", block.copy_as_string());
+      EXPECT_FALSE(repo.get(Key("other"), block, *snapshot).key_is_present());
+
+      const std::vector<std::string> names = { "manifest", "block" };
+      std::vector<Key> keys;
+      for (const std::string& name : names) {
+        keys.emplace_back(name);
+      }
+      std::vector<OutputBlock> blocks;
+      for (const Return& state : repo.multi_get(keys, blocks, *snapshot)) {
+        EXPECT_TRUE(state.success());
+      }
+      EXPECT_EQ("v1", blocks[1].copy_as_string());
+      blocks.clear();
+
+      ScanOptions options;
+      options.snapshot = snapshot.get();
+      std::unique_ptr<Cursor> cursor = repo.scan(Key(""), Key(""), options);
+      size_t count = 0;
+      while (cursor->next()) {
+        EXPECT_EQ("v1", cursor->value().copy_as_string());
+        ++count;
+      }
+      EXPECT_EQ(2U, count);
+      cursor.reset();
+
+      EXPECT_EQ(1U, repo.snapshots().older_than(std::chrono::seconds(0)));
+      EXPECT_EQ(0U, repo.snapshots().older_than(std::chrono::hours(1)));
+      snapshot.reset();
+      EXPECT_EQ(0U, repo.snapshots().live());
+      EXPECT_EQ(1U, repo.snapshots().taken());
+
+      // a snapshot of another repository is refused
+      MemRepo other;
+      EXPECT_TRUE(other.open().success());
+      snapshot = other.snapshot();
+      EXPECT_TRUE(repo.get(Key("manifest"), block, *snapshot).not_supported());
+      snapshot.reset();
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+  }
+
+  TEST_F(testLdbRepo, SnapshotOutlivesClose) {
+    const std::string path("/tmp/pipedb_testldbrepo_snapshot_close");
+    Tools::remove_all(path);
+    {
+      LdbRepo repo(path);
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.put(Key("key"), InputBlock("v1")).success());
+      std::unique_ptr<Snapshot> snapshot = repo.snapshot();
+      ASSERT_TRUE(snapshot != nullptr);
+
+      // the snapshot holds no lock on the database
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.open().success());
+      OutputBlock block;
+      EXPECT_TRUE(repo.get(Key("key"), block).success());
+      EXPECT_EQ("v1", block.copy_as_string());
+
+      // and reads nothing once closed
+      EXPECT_TRUE(repo.get(Key("key"), block, *snapshot).not_supported());
+      EXPECT_EQ(1U, repo.snapshots().live());
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+      snapshot.reset();
+      EXPECT_EQ(0U, repo.snapshots().live());
+    }
+  }
+
+  TEST_F(testLdbRepo, CursorOutlivesClose) {
+    const std::string path("/tmp/pipedb_testldbrepo_cursor_close");
+    Tools::remove_all(path);
+    {
+      LdbRepo repo(path);
+      EXPECT_TRUE(repo.open().success());
+      for (size_t i = 0; i < 8; ++i) {
+        EXPECT_TRUE(repo.put(Key("key" + std::to_string(i)), InputBlock("v1")).success());
+      }
+      ScanOptions options;
+      options.batch_entries = 2;
+      options.read_ahead = false;
+      std::unique_ptr<Cursor> cursor = repo.scan(Key(""), Key(""), options);
+      EXPECT_TRUE(cursor->next());
+
+      // the cursor holds no lock on the database
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.included(Key("key0")));
+
+      // and reads nothing once closed
+      EXPECT_TRUE(cursor->next());
+      EXPECT_FALSE(cursor->next());
+      EXPECT_TRUE(cursor->status().not_supported());
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+  }
+
+  TEST_F(testLdbRepo, EngineStats) {
+    const std::string path("/tmp/pipedb_testldbrepo_stats");
+    const std::string metrics("/tmp/pipedb_testldbrepo_stats.metrics");
+    Tools::remove_all(path);
+    Tools::remove_all(metrics);
+    {
+      LdbRepo repo(path);
+      EngineStats stats;
+      EXPECT_TRUE(repo.stats(stats).not_supported());
+
+      EXPECT_TRUE(repo.open().success());
+      const std::string data(1024, 'x');
+      for (size_t i = 0; i < 64; ++i) {
+        EXPECT_TRUE(repo.put(Key("key" + std::to_string(i)), InputBlock(data)).success());
+      }
+      EXPECT_TRUE(repo.stats(stats).success());
+      EXPECT_FALSE(stats.levels.empty());
+      EXPECT_LT(64U * 1024U, stats.user_bytes_written);
+      EXPECT_LT(0U, stats.memtable_bytes);
+      EXPECT_EQ(0U, stats.compaction_bytes_written());
+      EXPECT_DOUBLE_EQ(1.0, stats.write_amplification());
+
+      // reopening flushes the memtable in a table
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.put(Key("key"), InputBlock(data)).success());
+      EXPECT_TRUE(repo.stats(stats).success());
+      uint64_t files = 0;
+      for (const LevelShape& level : stats.levels) {
+        files += level.files;
+      }
+      EXPECT_EQ(1U, files);
+
+      auto reporter = StatsReporter::create(repo, metrics, std::chrono::milliseconds(50));
+      reporter->start();
+      std::this_thread::sleep_for(std::chrono::milliseconds(200));
+      reporter->stop();
+      std::ifstream ifs(metrics);
+      std::stringstream dump;
+      dump << ifs.rdbuf();
+      EXPECT_NE(std::string::npos, dump.str().find("level0.files "));
+      EXPECT_NE(std::string::npos, dump.str().find("write_amplification "));
+      reporter.reset();
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+      Tools::remove_all(metrics);
+    }
+  }
+
+}
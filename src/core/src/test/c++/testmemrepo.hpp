@@ -0,0 +1,208 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <vector>
+#include "testsuite.hpp"
+
+#include "memrepo.hpp"
+#include "repositoryfactory.hpp"
+
+namespace pipedb_testing {
+  using namespace pipedb;
+
+  class testMemRepo: public TestSuite {
+  };
+
+  TEST_F(testMemRepo, Basic) {
+    MemRepo repo(4);
+    EXPECT_FALSE(repo.put(Key("key"), InputBlock("value")).success());
+    EXPECT_TRUE(repo.open().success());
+    EXPECT_TRUE(repo.opened());
+
+    OutputBlock block;
+    EXPECT_TRUE(repo.get(Key("key"), block).key_is_present() == false);
+    EXPECT_TRUE(repo.put(Key("key"), InputBlock("value")).success());
+    EXPECT_TRUE(repo.included(Key("key")));
+    EXPECT_TRUE(repo.get(Key("key"), block).success());
+    EXPECT_TRUE(block.pinned());
+    EXPECT_EQ("value", block.copy_as_string());
+
+    // overwritten values stay readable by the blocks pinning them
+    EXPECT_TRUE(repo.put(Key("key"), InputBlock("other")).success());
+    EXPECT_EQ("value", block.copy_as_string());
+    OutputBlock other;
+    EXPECT_TRUE(repo.get(Key("key"), other).success());
+    EXPECT_EQ("other", other.copy_as_string());
+
+    EXPECT_TRUE(repo.drop(Key("key")).success());
+    EXPECT_TRUE(repo.excluded(Key("key")));
+    EXPECT_TRUE(repo.put(Key("key"), InputBlock("again")).success());
+    EXPECT_TRUE(repo.get(Key("key"), other).success());
+    EXPECT_EQ("again", other.copy_as_string());
+
+    EXPECT_TRUE(repo.close().success());
+    EXPECT_TRUE(repo.erase().success());
+    EXPECT_EQ("value", block.copy_as_string());
+    EXPECT_TRUE(repo.open().success());
+    EXPECT_TRUE(repo.excluded(Key("key")));
+    EXPECT_TRUE(repo.close().success());
+  }
+
+  TEST_F(testMemRepo, MaxBytes) {
+    MemRepo repo(4, 4 << 20);
+    EXPECT_TRUE(repo.open().success());
+    const std::string value(1 << 20, 'v');
+
+    // overwritten values still take room until erased
+    size_t written = 0;
+    while (repo.put(Key("key"), InputBlock(value)).success()) {
+      ++written;
+    }
+    EXPECT_LE(2U, written);
+    EXPECT_GT(4U, written);
+    EXPECT_GE(size_t(4 << 20), repo.memory_usage());
+    EXPECT_TRUE(repo.put(Key("key"), InputBlock(value)).backend_error());
+    OutputBlock block;
+    EXPECT_TRUE(repo.get(Key("key"), block).success());
+    EXPECT_EQ(value, block.copy_as_string());
+
+    EXPECT_TRUE(repo.close().success());
+    EXPECT_TRUE(repo.erase().success());
+    EXPECT_EQ(0U, repo.memory_usage());
+    EXPECT_TRUE(repo.open().success());
+    EXPECT_TRUE(repo.put(Key("key"), InputBlock(value)).success());
+    EXPECT_TRUE(repo.close().success());
+  }
+
+  TEST_F(testMemRepo, Concurrent) {
+    MemRepo repo(4);
+    EXPECT_TRUE(repo.open().success());
+
+    const size_t writers = 4;
+    const size_t count = 2000;
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < writers; ++w) {
+      threads.emplace_back([&repo, w, count]() {
+        for (size_t i = 0; i < count; ++i) {
+          const std::string name = std::to_string(w) + "/" + std::to_string(i);
+          EXPECT_TRUE(repo.put(Key(name), InputBlock(name)).success());
+          OutputBlock block;
+          EXPECT_TRUE(repo.get(Key(name), block).success());
+          EXPECT_EQ(name, block.copy_as_string());
+        }
+      });
+    }
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+
+    std::vector<std::string> names;
+    for (size_t w = 0; w < writers; ++w) {
+      for (size_t i = 0; i < count; i += 97) {
+        names.push_back(std::to_string(w) + "/" + std::to_string(i));
+      }
+    }
+    std::vector<Key> keys;
+    for (const std::string& name : names) {
+      keys.emplace_back(name);
+    }
+    std::vector<OutputBlock> blocks;
+    std::vector<Return> states = repo.multi_get(keys, blocks);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      EXPECT_TRUE(states[i].success());
+      EXPECT_EQ(names[i], blocks[i].copy_as_string());
+    }
+    for (const Return& state : repo.multi_drop(keys)) {
+      EXPECT_TRUE(state.success());
+    }
+    for (bool excluded : repo.multi_excluded(keys)) {
+      EXPECT_TRUE(excluded);
+    }
+    EXPECT_TRUE(repo.close().success());
+  }
+
+  TEST_F(testMemRepo, Scan) {
+    MemRepo repo;
+    EXPECT_TRUE(repo.open().success());
+    for (size_t i = 0; i < 100; ++i) {
+      const std::string name = "key" + std::to_string(i);
+      EXPECT_TRUE(repo.put(Key(name), InputBlock(name)).success());
+    }
+    EXPECT_TRUE(repo.put(Key("other"), InputBlock("other")).success());
+    EXPECT_TRUE(repo.drop(Key("key5")).success());
+
+    std::unique_ptr<Cursor> cursor = repo.scan_prefix(Key("key"));
+    std::string previous;
+    size_t count = 0;
+    while (cursor->next()) {
+      const std::string key = cursor->key().copy_as_string();
+      EXPECT_LT(previous, key);
+      EXPECT_TRUE(cursor->value().pinned());
+      EXPECT_EQ(key, cursor->value().copy_as_string());
+      previous = key;
+      ++count;
+    }
+    EXPECT_TRUE(cursor->status().success());
+    EXPECT_EQ(99U, count);
+
+    cursor = repo.scan(Key("key9"), Key(""));
+    count = 0;
+    while (cursor->next()) {
+      ++count;
+    }
+    EXPECT_EQ(12U, count);
+    cursor.reset();
+    EXPECT_TRUE(repo.close().success());
+  }
+
+  TEST_F(testMemRepo, Snapshot) {
+    MemRepo repo;
+    EXPECT_TRUE(repo.open().success());
+    EXPECT_TRUE(repo.put(Key("a"), InputBlock("v1")).success());
+    EXPECT_TRUE(repo.put(Key("b"), InputBlock("v1")).success());
+    std::unique_ptr<Snapshot> snapshot = repo.snapshot();
+    EXPECT_TRUE(repo.put(Key("a"), InputBlock("v2")).success());
+    EXPECT_TRUE(repo.drop(Key("b")).success());
+
+    OutputBlock block;
+    EXPECT_TRUE(repo.get(Key("a"), block, *snapshot).success());
+    EXPECT_EQ("v1", block.copy_as_string());
+    EXPECT_TRUE(repo.get(Key("b"), block, *snapshot).success());
+    EXPECT_FALSE(repo.get(Key("c"), block, *snapshot).key_is_present());
+
+    ScanOptions options;
+    options.snapshot = snapshot.get();
+    std::unique_ptr<Cursor> cursor = repo.scan_prefix(Key(""), options);
+    size_t count = 0;
+    while (cursor->next()) {
+      ++count;
+    }
+    EXPECT_EQ(2U, count);
+    cursor.reset();
+
+    // snapshots do not survive erase
+    EXPECT_TRUE(repo.close().success());
+    EXPECT_TRUE(repo.erase().success());
+    EXPECT_TRUE(repo.open().success());
+    EXPECT_TRUE(repo.get(Key("a"), block, *snapshot).not_supported());
+    snapshot.reset();
+    EXPECT_TRUE(repo.close().success());
+  }
+
+  TEST_F(testMemRepo, Factory) {
+    auto settings = Settings::create("/tmp/pipedb_testmemrepo.ini");
+    settings->set_backend_type(Settings::MEMORY_BACKEND);
+    {
+      std::shared_ptr<BlockRepository> repo = RepositoryFactory::create(*settings);
+      ASSERT_TRUE(repo != nullptr);
+      EXPECT_TRUE(repo->open().success());
+      EXPECT_TRUE(repo->put(Key("key"), InputBlock("value")).success());
+      EXPECT_TRUE(repo->included(Key("key")));
+      EXPECT_TRUE(repo->close().success());
+    }
+    settings->set_backend_type(Settings::LEVELDB_BACKEND);
+    EXPECT_TRUE(RepositoryFactory::create(*settings) == nullptr);
+  }
+
+}
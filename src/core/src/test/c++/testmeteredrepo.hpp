@@ -0,0 +1,127 @@
+#pragma once
+
+#include <string>
+#include <thread>
+#include <vector>
+#include "testsuite.hpp"
+
+#include "memrepo.hpp"
+#include "meteredrepo.hpp"
+
+namespace pipedb_testing {
+  using namespace pipedb;
+
+  class testMeteredRepo: public TestSuite {
+  };
+
+  TEST_F(testMeteredRepo, Histogram) {
+    for (uint64_t v : {0ULL, 15ULL, 16ULL, 17ULL, 100ULL, 4096ULL, 123456789ULL}) {
+      const size_t b = Histogram::bucket(v);
+      EXPECT_LE(Histogram::lower(b), v);
+      EXPECT_LT(v, Histogram::upper(b));
+    }
+    EXPECT_EQ(Histogram::buckets - 1, Histogram::bucket(1ULL << 62));
+
+    Histogram h;
+    for (uint64_t v = 1; v <= 1000; ++v) {
+      h.add(v * 1000);
+    }
+    EXPECT_EQ(1000U, h.count());
+    EXPECT_EQ(1000000U, h.max());
+    EXPECT_NEAR(500500.0, h.mean(), 1);
+    // within the 25% resolution of the buckets
+    EXPECT_NEAR(500000.0, h.p50(), 125000);
+    EXPECT_NEAR(990000.0, h.p99(), 250000);
+    EXPECT_LE(h.p999(), 1000000.0);
+  }
+
+  TEST_F(testMeteredRepo, Counters) {
+    MemRepo backend;
+    MeteredRepo repo(backend);
+    EXPECT_TRUE(repo.open().success());
+
+    const std::string data("value");
+    EXPECT_TRUE(repo.put(Key("key"), InputBlock(data)).success());
+    OutputBlock block;
+    EXPECT_TRUE(repo.get(Key("key"), block).success());
+    EXPECT_FALSE(repo.get(Key("other"), block).success());
+    EXPECT_TRUE(repo.included(Key("key")));
+    EXPECT_TRUE(repo.excluded(Key("other")));
+
+    OperationStats put = repo.stats(MeteredRepo::PUT);
+    EXPECT_EQ(1U, put.calls);
+    EXPECT_EQ(0U, put.errors);
+    EXPECT_EQ(3U + data.size(), put.bytes_in);
+    EXPECT_EQ(1U, put.latency.count());
+
+    OperationStats get = repo.stats(MeteredRepo::GET);
+    EXPECT_EQ(2U, get.calls);
+    EXPECT_EQ(1U, get.hits);
+    EXPECT_EQ(1U, get.misses);
+    EXPECT_EQ(data.size(), get.bytes_out);
+
+    OperationStats included = repo.stats(MeteredRepo::INCLUDED);
+    EXPECT_EQ(2U, included.calls);
+    EXPECT_EQ(1U, included.hits);
+    EXPECT_EQ(1U, included.misses);
+
+    // counted once per thread slot, summed on demand
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; ++t) {
+      threads.emplace_back([&repo]() {
+        OutputBlock b;
+        for (size_t i = 0; i < 100; ++i) {
+          repo.get(Key("key"), b);
+        }
+      });
+    }
+    for (std::thread& t : threads) {
+      t.join();
+    }
+    EXPECT_EQ(402U, repo.stats(MeteredRepo::GET).calls);
+    EXPECT_EQ(402U, repo.stats(MeteredRepo::GET).latency.count());
+
+    EXPECT_TRUE(repo.close().success());
+    EXPECT_FALSE(repo.put(Key("key"), InputBlock(data)).success());
+    EXPECT_EQ(1U, repo.stats(MeteredRepo::PUT).errors);
+
+    repo.reset();
+    EXPECT_EQ(0U, repo.stats(MeteredRepo::PUT).calls);
+  }
+
+  TEST_F(testMeteredRepo, SyncWrites) {
+    MemRepo backend;
+    MeteredRepo metered(backend);
+    BlockRepository& repo = metered;
+    EXPECT_TRUE(repo.open().success());
+
+    // the memory backend ignores sync, the calls are still recorded
+    const std::vector<std::string> names { "a", "b" };
+    std::vector<Key> keys;
+    std::vector<InputBlock> values;
+    for (const std::string& name : names) {
+      keys.emplace_back(name);
+      values.emplace_back(name);
+    }
+    EXPECT_TRUE(repo.put(Key("key"), InputBlock("value"), true).success());
+    for (const Return& state : repo.multi_put(keys, values, true)) {
+      EXPECT_TRUE(state.success());
+    }
+    EXPECT_TRUE(repo.included(Key("a")));
+    EXPECT_TRUE(repo.drop(Key("key"), true).success());
+    for (const Return& state : repo.multi_drop(keys, false)) {
+      EXPECT_TRUE(state.success());
+    }
+    EXPECT_TRUE(repo.excluded(Key("a")));
+
+    EXPECT_EQ(1U, metered.stats(MeteredRepo::PUT).calls);
+    EXPECT_EQ(8U, metered.stats(MeteredRepo::PUT).bytes_in);
+    EXPECT_EQ(1U, metered.stats(MeteredRepo::MULTI_PUT).calls);
+    EXPECT_EQ(4U, metered.stats(MeteredRepo::MULTI_PUT).bytes_in);
+    EXPECT_EQ(1U, metered.stats(MeteredRepo::DROP).calls);
+    EXPECT_EQ(1U, metered.stats(MeteredRepo::MULTI_DROP).calls);
+    EXPECT_EQ(2U, metered.stats(MeteredRepo::MULTI_DROP).bytes_in);
+    EXPECT_TRUE(repo.close().success());
+  }
+
+}
@@ -31,6 +31,34 @@ namespace pipedb_testing {
     std::this_thread::sleep_for(waitDuration);
     reloadSettings->stop();
   }
+
+  TEST_F(testSettings, BloomBitsPerKey) {
+    const std::string filename("/tmp/pipedb_testsettings_bloom.ini");
+    {
+      auto settings = Settings::create(filename);
+      EXPECT_EQ(Settings::DEFAULT_BLOOM_BITS_PER_KEY, settings->get_bloom_bits_per_key());
+      settings->set_bloom_bits_per_key(10);
+      settings->add_persistence_directory("/tmp");
+      EXPECT_TRUE(settings->save());
+    }
+    auto settings = Settings::create(filename);
+    EXPECT_TRUE(settings->load());
+    EXPECT_EQ(10, settings->get_bloom_bits_per_key());
+  }
+
+  TEST_F(testSettings, ValueLogThreshold) {
+    const std::string filename("/tmp/pipedb_testsettings_value_log.ini");
+    {
+      auto settings = Settings::create(filename);
+      EXPECT_EQ(static_cast<size_t>(Settings::DEFAULT_VALUE_LOG_THRESHOLD), settings->get_value_log_threshold());
+      settings->set_value_log_threshold(32 << 10);
+      settings->add_persistence_directory("/tmp");
+      EXPECT_TRUE(settings->save());
+    }
+    auto settings = Settings::create(filename);
+    EXPECT_TRUE(settings->load());
+    EXPECT_EQ(32U << 10, settings->get_value_log_threshold());
+  }
   
 }
 
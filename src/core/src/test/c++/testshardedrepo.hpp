@@ -0,0 +1,201 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+#include "testsuite.hpp"
+
+#include "repositoryfactory.hpp"
+#include "shardedrepo.hpp"
+
+#include <boost/filesystem.hpp>
+#include <leveldb/env.h>
+#include <leveldb/comparator.h>
+
+namespace pipedb_testing {
+  using namespace pipedb;
+
+  class testShardedRepo: public TestSuite {
+  protected:
+    virtual void SetUp() {
+      // leveldb lazily allocates its singletons once per process
+      leveldb::Env::Default();
+      leveldb::BytewiseComparator();
+      TestSuite::SetUp();
+    }
+  };
+
+  TEST_F(testShardedRepo, Basic) {
+    const std::string root("/tmp/pipedb_testshardedrepo");
+    Tools::remove_all(root);
+    {
+      auto settings = Settings::create(root + "/settings.ini");
+      settings->add_persistence_directory(root + "/disk1");
+      settings->add_persistence_directory(root + "/disk0");
+      for (const std::string& directory : settings->get_persistence_directories()) {
+        boost::filesystem::create_directories(directory);
+      }
+
+      ShardedRepo repo(*settings, 2);
+      EXPECT_EQ(4U, repo.count());
+      EXPECT_TRUE(repo.open().success());
+      EXPECT_TRUE(repo.opened());
+      EXPECT_TRUE(boost::filesystem::exists(root + "/disk0/shard0"));
+      EXPECT_TRUE(boost::filesystem::exists(root + "/disk1/shard3"));
+
+      std::vector<std::string> names;
+      for (size_t i = 0; i < 64; ++i) {
+        names.push_back("key" + std::to_string(i));
+      }
+      std::vector<Key> keys;
+      std::vector<InputBlock> values;
+      for (const std::string& name : names) {
+        keys.emplace_back(name);
+        values.emplace_back(name);
+      }
+
+      for (const Return& state : repo.multi_put(keys, values)) {
+        EXPECT_TRUE(state.success());
+      }
+      for (const std::string& name : names) {
+        OutputBlock block;
+        EXPECT_TRUE(repo.included(Key(name)));
+        EXPECT_TRUE(repo.get(Key(name), block).success());
+        EXPECT_EQ(name, block.copy_as_string());
+      }
+
+      std::vector<OutputBlock> blocks;
+      std::vector<Return> states = repo.multi_get(keys, blocks);
+      for (size_t i = 0; i < keys.size(); ++i) {
+        EXPECT_TRUE(states[i].success());
+        EXPECT_EQ(names[i], blocks[i].copy_as_string());
+      }
+      blocks.clear();
+
+      ScanOptions options;
+      options.batch_entries = 5;
+      std::unique_ptr<Cursor> cursor = repo.scan_prefix(Key("key"), options);
+      std::string previous;
+      size_t count = 0;
+      while (cursor->next()) {
+        const std::string key = cursor->key().copy_as_string();
+        EXPECT_LT(previous, key);
+        EXPECT_EQ(key, cursor->value().copy_as_string());
+        previous = key;
+        ++count;
+      }
+      EXPECT_TRUE(cursor->status().success());
+      EXPECT_EQ(names.size(), count);
+      cursor.reset();
+
+      std::unique_ptr<Snapshot> snapshot = repo.snapshot();
+      ASSERT_TRUE(snapshot != nullptr);
+      EXPECT_TRUE(repo.put(Key(names[1]), InputBlock("changed")).success());
+      OutputBlock block;
+      EXPECT_TRUE(repo.get(Key(names[1]), block, *snapshot).success());
+      EXPECT_EQ(names[1], block.copy_as_string());
+      options.snapshot = snapshot.get();
+      cursor = repo.scan_prefix(Key(names[1]), options);
+      EXPECT_TRUE(cursor->next());
+      EXPECT_EQ(names[1], cursor->value().copy_as_string());
+      cursor.reset();
+      snapshot.reset();
+
+      EXPECT_TRUE(repo.drop(Key(names[0])).success());
+      EXPECT_TRUE(repo.excluded(Key(names[0])));
+      for (const Return& state : repo.multi_drop(keys)) {
+        EXPECT_TRUE(state.success());
+      }
+      for (bool excluded : repo.multi_excluded(keys)) {
+        EXPECT_TRUE(excluded);
+      }
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+      EXPECT_FALSE(boost::filesystem::exists(root + "/disk0/shard0"));
+    }
+    Tools::remove_all(root);
+  }
+
+  TEST_F(testShardedRepo, Factory) {
+    const std::string root("/tmp/pipedb_testshardedrepo_factory");
+    Tools::remove_all(root);
+    boost::filesystem::create_directories(root);
+    auto settings = Settings::create(root + ".ini");
+    settings->add_persistence_directory(root);
+    settings->set_backend_type(Settings::SHARDED_BACKEND);
+    {
+      std::shared_ptr<BlockRepository> repo = RepositoryFactory::create(*settings);
+      ASSERT_TRUE(repo != nullptr);
+      EXPECT_TRUE(repo->open().success());
+      EXPECT_TRUE(repo->put(Key("key"), InputBlock("value")).success());
+      EXPECT_TRUE(repo->included(Key("key")));
+      EXPECT_TRUE(repo->close().success());
+      EXPECT_TRUE(repo->erase().success());
+    }
+    // rejected like by the other backends
+    settings->set_bloom_bits_per_key(-1);
+    EXPECT_TRUE(RepositoryFactory::create(*settings) == nullptr);
+    Tools::remove_all(root);
+    Tools::remove_all(root + ".ini");
+  }
+
+  TEST_F(testShardedRepo, SnapshotSeesWholeBatches) {
+    const std::string root("/tmp/pipedb_testshardedrepo_batches");
+    Tools::remove_all(root);
+    {
+      boost::filesystem::create_directories(root);
+      ShardedRepo repo(std::vector<std::string>(1, root), 4);
+      EXPECT_TRUE(repo.open().success());
+
+      // each batch of a writer writes the same version to its keys,
+      // spread over the shards
+      const size_t count = 2;
+      std::vector<std::vector<Key>> keys(count);
+      std::vector<std::vector<std::string>> names(count);
+      for (size_t w = 0; w < count; ++w) {
+        for (size_t i = 0; i < 16; ++i) {
+          names[w].push_back("key" + std::to_string(w) + "." + std::to_string(i));
+        }
+        for (const std::string& name : names[w]) {
+          keys[w].emplace_back(name);
+        }
+      }
+      std::atomic<bool> stop(false);
+      std::vector<std::thread> writers;
+      for (size_t w = 0; w < count; ++w) {
+        writers.emplace_back([&repo, &keys, &stop, w]() {
+          for (size_t version = 0; stop == false; ++version) {
+            const std::string data = std::to_string(version);
+            std::vector<InputBlock> values;
+            for (size_t i = 0; i < keys[w].size(); ++i) {
+              values.emplace_back(data);
+            }
+            repo.multi_put(keys[w], values);
+          }
+        });
+      }
+      for (size_t i = 0; i < 500; ++i) {
+        std::unique_ptr<Snapshot> snapshot = repo.snapshot();
+        ASSERT_TRUE(snapshot != nullptr);
+        for (size_t w = 0; w < count; ++w) {
+          std::vector<OutputBlock> blocks;
+          repo.multi_get(keys[w], blocks, *snapshot);
+          for (const OutputBlock& block : blocks) {
+            EXPECT_EQ(blocks.front().copy_as_string(), block.copy_as_string());
+          }
+        }
+      }
+      stop = true;
+      for (std::thread& writer : writers) {
+        writer.join();
+      }
+
+      EXPECT_TRUE(repo.close().success());
+      EXPECT_TRUE(repo.erase().success());
+    }
+    Tools::remove_all(root);
+  }
+
+}
@@ -1,9 +1,18 @@
 #include <chrono>
 #include "testsuite.hpp"
+#include "testasyncrepo.hpp"
+#include "testbulkloader.hpp"
+#include "testcachedrepo.hpp"
+#include "testdeduprepo.hpp"
 #include "testkey.hpp"
+#include "testldbrepo.hpp"
+#include "testmemrepo.hpp"
+#include "testmeteredrepo.hpp"
 #include "testpipe.hpp"
 #include "testreturn.hpp"
 #include "testsettings.hpp"
+#include "testshardedrepo.hpp"
+#include "teststreamrepo.hpp"
 
 #define GTEST_COLOR
 
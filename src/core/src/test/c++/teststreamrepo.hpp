@@ -0,0 +1,179 @@
+#pragma once
+
+#include <stdio.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "testsuite.hpp"
+
+#include "memrepo.hpp"
+#include "streamrepo.hpp"
+
+namespace pipedb_testing {
+  using namespace pipedb;
+
+  class testStreamRepo: public TestSuite {
+  protected:
+    static size_t count(BlockRepository& repo) {
+      std::unique_ptr<Cursor> cursor = repo.scan(Key(""), Key(""));
+      size_t n = 0;
+      while (cursor->next()) {
+        ++n;
+      }
+      return n;
+    }
+  };
+
+  TEST_F(testStreamRepo, Buffers) {
+    MemRepo repo;
+    EXPECT_TRUE(repo.open().success());
+    StreamRepo streams(repo, 1000);
+
+    std::string data;
+    for (size_t i = 0; data.size() < 10500; ++i) {
+      data += std::to_string(i) + ",";
+    }
+    std::vector<InputBlock> buffers;
+    buffers.emplace_back(data.data(), 10);
+    buffers.emplace_back(data.data() + 10, 2990);
+    buffers.emplace_back(data.data() + 3000, data.size() - 3000);
+    EXPECT_TRUE(streams.put(Key("object"), buffers).success());
+    // a manifest and 11 sub blocks
+    EXPECT_EQ(12U, count(repo));
+
+    uint64_t size = 0;
+    EXPECT_TRUE(streams.size(Key("object"), size).success());
+    EXPECT_EQ(data.size(), size);
+
+    std::string read;
+    size_t calls = 0;
+    EXPECT_TRUE(streams.get(Key("object"), [&read, &calls](const char* d, const size_t s) {
+      read.append(d, s);
+      ++calls;
+      return true;
+    }).success());
+    EXPECT_EQ(data, read);
+    EXPECT_EQ(11U, calls);
+
+    // a range inside a sub block, and one over three sub blocks
+    OutputBlock block;
+    EXPECT_TRUE(streams.read(Key("object"), 1200, 100, block).success());
+    EXPECT_EQ(data.substr(1200, 100), block.copy_as_string());
+    calls = 0;
+    EXPECT_TRUE(streams.get(Key("object"), [&calls](const char*, const size_t) {
+      ++calls;
+      return true;
+    }, 1990, 1020).success());
+    EXPECT_EQ(3U, calls);
+    EXPECT_TRUE(streams.read(Key("object"), data.size() - 5, 100, block).success());
+    EXPECT_EQ(data.substr(data.size() - 5), block.copy_as_string());
+
+    // overwriting drops the sub blocks of the previous version
+    buffers.clear();
+    buffers.emplace_back(data.data(), 1500);
+    EXPECT_TRUE(streams.put(Key("object"), buffers).success());
+    EXPECT_EQ(3U, count(repo));
+    EXPECT_TRUE(streams.read(Key("object"), 0, 2000, block).success());
+    EXPECT_EQ(data.substr(0, 1500), block.copy_as_string());
+
+    // an uncommitted writer leaves nothing behind
+    {
+      std::unique_ptr<StreamRepo::Writer> writer = streams.writer(Key("pending"));
+      EXPECT_TRUE(writer->write(data.data(), 2500).success());
+    }
+    EXPECT_EQ(3U, count(repo));
+    EXPECT_TRUE(streams.get(Key("pending"), [](const char*, const size_t) {
+      return true;
+    }).key_was_present());
+
+    EXPECT_TRUE(streams.drop(Key("object")).success());
+    EXPECT_EQ(0U, count(repo));
+    EXPECT_TRUE(repo.close().success());
+  }
+
+  TEST_F(testStreamRepo, FileDescriptors) {
+    MemRepo repo;
+    EXPECT_TRUE(repo.open().success());
+    StreamRepo streams(repo, 4096);
+
+    const std::string data(100000, 'x');
+    FILE* in = tmpfile();
+    ASSERT_TRUE(in != NULL);
+    EXPECT_EQ(data.size(), fwrite(data.data(), 1, data.size(), in));
+    fflush(in);
+    rewind(in);
+    EXPECT_TRUE(streams.put(Key("file"), fileno(in)).success());
+    fclose(in);
+
+    FILE* out = tmpfile();
+    ASSERT_TRUE(out != NULL);
+    EXPECT_TRUE(streams.get(Key("file"), fileno(out), 5000, 50000).success());
+    fflush(out);
+    EXPECT_EQ(50000, ftell(out));
+    fclose(out);
+
+    EXPECT_TRUE(streams.drop(Key("file")).success());
+    EXPECT_TRUE(repo.close().success());
+  }
+
+  TEST_F(testStreamRepo, ConcurrentWriters) {
+    MemRepo repo;
+    EXPECT_TRUE(repo.open().success());
+    StreamRepo streams(repo, 100);
+
+    // the writers of a key that lose drop no sub block of the winner,
+    // and leave none of theirs behind
+    const size_t writers = 4;
+    std::vector<std::thread> threads;
+    for (size_t w = 0; w < writers; ++w) {
+      threads.emplace_back([&streams, w]() {
+        const std::string data(1000 + 100 * w, static_cast<char>('a' + w));
+        for (size_t i = 0; i < 50; ++i) {
+          std::vector<InputBlock> buffers;
+          buffers.emplace_back(data);
+          EXPECT_TRUE(streams.put(Key("object"), buffers).success());
+        }
+      });
+    }
+    // reads without a snapshot see a whole version or fail
+    std::thread reader([&streams]() {
+      for (size_t i = 0; i < 200; ++i) {
+        std::string read;
+        Return state = streams.get(Key("object"), [&read](const char* d, const size_t s) {
+          read.append(d, s);
+          return true;
+        });
+        EXPECT_TRUE(state.success() || state.key_was_present());
+        if (state.success()) {
+          EXPECT_EQ(std::string(read.size(), read[0]), read);
+        }
+      }
+    });
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+    reader.join();
+
+    uint64_t size = 0;
+    EXPECT_TRUE(streams.size(Key("object"), size).success());
+    EXPECT_EQ(1U + (size + 99) / 100, count(repo));
+
+    // a snapshot keeps the version it saw
+    std::unique_ptr<Snapshot> snapshot = repo.snapshot();
+    std::vector<InputBlock> buffers;
+    buffers.emplace_back(std::string(250, 'z'));
+    EXPECT_TRUE(streams.put(Key("object"), buffers).success());
+    std::string read;
+    EXPECT_TRUE(streams.get(Key("object"), [&read](const char* d, const size_t s) {
+      read.append(d, s);
+      return true;
+    }, *snapshot).success());
+    EXPECT_EQ(size, read.size());
+    snapshot.reset();
+
+    EXPECT_TRUE(streams.drop(Key("object")).success());
+    EXPECT_EQ(0U, count(repo));
+    EXPECT_TRUE(repo.close().success());
+  }
+
+}
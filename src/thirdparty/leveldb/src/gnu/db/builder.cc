@@ -7,10 +7,12 @@
 #include "db/filename.h"
 #include "db/dbformat.h"
 #include "db/table_cache.h"
+#include "db/value_log.h"
 #include "db/version_edit.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
 #include "leveldb/iterator.h"
+#include "leveldb/rate_limiter.h"
 
 namespace leveldb {
 
@@ -19,11 +21,20 @@ Status BuildTable(const std::string& dbname,
                   const Options& options,
                   TableCache* table_cache,
                   Iterator* iter,
-                  FileMetaData* meta) {
+                  FileMetaData* meta,
+                  FileMetaData* value_log) {
   Status s;
   meta->file_size = 0;
+  if (value_log != NULL) {
+    value_log->file_size = 0;
+  }
   iter->SeekToFirst();
 
+  // Created with the first large value
+  WritableFile* value_file = NULL;
+  ValueLogBuilder* value_builder = NULL;
+  bool value_log_created = false;
+
   std::string fname = TableFileName(dbname, meta->number);
   if (iter->Valid()) {
     WritableFile* file;
@@ -31,13 +42,70 @@ Status BuildTable(const std::string& dbname,
     if (!s.ok()) {
       return s;
     }
+    if (options.rate_limiter != NULL) {
+      file = NewRateLimitedFile(file, options.rate_limiter, Env::HIGH);
+    }
 
     TableBuilder* builder = new TableBuilder(options, file);
-    meta->smallest.DecodeFrom(iter->key());
-    for (; iter->Valid(); iter->Next()) {
+    std::string index_key, index;
+    for (bool first = true; iter->Valid() && s.ok(); iter->Next()) {
       Slice key = iter->key();
-      meta->largest.DecodeFrom(key);
-      builder->Add(key, iter->value());
+      ParsedInternalKey ikey;
+      if (value_log == NULL || options.value_log_threshold == 0 ||
+          iter->value().size() < options.value_log_threshold ||
+          !ParseInternalKey(key, &ikey) ||
+          ikey.type != kTypeValue) {
+        if (first) {
+          meta->smallest.DecodeFrom(key);
+          first = false;
+        }
+        meta->largest.DecodeFrom(key);
+        builder->Add(key, iter->value());
+        continue;
+      }
+      if (value_builder == NULL) {
+        s = env->NewWritableFile(ValueLogFileName(dbname, value_log->number),
+                                 &value_file);
+        if (!s.ok()) {
+          break;
+        }
+        if (options.rate_limiter != NULL) {
+          value_file = NewRateLimitedFile(value_file, options.rate_limiter,
+                                          Env::HIGH);
+        }
+        value_builder = new ValueLogBuilder(value_file, value_log->number);
+        value_log_created = true;
+      }
+      ValueHandle handle;
+      s = value_builder->Add(ikey.user_key, iter->value(), &handle);
+      if (s.ok()) {
+        index_key.clear();
+        AppendInternalKey(&index_key, ParsedInternalKey(
+            ikey.user_key, ikey.sequence, kTypeValueIndex));
+        index.clear();
+        handle.EncodeTo(&index);
+        if (first) {
+          meta->smallest.DecodeFrom(index_key);
+          first = false;
+        }
+        meta->largest.DecodeFrom(index_key);
+        builder->Add(index_key, index);
+      }
+    }
+
+    // The value log must be durable before a table refers to it
+    if (value_builder != NULL) {
+      if (s.ok()) {
+        s = value_file->Sync();
+      }
+      if (s.ok()) {
+        s = value_file->Close();
+      }
+      if (s.ok()) {
+        value_log->file_size = value_builder->FileSize();
+      }
+      delete value_builder;
+      delete value_file;
     }
 
     // Finish and check for builder errors
@@ -81,6 +149,10 @@ Status BuildTable(const std::string& dbname,
     // Keep it
   } else {
     env->DeleteFile(fname);
+    if (value_log_created) {
+      env->DeleteFile(ValueLogFileName(dbname, value_log->number));
+      value_log->file_size = 0;
+    }
   }
   return s;
 }
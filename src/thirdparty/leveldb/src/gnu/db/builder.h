@@ -22,12 +22,19 @@ class VersionEdit;
 // *meta will be filled with metadata about the generated table.
 // If no data is present in *iter, meta->file_size will be set to
 // zero, and no Table file will be produced.
+//
+// If value_log is non-NULL, the values of options.value_log_threshold
+// bytes or more are written to the value log named according to
+// value_log->number, and the table only refers to them.  On success
+// value_log->file_size is the size of the value log, zero if no value
+// was that large and no value log file was produced.
 extern Status BuildTable(const std::string& dbname,
                          Env* env,
                          const Options& options,
                          TableCache* table_cache,
                          Iterator* iter,
-                         FileMetaData* meta);
+                         FileMetaData* meta,
+                         FileMetaData* value_log);
 
 }  // namespace leveldb
 
@@ -34,6 +34,7 @@
 //      readhot       -- read N times in random order from 1% section of DB
 //      seekrandom    -- N random seeks
 //      crc32c        -- repeated crc32c of 4K of data
+//      crc32c_portable -- same without the crc32 instruction of the CPU
 //      acquireload   -- load N*1000 times
 //   Meta operations:
 //      compact     -- Compact the entire DB
@@ -55,6 +56,7 @@ static const char* FLAGS_benchmarks =
     "readreverse,"
     "fill100K,"
     "crc32c,"
+    "crc32c_portable,"
     "snappycomp,"
     "snappyuncomp,"
     "acquireload,"
@@ -87,6 +89,9 @@ static int FLAGS_write_buffer_size = 0;
 // Negative means use default settings.
 static int FLAGS_cache_size = -1;
 
+// If true, the cache of --cache_size uses CLOCK eviction instead of LRU.
+static bool FLAGS_clock_cache = false;
+
 // Maximum number of files to keep open at the same time (use default if == 0)
 static int FLAGS_open_files = 0;
 
@@ -387,7 +392,9 @@ class Benchmark {
 
  public:
   Benchmark()
-  : cache_(FLAGS_cache_size >= 0 ? NewLRUCache(FLAGS_cache_size) : NULL),
+  : cache_(FLAGS_cache_size < 0 ? NULL :
+           FLAGS_clock_cache ? NewClockCache(FLAGS_cache_size, 4096) :
+           NewLRUCache(FLAGS_cache_size)),
     filter_policy_(FLAGS_bloom_bits >= 0
                    ? NewBloomFilterPolicy(FLAGS_bloom_bits)
                    : NULL),
@@ -491,6 +498,8 @@ class Benchmark {
         method = &Benchmark::Compact;
       } else if (name == Slice("crc32c")) {
         method = &Benchmark::Crc32c;
+      } else if (name == Slice("crc32c_portable")) {
+        method = &Benchmark::Crc32cPortable;
       } else if (name == Slice("acquireload")) {
         method = &Benchmark::AcquireLoad;
       } else if (name == Slice("snappycomp")) {
@@ -606,14 +615,25 @@ class Benchmark {
   }
 
   void Crc32c(ThreadState* thread) {
+    Crc32c(thread, crc32c::Extend,
+           crc32c::IsHardwareAccelerated() ? "(4K per op, SSE4.2)" :
+                                             "(4K per op)");
+  }
+
+  void Crc32cPortable(ThreadState* thread) {
+    Crc32c(thread, crc32c::ExtendPortable, "(4K per op)");
+  }
+
+  void Crc32c(ThreadState* thread,
+              uint32_t (*extend)(uint32_t, const char*, size_t),
+              const char* label) {
     // Checksum about 500MB of data total
     const int size = 4096;
-    const char* label = "(4K per op)";
     std::string data(size, 'x');
     int64_t bytes = 0;
     uint32_t crc = 0;
     while (bytes < 500 * 1048576) {
-      crc = crc32c::Value(data.data(), size);
+      crc = (*extend)(0, data.data(), size);
       thread->stats.FinishedSingleOp();
       bytes += size;
     }
@@ -954,6 +974,9 @@ int main(int argc, char** argv) {
       FLAGS_write_buffer_size = n;
     } else if (sscanf(argv[i], "--cache_size=%d%c", &n, &junk) == 1) {
       FLAGS_cache_size = n;
+    } else if (sscanf(argv[i], "--clock_cache=%d%c", &n, &junk) == 1 &&
+               (n == 0 || n == 1)) {
+      FLAGS_clock_cache = n;
     } else if (sscanf(argv[i], "--bloom_bits=%d%c", &n, &junk) == 1) {
       FLAGS_bloom_bits = n;
     } else if (sscanf(argv[i], "--open_files=%d%c", &n, &junk) == 1) {
@@ -5,6 +5,7 @@
 #include "db/db_impl.h"
 
 #include <algorithm>
+#include <atomic>
 #include <set>
 #include <string>
 #include <stdint.h>
@@ -18,13 +19,16 @@
 #include "db/log_writer.h"
 #include "db/memtable.h"
 #include "db/table_cache.h"
+#include "db/value_log.h"
 #include "db/version_set.h"
 #include "db/write_batch_internal.h"
 #include "leveldb/db.h"
 #include "leveldb/env.h"
+#include "leveldb/rate_limiter.h"
 #include "leveldb/status.h"
 #include "leveldb/table.h"
 #include "leveldb/table_builder.h"
+#include "leveldb/table_file_writer.h"
 #include "port/port.h"
 #include "table/block.h"
 #include "table/merger.h"
@@ -37,15 +41,86 @@ namespace leveldb {
 
 const int kNumNonTableCacheFiles = 10;
 
+// Value log files kept open for reads
+const int kValueLogCacheSize = 64;
+
+// Bytes of values the value log garbage collection writes at once
+const size_t kValueLogRewriteBytes = 4 << 20;
+
 // Information kept for every waiting writer
 struct DBImpl::Writer {
   Status status;
   WriteBatch* batch;
   bool sync;
   bool done;
+  ValueLogRewrite* rewrite;
+  bool exclusive;     // Tables are ingested: joins no group
+  bool logged;        // Out of the queue, its group on the way to mem_
+  bool insert_batch;  // Logged by the leader, to insert into the memtable
+  Writer* leader;     // Of its group, when inserting its own batch
+  int pending_inserts;     // Of a leader: followers still inserting
+  Status insert_status;    // Of a leader: first error of their inserts
   port::CondVar cv;
 
-  explicit Writer(port::Mutex* mu) : cv(mu) { }
+  explicit Writer(port::Mutex* mu)
+      : rewrite(NULL), exclusive(false), logged(false), insert_batch(false),
+        leader(NULL), pending_inserts(0), cv(mu) { }
+};
+
+// A group of writes logged with pipelined_writes, on its way into the
+// memtable
+struct DBImpl::WriteGroup {
+  std::vector<Writer*> writers;  // Its leader first
+  SequenceNumber last_sequence;
+  Status status;
+  bool applied;     // In the memtable
+  bool published;   // Its sequence numbers are visible
+};
+
+// A table file being ingested
+struct DBImpl::IngestedTable {
+  std::string source;   // Name given by the caller
+  bool copied;          // Copied, not renamed, into the DB directory
+  uint64_t number;      // Number of the file moved in
+  FileMetaData meta;    // File added: rewritten if meta.number != number
+  int level;
+  uint64_t value_log;   // Number of the value log moved in with it, or 0
+  uint64_t value_log_size;
+  bool value_log_copied;
+
+  struct BySmallest {
+    const InternalKeyComparator* icmp;
+    explicit BySmallest(const InternalKeyComparator* c) : icmp(c) { }
+    bool operator()(const IngestedTable* a, const IngestedTable* b) const {
+      return icmp->Compare(a->meta.smallest, b->meta.smallest) < 0;
+    }
+  };
+};
+
+// Records read from a value log by the garbage collection
+struct DBImpl::ValueLogRewrite {
+  std::vector<std::string> keys;
+  std::vector<std::string> values;
+  std::vector<ValueHandle> handles;
+  size_t bytes;
+  WriteBatch batch;  // The records still current
+
+  ValueLogRewrite() : bytes(0) { }
+
+  void Add(const Slice& key, const Slice& value, const ValueHandle& handle) {
+    keys.push_back(key.ToString());
+    values.push_back(value.ToString());
+    handles.push_back(handle);
+    bytes += handle.size;
+  }
+
+  void Clear() {
+    keys.clear();
+    values.clear();
+    handles.clear();
+    bytes = 0;
+    batch.Clear();
+  }
 };
 
 struct DBImpl::CompactionState {
@@ -65,22 +140,47 @@ struct DBImpl::CompactionState {
   };
   std::vector<Output> outputs;
 
+  // Bytes of the value log records referred to by dropped entries
+  std::map<uint64_t, uint64_t> value_log_garbage;
+
   // State kept for output being generated
   WritableFile* outfile;
   TableBuilder* builder;
 
   uint64_t total_bytes;
 
+  // User keys compacted, in [*start,*end).  NULL means unbounded.
+  const std::string* start;
+  const std::string* end;
+
+  int64_t imm_micros;  // Micros spent doing imm_ compactions
+
   Output* current_output() { return &outputs[outputs.size()-1]; }
 
   explicit CompactionState(Compaction* c)
       : compaction(c),
         outfile(NULL),
         builder(NULL),
-        total_bytes(0) {
+        total_bytes(0),
+        start(NULL),
+        end(NULL),
+        imm_micros(0) {
   }
 };
 
+// A range of a compaction compacted by another thread
+// A range of a compaction, scheduled in the LOW pool.  The compaction
+// runs itself the ranges no thread of the pool started, so that it never
+// waits for a pool busy with compactions waiting the same way.
+struct DBImpl::Subcompaction {
+  DBImpl* db;
+  CompactionState* state;
+  Status status;
+  bool done;                  // Guarded by db->mutex_
+  std::atomic<bool> started;  // Taken by a thread, which then merges it
+  std::atomic<int> refs;      // Held by the compaction and by the pool
+};
+
 // Fix user-supplied options to be reasonable
 template <class T,class V>
 static void ClipToRange(T* ptr, V minvalue, V maxvalue) {
@@ -97,6 +197,9 @@ Options SanitizeOptions(const std::string& dbname,
   ClipToRange(&result.max_open_files,    64 + kNumNonTableCacheFiles, 50000);
   ClipToRange(&result.write_buffer_size, 64<<10,                      1<<30);
   ClipToRange(&result.block_size,        1<<10,                       4<<20);
+  ClipToRange(&result.max_write_group_size, 64<<10,                   64<<20);
+  ClipToRange(&result.max_background_compactions, 1,                  64);
+  ClipToRange(&result.max_subcompactions, 1,                          64);
   if (result.info_log == NULL) {
     // Open a log file in the same directory as the db
     src.env->CreateDir(dbname);  // In case it does not exist
@@ -108,7 +211,7 @@ Options SanitizeOptions(const std::string& dbname,
     }
   }
   if (result.block_cache == NULL) {
-    result.block_cache = NewLRUCache(8 << 20);
+    result.block_cache = NewClockCache(8 << 20, result.block_size);
   }
   return result;
 }
@@ -132,16 +235,32 @@ DBImpl::DBImpl(const Options& raw_options, const std::string& dbname)
       log_(NULL),
       seed_(0),
       tmp_batch_(new WriteBatch),
-      bg_compaction_scheduled_(false),
-      manual_compaction_(NULL) {
+      group_leader_(NULL),
+      group_bytes_(0),
+      bg_compactions_scheduled_(0),
+      bg_flush_scheduled_(false),
+      flushing_imm_(false),
+      applying_edit_(false),
+      bg_gc_scheduled_(false),
+      ingesting_(false),
+      manual_compaction_(NULL),
+      user_bytes_written_(0),
+      stall_micros_(0),
+      slowdown_stalls_(0),
+      memtable_stalls_(0),
+      level0_stalls_(0),
+      table_reads_(0),
+      table_read_micros_(0),
+      last_load_report_micros_(0) {
   mem_->Ref();
   has_imm_.Release_Store(NULL);
 
   // Reserve ten files or so for other uses and give the rest to TableCache.
   const int table_cache_size = options_.max_open_files - kNumNonTableCacheFiles;
   table_cache_ = new TableCache(dbname_, &options_, table_cache_size);
+  value_log_ = new ValueLog(dbname_, &options_, kValueLogCacheSize);
 
-  versions_ = new VersionSet(dbname_, &options_, table_cache_,
+  versions_ = new VersionSet(dbname_, &options_, table_cache_, value_log_,
                              &internal_comparator_);
 }
 
@@ -150,7 +269,9 @@ DBImpl::~DBImpl() {
   {
     MutexLock l(&mutex_);
     shutting_down_.Release_Store(this);  // Any non-NULL value is ok
-    while (bg_compaction_scheduled_) {
+    bg_cv_.SignalAll();  // Wake up the garbage collection waiting for room
+    while (bg_compactions_scheduled_ > 0 || bg_flush_scheduled_ ||
+           bg_gc_scheduled_) {
       bg_cv_.Wait();
     }
   }
@@ -180,6 +301,7 @@ DBImpl::~DBImpl() {
     delete log_;
     delete logfile_;
     delete table_cache_;
+    delete value_log_;
 
     if (owns_info_log_) {
       delete options_.info_log;
@@ -241,6 +363,10 @@ void DBImpl::DeleteObsoleteFiles() {
   // Make a set of all of the live files
   std::set<uint64_t> live = pending_outputs_;
   versions_->AddLiveFiles(&live);
+  // Older versions may still read the value logs the current one no
+  // longer refers to
+  const bool delete_value_logs = versions_->OnlyCurrentVersionLive();
+  versions_->AddLiveValueLogs(&live);
 
   std::vector<std::string> filenames;
   env_->GetChildren(dbname_, &filenames); // Ignoring errors on purpose
@@ -267,6 +393,9 @@ void DBImpl::DeleteObsoleteFiles() {
           // be recorded in pending_outputs_, which is inserted into "live"
           keep = (live.find(number) != live.end());
           break;
+        case kValueLogFile:
+          keep = (!delete_value_logs || live.find(number) != live.end());
+          break;
         case kCurrentFile:
         case kDBLockFile:
         case kInfoLogFile:
@@ -277,6 +406,10 @@ void DBImpl::DeleteObsoleteFiles() {
       if (!keep) {
         if (type == kTableFile) {
           table_cache_->Evict(number);
+        } else if (type == kValueLogFile) {
+          value_log_->Evict(number);
+          versions_->ForgetValueLog(number);
+          rewritten_value_logs_.erase(number);
         }
         Log(options_.info_log, "Delete type=%d #%lld\n",
             int(type),
@@ -337,6 +470,7 @@ Status DBImpl::Recover(VersionEdit* edit) {
     }
     std::set<uint64_t> expected;
     versions_->AddLiveFiles(&expected);
+    versions_->AddLiveValueLogs(&expected);
     uint64_t number;
     FileType type;
     std::vector<uint64_t> logs;
@@ -471,12 +605,19 @@ Status DBImpl::RecoverLogFile(uint64_t log_number,
 }
 
 Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
-                                Version* base) {
+                                Version* base,
+                                std::vector<uint64_t>* outputs) {
   mutex_.AssertHeld();
   const uint64_t start_micros = env_->NowMicros();
   FileMetaData meta;
   meta.number = versions_->NewFileNumber();
   pending_outputs_.insert(meta.number);
+  FileMetaData value_log;
+  value_log.number = 0;
+  if (options_.value_log_threshold > 0) {
+    value_log.number = versions_->NewFileNumber();
+    pending_outputs_.insert(value_log.number);
+  }
   Iterator* iter = mem->NewIterator();
   Log(options_.info_log, "Level-0 table #%llu: started",
       (unsigned long long) meta.number);
@@ -484,7 +625,8 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
   Status s;
   {
     mutex_.Unlock();
-    s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
+    s = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta,
+                   value_log.number != 0 ? &value_log : NULL);
     mutex_.Lock();
   }
 
@@ -492,8 +634,19 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
       (unsigned long long) meta.number,
       (unsigned long long) meta.file_size,
       s.ToString().c_str());
+  if (value_log.file_size > 0) {
+    Log(options_.info_log, "Value log #%llu: %lld bytes",
+        (unsigned long long) value_log.number,
+        (unsigned long long) value_log.file_size);
+  }
   delete iter;
-  pending_outputs_.erase(meta.number);
+  if (outputs != NULL) {
+    outputs->push_back(meta.number);
+    outputs->push_back(value_log.number);
+  } else {
+    pending_outputs_.erase(meta.number);
+    pending_outputs_.erase(value_log.number);
+  }
 
 
   // Note that if file_size is zero, the file has been deleted and
@@ -504,14 +657,18 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
     const Slice max_user_key = meta.largest.user_key();
     if (base != NULL) {
       level = base->PickLevelForMemTableOutput(min_user_key, max_user_key);
+      level = AvoidCompactionOutputs(level, min_user_key, max_user_key);
     }
     edit->AddFile(level, meta.number, meta.file_size,
                   meta.smallest, meta.largest);
+    if (value_log.file_size > 0) {
+      edit->AddValueLog(value_log.number, value_log.file_size);
+    }
   }
 
   CompactionStats stats;
   stats.micros = env_->NowMicros() - start_micros;
-  stats.bytes_written = meta.file_size;
+  stats.bytes_written = meta.file_size + value_log.file_size;
   stats_[level].Add(stats);
   return s;
 }
@@ -519,12 +676,15 @@ Status DBImpl::WriteLevel0Table(MemTable* mem, VersionEdit* edit,
 void DBImpl::CompactMemTable() {
   mutex_.AssertHeld();
   assert(imm_ != NULL);
+  assert(!flushing_imm_);
+  flushing_imm_ = true;
 
   // Save the contents of the memtable as a new Table
   VersionEdit edit;
   Version* base = versions_->current();
   base->Ref();
-  Status s = WriteLevel0Table(imm_, &edit, base);
+  std::vector<uint64_t> outputs;
+  Status s = WriteLevel0Table(imm_, &edit, base, &outputs);
   base->Unref();
 
   if (s.ok() && shutting_down_.Acquire_Load()) {
@@ -535,7 +695,10 @@ void DBImpl::CompactMemTable() {
   if (s.ok()) {
     edit.SetPrevLogNumber(0);
     edit.SetLogNumber(logfile_number_);  // Earlier logs no longer needed
-    s = versions_->LogAndApply(&edit, &mutex_);
+    s = LogAndApply(&edit);
+  }
+  for (size_t i = 0; i < outputs.size(); i++) {
+    pending_outputs_.erase(outputs[i]);
   }
 
   if (s.ok()) {
@@ -547,6 +710,45 @@ void DBImpl::CompactMemTable() {
   } else {
     RecordBackgroundError(s);
   }
+  flushing_imm_ = false;
+}
+
+Status DBImpl::LogAndApply(VersionEdit* edit) {
+  mutex_.AssertHeld();
+  // VersionSet::LogAndApply() releases the mutex while it writes to the
+  // MANIFEST: the background threads take turns.
+  while (applying_edit_) {
+    bg_cv_.Wait();
+  }
+  applying_edit_ = true;
+  Status s = versions_->LogAndApply(edit, &mutex_);
+  applying_edit_ = false;
+  bg_cv_.SignalAll();
+  return s;
+}
+
+int DBImpl::AvoidCompactionOutputs(int level,
+                                   const Slice& smallest_user_key,
+                                   const Slice& largest_user_key) {
+  mutex_.AssertHeld();
+  // A compaction writes to level()+1 anywhere between the first and the
+  // last key of its inputs, even where no input had a file.
+  bool overlap = true;
+  while (level > 0 && overlap) {
+    overlap = false;
+    for (std::set<Compaction*>::const_iterator it =
+             active_compactions_.begin();
+         it != active_compactions_.end();
+         ++it) {
+      if ((*it)->level() + 1 == level &&
+          (*it)->OutputOverlaps(smallest_user_key, largest_user_key)) {
+        overlap = true;
+        level--;
+        break;
+      }
+    }
+  }
+  return level;
 }
 
 void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
@@ -569,6 +771,404 @@ void DBImpl::CompactRange(const Slice* begin, const Slice* end) {
   }
 }
 
+// Copy src to dst, for a file that cannot be renamed into the DB
+// directory because it lives on another file system.
+static Status CopyTableFile(Env* env, const std::string& src,
+                            const std::string& dst) {
+  SequentialFile* in;
+  Status s = env->NewSequentialFile(src, &in);
+  if (!s.ok()) {
+    return s;
+  }
+  WritableFile* out;
+  s = env->NewWritableFile(dst, &out);
+  if (!s.ok()) {
+    delete in;
+    return s;
+  }
+  const size_t kBufferSize = 1 << 20;
+  char* buffer = new char[kBufferSize];
+  while (s.ok()) {
+    Slice fragment;
+    s = in->Read(kBufferSize, &fragment, buffer);
+    if (!s.ok() || fragment.empty()) {
+      break;
+    }
+    s = out->Append(fragment);
+  }
+  delete[] buffer;
+  if (s.ok()) {
+    s = out->Sync();
+  }
+  if (s.ok()) {
+    s = out->Close();
+  }
+  delete out;
+  delete in;
+  if (!s.ok()) {
+    env->DeleteFile(dst);
+  }
+  return s;
+}
+
+// Move src to dst, copying it when it lives on another file system.
+static Status MoveIngestedFile(Env* env, const std::string& src,
+                               const std::string& dst, bool* copied) {
+  *copied = false;
+  Status s = env->RenameFile(src, dst);
+  if (!s.ok() && env->FileExists(src)) {
+    s = CopyTableFile(env, src, dst);
+    *copied = true;
+  }
+  return s;
+}
+
+// Undo MoveIngestedFile().
+static void PutBackIngestedFile(Env* env, const std::string& src,
+                                const std::string& dst, bool copied) {
+  if (copied) {
+    env->DeleteFile(dst);
+  } else {
+    env->RenameFile(dst, src);
+  }
+}
+
+Status DBImpl::IngestTables(const std::vector<std::string>& fnames) {
+  std::vector<IngestedTable> tables(fnames.size());
+  std::vector<bool> value_logs(fnames.size());
+  for (size_t i = 0; i < fnames.size(); i++) {
+    value_logs[i] = env_->FileExists(TableFileWriter::ValueLogName(fnames[i]));
+  }
+  {
+    MutexLock l(&mutex_);
+    for (size_t i = 0; i < tables.size(); i++) {
+      tables[i].source = fnames[i];
+      tables[i].copied = false;
+      tables[i].number = versions_->NewFileNumber();
+      tables[i].meta.number = tables[i].number;
+      tables[i].meta.file_size = 0;
+      tables[i].level = 0;
+      tables[i].value_log = 0;
+      tables[i].value_log_size = 0;
+      tables[i].value_log_copied = false;
+      pending_outputs_.insert(tables[i].number);
+      if (value_logs[i]) {
+        tables[i].value_log = versions_->NewFileNumber();
+        pending_outputs_.insert(tables[i].value_log);
+      }
+    }
+  }
+
+  // Move the files in and find their key ranges.
+  Status s;
+  size_t moved = 0;
+  for (; s.ok() && moved < tables.size(); moved++) {
+    IngestedTable* t = &tables[moved];
+    const std::string fname = TableFileName(dbname_, t->number);
+    const std::string value_source = TableFileWriter::ValueLogName(t->source);
+    const std::string value_fname = ValueLogFileName(dbname_, t->value_log);
+    if (t->value_log != 0) {
+      s = MoveIngestedFile(env_, value_source, value_fname,
+                           &t->value_log_copied);
+      if (!s.ok()) {
+        break;
+      }
+    }
+    s = MoveIngestedFile(env_, t->source, fname, &t->copied);
+    if (s.ok() && t->value_log != 0) {
+      s = env_->GetFileSize(value_fname, &t->value_log_size);
+    }
+    if (!s.ok()) {
+      if (t->value_log != 0) {
+        PutBackIngestedFile(env_, value_source, value_fname,
+                            t->value_log_copied);
+      }
+      break;
+    }
+    s = ReadIngestedTableRange(t);
+  }
+
+  const Comparator* ucmp = user_comparator();
+  std::vector<IngestedTable*> sorted;
+  for (size_t i = 0; s.ok() && i < tables.size(); i++) {
+    sorted.push_back(&tables[i]);
+  }
+  std::sort(sorted.begin(), sorted.end(),
+            IngestedTable::BySmallest(&internal_comparator_));
+  for (size_t i = 1; s.ok() && i < sorted.size(); i++) {
+    if (ucmp->Compare(sorted[i-1]->meta.largest.user_key(),
+                      sorted[i]->meta.smallest.user_key()) >= 0) {
+      s = Status::InvalidArgument("ingested tables overlap",
+                                  sorted[i]->source);
+    }
+  }
+
+  MutexLock l(&mutex_);
+
+  // Block the writes: wait to be at the front of the writer queue.
+  Writer w(&mutex_);
+  w.batch = NULL;
+  w.sync = false;
+  w.done = false;
+  w.exclusive = true;
+  writers_.push_back(&w);
+  while (&w != writers_.front()) {
+    w.cv.Wait();
+  }
+  WaitForPipelinedWrites();
+
+  // Entries still in a memtable would be older than the ingested ones
+  // once they are compacted: compact them first.
+  bool flush = false;
+  for (size_t i = 0; s.ok() && i < sorted.size(); i++) {
+    flush = flush || MemTableOverlaps(mem_, sorted[i]->meta) ||
+        MemTableOverlaps(imm_, sorted[i]->meta);
+  }
+  if (flush) {
+    s = MakeRoomForWrite(true /* force */);
+    while (s.ok() && imm_ != NULL && bg_error_.ok()) {
+      bg_cv_.Wait();
+    }
+    if (s.ok() && imm_ != NULL) {
+      s = bg_error_;
+    }
+  }
+
+  // Only this thread changes the version from now on.
+  ingesting_ = true;
+  while (bg_compactions_scheduled_ > 0 || bg_flush_scheduled_) {
+    bg_cv_.Wait();
+  }
+  if (s.ok()) {
+    s = bg_error_;
+  }
+
+  // A table overlapping nothing goes to the last level, the others right
+  // above the first level they overlap.  While a table overlaps or a
+  // snapshot is alive, the entries of all the tables are made newer than
+  // all the others: the snapshots do not see them.  Otherwise the tables
+  // keep sequence 0 and are moved as is.  A table with a value log is
+  // rewritten anyway to refer to the number given to the log: it only
+  // holds the small values and the handles, the log is not rewritten.
+  const SequenceNumber seq = versions_->LastSequence() + 1;
+  bool new_sequence = !snapshots_.empty();
+  Version* current = versions_->current();
+  for (size_t i = 0; s.ok() && i < sorted.size(); i++) {
+    IngestedTable* t = sorted[i];
+    const Slice smallest = t->meta.smallest.user_key();
+    const Slice largest = t->meta.largest.user_key();
+    int level = 0;
+    while (level < config::kNumLevels &&
+           !current->OverlapInLevel(level, &smallest, &largest)) {
+      level++;
+    }
+    if (level < config::kNumLevels) {
+      t->level = std::max(level - 1, 0);
+      new_sequence = true;
+    } else {
+      t->level = config::kNumLevels - 1;
+    }
+  }
+  for (size_t i = 0; s.ok() && i < sorted.size(); i++) {
+    IngestedTable* t = sorted[i];
+    if (new_sequence || t->value_log != 0) {
+      t->meta.number = versions_->NewFileNumber();
+      pending_outputs_.insert(t->meta.number);
+      mutex_.Unlock();
+      s = RewriteIngestedTable(t, new_sequence ? seq : 0);
+      mutex_.Lock();
+    }
+  }
+
+  if (s.ok()) {
+    VersionEdit edit;
+    for (size_t i = 0; i < sorted.size(); i++) {
+      const FileMetaData& f = sorted[i]->meta;
+      edit.AddFile(sorted[i]->level, f.number, f.file_size,
+                   f.smallest, f.largest);
+      if (sorted[i]->value_log != 0) {
+        edit.AddValueLog(sorted[i]->value_log, sorted[i]->value_log_size);
+      }
+    }
+    if (new_sequence) {
+      versions_->SetLastSequence(seq);
+    }
+    s = LogAndApply(&edit);
+  }
+
+  for (size_t i = 0; i < moved; i++) {
+    IngestedTable* t = &tables[i];
+    const bool rewritten = (t->meta.number != t->number);
+    if (s.ok()) {
+      Log(options_.info_log, "Ingested table #%llu: %lld bytes at level %d",
+          (unsigned long long) t->meta.number,
+          (unsigned long long) t->meta.file_size,
+          t->level);
+      if (rewritten) {
+        table_cache_->Evict(t->number);
+        env_->DeleteFile(TableFileName(dbname_, t->number));
+      }
+      if (t->copied) {
+        env_->DeleteFile(t->source);
+      }
+      if (t->value_log_copied) {
+        env_->DeleteFile(TableFileWriter::ValueLogName(t->source));
+      }
+    } else {
+      // Put the files back as they were.
+      if (rewritten) {
+        env_->DeleteFile(TableFileName(dbname_, t->meta.number));
+      }
+      table_cache_->Evict(t->number);
+      PutBackIngestedFile(env_, t->source, TableFileName(dbname_, t->number),
+                          t->copied);
+      if (t->value_log != 0) {
+        PutBackIngestedFile(env_, TableFileWriter::ValueLogName(t->source),
+                            ValueLogFileName(dbname_, t->value_log),
+                            t->value_log_copied);
+      }
+    }
+  }
+  for (size_t i = 0; i < tables.size(); i++) {
+    pending_outputs_.erase(tables[i].number);
+    pending_outputs_.erase(tables[i].meta.number);
+    pending_outputs_.erase(tables[i].value_log);
+  }
+
+  ingesting_ = false;
+  MaybeScheduleCompaction();
+  bg_cv_.SignalAll();
+
+  writers_.pop_front();
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+  return s;
+}
+
+// Set the key range of a table moved into the DB directory.
+Status DBImpl::ReadIngestedTableRange(IngestedTable* t) {
+  FileMetaData* f = &t->meta;
+  Status s = env_->GetFileSize(TableFileName(dbname_, t->number),
+                               &f->file_size);
+  if (!s.ok()) {
+    return s;
+  }
+  Iterator* iter = table_cache_->NewIterator(ReadOptions(), t->number,
+                                             f->file_size);
+  ParsedInternalKey first, last;
+  iter->SeekToFirst();
+  if (iter->Valid()) {
+    f->smallest.DecodeFrom(iter->key());
+    iter->SeekToLast();
+    f->largest.DecodeFrom(iter->key());
+    // Handles are only valid along with a value log
+    const ValueType max_type = (t->value_log != 0) ? kTypeValueIndex
+                                                   : kTypeValue;
+    if (!ParseInternalKey(f->smallest.Encode(), &first) ||
+        !ParseInternalKey(f->largest.Encode(), &last) ||
+        first.sequence != 0 || first.type == kTypeDeletion ||
+        first.type > max_type ||
+        last.sequence != 0 || last.type == kTypeDeletion ||
+        last.type > max_type) {
+      s = Status::InvalidArgument("not a table of TableFileWriter",
+                                  t->source);
+    }
+  } else {
+    s = iter->status();
+    if (s.ok()) {
+      s = Status::InvalidArgument("empty table", t->source);
+    }
+  }
+  delete iter;
+  return s;
+}
+
+// REQUIRES: mutex_ is held
+bool DBImpl::MemTableOverlaps(MemTable* mem, const FileMetaData& f) {
+  mutex_.AssertHeld();
+  if (mem == NULL) {
+    return false;
+  }
+  Iterator* iter = mem->NewIterator();
+  InternalKey start(f.smallest.user_key(), kMaxSequenceNumber,
+                    kValueTypeForSeek);
+  iter->Seek(start.Encode());
+  const bool overlap = iter->Valid() &&
+      user_comparator()->Compare(ExtractUserKey(iter->key()),
+                                 f.largest.user_key()) <= 0;
+  delete iter;
+  return overlap;
+}
+
+// Write again the table t->number, its entries with sequence number
+// seq and its value handles referring to t->value_log, to the table
+// t->meta.number.
+Status DBImpl::RewriteIngestedTable(IngestedTable* t, SequenceNumber seq) {
+  FileMetaData* f = &t->meta;
+  WritableFile* file;
+  Status s = env_->NewWritableFile(TableFileName(dbname_, f->number), &file);
+  if (!s.ok()) {
+    return s;
+  }
+  TableBuilder* builder = new TableBuilder(options_, file);
+  Iterator* iter = table_cache_->NewIterator(ReadOptions(), t->number,
+                                             f->file_size);
+  std::string key, index;
+  for (iter->SeekToFirst(); s.ok() && iter->Valid(); iter->Next()) {
+    ParsedInternalKey ikey;
+    if (!ParseInternalKey(iter->key(), &ikey)) {
+      s = Status::Corruption("bad key in ingested table", t->source);
+      break;
+    }
+    key.clear();
+    AppendInternalKey(&key, ParsedInternalKey(ikey.user_key, seq,
+                                              ikey.type));
+    if (ikey.type == kTypeValueIndex) {
+      Slice input = iter->value();
+      ValueHandle handle;
+      if (t->value_log == 0 || !handle.DecodeFrom(&input).ok()) {
+        s = Status::Corruption("bad value handle in ingested table",
+                               t->source);
+        break;
+      }
+      handle.number = t->value_log;
+      index.clear();
+      handle.EncodeTo(&index);
+      builder->Add(key, index);
+    } else {
+      builder->Add(key, iter->value());
+    }
+    s = builder->status();
+  }
+  if (s.ok()) {
+    s = iter->status();
+  }
+  delete iter;
+  if (s.ok()) {
+    s = builder->Finish();
+    f->file_size = builder->FileSize();
+  } else {
+    builder->Abandon();
+  }
+  delete builder;
+  if (s.ok()) {
+    s = file->Sync();
+  }
+  if (s.ok()) {
+    s = file->Close();
+  }
+  delete file;
+  ParsedInternalKey first, last;
+  ParseInternalKey(f->smallest.Encode(), &first);
+  ParseInternalKey(f->largest.Encode(), &last);
+  const std::string smallest = first.user_key.ToString();
+  const std::string largest = last.user_key.ToString();
+  f->smallest.SetFrom(ParsedInternalKey(smallest, seq, first.type));
+  f->largest.SetFrom(ParsedInternalKey(largest, seq, last.type));
+  return s;
+}
+
 void DBImpl::TEST_CompactRange(int level, const Slice* begin,const Slice* end) {
   assert(level >= 0);
   assert(level + 1 < config::kNumLevels);
@@ -622,6 +1222,32 @@ Status DBImpl::TEST_CompactMemTable() {
   return s;
 }
 
+void DBImpl::RecordTableRead(uint64_t micros) {
+  mutex_.AssertHeld();
+  table_reads_++;
+  table_read_micros_ += micros;
+  MaybeReportLoad();
+}
+
+void DBImpl::MaybeReportLoad() {
+  mutex_.AssertHeld();
+  static const uint64_t kLoadReportMicros = 1000000;
+  if (options_.rate_limiter == NULL) {
+    return;
+  }
+  const uint64_t now = env_->NowMicros();
+  if (now - last_load_report_micros_ < kLoadReportMicros) {
+    return;
+  }
+  const uint64_t read_micros =
+      (table_reads_ > 0) ? table_read_micros_ / table_reads_ : 0;
+  options_.rate_limiter->ReportLoad(read_micros,
+                                    versions_->PendingCompactionBytes());
+  table_reads_ = 0;
+  table_read_micros_ = 0;
+  last_load_report_micros_ = now;
+}
+
 void DBImpl::RecordBackgroundError(const Status& s) {
   mutex_.AssertHeld();
   if (bg_error_.ok()) {
@@ -632,20 +1258,68 @@ void DBImpl::RecordBackgroundError(const Status& s) {
 
 void DBImpl::MaybeScheduleCompaction() {
   mutex_.AssertHeld();
-  if (bg_compaction_scheduled_) {
-    // Already scheduled
-  } else if (shutting_down_.Acquire_Load()) {
+  if (shutting_down_.Acquire_Load()) {
     // DB is being deleted; no more background compactions
+    return;
   } else if (!bg_error_.ok()) {
     // Already got an error; no more changes
-  } else if (imm_ == NULL &&
-             manual_compaction_ == NULL &&
-             !versions_->NeedsCompaction()) {
-    // No work to be done
-  } else {
-    bg_compaction_scheduled_ = true;
-    env_->Schedule(&DBImpl::BGWork, this);
+    return;
+  } else if (ingesting_) {
+    // Tables are being added; rescheduled once done
+    return;
+  }
+
+  // The memtable is compacted first, whatever the other compactions do
+  if (imm_ != NULL && !bg_flush_scheduled_) {
+    bg_flush_scheduled_ = true;
+    env_->ScheduleWithPriority(&DBImpl::BGWorkFlush, this, Env::HIGH);
+  }
+
+  if (manual_compaction_ != NULL) {
+    // The manual compaction runs alone, once the others are done
+    if (bg_compactions_scheduled_ == 0) {
+      queued_compactions_.push_back(NULL);
+      bg_compactions_scheduled_++;
+      env_->ScheduleWithPriority(&DBImpl::BGWork, this, Env::LOW);
+    }
+    return;
+  }
+
+  while (bg_compactions_scheduled_ < options_.max_background_compactions &&
+         versions_->NeedsCompaction()) {
+    Compaction* c = versions_->PickCompaction();
+    if (c == NULL) {
+      // The inputs left are all being compacted
+      break;
+    }
+    active_compactions_.insert(c);
+    queued_compactions_.push_back(c);
+    bg_compactions_scheduled_++;
+    env_->ScheduleWithPriority(&DBImpl::BGWork, this, Env::LOW);
+  }
+}
+
+void DBImpl::BGWorkFlush(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundFlush();
+}
+
+void DBImpl::BackgroundFlush() {
+  MutexLock l(&mutex_);
+  assert(bg_flush_scheduled_);
+  if (shutting_down_.Acquire_Load()) {
+    // No more background work when shutting down.
+  } else if (!bg_error_.ok()) {
+    // No more background work after a background error.
+  } else if (imm_ != NULL && !flushing_imm_) {
+    CompactMemTable();
   }
+
+  bg_flush_scheduled_ = false;
+
+  // The new level-0 file may call for a compaction
+  MaybeScheduleCompaction();
+  MaybeScheduleValueLogGC();
+  bg_cv_.SignalAll();
 }
 
 void DBImpl::BGWork(void* db) {
@@ -654,39 +1328,183 @@ void DBImpl::BGWork(void* db) {
 
 void DBImpl::BackgroundCall() {
   MutexLock l(&mutex_);
-  assert(bg_compaction_scheduled_);
+  assert(bg_compactions_scheduled_ > 0);
+  assert(!queued_compactions_.empty());
+  Compaction* c = queued_compactions_.front();
+  queued_compactions_.pop_front();
   if (shutting_down_.Acquire_Load()) {
     // No more background work when shutting down.
   } else if (!bg_error_.ok()) {
     // No more background work after a background error.
   } else {
-    BackgroundCompaction();
+    BackgroundCompaction(c);
+    c = NULL;
+  }
+  if (c != NULL) {
+    active_compactions_.erase(c);
+    delete c;
+  }
+
+  bg_compactions_scheduled_--;
+  MaybeReportLoad();
+
+  // Previous compaction may have produced too many files in a level,
+  // so reschedule another compaction if needed.
+  MaybeScheduleCompaction();
+  // Or made garbage of enough value log records
+  MaybeScheduleValueLogGC();
+  bg_cv_.SignalAll();
+}
+
+void DBImpl::MaybeScheduleValueLogGC() {
+  mutex_.AssertHeld();
+  uint64_t number;
+  if (bg_gc_scheduled_) {
+    // Already running
+  } else if (shutting_down_.Acquire_Load()) {
+    // DB is being deleted; no more background work
+  } else if (!bg_error_.ok()) {
+    // Already got an error; no more changes
+  } else if (!PickValueLogToRewrite(&number)) {
+    // No work to be done
+  } else {
+    bg_gc_scheduled_ = true;
+    env_->StartThread(&DBImpl::BGWorkValueLogGC, this);
+  }
+}
+
+void DBImpl::BGWorkValueLogGC(void* db) {
+  reinterpret_cast<DBImpl*>(db)->BackgroundValueLogGC();
+}
+
+void DBImpl::BackgroundValueLogGC() {
+  MutexLock l(&mutex_);
+  assert(bg_gc_scheduled_);
+  uint64_t number;
+  while (!shutting_down_.Acquire_Load() && bg_error_.ok() &&
+         PickValueLogToRewrite(&number)) {
+    mutex_.Unlock();
+    Status s = RewriteValueLog(number);
+    mutex_.Lock();
+    // Not retried on error: the records are still read from where they are
+    rewritten_value_logs_.insert(number);
+    Log(options_.info_log, "Value log #%llu: rewritten %s",
+        (unsigned long long) number, s.ToString().c_str());
+  }
+  bg_gc_scheduled_ = false;
+  bg_cv_.SignalAll();
+}
+
+bool DBImpl::PickValueLogToRewrite(uint64_t* number) {
+  mutex_.AssertHeld();
+  const std::map<uint64_t, VersionSet::ValueLogStats>& logs =
+      versions_->value_logs();
+  double best_ratio = 0;
+  for (std::map<uint64_t, VersionSet::ValueLogStats>::const_iterator it =
+           logs.begin();
+       it != logs.end();
+       ++it) {
+    const VersionSet::ValueLogStats& stats = it->second;
+    if (stats.garbage >= stats.file_size ||
+        rewritten_value_logs_.count(it->first) > 0) {
+      continue;
+    }
+    const double ratio = static_cast<double>(stats.garbage) / stats.file_size;
+    if (ratio >= options_.value_log_gc_ratio && ratio > best_ratio) {
+      best_ratio = ratio;
+      *number = it->first;
+    }
+  }
+  return best_ratio > 0;
+}
+
+Status DBImpl::RewriteValueLog(uint64_t number) {
+  SequentialFile* file;
+  Status s = env_->NewSequentialFile(ValueLogFileName(dbname_, number), &file);
+  if (!s.ok()) {
+    return s;
+  }
+  ValueLogReader reader(file, number);
+  ValueLogRewrite rewrite;
+  Slice key, value;
+  ValueHandle handle;
+  bool more = true;
+  while (more && s.ok() && !shutting_down_.Acquire_Load()) {
+    more = reader.Next(&key, &value, &handle);
+    if (more) {
+      rewrite.Add(key, value, handle);
+    }
+    if (!rewrite.keys.empty() &&
+        (!more || rewrite.bytes >= kValueLogRewriteBytes)) {
+      s = WriteImpl(WriteOptions(), &rewrite.batch, &rewrite);
+      rewrite.Clear();
+    }
+  }
+  if (s.ok()) {
+    s = reader.status();
+  }
+  return s;
+}
+
+Status DBImpl::KeepLiveValues(ValueLogRewrite* rewrite) {
+  mutex_.AssertHeld();
+  MemTable* mem = mem_;
+  MemTable* imm = imm_;
+  Version* current = versions_->current();
+  mem->Ref();
+  if (imm != NULL) imm->Ref();
+  current->Ref();
+  const SequenceNumber snapshot = versions_->LastSequence();
+
+  Status s;
+  {
+    mutex_.Unlock();
+    std::string index;
+    for (size_t i = 0; i < rewrite->keys.size() && s.ok(); i++) {
+      LookupKey lkey(rewrite->keys[i], snapshot);
+      Status ignored;
+      if (mem->Contains(lkey, &ignored) ||
+          (imm != NULL && imm->Contains(lkey, &ignored))) {
+        continue;  // Written again since
+      }
+      Version::GetStats stats;
+      Status found = current->GetValueHandle(ReadOptions(), lkey, &index,
+                                             &stats);
+      if (found.IsNotFound()) {
+        continue;  // Deleted, or written again
+      } else if (!found.ok()) {
+        s = found;
+        break;
+      }
+      Slice input(index);
+      ValueHandle handle;
+      if (handle.DecodeFrom(&input).ok() &&
+          handle.number == rewrite->handles[i].number &&
+          handle.offset == rewrite->handles[i].offset) {
+        rewrite->batch.Put(rewrite->keys[i], rewrite->values[i]);
+      }
+    }
+    mutex_.Lock();
   }
 
-  bg_compaction_scheduled_ = false;
-
-  // Previous compaction may have produced too many files in a level,
-  // so reschedule another compaction if needed.
-  MaybeScheduleCompaction();
-  bg_cv_.SignalAll();
+  mem->Unref();
+  if (imm != NULL) imm->Unref();
+  current->Unref();
+  return s;
 }
 
-void DBImpl::BackgroundCompaction() {
+void DBImpl::BackgroundCompaction(Compaction* c) {
   mutex_.AssertHeld();
 
-  if (imm_ != NULL) {
-    CompactMemTable();
-    return;
-  }
-
-  Compaction* c;
-  bool is_manual = (manual_compaction_ != NULL);
+  // A NULL compaction is the manual one, which may have been cancelled
+  bool is_manual = (c == NULL && manual_compaction_ != NULL);
   InternalKey manual_end;
   if (is_manual) {
     ManualCompaction* m = manual_compaction_;
     c = versions_->CompactRange(m->level, m->begin, m->end);
     m->done = (c == NULL);
     if (c != NULL) {
+      active_compactions_.insert(c);
       manual_end = c->input(0, c->num_input_files(0) - 1)->largest;
     }
     Log(options_.info_log,
@@ -695,8 +1513,6 @@ void DBImpl::BackgroundCompaction() {
         (m->begin ? m->begin->DebugString().c_str() : "(begin)"),
         (m->end ? m->end->DebugString().c_str() : "(end)"),
         (m->done ? "(end)" : manual_end.DebugString().c_str()));
-  } else {
-    c = versions_->PickCompaction();
   }
 
   Status status;
@@ -709,7 +1525,7 @@ void DBImpl::BackgroundCompaction() {
     c->edit()->DeleteFile(c->level(), f->number);
     c->edit()->AddFile(c->level() + 1, f->number, f->file_size,
                        f->smallest, f->largest);
-    status = versions_->LogAndApply(c->edit(), &mutex_);
+    status = LogAndApply(c->edit());
     if (!status.ok()) {
       RecordBackgroundError(status);
     }
@@ -727,9 +1543,11 @@ void DBImpl::BackgroundCompaction() {
       RecordBackgroundError(status);
     }
     CleanupCompaction(compact);
+    active_compactions_.erase(c);
     c->ReleaseInputs();
     DeleteObsoleteFiles();
   }
+  active_compactions_.erase(c);
   delete c;
 
   if (status.ok()) {
@@ -796,6 +1614,10 @@ Status DBImpl::OpenCompactionOutputFile(CompactionState* compact) {
   std::string fname = TableFileName(dbname_, file_number);
   Status s = env_->NewWritableFile(fname, &compact->outfile);
   if (s.ok()) {
+    if (options_.rate_limiter != NULL) {
+      compact->outfile = NewRateLimitedFile(compact->outfile,
+                                            options_.rate_limiter, Env::LOW);
+    }
     compact->builder = new TableBuilder(options_, compact->outfile);
   }
   return s;
@@ -871,12 +1693,17 @@ Status DBImpl::InstallCompactionResults(CompactionState* compact) {
         level + 1,
         out.number, out.file_size, out.smallest, out.largest);
   }
-  return versions_->LogAndApply(compact->compaction->edit(), &mutex_);
+  for (std::map<uint64_t, uint64_t>::const_iterator it =
+           compact->value_log_garbage.begin();
+       it != compact->value_log_garbage.end();
+       ++it) {
+    compact->compaction->edit()->AddValueLogGarbage(it->first, it->second);
+  }
+  return LogAndApply(compact->compaction->edit());
 }
 
 Status DBImpl::DoCompactionWork(CompactionState* compact) {
   const uint64_t start_micros = env_->NowMicros();
-  int64_t imm_micros = 0;  // Micros spent doing imm_ compactions
 
   Log(options_.info_log,  "Compacting %d@%d + %d@%d files",
       compact->compaction->num_input_files(0),
@@ -893,11 +1720,126 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     compact->smallest_snapshot = snapshots_.oldest()->number_;
   }
 
+  // Other threads compact the ranges after the first one
+  std::vector<std::string> splits;
+  compact->compaction->GetSplitKeys(options_.max_subcompactions, &splits);
+  std::vector<Subcompaction*> subs(splits.size());
+  for (size_t i = 0; i < splits.size(); i++) {
+    CompactionState* state =
+        new CompactionState(compact->compaction->NewSubcompaction());
+    state->smallest_snapshot = compact->smallest_snapshot;
+    state->start = &splits[i];
+    state->end = (i + 1 < splits.size()) ? &splits[i + 1] : NULL;
+    subs[i] = new Subcompaction;
+    subs[i]->db = this;
+    subs[i]->state = state;
+    subs[i]->done = false;
+    subs[i]->started = false;
+    subs[i]->refs = 2;
+  }
+  if (!splits.empty()) {
+    compact->end = &splits[0];
+    Log(options_.info_log,  "Compacting in %d ranges",
+        static_cast<int>(splits.size()) + 1);
+  }
+
   // Release mutex while we're actually doing the compaction work
   mutex_.Unlock();
+  for (size_t i = 0; i < subs.size(); i++) {
+    env_->ScheduleWithPriority(&DBImpl::BGWorkSubcompaction, subs[i],
+                               Env::LOW);
+  }
+  Status status = DoSubcompactionWork(compact);
+  for (size_t i = 0; i < subs.size(); i++) {
+    RunSubcompaction(subs[i]);
+  }
+  mutex_.Lock();
+
+  // Gather the outputs of the other ranges, in key order
+  for (size_t i = 0; i < subs.size(); i++) {
+    while (!subs[i]->done) {
+      bg_cv_.Wait();
+    }
+    CompactionState* state = subs[i]->state;
+    if (status.ok()) {
+      status = subs[i]->status;
+    }
+    compact->outputs.insert(compact->outputs.end(),
+                            state->outputs.begin(), state->outputs.end());
+    state->outputs.clear();  // Kept in pending_outputs_ by compact
+    for (std::map<uint64_t, uint64_t>::const_iterator it =
+             state->value_log_garbage.begin();
+         it != state->value_log_garbage.end();
+         ++it) {
+      compact->value_log_garbage[it->first] += it->second;
+    }
+    compact->total_bytes += state->total_bytes;
+    Compaction* c = state->compaction;
+    CleanupCompaction(state);
+    delete c;
+    UnrefSubcompaction(subs[i]);
+  }
+
+  CompactionStats stats;
+  stats.micros = env_->NowMicros() - start_micros - compact->imm_micros;
+  for (int which = 0; which < 2; which++) {
+    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
+      stats.bytes_read += compact->compaction->input(which, i)->file_size;
+    }
+  }
+  for (size_t i = 0; i < compact->outputs.size(); i++) {
+    stats.bytes_written += compact->outputs[i].file_size;
+  }
+  stats_[compact->compaction->level() + 1].Add(stats);
+
+  if (status.ok()) {
+    status = InstallCompactionResults(compact);
+  }
+  if (!status.ok()) {
+    RecordBackgroundError(status);
+  }
+  VersionSet::LevelSummaryStorage tmp;
+  Log(options_.info_log,
+      "compacted to: %s", versions_->LevelSummary(&tmp));
+  return status;
+}
+
+void DBImpl::BGWorkSubcompaction(void* arg) {
+  Subcompaction* sub = reinterpret_cast<Subcompaction*>(arg);
+  RunSubcompaction(sub);
+  UnrefSubcompaction(sub);
+}
+
+// Merge the range of *sub, unless another thread started it.  The DB is
+// only used once the range is taken: a range the compaction ran itself
+// may reach the pool after the DB is gone.
+void DBImpl::RunSubcompaction(Subcompaction* sub) {
+  if (sub->started.exchange(true)) {
+    return;
+  }
+  DBImpl* db = sub->db;
+  Status s = db->DoSubcompactionWork(sub->state);
+  MutexLock l(&db->mutex_);
+  sub->status = s;
+  sub->done = true;
+  db->bg_cv_.SignalAll();
+}
 
+void DBImpl::UnrefSubcompaction(Subcompaction* sub) {
+  if (sub->refs.fetch_sub(1) == 1) {
+    delete sub;
+  }
+}
+
+Status DBImpl::DoSubcompactionWork(CompactionState* compact) {
   Iterator* input = versions_->MakeInputIterator(compact->compaction);
-  input->SeekToFirst();
+  if (compact->start != NULL) {
+    InternalKey start(*compact->start, kMaxSequenceNumber,
+                      kValueTypeForSeek);
+    input->Seek(start.Encode());
+  } else {
+    input->SeekToFirst();
+  }
   Status status;
   ParsedInternalKey ikey;
   std::string current_user_key;
@@ -908,15 +1850,20 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     if (has_imm_.NoBarrier_Load() != NULL) {
       const uint64_t imm_start = env_->NowMicros();
       mutex_.Lock();
-      if (imm_ != NULL) {
+      if (imm_ != NULL && !flushing_imm_) {
         CompactMemTable();
         bg_cv_.SignalAll();  // Wakeup MakeRoomForWrite() if necessary
       }
       mutex_.Unlock();
-      imm_micros += (env_->NowMicros() - imm_start);
+      compact->imm_micros += (env_->NowMicros() - imm_start);
     }
 
     Slice key = input->key();
+    if (compact->end != NULL && ParseInternalKey(key, &ikey) &&
+        user_comparator()->Compare(ikey.user_key, *compact->end) >= 0) {
+      // The next range starts here
+      break;
+    }
     if (compact->compaction->ShouldStopBefore(key) &&
         compact->builder != NULL) {
       status = FinishCompactionOutputFile(compact, input);
@@ -959,6 +1906,15 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
       }
 
       last_sequence_for_key = ikey.sequence;
+
+      if (drop && ikey.type == kTypeValueIndex) {
+        // The value log record is no longer referred to
+        Slice input_value = input->value();
+        ValueHandle handle;
+        if (handle.DecodeFrom(&input_value).ok()) {
+          compact->value_log_garbage[handle.number] += handle.size;
+        }
+      }
     }
 #if 0
     Log(options_.info_log,
@@ -1007,31 +1963,6 @@ Status DBImpl::DoCompactionWork(CompactionState* compact) {
     status = input->status();
   }
   delete input;
-  input = NULL;
-
-  CompactionStats stats;
-  stats.micros = env_->NowMicros() - start_micros - imm_micros;
-  for (int which = 0; which < 2; which++) {
-    for (int i = 0; i < compact->compaction->num_input_files(which); i++) {
-      stats.bytes_read += compact->compaction->input(which, i)->file_size;
-    }
-  }
-  for (size_t i = 0; i < compact->outputs.size(); i++) {
-    stats.bytes_written += compact->outputs[i].file_size;
-  }
-
-  mutex_.Lock();
-  stats_[compact->compaction->level() + 1].Add(stats);
-
-  if (status.ok()) {
-    status = InstallCompactionResults(compact);
-  }
-  if (!status.ok()) {
-    RecordBackgroundError(status);
-  }
-  VersionSet::LevelSummaryStorage tmp;
-  Log(options_.info_log,
-      "compacted to: %s", versions_->LevelSummary(&tmp));
   return status;
 }
 
@@ -1119,6 +2050,7 @@ Status DBImpl::Get(const ReadOptions& options,
 
   bool have_stat_update = false;
   Version::GetStats stats;
+  uint64_t read_micros = 0;
 
   // Unlock while reading from files and memtables
   {
@@ -1130,8 +2062,73 @@ Status DBImpl::Get(const ReadOptions& options,
     } else if (imm != NULL && imm->Get(lkey, value, &s)) {
       // Done
     } else {
+      const uint64_t start_micros =
+          (options_.rate_limiter != NULL) ? env_->NowMicros() : 0;
       s = current->Get(options, lkey, value, &stats);
       have_stat_update = true;
+      if (options_.rate_limiter != NULL) {
+        read_micros = env_->NowMicros() - start_micros;
+      }
+    }
+    mutex_.Lock();
+  }
+
+  if (have_stat_update && current->UpdateStats(stats)) {
+    MaybeScheduleCompaction();
+  }
+  if (have_stat_update && options_.rate_limiter != NULL) {
+    RecordTableRead(read_micros);
+  }
+  mem->Unref();
+  if (imm != NULL) imm->Unref();
+  current->Unref();
+  return s;
+}
+
+Status DBImpl::GetPinned(const ReadOptions& options,
+                         const Slice& key,
+                         PinnableSlice* value) {
+  Status s;
+  value->Reset();
+  MutexLock l(&mutex_);
+  SequenceNumber snapshot;
+  if (options.snapshot != NULL) {
+    snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  MemTable* mem = mem_;
+  MemTable* imm = imm_;
+  assert(versions_ != NULL);
+  Version* current = versions_->current();
+  if (mem != NULL) mem->Ref();
+  if (imm != NULL) imm->Ref();
+  assert(current != NULL);
+  current->Ref();
+
+  bool have_stat_update = false;
+  Version::GetStats stats;
+  uint64_t read_micros = 0;
+
+  // Unlock while reading from files and memtables
+  {
+    mutex_.Unlock();
+    // First look in the memtable, then in the immutable memtable (if any).
+    // Memtable entries go away with the memtable: copy them once.
+    LookupKey lkey(key, snapshot);
+    if (mem != NULL && mem->Get(lkey, value->GetSelf(), &s)) {
+      value->PinSelf();
+    } else if (imm != NULL && imm->Get(lkey, value->GetSelf(), &s)) {
+      value->PinSelf();
+    } else {
+      const uint64_t start_micros =
+          (options_.rate_limiter != NULL) ? env_->NowMicros() : 0;
+      s = current->GetPinned(options, lkey, value, &stats);
+      have_stat_update = true;
+      if (options_.rate_limiter != NULL) {
+        read_micros = env_->NowMicros() - start_micros;
+      }
     }
     mutex_.Lock();
   }
@@ -1139,12 +2136,75 @@ Status DBImpl::Get(const ReadOptions& options,
   if (have_stat_update && current->UpdateStats(stats)) {
     MaybeScheduleCompaction();
   }
+  if (have_stat_update && options_.rate_limiter != NULL) {
+    RecordTableRead(read_micros);
+  }
   mem->Unref();
   if (imm != NULL) imm->Unref();
   current->Unref();
   return s;
 }
 
+std::vector<Status> DBImpl::MultiGet(const ReadOptions& options,
+                                     const std::vector<Slice>& keys,
+                                     std::vector<std::string>* values) {
+  std::vector<Status> statuses(keys.size());
+  values->resize(keys.size());
+  MutexLock l(&mutex_);
+  SequenceNumber snapshot;
+  if (options.snapshot != NULL) {
+    snapshot = reinterpret_cast<const SnapshotImpl*>(options.snapshot)->number_;
+  } else {
+    snapshot = versions_->LastSequence();
+  }
+
+  MemTable* mem = mem_;
+  MemTable* imm = imm_;
+  assert(versions_ != NULL);
+  Version* current = versions_->current();
+  if (mem != NULL) mem->Ref();
+  if (imm != NULL) imm->Ref();
+  assert(current != NULL);
+  current->Ref();
+
+  std::vector<Version::GetStats> stats;
+
+  // Unlock while reading from files and memtables
+  {
+    mutex_.Unlock();
+    for (size_t i = 0; i < keys.size(); i++) {
+      Status* s = &statuses[i];
+      std::string* value = &(*values)[i];
+      // First look in the memtable, then in the immutable memtable (if any).
+      LookupKey lkey(keys[i], snapshot);
+      if (mem != NULL && mem->Get(lkey, value, s)) {
+        // Done
+      } else if (imm != NULL && imm->Get(lkey, value, s)) {
+        // Done
+      } else {
+        Version::GetStats key_stats;
+        *s = current->Get(options, lkey, value, &key_stats);
+        stats.push_back(key_stats);
+      }
+    }
+    mutex_.Lock();
+  }
+
+  bool need_compaction = false;
+  for (size_t i = 0; i < stats.size(); i++) {
+    if (current->UpdateStats(stats[i])) {
+      need_compaction = true;
+    }
+  }
+  if (need_compaction) {
+    MaybeScheduleCompaction();
+  }
+  mem->Unref();
+  if (imm != NULL) imm->Unref();
+  current->Unref();
+  return statuses;
+}
+
 Status DBImpl::Contains(const ReadOptions& options,
                         const Slice& key) {
   Status s;
@@ -1212,6 +2272,10 @@ void DBImpl::RecordReadSample(Slice key) {
   }
 }
 
+Status DBImpl::ReadValueLog(const Slice& handle, std::string* value) {
+  return value_log_->Get(ReadOptions(), handle, value);
+}
+
 const Snapshot* DBImpl::GetSnapshot() {
   MutexLock l(&mutex_);
   return snapshots_.New(versions_->LastSequence());
@@ -1232,27 +2296,83 @@ Status DBImpl::Delete(const WriteOptions& options, const Slice& key) {
 }
 
 Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
+  return WriteImpl(options, my_batch, NULL);
+}
+
+Status DBImpl::WriteImpl(const WriteOptions& options, WriteBatch* my_batch,
+                         ValueLogRewrite* rewrite) {
   Writer w(&mutex_);
   w.batch = my_batch;
   w.sync = options.sync;
   w.done = false;
+  w.rewrite = rewrite;
 
   MutexLock l(&mutex_);
   writers_.push_back(&w);
-  while (!w.done && &w != writers_.front()) {
+  if (group_leader_ != NULL && my_batch != NULL) {
+    group_bytes_ += WriteBatchInternal::ByteSize(my_batch);
+    if (group_bytes_ >= options_.max_write_group_size) {
+      group_leader_->cv.Signal();  // The group is full
+    }
+  }
+  while (!w.done && (w.logged || &w != writers_.front())) {
+    if (w.insert_batch) {
+      w.insert_batch = false;
+      MemTable* mem = mem_;
+      mutex_.Unlock();
+      Status s = WriteBatchInternal::InsertIntoConcurrently(my_batch, mem);
+      mutex_.Lock();
+      Writer* leader = w.leader;
+      if (!s.ok() && leader->insert_status.ok()) {
+        leader->insert_status = s;
+      }
+      if (--leader->pending_inserts == 0) {
+        leader->cv.Signal();  // The leader waits for its group
+      }
+      continue;
+    }
     w.cv.Wait();
   }
   if (w.done) {
     return w.status;
   }
 
+  if (w.sync && my_batch != NULL && rewrite == NULL &&
+      options_.group_commit_delay_micros > 0) {
+    GatherWriteGroup(&w);
+  }
+
   // May temporarily unlock and wait.
   Status status = MakeRoomForWrite(my_batch == NULL);
-  uint64_t last_sequence = versions_->LastSequence();
+  if (status.ok() && rewrite != NULL) {
+    // No other write can happen while this one is at the front of the
+    // queue: what is current now is current when written.
+    WaitForPipelinedWrites();
+    status = KeepLiveValues(rewrite);
+    if (WriteBatchInternal::Count(my_batch) == 0) {
+      my_batch = NULL;  // Nothing left to write
+    }
+  }
+  // The groups logged ahead may not be published yet
+  uint64_t last_sequence = applying_.empty() ?
+      versions_->LastSequence() : applying_.back()->last_sequence;
   Writer* last_writer = &w;
   if (status.ok() && my_batch != NULL) {  // NULL batch is for compactions
-    WriteBatch* updates = BuildBatchGroup(&last_writer);
+    bool sync = false;
+    WriteBatch* updates = BuildBatchGroup(&last_writer, &sync);
+    user_bytes_written_ += WriteBatchInternal::ByteSize(updates);
     WriteBatchInternal::SetSequence(updates, last_sequence + 1);
+    // A group of several batches is logged as one record.  Then either
+    // every writer inserts its own batch into the memtable at once, or
+    // the batches are inserted one by one after the merged one is freed
+    // for the next group.  Pipelined groups overlap in the memtable, so
+    // there even a group of one inserts concurrently.
+    const bool pipelined = options_.pipelined_writes;
+    const bool concurrently = options_.concurrent_memtable_writes &&
+                              (pipelined || updates != my_batch);
+    if (concurrently || pipelined) {
+      SetGroupSequences(last_writer, last_sequence + 1);
+    }
     last_sequence += WriteBatchInternal::Count(updates);
 
     // Add to log and apply to memtable.  We can release the lock
@@ -1263,13 +2383,13 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
       mutex_.Unlock();
       status = log_->AddRecord(WriteBatchInternal::Contents(updates));
       bool sync_error = false;
-      if (status.ok() && options.sync) {
+      if (status.ok() && sync) {
         status = logfile_->Sync();
         if (!status.ok()) {
           sync_error = true;
         }
       }
-      if (status.ok()) {
+      if (status.ok() && !concurrently && !pipelined) {
         status = WriteBatchInternal::InsertInto(updates, mem_);
       }
       mutex_.Lock();
@@ -1281,6 +2401,16 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
       }
     }
     if (updates == tmp_batch_) tmp_batch_->Clear();
+    if (pipelined) {
+      return ApplyPipelined(&w, last_writer, last_sequence, status,
+                            concurrently);
+    }
+    if (status.ok() && concurrently) {
+      std::vector<Writer*> group(
+          writers_.begin(),
+          std::find(writers_.begin(), writers_.end(), last_writer) + 1);
+      status = InsertGroupConcurrently(group);
+    }
 
     versions_->SetLastSequence(last_sequence);
   }
@@ -1304,22 +2434,167 @@ Status DBImpl::Write(const WriteOptions& options, WriteBatch* my_batch) {
   return status;
 }
 
+void DBImpl::SetGroupSequences(Writer* last_writer, SequenceNumber sequence) {
+  mutex_.AssertHeld();
+  for (std::deque<Writer*>::iterator iter = writers_.begin(); ; ++iter) {
+    Writer* w = *iter;
+    if (w->batch != NULL) {
+      WriteBatchInternal::SetSequence(w->batch, sequence);
+      sequence += WriteBatchInternal::Count(w->batch);
+    }
+    if (w == last_writer) break;
+  }
+}
+
+Status DBImpl::InsertGroupConcurrently(const std::vector<Writer*>& group) {
+  mutex_.AssertHeld();
+  // mem_ is not switched before the group is in: by the writer at the
+  // front of the queue, after the pipelined groups
+  MemTable* mem = mem_;
+  Writer* leader = group[0];
+  leader->pending_inserts = 0;
+  leader->insert_status = Status::OK();
+  for (size_t i = 1; i < group.size(); i++) {
+    Writer* w = group[i];
+    if (w->batch != NULL) {
+      w->insert_batch = true;
+      w->leader = leader;
+      leader->pending_inserts++;
+      w->cv.Signal();
+    }
+  }
+
+  mutex_.Unlock();
+  Status s = WriteBatchInternal::InsertIntoConcurrently(leader->batch, mem);
+  mutex_.Lock();
+  while (leader->pending_inserts > 0) {
+    leader->cv.Wait();
+  }
+  // The sequence numbers of the group become visible once all are in
+  return s.ok() ? leader->insert_status : s;
+}
+
+// REQUIRES: "leader" is the first writer of the queue
+Status DBImpl::ApplyPipelined(Writer* leader, Writer* last_writer,
+                              SequenceNumber last_sequence,
+                              const Status& status, bool concurrently) {
+  mutex_.AssertHeld();
+  WriteGroup group;
+  group.last_sequence = last_sequence;
+  group.status = status;
+  group.applied = false;
+  group.published = false;
+  while (true) {
+    Writer* w = writers_.front();
+    writers_.pop_front();
+    w->logged = true;
+    group.writers.push_back(w);
+    if (w == last_writer) break;
+  }
+  applying_.push_back(&group);
+  // The next group is logged meanwhile
+  if (!writers_.empty()) {
+    writers_.front()->cv.Signal();
+  }
+
+  if (group.status.ok()) {
+    if (concurrently) {
+      group.status = InsertGroupConcurrently(group.writers);
+    } else {
+      // The groups insert into the memtable one at a time, in log order
+      while (applying_.front() != &group) {
+        leader->cv.Wait();
+      }
+      MemTable* mem = mem_;
+      mutex_.Unlock();
+      Status s;
+      for (size_t i = 0; s.ok() && i < group.writers.size(); i++) {
+        if (group.writers[i]->batch != NULL) {
+          s = WriteBatchInternal::InsertInto(group.writers[i]->batch, mem);
+        }
+      }
+      mutex_.Lock();
+      group.status = s;
+    }
+  }
+  group.applied = true;
+
+  // Publish the sequence numbers of the groups in the memtable, in log
+  // order: a group done before the ones logged ahead waits for them
+  while (!applying_.empty() && applying_.front()->applied) {
+    WriteGroup* g = applying_.front();
+    applying_.pop_front();
+    versions_->SetLastSequence(g->last_sequence);
+    g->published = true;
+    for (size_t i = 1; i < g->writers.size(); i++) {
+      Writer* w = g->writers[i];
+      w->status = g->status;
+      w->done = true;
+      w->cv.Signal();
+    }
+    g->writers[0]->cv.Signal();
+  }
+  if (!applying_.empty()) {
+    applying_.front()->writers[0]->cv.Signal();  // Its turn to insert
+  } else {
+    bg_cv_.SignalAll();  // For WaitForPipelinedWrites()
+  }
+
+  while (!group.published) {
+    leader->cv.Wait();
+  }
+  return group.status;
+}
+
+void DBImpl::WaitForPipelinedWrites() {
+  mutex_.AssertHeld();
+  while (!applying_.empty()) {
+    bg_cv_.Wait();
+  }
+}
+
+// REQUIRES: "leader" is the first writer of the queue
+void DBImpl::GatherWriteGroup(Writer* leader) {
+  mutex_.AssertHeld();
+  assert(writers_.front() == leader);
+  group_leader_ = leader;
+  group_bytes_ = 0;
+  for (std::deque<Writer*>::iterator iter = writers_.begin();
+       iter != writers_.end(); ++iter) {
+    if ((*iter)->batch != NULL) {
+      group_bytes_ += WriteBatchInternal::ByteSize((*iter)->batch);
+    }
+  }
+  const uint64_t deadline = env_->NowMicros() +
+      static_cast<uint64_t>(options_.group_commit_delay_micros);
+  while (group_bytes_ < options_.max_write_group_size &&
+         !shutting_down_.Acquire_Load()) {
+    const uint64_t now = env_->NowMicros();
+    if (now >= deadline) {
+      break;
+    }
+    leader->cv.TimedWait(deadline - now);
+  }
+  group_leader_ = NULL;
+}
+
 // REQUIRES: Writer list must be non-empty
 // REQUIRES: First writer must have a non-NULL batch
-WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
+WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer, bool* sync) {
   assert(!writers_.empty());
   Writer* first = writers_.front();
   WriteBatch* result = first->batch;
   assert(result != NULL);
 
   size_t size = WriteBatchInternal::ByteSize(first->batch);
+  *sync = first->sync;
 
   // Allow the group to grow up to a maximum size, but if the
-  // original write is small, limit the growth so we do not slow
-  // down the small write too much.
-  size_t max_size = 1 << 20;
-  if (size <= (128<<10)) {
-    max_size = size + (128<<10);
+  // original write is small and does not wait for a sync anyway,
+  // limit the growth so we do not slow down the small write too much.
+  size_t max_size = options_.max_write_group_size;
+  if (!first->sync && size <= (128<<10)) {
+    max_size = std::min(max_size, size + (128<<10));
   }
 
   *last_writer = first;
@@ -1327,8 +2602,8 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
   ++iter;  // Advance past "first"
   for (; iter != writers_.end(); ++iter) {
     Writer* w = *iter;
-    if (w->sync && !first->sync) {
-      // Do not include a sync write into a batch handled by a non-sync write.
+    if (w->rewrite != NULL || w->exclusive) {
+      // Needs to be at the front of the queue to check its records.
       break;
     }
 
@@ -1348,6 +2623,8 @@ WriteBatch* DBImpl::BuildBatchGroup(Writer** last_writer) {
       }
       WriteBatchInternal::Append(result, w->batch);
     }
+    // A sync write makes the whole group durable with a single sync.
+    *sync = *sync || w->sync;
     *last_writer = w;
   }
   return result;
@@ -1365,6 +2642,10 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // Yield previous error
       s = bg_error_;
       break;
+    } else if (shutting_down_.Acquire_Load()) {
+      // The background work no longer makes room
+      s = Status::IOError("Deleting DB during write");
+      break;
     } else if (
         allow_delay &&
         versions_->NumLevelFiles(0) >= config::kL0_SlowdownWritesTrigger) {
@@ -1375,9 +2656,12 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // this delay hands over some CPU to the compaction thread in
       // case it is sharing the same core as the writer.
       mutex_.Unlock();
+      const uint64_t start = env_->NowMicros();
       env_->SleepForMicroseconds(1000);
       allow_delay = false;  // Do not delay a single write more than once
       mutex_.Lock();
+      slowdown_stalls_++;
+      stall_micros_ += env_->NowMicros() - start;
     } else if (!force &&
                (mem_ && (mem_->ApproximateMemoryUsage() <= options_.write_buffer_size))) {
       // There is room in current memtable
@@ -1386,11 +2670,20 @@ Status DBImpl::MakeRoomForWrite(bool force) {
       // We have filled up the current memtable, but the previous
       // one is still being compacted, so we wait.
       Log(options_.info_log, "Current memtable full; waiting...\n");
+      const uint64_t start = env_->NowMicros();
       bg_cv_.Wait();
+      memtable_stalls_++;
+      stall_micros_ += env_->NowMicros() - start;
     } else if (versions_->NumLevelFiles(0) >= config::kL0_StopWritesTrigger) {
       // There are too many level-0 files.
       Log(options_.info_log, "Too many L0 files; waiting...\n");
+      const uint64_t start = env_->NowMicros();
       bg_cv_.Wait();
+      level0_stalls_++;
+      stall_micros_ += env_->NowMicros() - start;
+    } else if (!applying_.empty()) {
+      // Groups already logged are still on their way into mem_
+      WaitForPipelinedWrites();
     } else {
       // Attempt to switch to a new memtable and trigger compaction of old
       assert(versions_->PrevLogNumber() == 0);
@@ -1488,6 +2781,42 @@ bool DBImpl::GetProperty(const Slice& property, std::string* value) {
   return false;
 }
 
+void DBImpl::GetStats(DbStats* stats) {
+  MutexLock l(&mutex_);
+  stats->levels.resize(config::kNumLevels);
+  for (int level = 0; level < config::kNumLevels; level++) {
+    LevelStats* s = &stats->levels[level];
+    s->files = versions_->NumLevelFiles(level);
+    s->bytes = versions_->NumLevelBytes(level);
+    s->compaction_micros = stats_[level].micros;
+    s->bytes_read = stats_[level].bytes_read;
+    s->bytes_written = stats_[level].bytes_written;
+  }
+  stats->user_bytes_written = user_bytes_written_;
+  stats->stall_micros = stall_micros_;
+  stats->slowdown_stalls = slowdown_stalls_;
+  stats->memtable_stalls = memtable_stalls_;
+  stats->level0_stalls = level0_stalls_;
+  stats->memtable_bytes = mem_->ApproximateMemoryUsage();
+  if (imm_ != NULL) {
+    stats->memtable_bytes += imm_->ApproximateMemoryUsage();
+  }
+  stats->block_cache_bytes = options_.block_cache->TotalCharge();
+  stats->value_log_files = 0;
+  stats->value_log_bytes = 0;
+  stats->value_log_garbage_bytes = 0;
+  const std::map<uint64_t, VersionSet::ValueLogStats>& logs =
+      versions_->value_logs();
+  for (std::map<uint64_t, VersionSet::ValueLogStats>::const_iterator it =
+           logs.begin();
+       it != logs.end();
+       ++it) {
+    stats->value_log_files++;
+    stats->value_log_bytes += it->second.file_size;
+    stats->value_log_garbage_bytes += it->second.garbage;
+  }
+}
+
 void DBImpl::GetApproximateSizes(
     const Range* range, int n,
     uint64_t* sizes) {
@@ -1535,6 +2864,9 @@ Status DB::Open(const Options& options, const std::string& dbname,
   *dbptr = NULL;
 
   DBImpl* impl = new DBImpl(options, dbname);
+  impl->env_->SetBackgroundThreads(impl->options_.max_background_compactions *
+                                   impl->options_.max_subcompactions,
+                                   Env::LOW);
   impl->mutex_.Lock();
   VersionEdit edit;
   Status s = impl->Recover(&edit); // Handles create_if_missing, error_if_exists
@@ -1553,6 +2885,7 @@ Status DB::Open(const Options& options, const std::string& dbname,
     if (s.ok()) {
       impl->DeleteObsoleteFiles();
       impl->MaybeScheduleCompaction();
+      impl->MaybeScheduleValueLogGC();
     }
   }
   impl->mutex_.Unlock();
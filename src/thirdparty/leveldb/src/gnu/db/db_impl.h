@@ -17,8 +17,11 @@
 
 namespace leveldb {
 
+class Compaction;
+struct FileMetaData;
 class MemTable;
 class TableCache;
+class ValueLog;
 class Version;
 class VersionEdit;
 class VersionSet;
@@ -35,14 +38,22 @@ class DBImpl : public DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key,
                      std::string* value);
+  virtual Status GetPinned(const ReadOptions& options,
+                           const Slice& key,
+                           PinnableSlice* value);
   virtual Status Contains(const ReadOptions& options,
                           const Slice& key);
+  virtual std::vector<Status> MultiGet(const ReadOptions& options,
+                                       const std::vector<Slice>& keys,
+                                       std::vector<std::string>* values);
   virtual Iterator* NewIterator(const ReadOptions&);
   virtual const Snapshot* GetSnapshot();
   virtual void ReleaseSnapshot(const Snapshot* snapshot);
   virtual bool GetProperty(const Slice& property, std::string* value);
+  virtual void GetStats(DbStats* stats);
   virtual void GetApproximateSizes(const Range* range, int n, uint64_t* sizes);
   virtual void CompactRange(const Slice* begin, const Slice* end);
+  virtual Status IngestTables(const std::vector<std::string>& fnames);
 
   // Extra methods (for testing) that are not in the public DB interface
 
@@ -66,10 +77,21 @@ class DBImpl : public DB {
   // bytes.
   void RecordReadSample(Slice key);
 
+  // Read from the value logs the value "handle" refers to.
+  Status ReadValueLog(const Slice& handle, std::string* value);
+
  private:
   friend class DB;
   struct CompactionState;
+  struct Subcompaction;
   struct Writer;
+  struct WriteGroup;
+  struct ValueLogRewrite;
+  struct IngestedTable;
+
+  // Write() applying the records of *rewrite still current, if non-NULL.
+  Status WriteImpl(const WriteOptions& options, WriteBatch* updates,
+                   ValueLogRewrite* rewrite);
 
   Iterator* NewInternalIterator(const ReadOptions&,
                                 SequenceNumber* latest_snapshot,
@@ -97,29 +119,103 @@ class DBImpl : public DB {
                         SequenceNumber* max_sequence)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
-  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base)
+  // If "outputs" is non-NULL, the numbers of the files written are stored
+  // in *outputs and stay in pending_outputs_: the caller erases them once
+  // *edit is applied, as other threads may delete obsolete files meanwhile.
+  Status WriteLevel0Table(MemTable* mem, VersionEdit* edit, Version* base,
+                          std::vector<uint64_t>* outputs = NULL)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   Status MakeRoomForWrite(bool force /* compact even if there is room? */)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
-  WriteBatch* BuildBatchGroup(Writer** last_writer);
+  // Wait, as the synchronous writer at the front of the queue, for
+  // other writers to join its group (see group_commit_delay_micros).
+  void GatherWriteGroup(Writer* leader) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Merge the batches of the writers at the front of the queue.  *sync
+  // is set if any of them asked for a synchronous write.
+  WriteBatch* BuildBatchGroup(Writer** last_writer, bool* sync);
+  // Give every batch of the group, from the front of the queue to
+  // last_writer, its own sequence numbers from "sequence" on.
+  void SetGroupSequences(Writer* last_writer, SequenceNumber sequence)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Have the followers of the group, after its leader group[0], insert
+  // their batch into mem_ while the leader inserts its own, and wait for
+  // them all.
+  Status InsertGroupConcurrently(const std::vector<Writer*>& group)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Take the group just logged out of the writer queue, so that the next
+  // group is logged while this one goes into mem_, and return once its
+  // sequence numbers are published (see pipelined_writes).
+  Status ApplyPipelined(Writer* leader, Writer* last_writer,
+                        SequenceNumber last_sequence,
+                        const Status& status, bool concurrently)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Wait until the groups logged are all in mem_ and published.
+  void WaitForPipelinedWrites() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
   void RecordBackgroundError(const Status& s);
 
+  // Account for a read served from the tables, and report the load to
+  // options_.rate_limiter when due.
+  void RecordTableRead(uint64_t micros) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void MaybeReportLoad() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Apply *edit to the current version.  Unlike VersionSet::LogAndApply()
+  // this can be called by several background threads at once.
+  Status LogAndApply(VersionEdit* edit) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Highest level "level" or above where a table of the given range may
+  // go without overlapping the outputs of the compactions not yet done.
+  int AvoidCompactionOutputs(int level, const Slice& smallest_user_key,
+                             const Slice& largest_user_key)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // The memtable compactions run in the HIGH priority thread pool of the
+  // Env, the other compactions in the LOW one, up to
+  // options_.max_background_compactions at once.
   void MaybeScheduleCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGWorkFlush(void* db);
+  void BackgroundFlush();
   static void BGWork(void* db);
   void BackgroundCall();
-  void  BackgroundCompaction() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  void  BackgroundCompaction(Compaction* c) EXCLUSIVE_LOCKS_REQUIRED(mutex_);
   void CleanupCompaction(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Compact the inputs of compact->compaction, in up to
+  // options_.max_subcompactions ranges of keys compacted in parallel.
   Status DoCompactionWork(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  // Compact the range of keys of "compact", without holding mutex_.
+  Status DoSubcompactionWork(CompactionState* compact);
+  static void BGWorkSubcompaction(void* arg);
+  static void RunSubcompaction(Subcompaction* sub);
+  static void UnrefSubcompaction(Subcompaction* sub);
 
   Status OpenCompactionOutputFile(CompactionState* compact);
   Status FinishCompactionOutputFile(CompactionState* compact, Iterator* input);
   Status InstallCompactionResults(CompactionState* compact)
       EXCLUSIVE_LOCKS_REQUIRED(mutex_);
 
+  // Garbage collection of the value logs: a value log holding too much
+  // garbage is read, and its records still the newest value of their
+  // key are written again, to a new value log at the next memtable
+  // compaction.  The value log is deleted when compactions dropped all
+  // the entries referring to it.
+  void MaybeScheduleValueLogGC() EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  static void BGWorkValueLogGC(void* db);
+  void BackgroundValueLogGC();
+  bool PickValueLogToRewrite(uint64_t* number)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status RewriteValueLog(uint64_t number);
+  Status KeepLiveValues(ValueLogRewrite* rewrite)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+
+  // Ingestion of the table files built by TableFileWriter
+  Status ReadIngestedTableRange(IngestedTable* table);
+  bool MemTableOverlaps(MemTable* mem, const FileMetaData& f)
+      EXCLUSIVE_LOCKS_REQUIRED(mutex_);
+  Status RewriteIngestedTable(IngestedTable* table, SequenceNumber seq);
+
   // Constant after construction
   Env* const env_;
   const InternalKeyComparator internal_comparator_;
@@ -132,6 +228,9 @@ class DBImpl : public DB {
   // table_cache_ provides its own synchronization
   TableCache* table_cache_;
 
+  // value_log_ provides its own synchronization
+  ValueLog* value_log_;
+
   // Lock over the persistent DB state.  Non-NULL iff successfully acquired.
   FileLock* db_lock_;
 
@@ -150,6 +249,9 @@ class DBImpl : public DB {
   // Queue of writers.
   std::deque<Writer*> writers_;
   WriteBatch* tmp_batch_;
+  Writer* group_leader_;         // Non-NULL while gathering a group
+  size_t group_bytes_;           // Bytes queued since then
+  std::deque<WriteGroup*> applying_;  // Logged, in log order, not published
 
   SnapshotList snapshots_;
 
@@ -157,8 +259,35 @@ class DBImpl : public DB {
   // part of ongoing compactions.
   std::set<uint64_t> pending_outputs_;
 
-  // Has a background compaction been scheduled or is running?
-  bool bg_compaction_scheduled_;
+  // Number of background compactions scheduled or running
+  int bg_compactions_scheduled_;
+
+  // Has a memtable compaction been scheduled or is running?
+  bool bg_flush_scheduled_;
+
+  // Is CompactMemTable() running, in any thread?
+  bool flushing_imm_;
+
+  // Is a version edit being written to the MANIFEST?
+  bool applying_edit_;
+
+  // Compactions picked for the scheduled BackgroundCall(), in order.  A
+  // NULL entry stands for the manual compaction.
+  std::deque<Compaction*> queued_compactions_;
+
+  // Compactions picked and not yet done, whose inputs are marked as being
+  // compacted.
+  std::set<Compaction*> active_compactions_;
+
+  // Is the value log garbage collection running?
+  bool bg_gc_scheduled_;
+
+  // Are tables being ingested?  No compaction is scheduled meanwhile.
+  bool ingesting_;
+
+  // Value logs already rewritten, waiting for the compactions to drop
+  // the entries referring to them.
+  std::set<uint64_t> rewritten_value_logs_;
 
   // Information for a manual compaction
   struct ManualCompaction {
@@ -192,6 +321,19 @@ class DBImpl : public DB {
   };
   CompactionStats stats_[config::kNumLevels];
 
+  // Bytes of the write batches and time spent stalled by MakeRoomForWrite.
+  uint64_t user_bytes_written_;
+  uint64_t stall_micros_;
+  uint64_t slowdown_stalls_;
+  uint64_t memtable_stalls_;
+  uint64_t level0_stalls_;
+
+  // Reads served from the tables since the last report of the load to
+  // options_.rate_limiter, and their total latency.
+  uint64_t table_reads_;
+  uint64_t table_read_micros_;
+  uint64_t last_load_report_micros_;
+
   // No copying allowed
   DBImpl(const DBImpl&);
   void operator=(const DBImpl&);
@@ -54,6 +54,7 @@ class DBIter: public Iterator {
         user_comparator_(cmp),
         iter_(iter),
         sequence_(s),
+        saved_type_(kTypeDeletion),
         direction_(kForward),
         valid_(false),
         rnd_(seed),
@@ -69,13 +70,25 @@ class DBIter: public Iterator {
   }
   virtual Slice value() const {
     assert(valid_);
-    return (direction_ == kForward) ? iter_->value() : saved_value_;
+    if (direction_ == kForward) {
+      if (ExtractValueType(iter_->key()) == kTypeValueIndex) {
+        return ReadValueLog(iter_->value());
+      }
+      return iter_->value();
+    } else {
+      if (saved_type_ == kTypeValueIndex) {
+        return ReadValueLog(saved_value_);
+      }
+      return saved_value_;
+    }
   }
   virtual Status status() const {
-    if (status_.ok()) {
-      return iter_->status();
-    } else {
+    if (!status_.ok()) {
       return status_;
+    } else if (!value_status_.ok()) {
+      return value_status_;
+    } else {
+      return iter_->status();
     }
   }
 
@@ -90,6 +103,10 @@ class DBIter: public Iterator {
   void FindPrevUserEntry();
   bool ParseKey(ParsedInternalKey* key);
 
+  // Value of the current entry, which refers to a value log.  Read once
+  // per entry, when first asked for.
+  Slice ReadValueLog(const Slice& handle) const;
+
   inline void SaveKey(const Slice& k, std::string* dst) {
     dst->assign(k.data(), k.size());
   }
@@ -116,17 +133,34 @@ class DBIter: public Iterator {
   Status status_;
   std::string saved_key_;     // == current key when direction_==kReverse
   std::string saved_value_;   // == current raw value when direction_==kReverse
+  ValueType saved_type_;      // == current type when direction_==kReverse
   Direction direction_;
   bool valid_;
 
   Random rnd_;
   ssize_t bytes_counter_;
 
+  // Last value read from a value log, and its handle
+  mutable std::string log_handle_;
+  mutable std::string log_value_;
+  mutable Status value_status_;
+
   // No copying allowed
   DBIter(const DBIter&);
   void operator=(const DBIter&);
 };
 
+Slice DBIter::ReadValueLog(const Slice& handle) const {
+  if (handle != Slice(log_handle_)) {
+    log_handle_.assign(handle.data(), handle.size());
+    Status s = db_->ReadValueLog(handle, &log_value_);
+    if (!s.ok() && value_status_.ok()) {
+      value_status_ = s;
+    }
+  }
+  return log_value_;
+}
+
 inline bool DBIter::ParseKey(ParsedInternalKey* ikey) {
   Slice k = iter_->key();
   ssize_t n = k.size() + iter_->value().size();
@@ -185,6 +219,7 @@ void DBIter::FindNextUserEntry(bool skipping, std::string* skip) {
           skipping = true;
           break;
         case kTypeValue:
+        case kTypeValueIndex:
           if (skipping &&
               user_comparator_->Compare(ikey.user_key, *skip) <= 0) {
             // Entry hidden
@@ -254,6 +289,7 @@ void DBIter::FindPrevUserEntry() {
           }
           SaveKey(ExtractUserKey(iter_->key()), &saved_key_);
           saved_value_.assign(raw_value.data(), raw_value.size());
+          saved_type_ = value_type;
         }
       }
       iter_->Prev();
@@ -10,7 +10,9 @@
 #include "db/write_batch_internal.h"
 #include "leveldb/cache.h"
 #include "leveldb/env.h"
+#include "leveldb/rate_limiter.h"
 #include "leveldb/table.h"
+#include "leveldb/table_file_writer.h"
 #include "util/hash.h"
 #include "util/logging.h"
 #include "util/mutexlock.h"
@@ -78,6 +80,11 @@ class SpecialEnv : public EnvWrapper {
   bool count_random_reads_;
   AtomicCounter random_read_counter_;
 
+  AtomicCounter data_sync_counter_;
+
+  // Work scheduled in the LOW priority pool
+  AtomicCounter low_scheduled_counter_;
+
   explicit SpecialEnv(Env* base) : EnvWrapper(base) {
     delay_data_sync_.Release_Store(NULL);
     data_sync_error_.Release_Store(NULL);
@@ -117,6 +124,7 @@ class SpecialEnv : public EnvWrapper {
         while (env_->delay_data_sync_.Acquire_Load() != NULL) {
           DelayMilliseconds(100);
         }
+        env_->data_sync_counter_.Increment();
         return base_->Sync();
       }
     };
@@ -161,6 +169,13 @@ class SpecialEnv : public EnvWrapper {
     return s;
   }
 
+  void ScheduleWithPriority(void (*f)(void*), void* a, Priority pri) {
+    if (pri == LOW) {
+      low_scheduled_counter_.Increment();
+    }
+    target()->ScheduleWithPriority(f, a, pri);
+  }
+
   Status NewRandomAccessFile(const std::string& f, RandomAccessFile** r) {
     class CountingFile : public RandomAccessFile {
      private:
@@ -194,7 +209,12 @@ class DBTest {
   enum OptionConfig {
     kDefault,
     kFilter,
+    kFullFilter,
+    kPartitionedFilter,
     kUncompressed,
+    kConcurrentMemtableWrites,
+    kPipelinedWrites,
+    kPipelinedConcurrentWrites,
     kEnd
   };
   int option_config_;
@@ -241,9 +261,28 @@ class DBTest {
       case kFilter:
         options.filter_policy = filter_policy_;
         break;
+      case kFullFilter:
+        options.filter_policy = filter_policy_;
+        options.whole_table_filter = true;
+        break;
+      case kPartitionedFilter:
+        options.filter_policy = filter_policy_;
+        options.whole_table_filter = true;
+        options.filter_partition_keys = 4;
+        break;
       case kUncompressed:
         options.compression = kNoCompression;
         break;
+      case kConcurrentMemtableWrites:
+        options.concurrent_memtable_writes = true;
+        break;
+      case kPipelinedWrites:
+        options.pipelined_writes = true;
+        break;
+      case kPipelinedConcurrentWrites:
+        options.pipelined_writes = true;
+        options.concurrent_memtable_writes = true;
+        break;
       default:
         break;
     }
@@ -1056,6 +1095,98 @@ static bool Between(uint64_t val, uint64_t low, uint64_t high) {
   return result;
 }
 
+TEST(DBTest, GetStats) {
+  ASSERT_OK(Put("foo", "v1"));
+  ASSERT_OK(Put("bar", "v2"));
+  DbStats stats;
+  db_->GetStats(&stats);
+  ASSERT_EQ(config::kNumLevels, static_cast<int>(stats.levels.size()));
+  ASSERT_GT(stats.user_bytes_written, 0);
+  ASSERT_GT(stats.memtable_bytes, 0);
+  ASSERT_EQ(0, stats.stall_micros);
+
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_EQ("v1", Get("foo"));
+  db_->GetStats(&stats);
+  int files = 0;
+  uint64_t written = 0;
+  for (int level = 0; level < config::kNumLevels; level++) {
+    ASSERT_EQ(NumTableFilesAtLevel(level), stats.levels[level].files);
+    files += stats.levels[level].files;
+    written += stats.levels[level].bytes_written;
+  }
+  ASSERT_EQ(1, files);
+  ASSERT_GT(written, 0);
+}
+
+TEST(DBTest, ValueLog) {
+  Options options = CurrentOptions();
+  options.value_log_threshold = 1000;
+  options.value_log_gc_ratio = 0.25;
+  options.create_if_missing = true;
+  DestroyAndReopen(&options);
+
+  const std::string big1(5000, 'a');
+  const std::string big2(6000, 'b');
+  ASSERT_OK(Put("big", big1));
+  ASSERT_OK(Put("small", "v1"));
+  dbfull()->TEST_CompactMemTable();
+  DbStats stats;
+  db_->GetStats(&stats);
+  ASSERT_EQ(1, stats.value_log_files);
+  ASSERT_GT(stats.value_log_bytes, big1.size());
+  ASSERT_EQ(0, stats.value_log_garbage_bytes);
+  ASSERT_EQ(big1, Get("big"));
+  ASSERT_EQ("v1", Get("small"));
+
+  Reopen(&options);
+  ASSERT_EQ(big1, Get("big"));
+  // Values read from a log are pinned in the block cache.
+  PinnableSlice pinned;
+  ASSERT_OK(db_->GetPinned(ReadOptions(), "big", &pinned));
+  ASSERT_TRUE(pinned.IsPinned());
+  ASSERT_EQ(big1, pinned.data().ToString());
+  pinned.Reset();
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  iter->SeekToLast();
+  ASSERT_TRUE(iter->Valid());
+  iter->Prev();
+  ASSERT_EQ("big", iter->key().ToString());
+  ASSERT_EQ(big1, iter->value().ToString());
+  ASSERT_OK(iter->status());
+  delete iter;
+
+  // Overwriting the value turns the first log into garbage, the
+  // compaction dropping the old handle then deletes it.
+  ASSERT_OK(Put("big", big2));
+  db_->CompactRange(NULL, NULL);
+  ASSERT_EQ(big2, Get("big"));
+  db_->GetStats(&stats);
+  ASSERT_EQ(1, stats.value_log_files);
+  ASSERT_EQ(0, stats.value_log_garbage_bytes);
+
+  // A log mostly holding garbage has its live values rewritten.
+  ASSERT_OK(Put("k1", big1));
+  ASSERT_OK(Put("k2", big1));
+  dbfull()->TEST_CompactMemTable();
+  ASSERT_OK(Put("k1", big2));
+  db_->CompactRange(NULL, NULL);
+  for (int i = 0; i < 100; i++) {
+    db_->GetStats(&stats);
+    if (stats.value_log_garbage_bytes == 0) {
+      break;
+    }
+    env_->SleepForMicroseconds(10000);
+    db_->CompactRange(NULL, NULL);
+  }
+  ASSERT_EQ(0, stats.value_log_garbage_bytes);
+  ASSERT_EQ(big1, Get("k2"));
+  ASSERT_EQ(big2, Get("k1"));
+  ASSERT_EQ(big2, Get("big"));
+  Reopen(&options);
+  ASSERT_EQ(big1, Get("k2"));
+}
+
 TEST(DBTest, ApproximateSizes) {
   do {
     Options options = CurrentOptions();
@@ -1593,6 +1724,505 @@ TEST(DBTest, WriteSyncError) {
   ASSERT_EQ("NOT_FOUND", Get("k3"));
 }
 
+namespace {
+
+struct GroupCommitThread {
+  DB* db;
+  int id;
+  port::AtomicPointer done;
+};
+
+static void GroupCommitBody(void* arg) {
+  GroupCommitThread* t = reinterpret_cast<GroupCommitThread*>(arg);
+  WriteOptions w;
+  w.sync = true;
+  for (int i = 0; i < 20; i++) {
+    char key[20];
+    snprintf(key, sizeof(key), "%d.%d", t->id, i);
+    ASSERT_OK(t->db->Put(w, key, std::string(100, 'v')));
+  }
+  t->done.Release_Store(t);
+}
+
+}  // namespace
+
+TEST(DBTest, GroupCommit) {
+  // Concurrent sync writes share the log syncs
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.group_commit_delay_micros = 20000;
+  Reopen(&options);
+  env_->data_sync_counter_.Reset();
+
+  const int kThreads = 8;
+  GroupCommitThread thread[kThreads];
+  for (int id = 0; id < kThreads; id++) {
+    thread[id].db = db_;
+    thread[id].id = id;
+    thread[id].done.Release_Store(NULL);
+    env_->StartThread(GroupCommitBody, &thread[id]);
+  }
+  for (int id = 0; id < kThreads; id++) {
+    while (thread[id].done.Acquire_Load() == NULL) {
+      DelayMilliseconds(10);
+    }
+  }
+  ASSERT_LT(env_->data_sync_counter_.Read(), kThreads * 20 / 2);
+  for (int id = 0; id < kThreads; id++) {
+    for (int i = 0; i < 20; i++) {
+      char key[20];
+      snprintf(key, sizeof(key), "%d.%d", id, i);
+      ASSERT_EQ(std::string(100, 'v'), Get(key));
+    }
+  }
+
+  // A full group does not wait for the delay
+  options.max_write_group_size = 64 << 10;
+  options.group_commit_delay_micros = 10000000;
+  Reopen(&options);
+  const uint64_t start = env_->NowMicros();
+  WriteOptions w;
+  w.sync = true;
+  ASSERT_OK(db_->Put(w, "big", std::string(100 << 10, 'x')));
+  ASSERT_LT(env_->NowMicros() - start, 5000000);
+}
+
+TEST(DBTest, ConcurrentMemtableWrites) {
+  // The writers of a group insert their own batch, after the leader
+  // logged them all
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.group_commit_delay_micros = 20000;
+  options.concurrent_memtable_writes = true;
+  Reopen(&options);
+
+  const int kThreads = 8;
+  GroupCommitThread thread[kThreads];
+  for (int id = 0; id < kThreads; id++) {
+    thread[id].db = db_;
+    thread[id].id = id;
+    thread[id].done.Release_Store(NULL);
+    env_->StartThread(GroupCommitBody, &thread[id]);
+  }
+  for (int id = 0; id < kThreads; id++) {
+    while (thread[id].done.Acquire_Load() == NULL) {
+      DelayMilliseconds(10);
+    }
+  }
+  for (int id = 0; id < kThreads; id++) {
+    for (int i = 0; i < 20; i++) {
+      char key[20];
+      snprintf(key, sizeof(key), "%d.%d", id, i);
+      ASSERT_EQ(std::string(100, 'v'), Get(key));
+    }
+  }
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    count++;
+  }
+  delete iter;
+  ASSERT_EQ(kThreads * 20, count);
+
+  // And all are found again in the log
+  Reopen(&options);
+  for (int id = 0; id < kThreads; id++) {
+    char key[20];
+    snprintf(key, sizeof(key), "%d.%d", id, 19);
+    ASSERT_EQ(std::string(100, 'v'), Get(key));
+  }
+}
+
+TEST(DBTest, PipelinedWrites) {
+  // A group is logged while the one before goes into the memtable, with
+  // or without its writers inserting at once
+  for (int concurrently = 0; concurrently < 2; concurrently++) {
+    Options options = CurrentOptions();
+    options.env = env_;
+    options.group_commit_delay_micros = 20000;
+    options.pipelined_writes = true;
+    options.concurrent_memtable_writes = (concurrently != 0);
+    options.create_if_missing = true;
+    DestroyAndReopen(&options);
+
+    const int kThreads = 8;
+    GroupCommitThread thread[kThreads];
+    for (int id = 0; id < kThreads; id++) {
+      thread[id].db = db_;
+      thread[id].id = id;
+      thread[id].done.Release_Store(NULL);
+      env_->StartThread(GroupCommitBody, &thread[id]);
+    }
+    for (int id = 0; id < kThreads; id++) {
+      while (thread[id].done.Acquire_Load() == NULL) {
+        DelayMilliseconds(10);
+      }
+    }
+    for (int id = 0; id < kThreads; id++) {
+      for (int i = 0; i < 20; i++) {
+        char key[20];
+        snprintf(key, sizeof(key), "%d.%d", id, i);
+        ASSERT_EQ(std::string(100, 'v'), Get(key));
+      }
+    }
+
+    // A snapshot sees every write done before it
+    ASSERT_OK(Put("last", "v1"));
+    const Snapshot* snapshot = db_->GetSnapshot();
+    ASSERT_OK(Put("last", "v2"));
+    ASSERT_EQ("v1", Get("last", snapshot));
+    ASSERT_EQ("v2", Get("last"));
+    db_->ReleaseSnapshot(snapshot);
+
+    Reopen(&options);
+    for (int id = 0; id < kThreads; id++) {
+      char key[20];
+      snprintf(key, sizeof(key), "%d.%d", id, 19);
+      ASSERT_EQ(std::string(100, 'v'), Get(key));
+    }
+    ASSERT_EQ("v2", Get("last"));
+  }
+}
+
+namespace {
+
+// Alternate the small writes with ones too big to share a group
+static void MixedGroupBody(void* arg) {
+  GroupCommitThread* t = reinterpret_cast<GroupCommitThread*>(arg);
+  WriteOptions w;
+  w.sync = true;
+  for (int i = 0; i < 20; i++) {
+    char key[20];
+    snprintf(key, sizeof(key), "%d.%d", t->id, i);
+    const size_t n = ((t->id + i) % 2 == 0) ? 100 : (64 << 10);
+    ASSERT_OK(t->db->Put(w, key, std::string(n, 'v')));
+  }
+  t->done.Release_Store(t);
+}
+
+}  // namespace
+
+TEST(DBTest, PipelinedMixedGroups) {
+  // The groups of one writer insert concurrently too, as the groups
+  // of several may be in the memtable at the same time
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.group_commit_delay_micros = 20000;
+  options.max_write_group_size = 64 << 10;
+  options.pipelined_writes = true;
+  options.concurrent_memtable_writes = true;
+  Reopen(&options);
+
+  const int kThreads = 8;
+  GroupCommitThread thread[kThreads];
+  for (int id = 0; id < kThreads; id++) {
+    thread[id].db = db_;
+    thread[id].id = id;
+    thread[id].done.Release_Store(NULL);
+    env_->StartThread(MixedGroupBody, &thread[id]);
+  }
+  for (int id = 0; id < kThreads; id++) {
+    while (thread[id].done.Acquire_Load() == NULL) {
+      DelayMilliseconds(10);
+    }
+  }
+  for (int id = 0; id < kThreads; id++) {
+    for (int i = 0; i < 20; i++) {
+      char key[20];
+      snprintf(key, sizeof(key), "%d.%d", id, i);
+      const size_t n = ((id + i) % 2 == 0) ? 100 : (64 << 10);
+      ASSERT_EQ(std::string(n, 'v'), Get(key));
+    }
+  }
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    count++;
+  }
+  delete iter;
+  ASSERT_EQ(kThreads * 20, count);
+}
+
+namespace {
+
+// Write to fname a table of the keys prefix000..prefix<n-1>.
+static Status WriteTableFile(const Options& options, const std::string& fname,
+                             const std::string& prefix, int n,
+                             const std::string& value) {
+  TableFileWriter writer(options, fname);
+  for (int i = 0; i < n; i++) {
+    char key[100];
+    snprintf(key, sizeof(key), "%s%03d", prefix.c_str(), i);
+    Status s = writer.Add(key, value);
+    if (!s.ok()) {
+      return s;
+    }
+  }
+  return writer.Finish();
+}
+
+}  // namespace
+
+TEST(DBTest, IngestTables) {
+  do {
+    Options options = CurrentOptions();
+    const std::string f1 = dbname_ + "_ingest1";
+    const std::string f2 = dbname_ + "_ingest2";
+    ASSERT_OK(Put("a000", "old"));
+    ASSERT_OK(Put("m", "memtable"));
+
+    // Out of order keys are refused
+    {
+      TableFileWriter writer(options, f1);
+      ASSERT_OK(writer.Add("b", "v"));
+      ASSERT_TRUE(!writer.Add("a", "v").ok());
+      ASSERT_EQ(1, writer.NumEntries());
+    }
+    ASSERT_TRUE(!env_->FileExists(f1));
+
+    // Overlapping nothing: moved as is to the last level
+    ASSERT_OK(WriteTableFile(options, f1, "x", 100, "bulk"));
+    std::vector<std::string> files;
+    files.push_back(f1);
+    ASSERT_OK(db_->IngestTables(files));
+    ASSERT_TRUE(!env_->FileExists(f1));
+    ASSERT_EQ(1, NumTableFilesAtLevel(config::kNumLevels - 1));
+    ASSERT_EQ("bulk", Get("x042"));
+    ASSERT_EQ("memtable", Get("m"));
+
+    // Tables overlapping each other are refused and left in place
+    ASSERT_OK(WriteTableFile(options, f1, "c", 10, "v1"));
+    ASSERT_OK(WriteTableFile(options, f2, "c", 10, "v2"));
+    files.push_back(f2);
+    ASSERT_TRUE(!db_->IngestTables(files).ok());
+    ASSERT_TRUE(env_->FileExists(f1));
+    ASSERT_TRUE(env_->FileExists(f2));
+    ASSERT_EQ("NOT_FOUND", Get("c001"));
+    env_->DeleteFile(f2);
+    files.pop_back();
+
+    // Overlapping the memtable: newer than it, older than the snapshot
+    const Snapshot* snapshot = db_->GetSnapshot();
+    ASSERT_OK(WriteTableFile(options, f1, "a", 10, "new"));
+    ASSERT_OK(db_->IngestTables(files));
+    ASSERT_EQ("new", Get("a000"));
+    ASSERT_EQ("new", Get("a009"));
+    ASSERT_EQ("old", Get("a000", snapshot));
+    ASSERT_EQ("NOT_FOUND", Get("a001", snapshot));
+    db_->ReleaseSnapshot(snapshot);
+    ASSERT_OK(Put("a000", "newer"));
+    ASSERT_EQ("newer", Get("a000"));
+
+    Reopen();
+    ASSERT_EQ("newer", Get("a000"));
+    ASSERT_EQ("new", Get("a005"));
+    ASSERT_EQ("bulk", Get("x099"));
+    ASSERT_EQ("memtable", Get("m"));
+    db_->CompactRange(NULL, NULL);
+    ASSERT_EQ("newer", Get("a000"));
+    ASSERT_EQ("new", Get("a005"));
+    ASSERT_EQ("bulk", Get("x000"));
+  } while (ChangeOptions());
+}
+
+TEST(DBTest, IngestTablesSnapshot) {
+  // A snapshot taken before does not see the ingested keys, even from a
+  // table overlapping nothing
+  Options options = CurrentOptions();
+  const std::string f1 = dbname_ + "_ingest1";
+  ASSERT_OK(Put("a", "old"));
+  const Snapshot* snapshot = db_->GetSnapshot();
+  ASSERT_OK(WriteTableFile(options, f1, "x", 10, "bulk"));
+  std::vector<std::string> files;
+  files.push_back(f1);
+  ASSERT_OK(db_->IngestTables(files));
+  ASSERT_EQ(1, NumTableFilesAtLevel(config::kNumLevels - 1));
+  ASSERT_EQ("bulk", Get("x005"));
+  ASSERT_EQ("NOT_FOUND", Get("x005", snapshot));
+  ASSERT_EQ("old", Get("a", snapshot));
+  db_->ReleaseSnapshot(snapshot);
+
+  Reopen();
+  ASSERT_EQ("bulk", Get("x005"));
+  ASSERT_OK(Put("x005", "newer"));
+  db_->CompactRange(NULL, NULL);
+  ASSERT_EQ("newer", Get("x005"));
+  ASSERT_EQ("bulk", Get("x006"));
+}
+
+TEST(DBTest, IngestTablesValueLog) {
+  Options options = CurrentOptions();
+  options.value_log_threshold = 1000;
+  options.create_if_missing = true;
+  DestroyAndReopen(&options);
+  const std::string f1 = dbname_ + "_ingest1";
+  const std::string f2 = dbname_ + "_ingest2";
+  const std::string big(2000, 'v');
+  ASSERT_OK(Put("a000", "old"));
+
+  // The large values go to a value log moved in with the table
+  ASSERT_OK(WriteTableFile(options, f1, "x", 10, big));
+  ASSERT_TRUE(env_->FileExists(TableFileWriter::ValueLogName(f1)));
+  {
+    TableFileWriter writer(options, f2);
+    ASSERT_OK(writer.Add("b", "small"));
+    ASSERT_OK(writer.Add("c", big));
+    ASSERT_GT(writer.ValueLogSize(), big.size());
+    ASSERT_LT(writer.FileSize(), big.size());
+    ASSERT_OK(writer.Finish());
+  }
+  std::vector<std::string> files;
+  files.push_back(f1);
+  files.push_back(f2);
+  ASSERT_OK(db_->IngestTables(files));
+  ASSERT_TRUE(!env_->FileExists(TableFileWriter::ValueLogName(f1)));
+  ASSERT_TRUE(!env_->FileExists(TableFileWriter::ValueLogName(f2)));
+  DbStats stats;
+  db_->GetStats(&stats);
+  ASSERT_EQ(2, stats.value_log_files);
+  ASSERT_EQ(big, Get("x005"));
+  ASSERT_EQ(big, Get("c"));
+  ASSERT_EQ("small", Get("b"));
+
+  // Overlapping the memtable: rewritten with the same value log
+  ASSERT_OK(WriteTableFile(options, f1, "a", 10, big));
+  files.pop_back();
+  ASSERT_OK(db_->IngestTables(files));
+  ASSERT_EQ(big, Get("a000"));
+  db_->GetStats(&stats);
+  ASSERT_EQ(3, stats.value_log_files);
+
+  Reopen(&options);
+  ASSERT_EQ(big, Get("a009"));
+  ASSERT_EQ(big, Get("x009"));
+  db_->CompactRange(NULL, NULL);
+  ASSERT_EQ(big, Get("a000"));
+  ASSERT_EQ(big, Get("c"));
+  db_->GetStats(&stats);
+  ASSERT_EQ(3, stats.value_log_files);
+}
+
+TEST(DBTest, ConcurrentCompactions) {
+  // Compactions of disjoint ranges run together, next to the memtable
+  // compactions, without losing or resurrecting entries
+  Options options = CurrentOptions();
+  options.write_buffer_size = 20000;
+  options.max_background_compactions = 4;
+  Reopen(&options);
+
+  const int kNum = 4000;
+  Random rnd(301);
+  std::vector<std::string> values(kNum);
+  for (int round = 0; round < 3; round++) {
+    for (int n = 0; n < kNum; n++) {
+      const int i = (n * 7919) % kNum;
+      if (round == 2 && i % 5 == 0) {
+        ASSERT_OK(Delete(Key(i)));
+        values[i] = "NOT_FOUND";
+      } else {
+        values[i] = RandomString(&rnd, 100);
+        ASSERT_OK(Put(Key(i), values[i]));
+      }
+    }
+  }
+  for (int i = 0; i < kNum; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+  ASSERT_GT(TotalTableFiles(), 1);
+
+  db_->CompactRange(NULL, NULL);
+  for (int i = 0; i < kNum; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+  Reopen(&options);
+  for (int i = 0; i < kNum; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+}
+
+TEST(DBTest, Subcompactions) {
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.max_subcompactions = 4;
+  Reopen(&options);
+
+  // Level-1 made of files of 32MB, 70MB in all
+  const int kNum = 70000;
+  Random rnd(301);
+  std::vector<std::string> values(kNum);
+  for (int n = 0; n < kNum; n++) {
+    const int i = (n * 7919) % kNum;
+    values[i] = RandomString(&rnd, 1000);
+    ASSERT_OK(Put(Key(i), values[i]));
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ(3, NumTableFilesAtLevel(1));
+
+  // Compacted into it in two ranges of at least one file each, the
+  // second one in the LOW priority pool
+  env_->low_scheduled_counter_.Reset();
+  for (int i = 0; i < kNum; i += 3) {
+    if (i % 2 == 0) {
+      ASSERT_OK(Delete(Key(i)));
+      values[i] = "NOT_FOUND";
+    } else {
+      values[i] = RandomString(&rnd, 1000);
+      ASSERT_OK(Put(Key(i), values[i]));
+    }
+  }
+  ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  dbfull()->TEST_CompactRange(0, NULL, NULL);
+  ASSERT_EQ(0, NumTableFilesAtLevel(0));
+  std::string log;
+  ASSERT_OK(ReadFileToString(env_, InfoLogFileName(dbname_), &log));
+  ASSERT_TRUE(log.find("Compacting in 2 ranges") != std::string::npos);
+  ASSERT_GE(env_->low_scheduled_counter_.Read(), 2);
+
+  int live = 0;
+  for (int i = 0; i < kNum; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+    live += (values[i] != "NOT_FOUND");
+  }
+  Iterator* iter = db_->NewIterator(ReadOptions());
+  int count = 0;
+  for (iter->SeekToFirst(); iter->Valid(); iter->Next()) {
+    const int i = atoi(iter->key().ToString().c_str() + 3);
+    ASSERT_EQ(values[i], iter->value().ToString());
+    count++;
+  }
+  delete iter;
+  ASSERT_EQ(live, count);
+}
+
+TEST(DBTest, RateLimiter) {
+  RateLimiter* limiter = NewRateLimiter(64 << 20);
+  Options options = CurrentOptions();
+  options.rate_limiter = limiter;
+  Reopen(&options);
+
+  // Both the memtable compactions and the compaction write through it
+  Random rnd(301);
+  std::vector<std::string> values(200);
+  for (int pass = 0; pass < 2; pass++) {
+    for (int i = 0; i < 200; i++) {
+      values[i] = RandomString(&rnd, 1000);
+      ASSERT_OK(Put(Key(i), values[i]));
+    }
+    ASSERT_OK(dbfull()->TEST_CompactMemTable());
+  }
+  const int64_t flushed = limiter->GetTotalBytesThrough();
+  ASSERT_GT(flushed, 400000);
+  db_->CompactRange(NULL, NULL);
+  ASSERT_GT(limiter->GetTotalBytesThrough(), flushed + 200000);
+  for (int i = 0; i < 200; i++) {
+    ASSERT_EQ(values[i], Get(Key(i)));
+  }
+
+  Close();
+  delete limiter;
+}
+
 TEST(DBTest, ManifestWriteError) {
   // Test for the following problem:
   // (a) Compaction produces file F
@@ -1726,6 +2356,64 @@ TEST(DBTest, BloomFilter) {
   delete options.filter_policy;
 }
 
+TEST(DBTest, WholeTableFilter) {
+  env_->count_random_reads_ = true;
+  Options options = CurrentOptions();
+  options.env = env_;
+  options.block_cache = NewLRUCache(0);  // Prevent cache hits
+  options.filter_policy = NewBloomFilterPolicy(10);
+  options.whole_table_filter = false;
+  options.filter_partition_keys = 0;
+  Reopen(&options);
+
+  const int N = 10000;
+  for (int i = 0; i < N; i++) {
+    ASSERT_OK(Put(Key(i), Key(i)));
+  }
+  Compact("a", "z");
+
+  // A filter per 2KB of blocks, then the tables are rewritten with a full
+  // filter, then with a partitioned one.  The tables of the previous
+  // format are read with their filter until then.
+  for (int pass = 0; pass < 3; pass++) {
+    // A lookup reads the partition of its key
+    const int partition_reads = (pass == 2 ? N : 0);
+    if (pass > 0) {
+      options.whole_table_filter = true;
+      if (pass == 2) {
+        options.filter_partition_keys = 1000;
+      }
+      Reopen(&options);
+      for (int i = 0; i < N; i++) {
+        ASSERT_EQ(Key(i), Get(Key(i)));
+        ASSERT_EQ("NOT_FOUND", Get(Key(i) + ".missing"));
+        ASSERT_OK(Put(Key(i), Key(i)));
+      }
+      Compact("a", "z");
+    }
+
+    env_->random_read_counter_.Reset();
+    for (int i = 0; i < N; i++) {
+      ASSERT_EQ(Key(i), Get(Key(i)));
+    }
+    int reads = env_->random_read_counter_.Read();
+    fprintf(stderr, "pass %d: %d present => %d reads\n", pass, N, reads);
+    ASSERT_LE(reads, N + partition_reads + 2*N/100);
+
+    env_->random_read_counter_.Reset();
+    for (int i = 0; i < N; i++) {
+      ASSERT_EQ("NOT_FOUND", Get(Key(i) + ".missing"));
+    }
+    reads = env_->random_read_counter_.Read();
+    fprintf(stderr, "pass %d: %d missing => %d reads\n", pass, N, reads);
+    ASSERT_LE(reads, partition_reads + 3*N/100);
+  }
+
+  Close();
+  delete options.block_cache;
+  delete options.filter_policy;
+}
+
 // Multi-threaded test:
 namespace {
 
@@ -1848,6 +2536,21 @@ class ModelDB: public DB {
     assert(false);      // Not implemented
     return Status::NotFound(key);
   }
+  virtual Status GetPinned(const ReadOptions& options,
+                           const Slice& key, PinnableSlice* value) {
+    assert(false);      // Not implemented
+    return Status::NotFound(key);
+  }
+  virtual Status Contains(const ReadOptions& options, const Slice& key) {
+    assert(false);      // Not implemented
+    return Status::NotFound(key);
+  }
+  virtual std::vector<Status> MultiGet(const ReadOptions& options,
+                                       const std::vector<Slice>& keys,
+                                       std::vector<std::string>* values) {
+    assert(false);      // Not implemented
+    return std::vector<Status>(keys.size(), Status::NotFound(Slice()));
+  }
   virtual Iterator* NewIterator(const ReadOptions& options) {
     if (options.snapshot == NULL) {
       KVMap* saved = new KVMap;
@@ -1887,6 +2590,8 @@ class ModelDB: public DB {
   virtual bool GetProperty(const Slice& property, std::string* value) {
     return false;
   }
+  virtual void GetStats(DbStats* stats) {
+  }
   virtual void GetApproximateSizes(const Range* r, int n, uint64_t* sizes) {
     for (int i = 0; i < n; i++) {
       sizes[i] = 0;
@@ -1894,6 +2599,9 @@ class ModelDB: public DB {
   }
   virtual void CompactRange(const Slice* start, const Slice* end) {
   }
+  virtual Status IngestTables(const std::vector<std::string>& fnames) {
+    return Status::NotSupported("IngestTables");
+  }
 
  private:
   class ModelIter: public Iterator {
@@ -2083,7 +2791,7 @@ void BM_LogAndApply(int iters, int num_base_files) {
 
   InternalKeyComparator cmp(BytewiseComparator());
   Options options;
-  VersionSet vset(dbname, &options, NULL, &cmp);
+  VersionSet vset(dbname, &options, NULL, NULL, &cmp);
   ASSERT_OK(vset.Recover());
   VersionEdit vbase;
   uint64_t fnum = 1;
@@ -110,6 +110,7 @@ class Repairer {
   std::vector<std::string> manifests_;
   std::vector<uint64_t> table_numbers_;
   std::vector<uint64_t> logs_;
+  std::vector<uint64_t> value_logs_;
   std::vector<TableInfo> tables_;
   uint64_t next_file_number_;
 
@@ -137,6 +138,8 @@ class Repairer {
             logs_.push_back(number);
           } else if (type == kTableFile) {
             table_numbers_.push_back(number);
+          } else if (type == kValueLogFile) {
+            value_logs_.push_back(number);
           } else {
             // Ignore other files
           }
@@ -224,7 +227,8 @@ class Repairer {
     FileMetaData meta;
     meta.number = next_file_number_++;
     Iterator* iter = mem->NewIterator();
-    status = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta);
+    status = BuildTable(dbname_, env_, options_, table_cache_, iter, &meta,
+                        NULL);
     delete iter;
     mem->Unref();
     mem = NULL;
@@ -399,6 +403,16 @@ class Repairer {
                     t.meta.smallest, t.meta.largest);
     }
 
+    // Keep the value logs the tables may refer to.  The garbage they
+    // held before the repair is not known and is never reclaimed.
+    for (size_t i = 0; i < value_logs_.size(); i++) {
+      uint64_t file_size;
+      if (env_->GetFileSize(ValueLogFileName(dbname_, value_logs_[i]),
+                            &file_size).ok()) {
+        edit_.AddValueLog(value_logs_[i], file_size);
+      }
+    }
+
     //fprintf(stderr, "NewDescriptor:\n%s\n", edit_.DebugString().c_str());
     {
       log::Writer log(file);
@@ -5,7 +5,9 @@
 // Thread safety
 // -------------
 //
-// Writes require external synchronization, most likely a mutex.
+// Writes require external synchronization, most likely a mutex, unless
+// they all go through InsertConcurrently(): its compare-and-swap on the
+// links lets several threads insert at once.
 // Reads require a guarantee that the SkipList will not be destroyed
 // while the read is in progress.  Apart from that, reads progress
 // without any internal locking or synchronization.
@@ -26,6 +28,7 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <atomic>
 #include "port/port.h"
 #include "util/arena.h"
 #include "util/random.h"
@@ -49,6 +52,13 @@ class SkipList {
   // REQUIRES: nothing that compares equal to key is currently in the list.
   void Insert(const Key& key);
 
+  // Like Insert(), but may run in several threads at once: each thread
+  // links its node level by level with a compare-and-swap, searching again
+  // from its predecessor when another insert got in between.
+  // REQUIRES: nothing that compares equal to key is currently in the list.
+  // REQUIRES: no concurrent Insert().
+  void InsertConcurrently(const Key& key);
+
   // Returns true iff an entry that compares equal to key is in the list.
   bool Contains(const Key& key) const;
 
@@ -112,8 +122,13 @@ class SkipList {
   // Read/written only by Insert().
   Random rnd_;
 
+  // Drawn from by InsertConcurrently()
+  std::atomic<uint32_t> concurrent_seed_;
+
   Node* NewNode(const Key& key, int height);
+  Node* NewNodeConcurrently(const Key& key, int height);
   int RandomHeight();
+  int RandomHeightConcurrently();
   bool Equal(const Key& a, const Key& b) const { return (compare_(a, b) == 0); }
 
   // Return true if key is greater than the data stored in "n"
@@ -126,6 +141,11 @@ class SkipList {
   // node at "level" for every level in [0..max_height_-1].
   Node* FindGreaterOrEqual(const Key& key, Node** prev) const;
 
+  // Starting from "before", a node before key at "level", find the last
+  // node before key and the one after it at that level.
+  void FindSpliceForLevel(const Key& key, Node* before, int level,
+                          Node** out_prev, Node** out_next) const;
+
   // Return the latest node with a key < key.
   // Return head_ if there is no such node.
   Node* FindLessThan(const Key& key) const;
@@ -171,6 +191,12 @@ struct SkipList<Key,Comparator>::Node {
     next_[n].NoBarrier_Store(x);
   }
 
+  // Link x after this node if its successor is still "expected".
+  bool CASNext(int n, Node* expected, Node* x) {
+    assert(n >= 0);
+    return next_[n].CompareAndSwap(expected, x);
+  }
+
  private:
   // Array of length equal to the node height.  next_[0] is lowest level link.
   port::AtomicPointer next_[1];
@@ -184,6 +210,14 @@ SkipList<Key,Comparator>::NewNode(const Key& key, int height) {
   return new (mem) Node(key);
 }
 
+template<typename Key, class Comparator>
+typename SkipList<Key,Comparator>::Node*
+SkipList<Key,Comparator>::NewNodeConcurrently(const Key& key, int height) {
+  char* mem = arena_->AllocateAlignedConcurrently(
+      sizeof(Node) + sizeof(port::AtomicPointer) * (height - 1));
+  return new (mem) Node(key);
+}
+
 template<typename Key, class Comparator>
 inline SkipList<Key,Comparator>::Iterator::Iterator(const SkipList* list) {
   list_ = list;
@@ -249,6 +283,25 @@ int SkipList<Key,Comparator>::RandomHeight() {
   return height;
 }
 
+template<typename Key, class Comparator>
+int SkipList<Key,Comparator>::RandomHeightConcurrently() {
+  // Same distribution as RandomHeight(), from a mix of a shared counter:
+  // two bits per level
+  uint32_t r = concurrent_seed_.fetch_add(0x9e3779b9u,
+                                          std::memory_order_relaxed);
+  r ^= r >> 16;
+  r *= 0x85ebca6bu;
+  r ^= r >> 13;
+  r *= 0xc2b2ae35u;
+  r ^= r >> 16;
+  int height = 1;
+  while (height < kMaxHeight && (r & 3) == 0) {
+    height++;
+    r >>= 2;
+  }
+  return height;
+}
+
 template<typename Key, class Comparator>
 bool SkipList<Key,Comparator>::KeyIsAfterNode(const Key& key, Node* n) const {
   // NULL n is considered infinite
@@ -277,6 +330,24 @@ typename SkipList<Key,Comparator>::Node* SkipList<Key,Comparator>::FindGreaterOr
   }
 }
 
+template<typename Key, class Comparator>
+void SkipList<Key,Comparator>::FindSpliceForLevel(const Key& key,
+                                                  Node* before, int level,
+                                                  Node** out_prev,
+                                                  Node** out_next) const {
+  Node* x = before;
+  while (true) {
+    Node* next = x->Next(level);
+    if (KeyIsAfterNode(key, next)) {
+      x = next;
+    } else {
+      *out_prev = x;
+      *out_next = next;
+      return;
+    }
+  }
+}
+
 template<typename Key, class Comparator>
 typename SkipList<Key,Comparator>::Node*
 SkipList<Key,Comparator>::FindLessThan(const Key& key) const {
@@ -324,7 +395,8 @@ SkipList<Key,Comparator>::SkipList(Comparator cmp, Arena* arena)
       arena_(arena),
       head_(NewNode(0 /* any key will do */, kMaxHeight)),
       max_height_(reinterpret_cast<void*>(1)),
-      rnd_(0xdeadbeef) {
+      rnd_(0xdeadbeef),
+      concurrent_seed_(0xdeadbeef) {
   for (int i = 0; i < kMaxHeight; i++) {
     head_->SetNext(i, NULL);
   }
@@ -366,6 +438,47 @@ void SkipList<Key,Comparator>::Insert(const Key& key) {
   }
 }
 
+template<typename Key, class Comparator>
+void SkipList<Key,Comparator>::InsertConcurrently(const Key& key) {
+  const int height = RandomHeightConcurrently();
+  int max_height = GetMaxHeight();
+  while (height > max_height) {
+    // Readers seeing the new height before the links fall through NULL
+    // links of head_, as with Insert()
+    if (max_height_.CompareAndSwap(reinterpret_cast<void*>(max_height),
+                                   reinterpret_cast<void*>(height))) {
+      max_height = height;
+      break;
+    }
+    max_height = GetMaxHeight();
+  }
+
+  // The splice of key at every level, from the top
+  Node* prev[kMaxHeight];
+  Node* next[kMaxHeight];
+  Node* before = head_;
+  for (int level = max_height - 1; level >= 0; level--) {
+    FindSpliceForLevel(key, before, level, &prev[level], &next[level]);
+    before = prev[level];
+  }
+
+  // Our data structure does not allow duplicate insertion
+  assert(next[0] == NULL || !Equal(key, next[0]->key));
+
+  Node* x = NewNodeConcurrently(key, height);
+  for (int i = 0; i < height; i++) {
+    while (true) {
+      // The compare-and-swap publishes x, a full barrier
+      x->NoBarrier_SetNext(i, next[i]);
+      if (prev[i]->CASNext(i, next[i], x)) {
+        break;
+      }
+      // Another node was linked after prev[i]: prev[i] is still before key
+      FindSpliceForLevel(key, prev[i], i, &prev[i], &next[i]);
+    }
+  }
+}
+
 template<typename Key, class Comparator>
 bool SkipList<Key,Comparator>::Contains(const Key& key) const {
   Node* x = FindGreaterOrEqual(key, NULL);
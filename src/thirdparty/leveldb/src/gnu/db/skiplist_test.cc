@@ -9,6 +9,7 @@
 #include "util/hash.h"
 #include "util/random.h"
 #include "util/testharness.h"
+#include "util/testutil.h"
 
 namespace leveldb {
 
@@ -29,7 +30,7 @@ struct Comparator {
 class SkipTest { };
 
 TEST(SkipTest, Empty) {
-  Arena arena;
+  test::TestArena arena;
   Comparator cmp;
   SkipList<Key, Comparator> list(cmp, &arena);
   ASSERT_TRUE(!list.Contains(10));
@@ -49,7 +50,7 @@ TEST(SkipTest, InsertAndLookup) {
   const int R = 5000;
   Random rnd(1000);
   std::set<Key> keys;
-  Arena arena;
+  test::TestArena arena;
   Comparator cmp;
   SkipList<Key, Comparator> list(cmp, &arena);
   for (int i = 0; i < N; i++) {
@@ -204,7 +205,7 @@ class ConcurrentTest {
   // Current state of the test
   State current_;
 
-  Arena arena_;
+  test::TestArena arena_;
 
   // SkipList is not protected by mu_.  We just use a single writer
   // thread to modify it.
@@ -371,6 +372,61 @@ TEST(SkipTest, Concurrent3) { RunConcurrent(3); }
 TEST(SkipTest, Concurrent4) { RunConcurrent(4); }
 TEST(SkipTest, Concurrent5) { RunConcurrent(5); }
 
+// Several threads inserting at once, each its own keys.
+struct ConcurrentInsertState {
+  SkipList<Key, Comparator>* list;
+  int id;
+  port::AtomicPointer done;
+};
+
+static const int kInsertThreads = 4;
+static const int kInsertsPerThread = 20000;
+
+static void ConcurrentInserter(void* arg) {
+  ConcurrentInsertState* state = reinterpret_cast<ConcurrentInsertState*>(arg);
+  for (int i = 0; i < kInsertsPerThread; i++) {
+    // Interleaved with the keys of the other threads
+    state->list->InsertConcurrently(i * kInsertThreads + state->id);
+  }
+  state->done.Release_Store(state);
+}
+
+TEST(SkipTest, ConcurrentInserts) {
+  test::TestArena arena;
+  Comparator cmp;
+  {
+    SkipList<Key, Comparator> list(cmp, &arena);
+    ConcurrentInsertState state[kInsertThreads];
+    for (int id = 0; id < kInsertThreads; id++) {
+      state[id].list = &list;
+      state[id].id = id;
+      state[id].done.Release_Store(NULL);
+      Env::Default()->StartThread(ConcurrentInserter, &state[id]);
+    }
+    for (int id = 0; id < kInsertThreads; id++) {
+      while (state[id].done.Acquire_Load() == NULL) {
+        Env::Default()->SleepForMicroseconds(1000);
+      }
+    }
+
+    // Every key is there, in order, at every level reached through Seek()
+    SkipList<Key, Comparator>::Iterator iter(&list);
+    iter.SeekToFirst();
+    for (Key k = 0; k < kInsertThreads * kInsertsPerThread; k++) {
+      ASSERT_TRUE(iter.Valid());
+      ASSERT_EQ(k, iter.key());
+      iter.Next();
+    }
+    ASSERT_TRUE(!iter.Valid());
+    for (Key k = 0; k < kInsertThreads * kInsertsPerThread; k += 7) {
+      ASSERT_TRUE(list.Contains(k));
+      iter.Seek(k);
+      ASSERT_TRUE(iter.Valid());
+      ASSERT_EQ(k, iter.key());
+    }
+  }
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
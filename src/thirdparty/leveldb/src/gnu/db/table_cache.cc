@@ -4,8 +4,11 @@
 
 #include "db/table_cache.h"
 
+#include <atomic>
+
 #include "db/filename.h"
 #include "leveldb/env.h"
+#include "leveldb/pinnable_slice.h"
 #include "leveldb/table.h"
 #include "util/coding.h"
 
@@ -29,17 +32,42 @@ static void UnrefEntry(void* arg1, void* arg2) {
   cache->Release(h);
 }
 
+// The open tables, shared by the TableCache and the values pinned out
+// of them: these may outlive the TableCache, and the DB.
+struct TableCache::Tables {
+  Cache* cache;
+  std::atomic<int> refs;
+};
+
+static void UnrefTables(TableCache::Tables* tables) {
+  if (tables->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+    delete tables->cache;
+    delete tables;
+  }
+}
+
+static void UnrefPinnedEntry(void* arg1, void* arg2) {
+  TableCache::Tables* tables = reinterpret_cast<TableCache::Tables*>(arg1);
+  tables->cache->Release(reinterpret_cast<Cache::Handle*>(arg2));
+  UnrefTables(tables);
+}
+
 TableCache::TableCache(const std::string& dbname,
                        const Options* options,
                        int entries)
     : env_(options->env),
       dbname_(dbname),
       options_(options),
-      cache_(NewLRUCache(entries)) {
+      tables_(new Tables),
+      cache_(NewClockCache(entries, 1)) {
+  tables_->cache = cache_;
+  tables_->refs.store(1, std::memory_order_relaxed);
 }
 
 TableCache::~TableCache() {
-  delete cache_;
+  // Close at once the tables no value is pinned from
+  cache_->SetCapacity(0);
+  UnrefTables(tables_);
 }
 
 Status TableCache::FindTable(uint64_t file_number, uint64_t file_size,
@@ -107,13 +135,21 @@ Status TableCache::Get(const ReadOptions& options,
                        uint64_t file_size,
                        const Slice& k,
                        void* arg,
-                       void (*saver)(void*, const Slice&, const Slice&)) {
+                       void (*saver)(void*, const Slice&, const Slice&),
+                       PinnableSlice* pinned) {
   Cache::Handle* handle = NULL;
   Status s = FindTable(file_number, file_size, &handle);
   if (s.ok()) {
     Table* t = reinterpret_cast<TableAndFile*>(cache_->Value(handle))->table;
-    s = t->InternalGet(options, k, arg, saver);
-    cache_->Release(handle);
+    const bool was_pinned = (pinned != NULL && pinned->IsPinned());
+    s = t->InternalGet(options, k, arg, saver, pinned);
+    if (pinned != NULL && !was_pinned && pinned->IsPinned()) {
+      // An mmapped block is only valid while its table is open
+      tables_->refs.fetch_add(1, std::memory_order_relaxed);
+      pinned->RegisterCleanup(&UnrefPinnedEntry, tables_, handle);
+    } else {
+      cache_->Release(handle);
+    }
   }
   return s;
 }
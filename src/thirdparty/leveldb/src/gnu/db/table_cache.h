@@ -37,21 +37,29 @@ class TableCache {
 
   // If a seek to internal key "k" in specified file finds an entry,
   // call (*handle_result)(arg, found_key, found_value).
+  //
+  // If "pinned" is non-NULL and handle_result pins the found value into
+  // it, the table stays in the cache until "*pinned" is released, even
+  // after this TableCache is deleted.
   Status Get(const ReadOptions& options,
              uint64_t file_number,
              uint64_t file_size,
              const Slice& k,
              void* arg,
-             void (*handle_result)(void*, const Slice&, const Slice&));
+             void (*handle_result)(void*, const Slice&, const Slice&),
+             PinnableSlice* pinned = NULL);
 
   // Evict any entry for the specified file number
   void Evict(uint64_t file_number);
 
+  struct Tables;
+
  private:
   Env* const env_;
   const std::string dbname_;
   const Options* options_;
-  Cache* cache_;
+  Tables* tables_;
+  Cache* cache_;               // tables_->cache
 
   Status FindTable(uint64_t file_number, uint64_t file_size, Cache::Handle**);
 };
@@ -0,0 +1,162 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/table_file_writer.h"
+
+#include "db/dbformat.h"
+#include "db/value_log.h"
+#include "leveldb/comparator.h"
+#include "leveldb/env.h"
+#include "leveldb/table_builder.h"
+
+namespace leveldb {
+
+// The entries are stored under internal keys of sequence number zero:
+// DB::IngestTables() assigns them a sequence number only when they
+// overlap data already in the DB.  The large values are referred to by
+// handles of value log number zero, that DB::IngestTables() replaces by
+// the number given to the value log.
+struct TableFileWriter::Rep {
+  Env* env;
+  std::string fname;
+  InternalKeyComparator icmp;
+  InternalFilterPolicy ipolicy;
+  Options options;
+  WritableFile* file;
+  TableBuilder* builder;
+  WritableFile* value_file;         // Created with the first large value
+  ValueLogBuilder* value_builder;
+  Status status;
+  std::string last_key;
+  uint64_t num_entries;
+  uint64_t file_size;
+  bool finished;
+
+  Rep(const Options& opt, const std::string& name)
+      : env(opt.env),
+        fname(name),
+        icmp(opt.comparator),
+        ipolicy(opt.filter_policy),
+        options(opt),
+        file(NULL),
+        builder(NULL),
+        value_file(NULL),
+        value_builder(NULL),
+        num_entries(0),
+        file_size(0),
+        finished(false) {
+    options.comparator = &icmp;
+    options.filter_policy = (opt.filter_policy != NULL) ? &ipolicy : NULL;
+  }
+};
+
+TableFileWriter::TableFileWriter(const Options& options,
+                                 const std::string& fname)
+    : rep_(new Rep(options, fname)) {
+  rep_->status = rep_->env->NewWritableFile(fname, &rep_->file);
+  if (rep_->status.ok()) {
+    rep_->builder = new TableBuilder(rep_->options, rep_->file);
+  }
+}
+
+TableFileWriter::~TableFileWriter() {
+  if (rep_->builder != NULL) {
+    rep_->builder->Abandon();
+    delete rep_->builder;
+  }
+  delete rep_->file;
+  delete rep_->value_builder;
+  delete rep_->value_file;
+  if (!rep_->finished || !rep_->status.ok()) {
+    rep_->env->DeleteFile(rep_->fname);
+    rep_->env->DeleteFile(ValueLogName(rep_->fname));
+  }
+  delete rep_;
+}
+
+Status TableFileWriter::Add(const Slice& key, const Slice& value) {
+  Rep* r = rep_;
+  assert(!r->finished);
+  if (!r->status.ok()) {
+    return r->status;
+  }
+  if (r->num_entries > 0 &&
+      r->icmp.user_comparator()->Compare(key, r->last_key) <= 0) {
+    return Status::InvalidArgument("keys added out of order", key);
+  }
+  r->last_key.assign(key.data(), key.size());
+  if (r->options.value_log_threshold == 0 ||
+      value.size() < r->options.value_log_threshold) {
+    InternalKey ikey(key, 0, kTypeValue);
+    r->builder->Add(ikey.Encode(), value);
+  } else {
+    if (r->value_builder == NULL) {
+      r->status = r->env->NewWritableFile(ValueLogName(r->fname),
+                                          &r->value_file);
+      if (!r->status.ok()) {
+        return r->status;
+      }
+      r->value_builder = new ValueLogBuilder(r->value_file, 0);
+    }
+    ValueHandle handle;
+    r->status = r->value_builder->Add(key, value, &handle);
+    if (!r->status.ok()) {
+      return r->status;
+    }
+    std::string index;
+    handle.EncodeTo(&index);
+    InternalKey ikey(key, 0, kTypeValueIndex);
+    r->builder->Add(ikey.Encode(), index);
+  }
+  r->num_entries++;
+  r->status = r->builder->status();
+  return r->status;
+}
+
+Status TableFileWriter::Finish() {
+  Rep* r = rep_;
+  assert(!r->finished);
+  r->finished = true;
+  if (!r->status.ok()) {
+    return r->status;
+  }
+  if (r->value_builder != NULL) {
+    r->status = r->value_file->Sync();
+    if (r->status.ok()) {
+      r->status = r->value_file->Close();
+    }
+    if (!r->status.ok()) {
+      return r->status;
+    }
+  }
+  r->status = r->builder->Finish();
+  r->file_size = r->builder->FileSize();
+  delete r->builder;
+  r->builder = NULL;
+  if (r->status.ok()) {
+    r->status = r->file->Sync();
+  }
+  if (r->status.ok()) {
+    r->status = r->file->Close();
+  }
+  return r->status;
+}
+
+uint64_t TableFileWriter::NumEntries() const {
+  return rep_->num_entries;
+}
+
+uint64_t TableFileWriter::FileSize() const {
+  return rep_->builder != NULL ? rep_->builder->FileSize() : rep_->file_size;
+}
+
+uint64_t TableFileWriter::ValueLogSize() const {
+  return rep_->value_builder != NULL ? rep_->value_builder->FileSize() : 0;
+}
+
+std::string TableFileWriter::ValueLogName(const std::string& fname) {
+  return fname + ".vlog";
+}
+
+}  // namespace leveldb
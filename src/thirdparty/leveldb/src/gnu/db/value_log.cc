@@ -0,0 +1,280 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "db/value_log.h"
+
+#include <string.h>
+#include "db/filename.h"
+#include "leveldb/env.h"
+#include "leveldb/pinnable_slice.h"
+#include "util/coding.h"
+#include "util/crc32c.h"
+
+namespace leveldb {
+
+static const size_t kHeaderSize = 4 + 4 + 4;
+
+void ValueHandle::EncodeTo(std::string* dst) const {
+  PutVarint64(dst, number);
+  PutVarint64(dst, offset);
+  PutVarint64(dst, size);
+}
+
+Status ValueHandle::DecodeFrom(Slice* input) {
+  if (GetVarint64(input, &number) &&
+      GetVarint64(input, &offset) &&
+      GetVarint64(input, &size)) {
+    return Status::OK();
+  } else {
+    return Status::Corruption("bad value handle");
+  }
+}
+
+// Checksum of a record, "header" being its first kHeaderSize bytes.
+static uint32_t RecordChecksum(const char* header, const Slice& key,
+                               const Slice& value) {
+  uint32_t crc = crc32c::Value(header + 4, kHeaderSize - 4);
+  crc = crc32c::Extend(crc, key.data(), key.size());
+  crc = crc32c::Extend(crc, value.data(), value.size());
+  return crc32c::Mask(crc);
+}
+
+// Check the record of "size" bytes at "data" and extract its key and value.
+static Status ParseRecord(const char* data, uint64_t size, bool checksum,
+                          Slice* key, Slice* value) {
+  if (size < kHeaderSize) {
+    return Status::Corruption("truncated value log record");
+  }
+  const uint32_t key_size = DecodeFixed32(data + 4);
+  const uint32_t value_size = DecodeFixed32(data + 8);
+  if (kHeaderSize + static_cast<uint64_t>(key_size) + value_size != size) {
+    return Status::Corruption("bad value log record size");
+  }
+  *key = Slice(data + kHeaderSize, key_size);
+  *value = Slice(data + kHeaderSize + key_size, value_size);
+  if (checksum &&
+      DecodeFixed32(data) != RecordChecksum(data, *key, *value)) {
+    return Status::Corruption("value log record checksum mismatch");
+  }
+  return Status::OK();
+}
+
+ValueLogBuilder::ValueLogBuilder(WritableFile* file, uint64_t number)
+    : file_(file),
+      number_(number),
+      offset_(0) {
+}
+
+Status ValueLogBuilder::Add(const Slice& key, const Slice& value,
+                            ValueHandle* handle) {
+  char header[kHeaderSize];
+  EncodeFixed32(header + 4, static_cast<uint32_t>(key.size()));
+  EncodeFixed32(header + 8, static_cast<uint32_t>(value.size()));
+  EncodeFixed32(header, RecordChecksum(header, key, value));
+
+  Status s = file_->Append(Slice(header, kHeaderSize));
+  if (s.ok()) {
+    s = file_->Append(key);
+  }
+  if (s.ok()) {
+    s = file_->Append(value);
+  }
+  if (s.ok()) {
+    handle->number = number_;
+    handle->offset = offset_;
+    handle->size = kHeaderSize + key.size() + value.size();
+    offset_ += handle->size;
+  }
+  return s;
+}
+
+ValueLogReader::ValueLogReader(SequentialFile* file, uint64_t number)
+    : file_(file),
+      number_(number),
+      offset_(0) {
+}
+
+ValueLogReader::~ValueLogReader() {
+  delete file_;
+}
+
+bool ValueLogReader::Next(Slice* key, Slice* value, ValueHandle* handle) {
+  if (!status_.ok()) {
+    return false;
+  }
+  char header[kHeaderSize];
+  Slice fragment;
+  status_ = file_->Read(kHeaderSize, &fragment, header);
+  if (!status_.ok() || fragment.empty()) {
+    return false;  // Error or end of file
+  }
+  if (fragment.size() < kHeaderSize) {
+    status_ = Status::Corruption("truncated value log record");
+    return false;
+  }
+  const uint64_t size = kHeaderSize +
+      static_cast<uint64_t>(DecodeFixed32(fragment.data() + 4)) +
+      DecodeFixed32(fragment.data() + 8);
+  scratch_.resize(size);
+  memcpy(&scratch_[0], fragment.data(), kHeaderSize);
+  status_ = file_->Read(size - kHeaderSize, &fragment,
+                        &scratch_[kHeaderSize]);
+  if (!status_.ok()) {
+    return false;
+  }
+  if (fragment.size() != size - kHeaderSize) {
+    status_ = Status::Corruption("truncated value log record");
+    return false;
+  }
+  if (fragment.data() != &scratch_[kHeaderSize]) {
+    memcpy(&scratch_[kHeaderSize], fragment.data(), fragment.size());
+  }
+  status_ = ParseRecord(scratch_.data(), size, true, key, value);
+  if (!status_.ok()) {
+    return false;
+  }
+  handle->number = number_;
+  handle->offset = offset_;
+  handle->size = size;
+  offset_ += size;
+  return true;
+}
+
+static void DeleteEntry(const Slice& key, void* value) {
+  delete reinterpret_cast<RandomAccessFile*>(value);
+}
+
+ValueLog::ValueLog(const std::string& dbname,
+                   const Options* options,
+                   int entries)
+    : env_(options->env),
+      dbname_(dbname),
+      cache_(NewClockCache(entries, 1)),
+      block_cache_(options->block_cache),
+      cache_id_(block_cache_ != NULL ? block_cache_->NewId() : 0) {
+}
+
+ValueLog::~ValueLog() {
+  delete cache_;
+}
+
+Status ValueLog::FindFile(uint64_t number, Cache::Handle** handle) {
+  Status s;
+  char buf[sizeof(number)];
+  EncodeFixed64(buf, number);
+  Slice key(buf, sizeof(buf));
+  *handle = cache_->Lookup(key);
+  if (*handle == NULL) {
+    RandomAccessFile* file = NULL;
+    s = env_->NewRandomAccessFile(ValueLogFileName(dbname_, number), &file);
+    if (s.ok()) {
+      *handle = cache_->Insert(key, file, 1, &DeleteEntry);
+    }
+  }
+  return s;
+}
+
+static void DeleteCachedValue(const Slice& key, void* value) {
+  delete reinterpret_cast<std::string*>(value);
+}
+
+static void ReleaseCachedValue(void* arg, void* h) {
+  Cache* cache = reinterpret_cast<Cache*>(arg);
+  cache->Release(reinterpret_cast<Cache::Handle*>(h));
+}
+
+Status ValueLog::Read(const ReadOptions& options, const Slice& encoded,
+                      std::string* value, Cache::Handle** cache_handle) {
+  *cache_handle = NULL;
+  Slice input = encoded;
+  ValueHandle handle;
+  Status s = handle.DecodeFrom(&input);
+  if (!s.ok()) {
+    return s;
+  }
+  char cache_key_buffer[24];
+  EncodeFixed64(cache_key_buffer, cache_id_);
+  EncodeFixed64(cache_key_buffer + 8, handle.number);
+  EncodeFixed64(cache_key_buffer + 16, handle.offset);
+  Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+  if (block_cache_ != NULL) {
+    *cache_handle = block_cache_->Lookup(key);
+    if (*cache_handle != NULL) {
+      return s;
+    }
+  }
+
+  Cache::Handle* h = NULL;
+  s = FindFile(handle.number, &h);
+  if (!s.ok()) {
+    return s;
+  }
+  RandomAccessFile* file = reinterpret_cast<RandomAccessFile*>(cache_->Value(h));
+  // Read the record straight into *value, then drop its header and key.
+  value->resize(handle.size);
+  Slice record;
+  s = file->Read(handle.offset, handle.size, &record, &(*value)[0]);
+  if (s.ok() && record.size() != handle.size) {
+    s = Status::Corruption("truncated value log read");
+  }
+  Slice k, v;
+  if (s.ok()) {
+    s = ParseRecord(record.data(), record.size(), options.verify_checksums,
+                    &k, &v);
+  }
+  if (s.ok()) {
+    if (record.data() == value->data()) {
+      value->erase(0, v.data() - record.data());
+    } else {
+      value->assign(v.data(), v.size());
+    }
+  } else {
+    value->clear();
+  }
+  cache_->Release(h);
+
+  if (s.ok() && block_cache_ != NULL && options.fill_cache) {
+    std::string* cached = new std::string;
+    cached->swap(*value);
+    *cache_handle = block_cache_->Insert(key, cached, cached->size(),
+                                         &DeleteCachedValue);
+  }
+  return s;
+}
+
+Status ValueLog::Get(const ReadOptions& options, const Slice& handle,
+                     std::string* value) {
+  Cache::Handle* h = NULL;
+  Status s = Read(options, handle, value, &h);
+  if (h != NULL) {
+    value->assign(*reinterpret_cast<std::string*>(block_cache_->Value(h)));
+    block_cache_->Release(h);
+  }
+  return s;
+}
+
+Status ValueLog::GetPinned(const ReadOptions& options, const Slice& handle,
+                           PinnableSlice* value) {
+  Cache::Handle* h = NULL;
+  Status s = Read(options, handle, value->GetSelf(), &h);
+  if (!s.ok()) {
+    return s;
+  }
+  if (h != NULL) {
+    value->PinCleanup(
+        Slice(*reinterpret_cast<std::string*>(block_cache_->Value(h))),
+        &ReleaseCachedValue, block_cache_, h);
+  } else {
+    value->PinSelf();
+  }
+  return s;
+}
+
+void ValueLog::Evict(uint64_t number) {
+  char buf[sizeof(number)];
+  EncodeFixed64(buf, number);
+  cache_->Erase(Slice(buf, sizeof(buf)));
+}
+
+}  // namespace leveldb
@@ -0,0 +1,143 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A value log holds the large values kept out of the tables.  Each
+// memtable compaction appends its large values to a new value log and
+// stores in the table, under the kTypeValueIndex type, a ValueHandle
+// referring to the record.  Compactions then only move the handles.
+//
+// A value log file is a sequence of records:
+//    checksum: fixed32    // masked crc32c of the rest of the record
+//    key_size: fixed32
+//    value_size: fixed32
+//    key: char[key_size]
+//    value: char[value_size]
+//
+// The key lets the garbage collection check whether a record is still
+// the latest value of its key.
+
+#ifndef STORAGE_LEVELDB_DB_VALUE_LOG_H_
+#define STORAGE_LEVELDB_DB_VALUE_LOG_H_
+
+#include <stdint.h>
+#include <string>
+#include "leveldb/cache.h"
+#include "leveldb/options.h"
+#include "leveldb/slice.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+class Env;
+class PinnableSlice;
+class SequentialFile;
+class WritableFile;
+
+// Location of a record in a value log.
+struct ValueHandle {
+  uint64_t number;  // Number of the value log file
+  uint64_t offset;  // Offset of the record in the file
+  uint64_t size;    // Size of the record, header included
+
+  ValueHandle() : number(0), offset(0), size(0) { }
+
+  void EncodeTo(std::string* dst) const;
+  Status DecodeFrom(Slice* input);
+};
+
+// Appends records to a new value log file.
+class ValueLogBuilder {
+ public:
+  // Append to "file", the value log "number".  The caller keeps the
+  // ownership of "file".
+  ValueLogBuilder(WritableFile* file, uint64_t number);
+
+  // Append a record for "key" and "value", and store in *handle where
+  // it was written.
+  Status Add(const Slice& key, const Slice& value, ValueHandle* handle);
+
+  // Size of the file so far.
+  uint64_t FileSize() const { return offset_; }
+
+ private:
+  WritableFile* file_;
+  const uint64_t number_;
+  uint64_t offset_;
+
+  // No copying allowed
+  ValueLogBuilder(const ValueLogBuilder&);
+  void operator=(const ValueLogBuilder&);
+};
+
+// Reads all the records of a value log in order.
+class ValueLogReader {
+ public:
+  // Read "file", the value log "number".  Takes the ownership of "file".
+  ValueLogReader(SequentialFile* file, uint64_t number);
+  ~ValueLogReader();
+
+  // Read the next record.  Returns false at the end of the file or on
+  // error, see status().  The key and the value are valid until the
+  // next call.
+  bool Next(Slice* key, Slice* value, ValueHandle* handle);
+
+  Status status() const { return status_; }
+
+ private:
+  SequentialFile* const file_;
+  const uint64_t number_;
+  uint64_t offset_;
+  std::string scratch_;
+  Status status_;
+
+  // No copying allowed
+  ValueLogReader(const ValueLogReader&);
+  void operator=(const ValueLogReader&);
+};
+
+// Reads values by handle, keeping the value log files open in a cache.
+// The values read are kept in the block cache of the options, like table
+// blocks.  Safe for concurrent use.
+class ValueLog {
+ public:
+  // "entries" is the number of files kept open.
+  ValueLog(const std::string& dbname, const Options* options, int entries);
+  ~ValueLog();
+
+  // Store in *value the value referred to by the encoded ValueHandle
+  // "handle".
+  Status Get(const ReadOptions& options, const Slice& handle,
+             std::string* value);
+
+  // Same as Get(), but the value refers to its entry in the block cache
+  // and keeps it alive until *value is released.
+  Status GetPinned(const ReadOptions& options, const Slice& handle,
+                   PinnableSlice* value);
+
+  // Close the value log "number", about to be deleted.
+  void Evict(uint64_t number);
+
+ private:
+  Status FindFile(uint64_t number, Cache::Handle** handle);
+
+  // Look the value up in the block cache, or read it from its file and
+  // insert it when options.fill_cache.  On success, *cache_handle refers
+  // to the cached value, or is NULL and the value is left in *value.
+  Status Read(const ReadOptions& options, const Slice& handle,
+              std::string* value, Cache::Handle** cache_handle);
+
+  Env* const env_;
+  const std::string dbname_;
+  Cache* cache_;
+  Cache* const block_cache_;
+  const uint64_t cache_id_;
+
+  // No copying allowed
+  ValueLog(const ValueLog&);
+  void operator=(const ValueLog&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_DB_VALUE_LOG_H_
@@ -20,7 +20,9 @@ enum Tag {
   kDeletedFile          = 6,
   kNewFile              = 7,
   // 8 was used for large value refs
-  kPrevLogNumber        = 9
+  kPrevLogNumber        = 9,
+  kNewValueLog          = 10,
+  kValueLogGarbage      = 11
 };
 
 void VersionEdit::Clear() {
@@ -36,6 +38,8 @@ void VersionEdit::Clear() {
   has_last_sequence_ = false;
   deleted_files_.clear();
   new_files_.clear();
+  new_value_logs_.clear();
+  value_log_garbage_.clear();
 }
 
 void VersionEdit::EncodeTo(std::string* dst) const {
@@ -83,6 +87,18 @@ void VersionEdit::EncodeTo(std::string* dst) const {
     PutLengthPrefixedSlice(dst, f.smallest.Encode());
     PutLengthPrefixedSlice(dst, f.largest.Encode());
   }
+
+  for (size_t i = 0; i < new_value_logs_.size(); i++) {
+    PutVarint32(dst, kNewValueLog);
+    PutVarint64(dst, new_value_logs_[i].first);   // file number
+    PutVarint64(dst, new_value_logs_[i].second);  // file size
+  }
+
+  for (size_t i = 0; i < value_log_garbage_.size(); i++) {
+    PutVarint32(dst, kValueLogGarbage);
+    PutVarint64(dst, value_log_garbage_[i].first);   // file number
+    PutVarint64(dst, value_log_garbage_[i].second);  // bytes
+  }
 }
 
 static bool GetInternalKey(Slice* input, InternalKey* dst) {
@@ -115,6 +131,7 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
   // Temporary storage for parsing
   int level;
   uint64_t number;
+  uint64_t bytes;
   FileMetaData f;
   Slice str;
   InternalKey key;
@@ -192,6 +209,24 @@ Status VersionEdit::DecodeFrom(const Slice& src) {
         }
         break;
 
+      case kNewValueLog:
+        if (GetVarint64(&input, &number) &&
+            GetVarint64(&input, &bytes)) {
+          new_value_logs_.push_back(std::make_pair(number, bytes));
+        } else {
+          msg = "new value log";
+        }
+        break;
+
+      case kValueLogGarbage:
+        if (GetVarint64(&input, &number) &&
+            GetVarint64(&input, &bytes)) {
+          value_log_garbage_.push_back(std::make_pair(number, bytes));
+        } else {
+          msg = "value log garbage";
+        }
+        break;
+
       default:
         msg = "unknown tag";
         break;
@@ -259,6 +294,18 @@ std::string VersionEdit::DebugString() const {
     r.append(" .. ");
     r.append(f.largest.DebugString());
   }
+  for (size_t i = 0; i < new_value_logs_.size(); i++) {
+    r.append("\n  AddValueLog: ");
+    AppendNumberTo(&r, new_value_logs_[i].first);
+    r.append(" ");
+    AppendNumberTo(&r, new_value_logs_[i].second);
+  }
+  for (size_t i = 0; i < value_log_garbage_.size(); i++) {
+    r.append("\n  ValueLogGarbage: ");
+    AppendNumberTo(&r, value_log_garbage_[i].first);
+    r.append(" ");
+    AppendNumberTo(&r, value_log_garbage_[i].second);
+  }
   r.append("\n}\n");
   return r;
 }
@@ -21,8 +21,11 @@ struct FileMetaData {
   uint64_t file_size;         // File size in bytes
   InternalKey smallest;       // Smallest internal key served by table
   InternalKey largest;        // Largest internal key served by table
+  bool being_compacted;       // Input of a compaction not yet done
 
-  FileMetaData() : refs(0), allowed_seeks(1 << 30), file_size(0) { }
+  FileMetaData()
+      : refs(0), allowed_seeks(1 << 30), file_size(0),
+        being_compacted(false) { }
 };
 
 class VersionEdit {
@@ -76,6 +79,17 @@ class VersionEdit {
     deleted_files_.insert(std::make_pair(level, file));
   }
 
+  // Add the value log "file" holding "file_size" bytes of records.
+  void AddValueLog(uint64_t file, uint64_t file_size) {
+    new_value_logs_.push_back(std::make_pair(file, file_size));
+  }
+
+  // Count "bytes" more of the records of the value log "file" as no
+  // longer referenced by any table.
+  void AddValueLogGarbage(uint64_t file, uint64_t bytes) {
+    value_log_garbage_.push_back(std::make_pair(file, bytes));
+  }
+
   void EncodeTo(std::string* dst) const;
   Status DecodeFrom(const Slice& src);
 
@@ -100,6 +114,8 @@ class VersionEdit {
   std::vector< std::pair<int, InternalKey> > compact_pointers_;
   DeletedFileSet deleted_files_;
   std::vector< std::pair<int, FileMetaData> > new_files_;
+  std::vector< std::pair<uint64_t, uint64_t> > new_value_logs_;
+  std::vector< std::pair<uint64_t, uint64_t> > value_log_garbage_;
 };
 
 }  // namespace leveldb
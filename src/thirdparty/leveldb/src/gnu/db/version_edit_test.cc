@@ -30,6 +30,8 @@ TEST(VersionEditTest, EncodeDecode) {
                  InternalKey("zoo", kBig + 600 + i, kTypeDeletion));
     edit.DeleteFile(4, kBig + 700 + i);
     edit.SetCompactPointer(i, InternalKey("x", kBig + 900 + i, kTypeValue));
+    edit.AddValueLog(kBig + 1100 + i, kBig + 1200 + i);
+    edit.AddValueLogGarbage(kBig + 1100 + i, 1300 + i);
   }
 
   edit.SetComparatorName("foo");
@@ -11,7 +11,9 @@
 #include "db/log_writer.h"
 #include "db/memtable.h"
 #include "db/table_cache.h"
+#include "db/value_log.h"
 #include "leveldb/env.h"
+#include "leveldb/pinnable_slice.h"
 #include "leveldb/table_builder.h"
 #include "table/merger.h"
 #include "table/two_level_iterator.h"
@@ -273,9 +275,12 @@ enum SaverState {
 };
 struct Saver {
   SaverState state;
+  ValueType type;
   const Comparator* ucmp;
   Slice user_key;
   std::string* value;
+  PinnableSlice* pinned;
+  std::string* handle;  // Receives the entries referring to a value log
 };
 struct EmptySaver {
   SaverState state;
@@ -290,9 +295,16 @@ static void SaveValue(void* arg, const Slice& ikey, const Slice& v) {
     s->state = kCorrupt;
   } else {
     if (s->ucmp->Compare(parsed_key.user_key, s->user_key) == 0) {
-      s->state = (parsed_key.type == kTypeValue) ? kFound : kDeleted;
+      s->state = (parsed_key.type != kTypeDeletion) ? kFound : kDeleted;
+      s->type = parsed_key.type;
       if (s->state == kFound) {
-        s->value->assign(v.data(), v.size());
+        if (parsed_key.type == kTypeValueIndex) {
+          s->handle->assign(v.data(), v.size());
+        } else if (s->pinned != NULL) {
+          s->pinned->PinSlice(v);
+        } else if (s->value != NULL) {
+          s->value->assign(v.data(), v.size());
+        }
       }
     }
   }
@@ -305,9 +317,7 @@ static void SaveDummy(void* arg, const Slice& ikey, const Slice& v) {
     s->state = kCorrupt;
   } else {
     if (s->ucmp->Compare(parsed_key.user_key, s->user_key) == 0) {
-      s->state = (parsed_key.type == kTypeValue) ? kFound : kDeleted;
-      if (s->state == kFound) {
-      }
+      s->state = (parsed_key.type != kTypeDeletion) ? kFound : kDeleted;
     }
   }
 }
@@ -365,10 +375,34 @@ Status Version::Get(const ReadOptions& options,
                     const LookupKey& k,
                     std::string* value,
                     GetStats* stats) {
+  return InternalGet(options, k, value, NULL, NULL, stats);
+}
+
+Status Version::GetPinned(const ReadOptions& options,
+                          const LookupKey& k,
+                          PinnableSlice* value,
+                          GetStats* stats) {
+  return InternalGet(options, k, NULL, value, NULL, stats);
+}
+
+Status Version::GetValueHandle(const ReadOptions& options,
+                               const LookupKey& k,
+                               std::string* handle,
+                               GetStats* stats) {
+  return InternalGet(options, k, NULL, NULL, handle, stats);
+}
+
+Status Version::InternalGet(const ReadOptions& options,
+                            const LookupKey& k,
+                            std::string* value,
+                            PinnableSlice* pinned,
+                            std::string* handle,
+                            GetStats* stats) {
   Slice ikey = k.internal_key();
   Slice user_key = k.user_key();
   const Comparator* ucmp = vset_->icmp_.user_comparator();
   Status s;
+  std::string index;
 
   stats->seek_file = NULL;
   stats->seek_file_level = -1;
@@ -437,8 +471,10 @@ Status Version::Get(const ReadOptions& options,
       saver.ucmp = ucmp;
       saver.user_key = user_key;
       saver.value = value;
+      saver.pinned = pinned;
+      saver.handle = (handle != NULL) ? handle : &index;
       s = vset_->table_cache_->Get(options, f->number, f->file_size,
-                                   ikey, &saver, SaveValue);
+                                   ikey, &saver, SaveValue, pinned);
       if (!s.ok()) {
         return s;
       }
@@ -446,6 +482,13 @@ Status Version::Get(const ReadOptions& options,
         case kNotFound:
           break;      // Keep searching in other files
         case kFound:
+          if (handle != NULL) {
+            if (saver.type != kTypeValueIndex) {
+              s = Status::NotFound(Slice());
+            }
+          } else if (saver.type == kTypeValueIndex) {
+            s = ReadValueLog(options, index, value, pinned);
+          }
           return s;
         case kDeleted:
           s = Status::NotFound(Slice());  // Use empty error message for speed
@@ -460,6 +503,19 @@ Status Version::Get(const ReadOptions& options,
   return Status::NotFound(Slice());  // Use an empty error message for speed
 }
 
+Status Version::ReadValueLog(const ReadOptions& options,
+                             const Slice& handle,
+                             std::string* value,
+                             PinnableSlice* pinned) {
+  if (vset_->value_log_ == NULL) {
+    return Status::Corruption("no value log for a large value");
+  }
+  if (pinned != NULL) {
+    return vset_->value_log_->GetPinned(options, handle, pinned);
+  }
+  return vset_->value_log_->Get(options, handle, value);
+}
+
 Status Version::Contains(const ReadOptions& options,
                          const LookupKey& k,
                          GetStats* stats) {
@@ -904,11 +960,13 @@ class VersionSet::Builder {
 VersionSet::VersionSet(const std::string& dbname,
                        const Options* options,
                        TableCache* table_cache,
+                       ValueLog* value_log,
                        const InternalKeyComparator* cmp)
     : env_(options->env),
       dbname_(dbname),
       options_(options),
       table_cache_(table_cache),
+      value_log_(value_log),
       icmp_(*cmp),
       next_file_number_(2),
       manifest_file_number_(0),  // Filled by Recover()
@@ -1015,6 +1073,7 @@ Status VersionSet::LogAndApply(VersionEdit* edit, port::Mutex* mu) {
   // Install the new version
   if (s.ok()) {
     AppendVersion(v);
+    ApplyValueLogs(edit);
     log_number_ = edit->log_number_;
     prev_log_number_ = edit->prev_log_number_;
   } else {
@@ -1087,6 +1146,7 @@ Status VersionSet::Recover() {
 
       if (s.ok()) {
         builder.Apply(&edit);
+        ApplyValueLogs(&edit);
       }
 
       if (edit.has_log_number_) {
@@ -1128,6 +1188,16 @@ Status VersionSet::Recover() {
 
     MarkFileNumberUsed(prev_log_number);
     MarkFileNumberUsed(log_number);
+
+    // Value logs entirely garbage were deleted, or are about to be
+    std::map<uint64_t, ValueLogStats>::iterator it = value_logs_.begin();
+    while (it != value_logs_.end()) {
+      if (it->second.garbage >= it->second.file_size) {
+        value_logs_.erase(it++);
+      } else {
+        ++it;
+      }
+    }
   }
 
   if (s.ok()) {
@@ -1146,6 +1216,21 @@ Status VersionSet::Recover() {
   return s;
 }
 
+void VersionSet::ApplyValueLogs(const VersionEdit* edit) {
+  for (size_t i = 0; i < edit->new_value_logs_.size(); i++) {
+    ValueLogStats& stats = value_logs_[edit->new_value_logs_[i].first];
+    stats.file_size = edit->new_value_logs_[i].second;
+    stats.garbage = 0;
+  }
+  for (size_t i = 0; i < edit->value_log_garbage_.size(); i++) {
+    std::map<uint64_t, ValueLogStats>::iterator it =
+        value_logs_.find(edit->value_log_garbage_[i].first);
+    if (it != value_logs_.end()) {
+      it->second.garbage += edit->value_log_garbage_[i].second;
+    }
+  }
+}
+
 void VersionSet::MarkFileNumberUsed(uint64_t number) {
   if (next_file_number_ <= number) {
     next_file_number_ = number + 1;
@@ -1214,6 +1299,19 @@ Status VersionSet::WriteSnapshot(log::Writer* log) {
     }
   }
 
+  // Save value logs
+  for (std::map<uint64_t, ValueLogStats>::const_iterator it =
+           value_logs_.begin();
+       it != value_logs_.end();
+       ++it) {
+    if (it->second.garbage < it->second.file_size) {
+      edit.AddValueLog(it->first, it->second.file_size);
+      if (it->second.garbage > 0) {
+        edit.AddValueLogGarbage(it->first, it->second.garbage);
+      }
+    }
+  }
+
   std::string record;
   edit.EncodeTo(&record);
   return log->AddRecord(record);
@@ -1289,12 +1387,38 @@ void VersionSet::AddLiveFiles(std::set<uint64_t>* live) {
   }
 }
 
+void VersionSet::AddLiveValueLogs(std::set<uint64_t>* live) const {
+  for (std::map<uint64_t, ValueLogStats>::const_iterator it =
+           value_logs_.begin();
+       it != value_logs_.end();
+       ++it) {
+    if (it->second.garbage < it->second.file_size) {
+      live->insert(it->first);
+    }
+  }
+}
+
 int64_t VersionSet::NumLevelBytes(int level) const {
   assert(level >= 0);
   assert(level < config::kNumLevels);
   return TotalFileSize(current_->files_[level]);
 }
 
+uint64_t VersionSet::PendingCompactionBytes() const {
+  uint64_t result = 0;
+  if (current_->files_[0].size() >= config::kL0_CompactionTrigger) {
+    result += TotalFileSize(current_->files_[0]);
+  }
+  for (int level = 1; level < config::kNumLevels-1; level++) {
+    const int64_t bytes = TotalFileSize(current_->files_[level]);
+    const double limit = MaxBytesForLevel(level);
+    if (bytes > limit) {
+      result += static_cast<uint64_t>(bytes - limit);
+    }
+  }
+  return result;
+}
+
 int64_t VersionSet::MaxNextLevelOverlappingBytes() {
   int64_t result = 0;
   std::vector<FileMetaData*> overlaps;
@@ -1317,7 +1441,7 @@ int64_t VersionSet::MaxNextLevelOverlappingBytes() {
 // REQUIRES: inputs is not empty
 void VersionSet::GetRange(const std::vector<FileMetaData*>& inputs,
                           InternalKey* smallest,
-                          InternalKey* largest) {
+                          InternalKey* largest) const {
   assert(!inputs.empty());
   smallest->Clear();
   largest->Clear();
@@ -1343,7 +1467,7 @@ void VersionSet::GetRange(const std::vector<FileMetaData*>& inputs,
 void VersionSet::GetRange2(const std::vector<FileMetaData*>& inputs1,
                            const std::vector<FileMetaData*>& inputs2,
                            InternalKey* smallest,
-                           InternalKey* largest) {
+                           InternalKey* largest) const {
   std::vector<FileMetaData*> all = inputs1;
   all.insert(all.end(), inputs2.begin(), inputs2.end());
   GetRange(all, smallest, largest);
@@ -1382,43 +1506,100 @@ Iterator* VersionSet::MakeInputIterator(Compaction* c) {
   return result;
 }
 
-Compaction* VersionSet::PickCompaction() {
-  Compaction* c;
-  int level;
+// Score of "level" counting only the files not being compacted, see
+// VersionSet::Finalize().
+static double AvailableScore(const std::vector<FileMetaData*>& files,
+                             int level) {
+  int count = 0;
+  int64_t bytes = 0;
+  for (size_t i = 0; i < files.size(); i++) {
+    if (!files[i]->being_compacted) {
+      count++;
+      bytes += files[i]->file_size;
+    }
+  }
+  if (level == 0) {
+    return count / static_cast<double>(config::kL0_CompactionTrigger);
+  }
+  return static_cast<double>(bytes) / MaxBytesForLevel(level);
+}
 
+Compaction* VersionSet::PickCompaction() {
   // We prefer compactions triggered by too much data in a level over
-  // the compactions triggered by seeks.
-  const bool size_compaction = (current_->compaction_score_ >= 1);
-  const bool seek_compaction = (current_->file_to_compact_ != NULL);
-  if (size_compaction) {
-    level = current_->compaction_level_;
-    assert(level >= 0);
-    assert(level+1 < config::kNumLevels);
-    c = new Compaction(level);
-
-    // Pick the first file that comes after compact_pointer_[level]
-    for (size_t i = 0; i < current_->files_[level].size(); i++) {
-      FileMetaData* f = current_->files_[level][i];
-      if (compact_pointer_[level].empty() ||
-          icmp_.Compare(f->largest.Encode(), compact_pointer_[level]) > 0) {
-        c->inputs_[0].push_back(f);
+  // the compactions triggered by seeks.  The levels are tried from the
+  // highest score down, so that a level whose files are all being
+  // compacted does not hold back the others.
+  std::vector<std::pair<double, int> > levels;
+  for (int level = 0; level < config::kNumLevels-1; level++) {
+    const double score = AvailableScore(current_->files_[level], level);
+    if (score >= 1) {
+      levels.push_back(std::make_pair(score, level));
+    }
+  }
+  std::sort(levels.rbegin(), levels.rend());
+
+  for (size_t l = 0; l < levels.size(); l++) {
+    const int level = levels[l].second;
+    const std::vector<FileMetaData*>& files = current_->files_[level];
+
+    // Start with the first file that comes after compact_pointer_[level],
+    // wrapping around to the beginning of the key space
+    size_t first = 0;
+    if (!compact_pointer_[level].empty()) {
+      while (first < files.size() &&
+             icmp_.Compare(files[first]->largest.Encode(),
+                           compact_pointer_[level]) <= 0) {
+        first++;
+      }
+      if (first == files.size()) {
+        first = 0;
+      }
+    }
+    for (size_t i = 0; i < files.size(); i++) {
+      FileMetaData* f = files[(first + i) % files.size()];
+      if (f->being_compacted) {
+        continue;
+      }
+      Compaction* c = NewCompaction(level, f);
+      if (c != NULL) {
+        AcceptCompaction(c);
+        return c;
+      }
+      if (level == 0) {
+        // Another compaction holds level-0, see NewCompaction()
         break;
       }
     }
-    if (c->inputs_[0].empty()) {
-      // Wrap-around to the beginning of the key space
-      c->inputs_[0].push_back(current_->files_[level][0]);
+  }
+
+  FileMetaData* f = current_->file_to_compact_;
+  if (f != NULL && !f->being_compacted) {
+    Compaction* c = NewCompaction(current_->file_to_compact_level_, f);
+    if (c != NULL) {
+      AcceptCompaction(c);
+      return c;
     }
-  } else if (seek_compaction) {
-    level = current_->file_to_compact_level_;
-    c = new Compaction(level);
-    c->inputs_[0].push_back(current_->file_to_compact_);
-  } else {
-    return NULL;
   }
+  return NULL;
+}
 
+Compaction* VersionSet::NewCompaction(int level, FileMetaData* f) {
+  assert(level >= 0);
+  assert(level+1 < config::kNumLevels);
+  if (level == 0) {
+    // Files in level 0 may overlap each other and must be compacted in
+    // order: a single compaction out of level 0 at a time.
+    for (size_t i = 0; i < current_->files_[0].size(); i++) {
+      if (current_->files_[0][i]->being_compacted) {
+        return NULL;
+      }
+    }
+  }
+
+  Compaction* c = new Compaction(level);
   c->input_version_ = current_;
   c->input_version_->Ref();
+  c->inputs_[0].push_back(f);
 
   // Files in level 0 may overlap each other, so pick up all overlapping ones
   if (level == 0) {
@@ -1433,6 +1614,10 @@ Compaction* VersionSet::PickCompaction() {
 
   SetupOtherInputs(c);
 
+  if (c->InputsBeingCompacted()) {
+    delete c;
+    return NULL;
+  }
   return c;
 }
 
@@ -1494,6 +1679,12 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
         smallest.DebugString().c_str(),
         largest.DebugString().c_str());
   }
+}
+
+void VersionSet::AcceptCompaction(Compaction* c) {
+  const int level = c->level();
+  InternalKey smallest, largest;
+  GetRange(c->inputs_[0], &smallest, &largest);
 
   // Update the place where we will do the next compaction for this level.
   // We update this immediately instead of waiting for the VersionEdit
@@ -1501,6 +1692,8 @@ void VersionSet::SetupOtherInputs(Compaction* c) {
   // key range next time.
   compact_pointer_[level] = largest.Encode().ToString();
   c->edit_.SetCompactPointer(level, largest);
+
+  c->MarkInputs(true);
 }
 
 Compaction* VersionSet::CompactRange(
@@ -1535,6 +1728,7 @@ Compaction* VersionSet::CompactRange(
   c->input_version_->Ref();
   c->inputs_[0] = inputs;
   SetupOtherInputs(c);
+  AcceptCompaction(c);
   return c;
 }
 
@@ -1542,6 +1736,7 @@ Compaction::Compaction(int level)
     : level_(level),
       max_output_file_size_(MaxFileSizeForLevel(level)),
       input_version_(NULL),
+      inputs_marked_(false),
       grandparent_index_(0),
       seen_key_(false),
       overlapped_bytes_(0) {
@@ -1551,9 +1746,7 @@ Compaction::Compaction(int level)
 }
 
 Compaction::~Compaction() {
-  if (input_version_ != NULL) {
-    input_version_->Unref();
-  }
+  ReleaseInputs();
 }
 
 bool Compaction::IsTrivialMove() const {
@@ -1616,8 +1809,85 @@ bool Compaction::ShouldStopBefore(const Slice& internal_key) {
   }
 }
 
+bool Compaction::OutputOverlaps(const Slice& smallest_user_key,
+                                const Slice& largest_user_key) const {
+  assert(input_version_ != NULL);
+  const VersionSet* vset = input_version_->vset_;
+  const Comparator* user_cmp = vset->icmp_.user_comparator();
+  InternalKey smallest, largest;
+  vset->GetRange2(inputs_[0], inputs_[1], &smallest, &largest);
+  return user_cmp->Compare(smallest_user_key, largest.user_key()) <= 0 &&
+         user_cmp->Compare(largest_user_key, smallest.user_key()) >= 0;
+}
+
+void Compaction::GetSplitKeys(int n, std::vector<std::string>* keys) const {
+  keys->clear();
+  // Files in level 0 may overlap each other: they are split only along
+  // the files of level+1.
+  const std::vector<FileMetaData*>* files = &inputs_[1];
+  if (files->empty() && level_ > 0) {
+    files = &inputs_[0];
+  }
+  const int64_t total = TotalFileSize(*files);
+  const int64_t most = total / static_cast<int64_t>(max_output_file_size_);
+  if (most < n) {
+    n = static_cast<int>(most);
+  }
+  if (n < 2 || files->size() < 2) {
+    return;
+  }
+
+  const Comparator* user_cmp = input_version_->vset_->icmp_.user_comparator();
+  const int64_t share = total / n;
+  int64_t bytes = 0;
+  for (size_t i = 0;
+       i + 1 < files->size() && static_cast<int>(keys->size()) + 1 < n;
+       i++) {
+    bytes += (*files)[i]->file_size;
+    if (bytes >= share * static_cast<int64_t>(keys->size() + 1)) {
+      const Slice key = (*files)[i + 1]->smallest.user_key();
+      if (keys->empty() || user_cmp->Compare(key, keys->back()) > 0) {
+        keys->push_back(key.ToString());
+      }
+    }
+  }
+}
+
+Compaction* Compaction::NewSubcompaction() const {
+  Compaction* c = new Compaction(level_);
+  c->input_version_ = input_version_;
+  c->input_version_->Ref();
+  c->inputs_[0] = inputs_[0];
+  c->inputs_[1] = inputs_[1];
+  c->grandparents_ = grandparents_;
+  return c;
+}
+
+void Compaction::MarkInputs(bool being_compacted) {
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < inputs_[which].size(); i++) {
+      inputs_[which][i]->being_compacted = being_compacted;
+    }
+  }
+  inputs_marked_ = being_compacted;
+}
+
+bool Compaction::InputsBeingCompacted() const {
+  for (int which = 0; which < 2; which++) {
+    for (size_t i = 0; i < inputs_[which].size(); i++) {
+      if (inputs_[which][i]->being_compacted) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
 void Compaction::ReleaseInputs() {
   if (input_version_ != NULL) {
+    if (inputs_marked_) {
+      MarkInputs(false);
+    }
     input_version_->Unref();
     input_version_ = NULL;
   }
@@ -30,8 +30,10 @@ namespace log { class Writer; }
 class Compaction;
 class Iterator;
 class MemTable;
+class PinnableSlice;
 class TableBuilder;
 class TableCache;
+class ValueLog;
 class Version;
 class VersionSet;
 class WritableFile;
@@ -72,7 +74,15 @@ class Version {
   };
   Status Get(const ReadOptions&, const LookupKey& key, std::string* val,
              GetStats* stats);
+  // Like Get(), but a value found in a table is pinned into "*val"
+  // instead of being copied.
+  Status GetPinned(const ReadOptions&, const LookupKey& key,
+                   PinnableSlice* val, GetStats* stats);
   Status Contains(const ReadOptions&, const LookupKey& key, GetStats* stats);
+  // Like Get(), but only succeeds if the newest entry for key refers to
+  // a value log, storing in *handle the encoded ValueHandle.
+  Status GetValueHandle(const ReadOptions&, const LookupKey& key,
+                        std::string* handle, GetStats* stats);
 
   // Adds "stats" into the current state.  Returns true if a new
   // compaction may need to be triggered, false otherwise.
@@ -121,6 +131,17 @@ class Version {
   class LevelFileNumIterator;
   Iterator* NewConcatenatingIterator(const ReadOptions&, int level) const;
 
+  // Shared implementation of Get(), GetPinned() and GetValueHandle():
+  // exactly one of "value", "pinned" and "handle" is non-NULL.
+  Status InternalGet(const ReadOptions&, const LookupKey& key,
+                     std::string* value, PinnableSlice* pinned,
+                     std::string* handle, GetStats* stats);
+
+  // Read from the value log the value "handle" refers to, into *value
+  // or else into *pinned.
+  Status ReadValueLog(const ReadOptions&, const Slice& handle,
+                      std::string* value, PinnableSlice* pinned);
+
   // Call func(arg, level, f) for every file that overlaps user_key in
   // order from newest to oldest.  If an invocation of func returns
   // false, makes no more calls.
@@ -168,6 +189,7 @@ class VersionSet {
   VersionSet(const std::string& dbname,
              const Options* options,
              TableCache* table_cache,
+             ValueLog* value_log,
              const InternalKeyComparator*);
   ~VersionSet();
 
@@ -206,6 +228,11 @@ class VersionSet {
   // Return the combined file size of all files at the specified level.
   int64_t NumLevelBytes(int level) const;
 
+  // Return the bytes of the levels beyond their size limit, and of
+  // level-0 once it has enough files to be compacted: about what the
+  // compactions still have to compact.
+  uint64_t PendingCompactionBytes() const;
+
   // Return the last sequence number.
   uint64_t LastSequence() const { return last_sequence_; }
 
@@ -225,7 +252,9 @@ class VersionSet {
   // being compacted, or zero if there is no such log file.
   uint64_t PrevLogNumber() const { return prev_log_number_; }
 
-  // Pick level and inputs for a new compaction.
+  // Pick level and inputs for a new compaction.  The inputs of the
+  // compactions not yet deleted are left out, so that compactions may
+  // run concurrently.
   // Returns NULL if there is no compaction to be done.
   // Otherwise returns a pointer to a heap-allocated object that
   // describes the compaction.  Caller should delete the result.
@@ -258,6 +287,27 @@ class VersionSet {
   // May also mutate some internal state.
   void AddLiveFiles(std::set<uint64_t>* live);
 
+  // Size of a value log, and bytes of its records no table refers to.
+  struct ValueLogStats {
+    uint64_t file_size;
+    uint64_t garbage;
+  };
+  const std::map<uint64_t, ValueLogStats>& value_logs() const {
+    return value_logs_;
+  }
+
+  // Add to *live the value logs some table may still refer to.
+  void AddLiveValueLogs(std::set<uint64_t>* live) const;
+
+  // Returns true iff no version older than the current one is in use:
+  // nothing reads the value logs the current version no longer needs.
+  bool OnlyCurrentVersionLive() const {
+    return dummy_versions_.next_ == current_;
+  }
+
+  // Forget the value log "number", deleted.
+  void ForgetValueLog(uint64_t number) { value_logs_.erase(number); }
+
   // Return the approximate offset in the database of the data for
   // "key" as of version "v".
   uint64_t ApproximateOffsetOf(Version* v, const InternalKey& key);
@@ -279,24 +329,35 @@ class VersionSet {
 
   void GetRange(const std::vector<FileMetaData*>& inputs,
                 InternalKey* smallest,
-                InternalKey* largest);
+                InternalKey* largest) const;
 
   void GetRange2(const std::vector<FileMetaData*>& inputs1,
                  const std::vector<FileMetaData*>& inputs2,
                  InternalKey* smallest,
-                 InternalKey* largest);
+                 InternalKey* largest) const;
+
+  // Return a compaction of "f" in "level", with the other inputs it
+  // needs, or NULL if some of these inputs are being compacted.
+  Compaction* NewCompaction(int level, FileMetaData* f);
 
   void SetupOtherInputs(Compaction* c);
 
+  // Make "c" the compaction next to run at its level.
+  void AcceptCompaction(Compaction* c);
+
   // Save current contents to *log
   Status WriteSnapshot(log::Writer* log);
 
   void AppendVersion(Version* v);
 
+  // Apply the value log records of *edit to value_logs_.
+  void ApplyValueLogs(const VersionEdit* edit);
+
   Env* const env_;
   const std::string dbname_;
   const Options* const options_;
   TableCache* const table_cache_;
+  ValueLog* const value_log_;
   const InternalKeyComparator icmp_;
   uint64_t next_file_number_;
   uint64_t manifest_file_number_;
@@ -314,6 +375,9 @@ class VersionSet {
   // Either an empty string, or a valid InternalKey.
   std::string compact_pointer_[config::kNumLevels];
 
+  // Value logs added and not yet deleted.
+  std::map<uint64_t, ValueLogStats> value_logs_;
+
   // No copying allowed
   VersionSet(const VersionSet&);
   void operator=(const VersionSet&);
@@ -361,15 +425,36 @@ class Compaction {
   // is successful.
   void ReleaseInputs();
 
+  // Returns true iff the files this compaction adds to level()+1 may
+  // overlap [smallest_user_key,largest_user_key].
+  bool OutputOverlaps(const Slice& smallest_user_key,
+                      const Slice& largest_user_key) const;
+
+  // Store in *keys up to n-1 increasing user keys splitting the inputs
+  // into ranges holding about the same bytes of level()+1 files, and at
+  // least MaxOutputFileSize() of them.  The ranges start on file
+  // boundaries, and may be compacted independently.
+  void GetSplitKeys(int n, std::vector<std::string>* keys) const;
+
+  // Return a compaction of the same inputs, with its own state for
+  // ShouldStopBefore() and IsBaseLevelForKey(), to compact one of the
+  // ranges given by GetSplitKeys().  Its edit() is not used.
+  Compaction* NewSubcompaction() const;
+
  private:
   friend class Version;
   friend class VersionSet;
 
   explicit Compaction(int level);
 
+  // Mark the inputs as being compacted, or no longer.
+  void MarkInputs(bool being_compacted);
+  bool InputsBeingCompacted() const;
+
   int level_;
   uint64_t max_output_file_size_;
   Version* input_version_;
+  bool inputs_marked_;          // This compaction marked its inputs
   VersionEdit edit_;
 
   // Each compaction reads inputs from "level_" and "level_+1"
@@ -10,10 +10,11 @@
 // length strings, may use the length of the string as the charge for
 // the string.
 //
-// A builtin cache implementation with a least-recently-used eviction
-// policy is provided.  Clients may use their own implementations if
-// they want something more sophisticated (like scan-resistance, a
-// custom eviction policy, variable cache sizing, etc.)
+// Two builtin cache implementations are provided: one with a
+// least-recently-used eviction policy, and one with a CLOCK eviction
+// policy whose lookups take no lock.  Clients may use their own
+// implementations if they want something more sophisticated (like
+// scan-resistance, a custom eviction policy, etc.)
 
 #ifndef STORAGE_LEVELDB_INCLUDE_CACHE_H_
 #define STORAGE_LEVELDB_INCLUDE_CACHE_H_
@@ -29,6 +30,16 @@ class Cache;
 // of Cache uses a least-recently-used eviction policy.
 extern Cache* NewLRUCache(size_t capacity);
 
+// Create a new cache with a fixed size capacity, using a CLOCK eviction
+// policy: a hit only sets the reference bit of the entry, without taking
+// any lock, so that many threads may read from the cache at once.  The
+// number of shards follows the number of processors.
+//
+// The entries are kept in tables sized for capacity/estimated_entry_charge
+// entries.  SetCapacity() grows the tables along with the capacity, the
+// entries in use at that time being dropped once released.
+extern Cache* NewClockCache(size_t capacity, size_t estimated_entry_charge);
+
 class Cache {
  public:
   Cache() { }
@@ -81,6 +92,15 @@ class Cache {
   // its cache keys.
   virtual uint64_t NewId() = 0;
 
+  // Return the sum of the charges of all the entries stored in the
+  // cache, including the entries that are only kept alive by handles.
+  virtual size_t TotalCharge() const = 0;
+
+  // Change the capacity of the cache, evicting entries at once if it
+  // shrinks.  May be called while the cache is in use.
+  virtual void SetCapacity(size_t capacity) = 0;
+  virtual size_t GetCapacity() const = 0;
+
  private:
   void LRU_Remove(Handle* e);
   void LRU_Append(Handle* e);
@@ -7,8 +7,10 @@
 
 #include <stdint.h>
 #include <stdio.h>
+#include <vector>
 #include "leveldb/iterator.h"
 #include "leveldb/options.h"
+#include "leveldb/pinnable_slice.h"
 
 namespace leveldb {
 
@@ -29,6 +31,40 @@ class Snapshot {
   virtual ~Snapshot();
 };
 
+// Statistics of a level, see DB::GetStats().
+struct LevelStats {
+  int files;                    // Number of table files in the level
+  uint64_t bytes;               // Total size of these files
+  uint64_t compaction_micros;   // Time spent compacting into the level
+  uint64_t bytes_read;          // Bytes read by these compactions
+  uint64_t bytes_written;       // Bytes written by these compactions
+
+  LevelStats()
+      : files(0), bytes(0), compaction_micros(0),
+        bytes_read(0), bytes_written(0) { }
+};
+
+// Statistics of a DB since it was opened, see DB::GetStats().
+struct DbStats {
+  std::vector<LevelStats> levels;
+  uint64_t user_bytes_written;  // Bytes of the batches given to Write()
+  uint64_t stall_micros;        // Time writes waited in MakeRoomForWrite()
+  uint64_t slowdown_stalls;     // Writes delayed, too many level-0 files
+  uint64_t memtable_stalls;     // Waits for the memtable compaction
+  uint64_t level0_stalls;       // Waits, far too many level-0 files
+  uint64_t memtable_bytes;      // Memory used by the memtables
+  uint64_t block_cache_bytes;   // Charge of the entries of the block cache
+  uint64_t value_log_files;     // Value logs not yet deleted
+  uint64_t value_log_bytes;     // Size of these value logs
+  uint64_t value_log_garbage_bytes;  // Their records no table refers to
+
+  DbStats()
+      : user_bytes_written(0), stall_micros(0), slowdown_stalls(0),
+        memtable_stalls(0), level0_stalls(0), memtable_bytes(0),
+        block_cache_bytes(0), value_log_files(0), value_log_bytes(0),
+        value_log_garbage_bytes(0) { }
+};
+
 // A range of keys
 struct Range {
   Slice start;          // Included in the range
@@ -83,6 +119,16 @@ class DB {
   virtual Status Get(const ReadOptions& options,
                      const Slice& key, std::string* value) = 0;
 
+  // Same as Get(), but when the value is stored in a table, "*value"
+  // refers to the table block instead of a copy of it and keeps that
+  // block alive until it is Reset() or destroyed.  Values found in the
+  // memtables are copied into the buffer owned by "*value".
+  //
+  // "*value" may be released after this db is deleted, if the block
+  // cache of its options is deleted later still.
+  virtual Status GetPinned(const ReadOptions& options,
+                           const Slice& key, PinnableSlice* value) = 0;
+
   // If the database contains an entry for "key" return OK.
   //
   // If there is no entry for "key" leave value unchanged and return
@@ -92,6 +138,17 @@ class DB {
   virtual Status Contains(const ReadOptions& options,
                           const Slice& key) = 0;
 
+  // For each i in [0,keys.size()-1], look up "keys[i]" as Get() does:
+  // store the corresponding value in (*values)[i] and its status in the
+  // i-th element of the returned vector.  *values is resized to match
+  // "keys".
+  //
+  // All the lookups observe the same state of the database and share a
+  // single acquisition of the internal mutex.
+  virtual std::vector<Status> MultiGet(const ReadOptions& options,
+                                       const std::vector<Slice>& keys,
+                                       std::vector<std::string>* values) = 0;
+
   // Return a heap-allocated iterator over the contents of the database.
   // The result of NewIterator() is initially invalid (caller must
   // call one of the Seek methods on the iterator before using it).
@@ -126,6 +183,11 @@ class DB {
   //     of the sstables that make up the db contents.
   virtual bool GetProperty(const Slice& property, std::string* value) = 0;
 
+  // Fill "*stats" with the shape of the levels and the counters of the
+  // compactions and the write stalls.  The typed form of the
+  // "leveldb.stats" property.
+  virtual void GetStats(DbStats* stats) = 0;
+
   // For each i in [0,n-1], store in "sizes[i]", the approximate
   // file system space used by keys in "[range[i].start .. range[i].limit)".
   //
@@ -149,6 +211,22 @@ class DB {
   //    db->CompactRange(NULL, NULL);
   virtual void CompactRange(const Slice* begin, const Slice* end) = 0;
 
+  // Move into the DB the table files built by TableFileWriter, bypassing
+  // the log, the memtable and the compactions.  The files must not
+  // overlap each other.  A file overlapping nothing in the DB is added
+  // as is to the last level.  Otherwise its entries are rewritten, newer
+  // than anything written before, and the file is added to the deepest
+  // level it can go to without hiding newer data; the memtable is
+  // compacted first if it overlaps.  Writes wait while tables are
+  // ingested, and all the files are added at once or none is.
+  //
+  // A file moved as is keeps the entries of sequence number zero written
+  // by TableFileWriter: snapshots taken before see them.
+  //
+  // On success the files no longer exist under their names.  On failure
+  // they are left in place.
+  virtual Status IngestTables(const std::vector<std::string>& fnames) = 0;
+
  private:
   // No copying allowed
   DB(const DB&);
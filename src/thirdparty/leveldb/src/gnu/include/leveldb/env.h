@@ -125,6 +125,20 @@ class Env {
       void (*function)(void* arg),
       void* arg) = 0;
 
+  // Background work is run by pools of threads.  The work of the HIGH
+  // pool, such as memtable compactions, does not wait behind the
+  // long-running work of the LOW pool.
+  enum Priority { LOW, HIGH };
+
+  // Same as Schedule(), in the thread pool "pri".  The default
+  // implementation ignores "pri" and calls Schedule().
+  virtual void ScheduleWithPriority(void (*function)(void* arg), void* arg,
+                                    Priority pri);
+
+  // Let the thread pool "pri" run up to "number" functions at once.
+  // A pool never shrinks.  The default implementation does nothing.
+  virtual void SetBackgroundThreads(int number, Priority pri);
+
   // Start a new thread, invoking "function(arg)" within the new thread.
   // When "function(arg)" returns, the thread will be destroyed.
   virtual void StartThread(void (*function)(void* arg), void* arg) = 0;
@@ -309,6 +323,12 @@ class EnvWrapper : public Env {
   void Schedule(void (*f)(void*), void* a) {
     return target_->Schedule(f, a);
   }
+  void ScheduleWithPriority(void (*f)(void*), void* a, Priority pri) {
+    return target_->ScheduleWithPriority(f, a, pri);
+  }
+  void SetBackgroundThreads(int number, Priority pri) {
+    return target_->SetBackgroundThreads(number, pri);
+  }
   void StartThread(void (*f)(void*), void* a) {
     return target_->StartThread(f, a);
   }
@@ -65,6 +65,15 @@ class FilterPolicy {
 // trailing spaces in keys.
 extern const FilterPolicy* NewBloomFilterPolicy(int bits_per_key);
 
+// Return a new filter policy that uses a bloom filter cut in 64-byte
+// lines, all the probes of a key falling in the same line: a lookup of
+// a missing key costs one cache miss instead of one per probe.  For the
+// same false positive rate, it needs about one more bit per key than
+// NewBloomFilterPolicy(): 10 bits per key yield ~ 1.2%, 16 bits ~ 0.1%.
+// Its filters are named differently, tables written with the other
+// policy are read without their filters.  The same notes apply.
+extern const FilterPolicy* NewBlockedBloomFilterPolicy(int bits_per_key);
+
 }
 
 #endif  // STORAGE_LEVELDB_INCLUDE_FILTER_POLICY_H_
@@ -14,6 +14,7 @@ class Comparator;
 class Env;
 class FilterPolicy;
 class Logger;
+class RateLimiter;
 class Snapshot;
 
 // DB contents are stored in a set of blocks, each of which holds a
@@ -93,7 +94,8 @@ struct Options {
   // a block is the unit of reading from disk).
 
   // If non-NULL, use the specified cache for blocks.
-  // If NULL, leveldb will automatically create and use an 8MB internal cache.
+  // If NULL, leveldb will automatically create and use an 8MB internal
+  // cache, with CLOCK eviction.
   // Default: NULL
   Cache* block_cache;
 
@@ -135,6 +137,87 @@ struct Options {
   // Default: NULL
   const FilterPolicy* filter_policy;
 
+  // If true, a table gets a single filter of all its keys, checked before
+  // its index, instead of a filter per 2KB of data blocks.  Tables of
+  // both kinds are read whatever this option.
+  //
+  // Default: false
+  bool whole_table_filter;
+
+  // If non-zero, the whole table filter is cut in partitions of this many
+  // keys, read on demand through the block_cache: a lookup only reads the
+  // partition of its key, and large tables do not keep large filters in
+  // memory.
+  //
+  // Default: 0
+  size_t filter_partition_keys;
+
+  // A synchronous write waits up to this many microseconds for
+  // concurrent writes to join it, so that a single fdatasync() makes the
+  // whole group durable.  The wait ends early once max_write_group_size
+  // bytes are queued.  Zero writes as soon as possible.
+  //
+  // Default: 0
+  int group_commit_delay_micros;
+
+  // Maximum bytes of write batches merged and logged together.
+  //
+  // Default: 1MB
+  size_t max_write_group_size;
+
+  // If true, the writers of a group insert their own batch into the
+  // memtable at once, once the leader has logged the whole group,
+  // instead of the leader inserting all the batches alone.  Many threads
+  // writing at once are then no longer bound by a single core.
+  //
+  // Default: false
+  bool concurrent_memtable_writes;
+
+  // If true, a group leaves the writer queue once logged, and the next
+  // group is logged while its batches go into the memtable.  The
+  // sequence numbers of the groups still become visible in log order.
+  //
+  // Default: false
+  bool pipelined_writes;
+
+  // Values of at least this many bytes are not stored in the tables but
+  // in value logs written at memtable compactions: the tables only keep
+  // a small reference, and compactions no longer copy the values.  Zero
+  // keeps all the values in the tables.
+  //
+  // Default: 0
+  size_t value_log_threshold;
+
+  // A value log is rewritten by the background garbage collection once
+  // this fraction of its bytes belongs to values overwritten or deleted.
+  //
+  // Default: 0.5
+  double value_log_gc_ratio;
+
+  // Number of compactions of non-overlapping key ranges that may run at
+  // once, in the LOW priority threads of the Env.  The memtable is
+  // compacted in a HIGH priority thread, so that writes are not held back
+  // by a long compaction.  Open() makes sure the Env has as many threads.
+  //
+  // Default: 1
+  int max_background_compactions;
+
+  // A compaction with enough input is split into up to this many ranges
+  // of keys, along the boundaries of its input files, merged at once in
+  // the LOW priority threads.  Their outputs are installed together.
+  // Open() gives the Env max_background_compactions * max_subcompactions
+  // LOW priority threads.
+  //
+  // Default: 1
+  int max_subcompactions;
+
+  // If non-NULL, bounds the bytes written per second by the memtable
+  // compactions and the compactions, see leveldb/rate_limiter.h.  The
+  // DB reports its load to it once per second.
+  //
+  // Default: NULL
+  RateLimiter* rate_limiter;
+
   // Create an Options object with default values for all fields.
   Options();
 };
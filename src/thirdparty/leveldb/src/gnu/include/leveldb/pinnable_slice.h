@@ -0,0 +1,110 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// PinnableSlice is the value filled by DB::GetPinned().  When the value
+// lives in a table block, the slice refers directly to the block (in the
+// block cache or in an mmapped table file) and keeps it alive until the
+// PinnableSlice is Reset() or destroyed.  Large values read from a value
+// log are pinned the same way in the block cache.  Otherwise the value is
+// copied once into a buffer owned by the PinnableSlice.
+//
+// A pinned value may outlive the DB it was read from when the block
+// cache of its options was given by the caller and is deleted after it.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
+#define STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
+
+#include <assert.h>
+#include <string>
+#include "leveldb/iterator.h"
+#include "leveldb/slice.h"
+
+namespace leveldb {
+
+class PinnableSlice {
+ public:
+  PinnableSlice() : pinned_iter_(NULL), pending_(false) { }
+
+  ~PinnableSlice() { Reset(); }
+
+  // Return the referenced value.
+  Slice data() const { return data_; }
+
+  // Return true iff the value refers to memory held by the database
+  // rather than to the buffer owned by this object.
+  bool IsPinned() const { return pinned_iter_ != NULL; }
+
+  // Return the buffer owned by this object.  The caller may fill it and
+  // then call PinSelf(), or take its contents when !IsPinned().
+  std::string* GetSelf() { return &buf_; }
+
+  // Make the value refer to the buffer owned by this object.
+  void PinSelf() {
+    assert(!IsPinned());
+    data_ = buf_;
+  }
+
+  // Release the pinned memory (if any) and clear the value.
+  void Reset() {
+    delete pinned_iter_;
+    pinned_iter_ = NULL;
+    pending_ = false;
+    data_.clear();
+    buf_.clear();
+  }
+
+  // Internal methods used by the read path.
+
+  // Record "s" as the value.  "s" is only valid until the iterator it
+  // was read from is handed over to PinIterator().
+  void PinSlice(const Slice& s) {
+    assert(!IsPinned());
+    data_ = s;
+    pending_ = true;
+  }
+
+  // Return true iff PinSlice() was called and is waiting for the owner of
+  // the recorded value.
+  bool IsPending() const { return pending_; }
+
+  // Take ownership of "iter", which holds the memory recorded by the
+  // last PinSlice().
+  void PinIterator(Iterator* iter) {
+    assert(pending_ && pinned_iter_ == NULL);
+    pinned_iter_ = iter;
+    pending_ = false;
+  }
+
+  // Make the value refer to "s", held until function(arg1, arg2) is
+  // invoked when the value is released.
+  void PinCleanup(const Slice& s, Iterator::CleanupFunction function,
+                  void* arg1, void* arg2) {
+    assert(!IsPinned() && !pending_);
+    data_ = s;
+    pinned_iter_ = NewEmptyIterator();
+    pinned_iter_->RegisterCleanup(function, arg1, arg2);
+  }
+
+  // Invoke function(arg1, arg2) when the pinned memory is released.
+  // REQUIRES: IsPinned()
+  void RegisterCleanup(Iterator::CleanupFunction function,
+                       void* arg1, void* arg2) {
+    assert(IsPinned());
+    pinned_iter_->RegisterCleanup(function, arg1, arg2);
+  }
+
+ private:
+  Slice data_;
+  std::string buf_;
+  Iterator* pinned_iter_;
+  bool pending_;
+
+  // No copying allowed
+  PinnableSlice(const PinnableSlice&);
+  void operator=(const PinnableSlice&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_PINNABLE_SLICE_H_
@@ -0,0 +1,74 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A RateLimiter bounds the bytes per second written by the background
+// work of a DB: the tables and value logs of the memtable compactions and
+// of the compactions.  Bursts of compactions no longer take the whole
+// disk from the reads.  It has internal synchronization and may be
+// shared by several DBs.
+//
+// The rate is either fixed, or tuned between two bounds from the load
+// the DB reports: the latency of the reads served from the tables, and
+// how far behind the compactions are.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
+#define STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
+
+#include <stdint.h>
+#include "leveldb/env.h"
+
+namespace leveldb {
+
+class RateLimiter;
+
+// Create a rate limiter letting through up to bytes_per_second.
+extern RateLimiter* NewRateLimiter(int64_t bytes_per_second);
+
+// Create a rate limiter letting through max_bytes_per_second at first,
+// then tuned between min_bytes_per_second and max_bytes_per_second: the
+// rate is raised while the compactions have more than max_pending_bytes
+// to compact, and otherwise lowered while the reads take more than
+// target_read_micros on average.
+extern RateLimiter* NewAutoTunedRateLimiter(int64_t min_bytes_per_second,
+                                            int64_t max_bytes_per_second,
+                                            uint64_t target_read_micros,
+                                            uint64_t max_pending_bytes);
+
+// Return a file writing to "base", whose Append() first asks "limiter"
+// for the bytes appended, with priority "pri".  The result owns "base".
+extern WritableFile* NewRateLimitedFile(WritableFile* base,
+                                        RateLimiter* limiter,
+                                        Env::Priority pri);
+
+class RateLimiter {
+ public:
+  RateLimiter() { }
+  virtual ~RateLimiter();
+
+  // Wait until "bytes" may be written.  The requests of priority
+  // Env::HIGH, the memtable compactions, are counted but never wait: the
+  // other requests wait for them, up to a bounded debt.
+  virtual void Request(int64_t bytes, Env::Priority pri) = 0;
+
+  virtual void SetBytesPerSecond(int64_t bytes_per_second) = 0;
+  virtual int64_t GetBytesPerSecond() const = 0;
+
+  // Total bytes requested so far.
+  virtual int64_t GetTotalBytesThrough() const = 0;
+
+  // Report the load of a DB since its previous report: the average
+  // latency of the reads served from its tables, and the bytes of its
+  // levels beyond their size limit.  An auto-tuned rate limiter adjusts
+  // its rate, the others ignore the report.
+  virtual void ReportLoad(uint64_t read_micros, uint64_t pending_bytes);
+
+ private:
+  // No copying allowed
+  RateLimiter(const RateLimiter&);
+  void operator=(const RateLimiter&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_RATE_LIMITER_H_
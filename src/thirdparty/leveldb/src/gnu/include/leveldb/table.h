@@ -14,6 +14,7 @@ class Block;
 class BlockHandle;
 class Footer;
 struct Options;
+class PinnableSlice;
 class RandomAccessFile;
 struct ReadOptions;
 class TableCache;
@@ -65,15 +66,24 @@ class Table {
   // Calls (*handle_result)(arg, ...) with the entry found after a call
   // to Seek(key).  May not make such a call if filter policy says
   // that key is not present.
+  //
+  // If handle_result left "*pinned" pending (see PinSlice()), the block
+  // holding the entry is handed over to "*pinned" instead of released.
   friend class TableCache;
   Status InternalGet(
       const ReadOptions&, const Slice& key,
       void* arg,
-      void (*handle_result)(void* arg, const Slice& k, const Slice& v));
+      void (*handle_result)(void* arg, const Slice& k, const Slice& v),
+      PinnableSlice* pinned = NULL);
 
 
   void ReadMeta(const Footer& footer);
   void ReadFilter(const Slice& filter_handle_value);
+  void ReadFullFilter(const Slice& filter_handle_value, bool partitioned);
+
+  // Return false if the full filter of the table, when it has one, says
+  // that key is not present.
+  bool FullFilterMayMatch(const ReadOptions&, const Slice& key) const;
 
   // No copying allowed
   Table(const Table&);
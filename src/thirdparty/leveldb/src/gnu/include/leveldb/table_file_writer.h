@@ -0,0 +1,73 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// TableFileWriter builds, outside of any DB, a table file that
+// DB::IngestTables() can later move into a DB.  The entries must be
+// added in increasing key order; the table is written in the format the
+// DB itself uses, so that ingesting it does not rewrite it.
+//
+// The options given must use the same comparator and filter policy as
+// the DB the file is going to be ingested into.
+//
+// When options.value_log_threshold is set, the values of at least that
+// many bytes are appended to the value log ValueLogName(fname) instead,
+// and DB::IngestTables() moves that file in along with the table.
+//
+// A TableFileWriter is not thread safe.
+
+#ifndef STORAGE_LEVELDB_INCLUDE_TABLE_FILE_WRITER_H_
+#define STORAGE_LEVELDB_INCLUDE_TABLE_FILE_WRITER_H_
+
+#include <stdint.h>
+#include <string>
+#include "leveldb/options.h"
+#include "leveldb/slice.h"
+#include "leveldb/status.h"
+
+namespace leveldb {
+
+class TableFileWriter {
+ public:
+  // Create the file "fname", replacing any existing file.  Errors are
+  // reported by the first call to Add() or Finish().
+  TableFileWriter(const Options& options, const std::string& fname);
+
+  // An unfinished file is deleted.
+  ~TableFileWriter();
+
+  // Add key,value to the file.
+  // REQUIRES: key is after any previously added key according to the
+  // comparator, otherwise InvalidArgument is returned.
+  // REQUIRES: Finish() has not been called
+  Status Add(const Slice& key, const Slice& value);
+
+  // Write the end of the table, sync it and close the file.
+  // REQUIRES: Finish() has not been called
+  Status Finish();
+
+  // Number of entries added so far.
+  uint64_t NumEntries() const;
+
+  // Size of the file generated so far.  After a successful Finish(),
+  // the size of the final file.
+  uint64_t FileSize() const;
+
+  // Size of the value log generated so far, 0 if none.
+  uint64_t ValueLogSize() const;
+
+  // Name of the value log written along with the table "fname".
+  static std::string ValueLogName(const std::string& fname);
+
+ private:
+  struct Rep;
+  Rep* rep_;
+
+  // No copying allowed
+  TableFileWriter(const TableFileWriter&);
+  void operator=(const TableFileWriter&);
+};
+
+}  // namespace leveldb
+
+#endif  // STORAGE_LEVELDB_INCLUDE_TABLE_FILE_WRITER_H_
@@ -123,6 +123,15 @@ class AtomicPointer {
     MemoryBarrier();
     rep_ = v;
   }
+  // Store v if the pointer is still "expected", with a full barrier.
+  // Returns false, leaving it unchanged, if not.
+  inline bool CompareAndSwap(void* expected, void* v) {
+#if defined(OS_WIN) && defined(COMPILER_MSVC)
+    return InterlockedCompareExchangePointer(&rep_, v, expected) == expected;
+#else
+    return __sync_bool_compare_and_swap(&rep_, expected, v);
+#endif
+  }
 };
 
 // AtomicPointer based on <cstdatomic>
@@ -145,6 +154,9 @@ class AtomicPointer {
   inline void NoBarrier_Store(void* v) {
     rep_.store(v, std::memory_order_relaxed);
   }
+  inline bool CompareAndSwap(void* expected, void* v) {
+    return rep_.compare_exchange_strong(expected, v);
+  }
 };
 
 // Atomic pointer based on sparc memory barriers
@@ -175,6 +187,9 @@ class AtomicPointer {
   }
   inline void* NoBarrier_Load() const { return rep_; }
   inline void NoBarrier_Store(void* v) { rep_ = v; }
+  inline bool CompareAndSwap(void* expected, void* v) {
+    return __sync_bool_compare_and_swap(&rep_, expected, v);
+  }
 };
 
 // Atomic pointer based on ia64 acq/rel
@@ -205,6 +220,9 @@ class AtomicPointer {
   }
   inline void* NoBarrier_Load() const { return rep_; }
   inline void NoBarrier_Store(void* v) { rep_ = v; }
+  inline bool CompareAndSwap(void* expected, void* v) {
+    return __sync_bool_compare_and_swap(&rep_, expected, v);
+  }
 };
 
 // We have neither MemoryBarrier(), nor <cstdatomic>
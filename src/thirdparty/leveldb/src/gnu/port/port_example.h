@@ -53,6 +53,11 @@ class CondVar {
   // REQUIRES: this thread holds *mu
   void Wait();
 
+  // Like Wait(), but gives up after "micros" microseconds.  Returns
+  // false if it timed out.
+  // REQUIRES: this thread holds *mu
+  bool TimedWait(uint64_t micros);
+
   // If there are some threads waiting, wake up at least one of them.
   void Signal();
 
@@ -97,6 +102,11 @@ class AtomicPointer {
 
   // Set va as the stored pointer with no ordering guarantees.
   void NoBarrier_Store(void* v);
+
+  // If the stored pointer is "expected", replace it with v and return
+  // true, else return false.  Either way, no memory access by this thread
+  // can be reordered across it.
+  bool CompareAndSwap(void* expected, void* v);
 };
 
 // ------------------ Compression -------------------
@@ -124,6 +134,9 @@ extern bool Snappy_Uncompress(const char* input_data, size_t input_length,
 
 // ------------------ Miscellaneous -------------------
 
+// Returns the number of processors online, at least 1.
+extern int NumCPUs();
+
 // If heap profiling is not supported, returns false.
 // Else repeatedly calls (*func)(arg, data, n) and then returns true.
 // The concatenation of all "data[0,n-1]" fragments is the heap profile.
@@ -8,6 +8,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <sys/time.h>
+#include <unistd.h>
 #include "util/logging.h"
 
 namespace leveldb {
@@ -66,6 +68,21 @@ void CondVar::Wait() {
   PthreadCall("wait", pthread_cond_wait(&cv_, &mu_->mu_));
 }
 
+bool CondVar::TimedWait(uint64_t micros) {
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  const uint64_t deadline = now.tv_sec * 1000000ull + now.tv_usec + micros;
+  struct timespec ts;
+  ts.tv_sec = deadline / 1000000;
+  ts.tv_nsec = (deadline % 1000000) * 1000;
+  const int err = pthread_cond_timedwait(&cv_, &mu_->mu_, &ts);
+  if (err == ETIMEDOUT) {
+    return false;
+  }
+  PthreadCall("timedwait", err);
+  return true;
+}
+
 void CondVar::Signal() {
   PthreadCall("signal", pthread_cond_signal(&cv_));
 }
@@ -78,5 +95,10 @@ void InitOnce(OnceType* once, void (*initializer)()) {
   PthreadCall("once", pthread_once(once, initializer));
 }
 
+int NumCPUs() {
+  const long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? static_cast<int>(n) : 1;
+}
+
 }  // namespace port
 }  // namespace leveldb
@@ -106,6 +106,8 @@ class CondVar {
   explicit CondVar(Mutex* mu);
   ~CondVar();
   void Wait();
+  // Wait at most "micros" microseconds.  Returns false on timeout.
+  bool TimedWait(uint64_t micros);
   void Signal();
   void SignalAll();
  private:
@@ -117,6 +119,8 @@ typedef pthread_once_t OnceType;
 #define LEVELDB_ONCE_INIT PTHREAD_ONCE_INIT
 extern void InitOnce(OnceType* once, void (*initializer)());
 
+extern int NumCPUs();
+
 inline bool Snappy_Compress(const char* input, size_t length,
                             ::std::string* output) {
 #ifdef SNAPPY
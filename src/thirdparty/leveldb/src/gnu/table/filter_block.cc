@@ -75,6 +75,47 @@ void FilterBlockBuilder::GenerateFilter() {
   start_.clear();
 }
 
+FullFilterBlockBuilder::FullFilterBlockBuilder(const FilterPolicy* policy,
+                                               size_t partition_keys)
+    : policy_(policy),
+      partition_keys_(partition_keys) {
+}
+
+void FullFilterBlockBuilder::AddKey(const Slice& key) {
+  if (partition_keys_ > 0 && start_.size() >= partition_keys_) {
+    GenerateFilter();
+  }
+  start_.push_back(keys_.size());
+  keys_.append(key.data(), key.size());
+}
+
+void FullFilterBlockBuilder::Finish() {
+  if (!start_.empty() || filters_.empty()) {
+    GenerateFilter();
+  }
+}
+
+void FullFilterBlockBuilder::GenerateFilter() {
+  const size_t num_keys = start_.size();
+  start_.push_back(keys_.size());  // Simplify length computation
+  tmp_keys_.resize(num_keys);
+  for (size_t i = 0; i < num_keys; i++) {
+    const char* base = keys_.data() + start_[i];
+    size_t length = start_[i+1] - start_[i];
+    tmp_keys_[i] = Slice(base, length);
+  }
+
+  filters_.push_back(std::string());
+  last_keys_.push_back(num_keys > 0 ? tmp_keys_[num_keys-1].ToString()
+                                    : std::string());
+  policy_->CreateFilter(num_keys > 0 ? &tmp_keys_[0] : NULL, num_keys,
+                        &filters_.back());
+
+  tmp_keys_.clear();
+  keys_.clear();
+  start_.clear();
+}
+
 FilterBlockReader::FilterBlockReader(const FilterPolicy* policy,
                                      const Slice& contents)
     : policy_(policy),
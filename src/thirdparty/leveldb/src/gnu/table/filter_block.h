@@ -5,6 +5,9 @@
 // A filter block is stored near the end of a Table file.  It contains
 // filters (e.g., bloom filters) for all data blocks in the table combined
 // into a single filter block.
+//
+// A table may instead have a full filter: a single filter of all its
+// keys, or a few partitions of it, checked before its index.
 
 #ifndef STORAGE_LEVELDB_TABLE_FILTER_BLOCK_H_
 #define STORAGE_LEVELDB_TABLE_FILTER_BLOCK_H_
@@ -49,6 +52,41 @@ class FilterBlockBuilder {
   void operator=(const FilterBlockBuilder&);
 };
 
+// Builds the full filter of a table.  With partition_keys, the filter is
+// cut every partition_keys keys: each partition remembers the last key it
+// covers, a lookup only needs the partition of its key.
+//
+// The sequence of calls to FullFilterBlockBuilder must match the regexp:
+//      (AddKey)* Finish
+class FullFilterBlockBuilder {
+ public:
+  FullFilterBlockBuilder(const FilterPolicy*, size_t partition_keys);
+
+  void AddKey(const Slice& key);
+  void Finish();
+
+  // REQUIRES: Finish() has been called.  A single partition when
+  // partition_keys is 0 or not exceeded.
+  size_t NumPartitions() const { return filters_.size(); }
+  Slice Filter(size_t i) const { return filters_[i]; }
+  Slice LastKey(size_t i) const { return last_keys_[i]; }
+
+ private:
+  void GenerateFilter();
+
+  const FilterPolicy* policy_;
+  const size_t partition_keys_;
+  std::string keys_;              // Flattened key contents
+  std::vector<size_t> start_;     // Starting index in keys_ of each key
+  std::vector<Slice> tmp_keys_;   // policy_->CreateFilter() argument
+  std::vector<std::string> filters_;
+  std::vector<std::string> last_keys_;
+
+  // No copying allowed
+  FullFilterBlockBuilder(const FullFilterBlockBuilder&);
+  void operator=(const FullFilterBlockBuilder&);
+};
+
 class FilterBlockReader {
  public:
  // REQUIRES: "contents" and *policy must stay live while *this is live.
@@ -121,6 +121,47 @@ TEST(FilterBlockTest, MultiChunk) {
   ASSERT_TRUE(! reader.KeyMayMatch(9000, "bar"));
 }
 
+TEST(FilterBlockTest, FullFilter) {
+  FullFilterBlockBuilder builder(&policy_, 0);
+  builder.AddKey("bar");
+  builder.AddKey("box");
+  builder.AddKey("foo");
+  builder.Finish();
+  ASSERT_EQ(1, builder.NumPartitions());
+  ASSERT_EQ("foo", builder.LastKey(0).ToString());
+  ASSERT_TRUE(policy_.KeyMayMatch("bar", builder.Filter(0)));
+  ASSERT_TRUE(policy_.KeyMayMatch("foo", builder.Filter(0)));
+  ASSERT_TRUE(! policy_.KeyMayMatch("hello", builder.Filter(0)));
+}
+
+TEST(FilterBlockTest, EmptyFullFilter) {
+  FullFilterBlockBuilder builder(&policy_, 2);
+  builder.Finish();
+  ASSERT_EQ(1, builder.NumPartitions());
+  ASSERT_TRUE(! policy_.KeyMayMatch("foo", builder.Filter(0)));
+}
+
+TEST(FilterBlockTest, PartitionedFilter) {
+  FullFilterBlockBuilder builder(&policy_, 2);
+  builder.AddKey("a");
+  builder.AddKey("b");
+  builder.AddKey("c");
+  builder.AddKey("d");
+  builder.AddKey("e");
+  builder.Finish();
+  ASSERT_EQ(3, builder.NumPartitions());
+  ASSERT_EQ("b", builder.LastKey(0).ToString());
+  ASSERT_EQ("d", builder.LastKey(1).ToString());
+  ASSERT_EQ("e", builder.LastKey(2).ToString());
+  ASSERT_TRUE(policy_.KeyMayMatch("a", builder.Filter(0)));
+  ASSERT_TRUE(policy_.KeyMayMatch("b", builder.Filter(0)));
+  ASSERT_TRUE(! policy_.KeyMayMatch("c", builder.Filter(0)));
+  ASSERT_TRUE(policy_.KeyMayMatch("c", builder.Filter(1)));
+  ASSERT_TRUE(policy_.KeyMayMatch("d", builder.Filter(1)));
+  ASSERT_TRUE(! policy_.KeyMayMatch("e", builder.Filter(1)));
+  ASSERT_TRUE(policy_.KeyMayMatch("e", builder.Filter(2)));
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -9,6 +9,7 @@
 #include "leveldb/env.h"
 #include "leveldb/filter_policy.h"
 #include "leveldb/options.h"
+#include "leveldb/pinnable_slice.h"
 #include "table/block.h"
 #include "table/filter_block.h"
 #include "table/format.h"
@@ -21,6 +22,8 @@ struct Table::Rep {
   ~Rep() {
     delete filter;
     delete [] filter_data;
+    delete [] full_filter_data;
+    delete filter_partitions;
     delete index_block;
   }
 
@@ -31,6 +34,12 @@ struct Table::Rep {
   FilterBlockReader* filter;
   const char* filter_data;
 
+  // Full filter of the table, or the index of its partitions
+  bool has_full_filter;
+  Slice full_filter;
+  const char* full_filter_data;
+  Block* filter_partitions;
+
   BlockHandle metaindex_handle;  // Handle to metaindex_block: saved from footer
   Block* index_block;
 };
@@ -75,6 +84,9 @@ Status Table::Open(const Options& options,
     rep->cache_id = (options.block_cache ? options.block_cache->NewId() : 0);
     rep->filter_data = NULL;
     rep->filter = NULL;
+    rep->has_full_filter = false;
+    rep->full_filter_data = NULL;
+    rep->filter_partitions = NULL;
     *table = new Table(rep);
     (*table)->ReadMeta(footer);
   } else {
@@ -99,12 +111,24 @@ void Table::ReadMeta(const Footer& footer) {
   }
   Block* meta = new Block(contents);
 
+  // A table has one of these filters, depending on the options it was
+  // built with
+  static const char* kFilterPrefixes[] = {
+    "fullfilter.", "partitionedfilter.", "filter."
+  };
   Iterator* iter = meta->NewIterator(BytewiseComparator());
-  std::string key = "filter.";
-  key.append(rep_->options.filter_policy->Name());
-  iter->Seek(key);
-  if (iter->Valid() && iter->key() == Slice(key)) {
-    ReadFilter(iter->value());
+  for (int i = 0; i < 3; i++) {
+    std::string key = kFilterPrefixes[i];
+    key.append(rep_->options.filter_policy->Name());
+    iter->Seek(key);
+    if (iter->Valid() && iter->key() == Slice(key)) {
+      if (i < 2) {
+        ReadFullFilter(iter->value(), i == 1);
+      } else {
+        ReadFilter(iter->value());
+      }
+      break;
+    }
   }
   delete iter;
   delete meta;
@@ -130,6 +154,31 @@ void Table::ReadFilter(const Slice& filter_handle_value) {
   rep_->filter = new FilterBlockReader(rep_->options.filter_policy, block.data);
 }
 
+void Table::ReadFullFilter(const Slice& filter_handle_value,
+                           bool partitioned) {
+  Slice v = filter_handle_value;
+  BlockHandle filter_handle;
+  if (!filter_handle.DecodeFrom(&v).ok()) {
+    return;
+  }
+
+  ReadOptions opt;
+  BlockContents block;
+  if (!ReadBlock(rep_->file, opt, filter_handle, &block).ok()) {
+    return;
+  }
+  if (partitioned) {
+    // The partitions are read on demand
+    rep_->filter_partitions = new Block(block);
+  } else {
+    if (block.heap_allocated) {
+      rep_->full_filter_data = block.data.data();  // Will need to delete later
+    }
+    rep_->full_filter = block.data;
+    rep_->has_full_filter = true;
+  }
+}
+
 Table::~Table() {
   delete rep_;
 }
@@ -149,6 +198,74 @@ static void ReleaseBlock(void* arg, void* h) {
   cache->Release(handle);
 }
 
+static void DeleteCachedFilter(const Slice& key, void* value) {
+  Slice* filter = reinterpret_cast<Slice*>(value);
+  delete[] filter->data();
+  delete filter;
+}
+
+bool Table::FullFilterMayMatch(const ReadOptions& options,
+                               const Slice& k) const {
+  const FilterPolicy* policy = rep_->options.filter_policy;
+  if (rep_->has_full_filter) {
+    return policy->KeyMayMatch(k, rep_->full_filter);
+  }
+  if (rep_->filter_partitions == NULL) {
+    return true;
+  }
+
+  // Find the partition of the first key at or after k
+  Iterator* iter = rep_->filter_partitions->NewIterator(
+      rep_->options.comparator);
+  iter->Seek(k);
+  if (!iter->Valid()) {
+    // Past the last key of the table, unless the index is corrupted
+    const bool may_match = !iter->status().ok();
+    delete iter;
+    return may_match;
+  }
+  BlockHandle handle;
+  Slice input = iter->value();
+  Status s = handle.DecodeFrom(&input);
+  delete iter;
+  if (!s.ok()) {
+    return true;  // Errors are treated as potential matches
+  }
+
+  Cache* block_cache = rep_->options.block_cache;
+  char cache_key_buffer[16];
+  EncodeFixed64(cache_key_buffer, rep_->cache_id);
+  EncodeFixed64(cache_key_buffer+8, handle.offset());
+  Slice key(cache_key_buffer, sizeof(cache_key_buffer));
+  if (block_cache != NULL) {
+    Cache::Handle* cache_handle = block_cache->Lookup(key);
+    if (cache_handle != NULL) {
+      const Slice* filter =
+          reinterpret_cast<Slice*>(block_cache->Value(cache_handle));
+      const bool may_match = policy->KeyMayMatch(k, *filter);
+      block_cache->Release(cache_handle);
+      return may_match;
+    }
+  }
+
+  BlockContents contents;
+  if (!ReadBlock(rep_->file, options, handle, &contents).ok()) {
+    return true;
+  }
+  const bool may_match = policy->KeyMayMatch(k, contents.data);
+  if (contents.heap_allocated) {
+    if (block_cache != NULL && contents.cachable && options.fill_cache) {
+      Slice* filter = new Slice(contents.data);
+      block_cache->Release(block_cache->Insert(key, filter, filter->size(),
+                                               &DeleteCachedFilter));
+    } else {
+      delete[] contents.data.data();
+    }
+  }
+  // Otherwise the partition lives in the file mapping
+  return may_match;
+}
+
 // Convert an index iterator value (i.e., an encoded BlockHandle)
 // into an iterator over the contents of the corresponding block.
 Iterator* Table::BlockReader(void* arg,
@@ -215,8 +332,12 @@ Iterator* Table::NewIterator(const ReadOptions& options) const {
 
 Status Table::InternalGet(const ReadOptions& options, const Slice& k,
                           void* arg,
-                          void (*saver)(void*, const Slice&, const Slice&)) {
+                          void (*saver)(void*, const Slice&, const Slice&),
+                          PinnableSlice* pinned) {
   Status s;
+  if (!FullFilterMayMatch(options, k)) {
+    return s;  // Not found, without a look at the index
+  }
   Iterator* iiter = rep_->index_block->NewIterator(rep_->options.comparator);
   iiter->Seek(k);
   if (iiter->Valid()) {
@@ -234,7 +355,12 @@ Status Table::InternalGet(const ReadOptions& options, const Slice& k,
         (*saver)(arg, block_iter->key(), block_iter->value());
       }
       s = block_iter->status();
-      delete block_iter;
+      if (pinned != NULL && pinned->IsPending()) {
+        // The value refers to the block: keep it alive with the value
+        pinned->PinIterator(block_iter);
+      } else {
+        delete block_iter;
+      }
     }
   }
   if (s.ok()) {
@@ -29,6 +29,7 @@ struct TableBuilder::Rep {
   int64_t num_entries;
   bool closed;          // Either Finish() or Abandon() has been called.
   FilterBlockBuilder* filter_block;
+  FullFilterBlockBuilder* full_filter_block;
 
   // We do not emit the index entry for a block until we have seen the
   // first key for the next data block.  This allows us to use shorter
@@ -53,8 +54,12 @@ struct TableBuilder::Rep {
         index_block(&index_block_options),
         num_entries(0),
         closed(false),
-        filter_block(opt.filter_policy == NULL ? NULL
+        filter_block(opt.filter_policy == NULL || opt.whole_table_filter ? NULL
                      : new FilterBlockBuilder(opt.filter_policy)),
+        full_filter_block(opt.filter_policy == NULL || !opt.whole_table_filter
+                          ? NULL
+                          : new FullFilterBlockBuilder(
+                                opt.filter_policy, opt.filter_partition_keys)),
         pending_index_entry(false) {
     index_block_options.block_restart_interval = 1;
   }
@@ -70,6 +75,7 @@ TableBuilder::TableBuilder(const Options& options, WritableFile* file)
 TableBuilder::~TableBuilder() {
   assert(rep_->closed);  // Catch errors where caller forgot to call Finish()
   delete rep_->filter_block;
+  delete rep_->full_filter_block;
   delete rep_;
 }
 
@@ -80,6 +86,10 @@ Status TableBuilder::ChangeOptions(const Options& options) {
   if (options.comparator != rep_->options.comparator) {
     return Status::InvalidArgument("changing comparator while building table");
   }
+  if (options.whole_table_filter != rep_->options.whole_table_filter ||
+      options.filter_partition_keys != rep_->options.filter_partition_keys) {
+    return Status::InvalidArgument("changing filter while building table");
+  }
 
   // Note that any live BlockBuilders point to rep_->options and therefore
   // will automatically pick up the updated options.
@@ -109,6 +119,9 @@ void TableBuilder::Add(const Slice& key, const Slice& value) {
   if (r->filter_block != NULL) {
     r->filter_block->AddKey(key);
   }
+  if (r->full_filter_block != NULL) {
+    r->full_filter_block->AddKey(key);
+  }
 
   r->last_key.assign(key.data(), key.size());
   r->num_entries++;
@@ -210,12 +223,39 @@ Status TableBuilder::Finish() {
                   &filter_block_handle);
   }
 
+  // Write full filter: the filter itself, or its partitions followed by
+  // the block mapping the last key of each partition to its handle
+  const char* full_filter_prefix = NULL;
+  if (ok() && r->full_filter_block != NULL) {
+    FullFilterBlockBuilder* builder = r->full_filter_block;
+    builder->Finish();
+    if (builder->NumPartitions() == 1) {
+      full_filter_prefix = "fullfilter.";
+      WriteRawBlock(builder->Filter(0), kNoCompression, &filter_block_handle);
+    } else {
+      full_filter_prefix = "partitionedfilter.";
+      BlockBuilder partition_index(&r->index_block_options);
+      for (size_t i = 0; ok() && i < builder->NumPartitions(); i++) {
+        BlockHandle handle;
+        WriteRawBlock(builder->Filter(i), kNoCompression, &handle);
+        std::string handle_encoding;
+        handle.EncodeTo(&handle_encoding);
+        partition_index.Add(builder->LastKey(i), handle_encoding);
+      }
+      if (ok()) {
+        WriteBlock(&partition_index, &filter_block_handle);
+      }
+    }
+  }
+
   // Write metaindex block
   if (ok()) {
     BlockBuilder meta_index_block(&r->options);
-    if (r->filter_block != NULL) {
-      // Add mapping from "filter.Name" to location of filter data
-      std::string key = "filter.";
+    if (r->filter_block != NULL || full_filter_prefix != NULL) {
+      // Add mapping from "filter.Name" (or "fullfilter.Name",
+      // "partitionedfilter.Name") to location of filter data
+      std::string key = (full_filter_prefix != NULL ? full_filter_prefix
+                                                    : "filter.");
       key.append(r->options.filter_policy->Name());
       std::string handle_encoding;
       filter_block_handle.EncodeTo(&handle_encoding);
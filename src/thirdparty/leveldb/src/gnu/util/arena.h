@@ -10,6 +10,7 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <atomic>
+#include "port/port.h"
 
 namespace leveldb {
 
@@ -30,11 +31,16 @@ class Arena {
   // Allocate memory with the normal alignment guarantees provided by malloc
   char* AllocateAligned(size_t bytes);
 
+  // Like Allocate() and AllocateAligned(), but safe to call from several
+  // threads at once.  REQUIRES: no concurrent call of the two above.
+  char* AllocateConcurrently(size_t bytes);
+  char* AllocateAlignedConcurrently(size_t bytes);
+
   // Returns an estimate of the total memory usage of data allocated
   // by the arena (including space allocated but not yet used for user
-  // allocations).
+  // allocations).  May be called while other threads allocate.
   size_t MemoryUsage() const {
-    return blocks_memory_ + blocks_.capacity() * sizeof(char*);
+    return blocks_memory_.load(std::memory_order_relaxed);
   }
 
  private:
@@ -48,8 +54,11 @@ class Arena {
   // Array of new[] allocated memory blocks
   std::vector<char*> blocks_;
 
-  // Bytes of memory in blocks allocated so far
-  size_t blocks_memory_;
+  // Bytes of memory in blocks allocated so far, and of their pointers
+  std::atomic<size_t> blocks_memory_;
+
+  // Serializes the concurrent allocations
+  port::Mutex mu_;
 
   // if destroy is pending
   std::atomic<bool> destroying;
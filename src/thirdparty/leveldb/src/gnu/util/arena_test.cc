@@ -6,18 +6,19 @@
 
 #include "util/random.h"
 #include "util/testharness.h"
+#include "util/testutil.h"
 
 namespace leveldb {
 
 class ArenaTest { };
 
 TEST(ArenaTest, Empty) {
-  Arena arena;
+  test::TestArena arena;
 }
 
 TEST(ArenaTest, Simple) {
   std::vector<std::pair<size_t, char*> > allocated;
-  Arena arena;
+  test::TestArena arena;
   const int N = 100000;
   size_t bytes = 0;
   Random rnd(301);
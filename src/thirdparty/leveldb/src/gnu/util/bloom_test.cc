@@ -25,7 +25,8 @@ class BloomTest {
   std::vector<std::string> keys_;
 
  public:
-  BloomTest() : policy_(NewBloomFilterPolicy(10)) { }
+  explicit BloomTest(const FilterPolicy* policy = NewBloomFilterPolicy(10))
+      : policy_(policy) { }
 
   ~BloomTest() {
     delete policy_;
@@ -152,7 +153,92 @@ TEST(BloomTest, VaryingLengths) {
   ASSERT_LE(mediocre_filters, good_filters/5);
 }
 
-// Different bits-per-byte
+class BlockedBloomTest : public BloomTest {
+ public:
+  BlockedBloomTest() : BloomTest(NewBlockedBloomFilterPolicy(10)) { }
+};
+
+TEST(BlockedBloomTest, BlockedEmptyFilter) {
+  ASSERT_TRUE(! Matches("hello"));
+  ASSERT_TRUE(! Matches("world"));
+}
+
+TEST(BlockedBloomTest, BlockedSmall) {
+  Add("hello");
+  Add("world");
+  ASSERT_TRUE(Matches("hello"));
+  ASSERT_TRUE(Matches("world"));
+  ASSERT_TRUE(! Matches("x"));
+  ASSERT_TRUE(! Matches("foo"));
+}
+
+TEST(BlockedBloomTest, BlockedVaryingLengths) {
+  char buffer[sizeof(int)];
+
+  int mediocre_filters = 0;
+  int good_filters = 0;
+
+  for (int length = 1; length <= 10000; length = NextLength(length)) {
+    Reset();
+    for (int i = 0; i < length; i++) {
+      Add(Key(i, buffer));
+    }
+    Build();
+
+    // Whole lines of 64 bytes
+    ASSERT_LE(FilterSize(), static_cast<size_t>((length * 10 / 8) + 65))
+        << length;
+    ASSERT_EQ(1, FilterSize() % 64);
+
+    for (int i = 0; i < length; i++) {
+      ASSERT_TRUE(Matches(Key(i, buffer)))
+          << "Length " << length << "; key " << i;
+    }
+
+    double rate = FalsePositiveRate();
+    if (kVerbose >= 1) {
+      fprintf(stderr, "False positives: %5.2f%% @ length = %6d ; bytes = %6d\n",
+              rate*100.0, length, static_cast<int>(FilterSize()));
+    }
+    ASSERT_LE(rate, 0.025);   // Must not be over 2.5%
+    if (rate > 0.015) mediocre_filters++;  // Allowed, but not too often
+    else good_filters++;
+  }
+  if (kVerbose >= 1) {
+    fprintf(stderr, "Filters: %d good, %d mediocre\n",
+            good_filters, mediocre_filters);
+  }
+  ASSERT_LE(mediocre_filters, good_filters/5);
+}
+
+TEST(BlockedBloomTest, BlockedBitsPerKey) {
+  char buffer[sizeof(int)];
+  const FilterPolicy* policy = NewBlockedBloomFilterPolicy(16);
+  std::vector<std::string> keys;
+  std::vector<Slice> slices;
+  for (int i = 0; i < 10000; i++) {
+    keys.push_back(Key(i, buffer).ToString());
+  }
+  for (size_t i = 0; i < keys.size(); i++) {
+    slices.push_back(keys[i]);
+  }
+  std::string filter;
+  policy->CreateFilter(&slices[0], slices.size(), &filter);
+  ASSERT_LE(filter.size(), 10000 * 16 / 8 + 65);
+  int result = 0;
+  for (int i = 0; i < 10000; i++) {
+    ASSERT_TRUE(policy->KeyMayMatch(keys[i], filter));
+    if (policy->KeyMayMatch(Key(i + 1000000000, buffer), filter)) {
+      result++;
+    }
+  }
+  if (kVerbose >= 1) {
+    fprintf(stderr, "False positives: %5.2f%% @ 16 bits per key\n",
+            result / 100.0);
+  }
+  ASSERT_LE(result, 30);   // ~0.1%
+  delete policy;
+}
 
 }  // namespace leveldb
 
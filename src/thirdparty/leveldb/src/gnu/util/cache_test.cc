@@ -5,7 +5,10 @@
 #include "leveldb/cache.h"
 
 #include <vector>
+#include "leveldb/env.h"
+#include "port/port.h"
 #include "util/coding.h"
+#include "util/mutexlock.h"
 #include "util/testharness.h"
 
 namespace leveldb {
@@ -37,7 +40,7 @@ class CacheTest {
   std::vector<int> deleted_values_;
   Cache* cache_;
 
-  CacheTest() : cache_(NewLRUCache(kCacheSize)) {
+  explicit CacheTest(Cache* cache = NewLRUCache(kCacheSize)) : cache_(cache) {
     current_ = this;
   }
 
@@ -179,6 +182,248 @@ TEST(CacheTest, NewId) {
   ASSERT_NE(a, b);
 }
 
+TEST(CacheTest, SetCapacity) {
+  for (int i = 0; i < kCacheSize; i++) {
+    Insert(i, 1000+i);
+  }
+  ASSERT_GT(cache_->TotalCharge(), kCacheSize / 2 + 16);
+  cache_->SetCapacity(kCacheSize / 2);
+  ASSERT_EQ(kCacheSize / 2, cache_->GetCapacity());
+  ASSERT_LE(cache_->TotalCharge(), kCacheSize / 2 + 16);
+  ASSERT_EQ(kCacheSize - cache_->TotalCharge(), deleted_keys_.size());
+}
+
+class ClockCacheTest : public CacheTest {
+ public:
+  ClockCacheTest() : CacheTest(NewClockCache(kCacheSize, 1)) { }
+};
+
+TEST(ClockCacheTest, ClockHitAndMiss) {
+  ASSERT_EQ(-1, Lookup(100));
+
+  Insert(100, 101);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1,  Lookup(200));
+
+  Insert(200, 201);
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+
+  Insert(100, 102);
+  ASSERT_EQ(102, Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+  ASSERT_EQ(-1,  Lookup(300));
+
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[0]);
+  ASSERT_EQ(101, deleted_values_[0]);
+}
+
+TEST(ClockCacheTest, ClockErase) {
+  Erase(200);
+  ASSERT_EQ(0, deleted_keys_.size());
+
+  Insert(100, 101);
+  Insert(200, 201);
+  Erase(100);
+  ASSERT_EQ(-1,  Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(100, deleted_keys_[0]);
+
+  Erase(100);
+  ASSERT_EQ(-1,  Lookup(100));
+  ASSERT_EQ(201, Lookup(200));
+  ASSERT_EQ(1, deleted_keys_.size());
+}
+
+TEST(ClockCacheTest, ClockEntriesArePinned) {
+  Insert(100, 101);
+  Cache::Handle* h1 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(101, DecodeValue(cache_->Value(h1)));
+
+  Insert(100, 102);
+  Cache::Handle* h2 = cache_->Lookup(EncodeKey(100));
+  ASSERT_EQ(102, DecodeValue(cache_->Value(h2)));
+  ASSERT_EQ(0, deleted_keys_.size());
+
+  cache_->Release(h1);
+  ASSERT_EQ(1, deleted_keys_.size());
+  ASSERT_EQ(101, deleted_values_[0]);
+
+  Erase(100);
+  ASSERT_EQ(-1, Lookup(100));
+  ASSERT_EQ(1, deleted_keys_.size());
+
+  cache_->Release(h2);
+  ASSERT_EQ(2, deleted_keys_.size());
+  ASSERT_EQ(102, deleted_values_[1]);
+}
+
+TEST(ClockCacheTest, ClockEvictionPolicy) {
+  Insert(100, 101);
+  Insert(200, 201);
+
+  // Entry hit between two turns of the clock must be kept around
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    Insert(1000+i, 2000+i);
+    ASSERT_EQ(101, Lookup(100));
+  }
+  ASSERT_EQ(101, Lookup(100));
+  ASSERT_EQ(-1, Lookup(200));
+  ASSERT_LE(cache_->TotalCharge(), kCacheSize);
+}
+
+TEST(ClockCacheTest, ClockPinnedEntriesOverflow) {
+  // Entries in use are never evicted, even past the capacity
+  std::vector<Cache::Handle*> handles;
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    handles.push_back(cache_->Insert(EncodeKey(i), EncodeValue(1000+i), 1,
+                                     &CacheTest::Deleter));
+  }
+  ASSERT_EQ(0, deleted_keys_.size());
+  ASSERT_EQ(2 * kCacheSize, cache_->TotalCharge());
+  for (int i = 0; i < 2 * kCacheSize; i++) {
+    ASSERT_EQ(1000+i, DecodeValue(cache_->Value(handles[i])));
+    cache_->Release(handles[i]);
+  }
+  // The next inserts make room again
+  Insert(-1, -1);
+  ASSERT_LT(cache_->TotalCharge(), 2 * kCacheSize);
+  ASSERT_GT(deleted_keys_.size(), 0);
+}
+
+TEST(ClockCacheTest, ClockSetCapacity) {
+  for (int i = 0; i < kCacheSize; i++) {
+    Insert(i, 1000+i);
+  }
+  ASSERT_EQ(kCacheSize, cache_->GetCapacity());
+  cache_->SetCapacity(kCacheSize / 2);
+  ASSERT_EQ(kCacheSize / 2, cache_->GetCapacity());
+  ASSERT_LE(cache_->TotalCharge(), kCacheSize / 2 + 64);
+
+  cache_->SetCapacity(kCacheSize);
+  for (int i = 0; i < kCacheSize; i++) {
+    Insert(kCacheSize + i, 1000+i);
+  }
+  ASSERT_GT(cache_->TotalCharge(), kCacheSize / 2 + 64);
+}
+
+TEST(ClockCacheTest, ClockGrow) {
+  for (int i = 0; i < kCacheSize; i++) {
+    Insert(i, 1000+i);
+  }
+  Cache::Handle* h = cache_->Insert(EncodeKey(5000), EncodeValue(6000), 1,
+                                    &CacheTest::Deleter);
+  const size_t deleted = deleted_keys_.size();
+
+  // The entries move to larger tables, the one in use only when released
+  cache_->SetCapacity(4 * kCacheSize);
+  ASSERT_EQ(1000 + kCacheSize - 1, Lookup(kCacheSize - 1));
+  ASSERT_EQ(deleted, deleted_keys_.size());
+  ASSERT_EQ(6000, DecodeValue(cache_->Value(h)));
+  cache_->Release(h);
+  ASSERT_EQ(deleted + 1, deleted_keys_.size());
+  ASSERT_EQ(5000, deleted_keys_.back());
+
+  // Past what the initial tables hold
+  for (int i = 0; i < 4 * kCacheSize; i++) {
+    Insert(kCacheSize + i, 1000+i);
+  }
+  ASSERT_GT(cache_->TotalCharge(), 2 * kCacheSize);
+  ASSERT_LE(cache_->TotalCharge(), 4 * kCacheSize);
+}
+
+namespace {
+
+struct ConcurrentState {
+  Cache* cache;
+  port::Mutex mu;
+  int done;
+  int errors;
+};
+
+static const int kConcurrentKeys = 4000;
+
+static void NoopDeleter(const Slice& key, void* v) {
+}
+
+static void ConcurrentClient(void* arg) {
+  ConcurrentState* state = reinterpret_cast<ConcurrentState*>(arg);
+  int errors = 0;
+  uint32_t seed = reinterpret_cast<uintptr_t>(&errors);
+  for (int i = 0; i < 100000; i++) {
+    seed = seed * 1103515245 + 12345;
+    const int k = (seed >> 8) % kConcurrentKeys;
+    const std::string key = EncodeKey(k);
+    Cache::Handle* h = state->cache->Lookup(key);
+    if (h == NULL) {
+      h = state->cache->Insert(key, EncodeValue(k), 1, &NoopDeleter);
+    } else if ((i % 64) == 0) {
+      state->cache->Erase(key);
+    }
+    if (DecodeValue(state->cache->Value(h)) != k) {
+      errors++;
+    }
+    state->cache->Release(h);
+  }
+  MutexLock l(&state->mu);
+  state->done++;
+  state->errors += errors;
+}
+
+}  // namespace
+
+TEST(ClockCacheTest, ClockConcurrentAccess) {
+  const int kThreads = 8;
+  ConcurrentState state;
+  state.cache = cache_;
+  state.done = 0;
+  state.errors = 0;
+  for (int i = 0; i < kThreads; i++) {
+    Env::Default()->StartThread(&ConcurrentClient, &state);
+  }
+  for (;;) {
+    {
+      MutexLock l(&state.mu);
+      if (state.done == kThreads) {
+        break;
+      }
+    }
+    Env::Default()->SleepForMicroseconds(10000);
+  }
+  ASSERT_EQ(0, state.errors);
+  ASSERT_LE(cache_->TotalCharge(), kCacheSize);
+}
+
+TEST(ClockCacheTest, ClockConcurrentGrow) {
+  const int kThreads = 8;
+  ConcurrentState state;
+  state.cache = cache_;
+  state.done = 0;
+  state.errors = 0;
+  cache_->SetCapacity(kCacheSize / 8);
+  for (int i = 0; i < kThreads; i++) {
+    Env::Default()->StartThread(&ConcurrentClient, &state);
+  }
+  size_t capacity = kCacheSize / 8;
+  for (;;) {
+    {
+      MutexLock l(&state.mu);
+      if (state.done == kThreads) {
+        break;
+      }
+    }
+    if (capacity < kConcurrentKeys) {
+      capacity *= 2;
+      cache_->SetCapacity(capacity);
+    }
+    Env::Default()->SleepForMicroseconds(10000);
+  }
+  ASSERT_EQ(0, state.errors);
+  ASSERT_LE(cache_->TotalCharge(), cache_->GetCapacity());
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
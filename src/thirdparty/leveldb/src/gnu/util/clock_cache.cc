@@ -0,0 +1,575 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+//
+// A cache with a CLOCK eviction policy whose lookups take no lock.
+//
+// Each shard is an open addressing hash table of slots, probed with
+// double hashing.  The state of a slot, the number of references to it and
+// its CLOCK bit share one 64-bit word, only changed with atomic operations:
+//
+//   Lookup() adds a reference to the visible slots of its probe sequence
+//   whose hash matches, and keeps it if the slot holds the key.  A hit then
+//   sets the CLOCK bit of the slot.  It never blocks.
+//
+//   Insert(), Erase() and the CLOCK sweep run under the mutex of the shard.
+//   They only take a slot without references, with a compare-and-swap
+//   that fails if a lookup got a reference in the meantime.  An entry
+//   erased while referenced becomes invisible, and the last Release() of
+//   it frees the slot.
+//
+// A lookup may briefly reference a slot it does not keep: the owner of the
+// slot carries such references over whenever it changes the state.
+//
+// Growing the capacity past what the table of a shard holds moves its
+// entries to a larger table.  The entries in use stay behind, invisible,
+// until their last handle goes.  The tables given up are kept until the
+// cache goes, as lookups may still be probing them: each being half the
+// size of the next, they take less memory than the table in use.
+
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+
+#include "leveldb/cache.h"
+#include "port/port.h"
+#include "util/hash.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+namespace {
+
+// Layout of ClockSlot::meta
+static const uint64_t kRefsMask = 0xffffffffu;
+static const uint64_t kClockBit = 1ull << 32;
+static const int kStateShift = 33;
+static const uint64_t kStateMask = 3ull << kStateShift;
+
+enum SlotState {
+  kEmpty = 0,          // Free
+  kConstruction = 1,   // Owned by one thread, which fills or frees it
+  kVisible = 2,        // Holds an entry that lookups may find
+  kInvisible = 3       // Holds an erased entry still referenced
+};
+
+static inline SlotState StateOf(uint64_t meta) {
+  return static_cast<SlotState>((meta & kStateMask) >> kStateShift);
+}
+
+static inline uint64_t WithState(uint64_t meta, SlotState state) {
+  return (meta & ~kStateMask) | (static_cast<uint64_t>(state) << kStateShift);
+}
+
+static inline uint32_t RefsOf(uint64_t meta) {
+  return static_cast<uint32_t>(meta & kRefsMask);
+}
+
+// The shared words are read with acquire and written with release
+// semantics, so that the fields of a slot filled before it is made
+// visible are seen by the lookups referencing it.
+template <typename T>
+static inline T AtomicLoad(const std::atomic<T>* p) {
+  return p->load(std::memory_order_acquire);
+}
+
+template <typename T>
+static inline void AtomicStore(std::atomic<T>* p, T v) {
+  p->store(v, std::memory_order_release);
+}
+
+template <typename T>
+static inline T AtomicFetchAdd(std::atomic<T>* p, T v) {
+  return p->fetch_add(v, std::memory_order_acq_rel);
+}
+
+template <typename T>
+static inline T AtomicFetchSub(std::atomic<T>* p, T v) {
+  return p->fetch_sub(v, std::memory_order_acq_rel);
+}
+
+// On failure, *expected is set to the current value.
+static inline bool AtomicCompareExchange(std::atomic<uint64_t>* p,
+                                         uint64_t* expected,
+                                         uint64_t desired) {
+  return p->compare_exchange_strong(*expected, desired,
+                                    std::memory_order_acq_rel,
+                                    std::memory_order_acquire);
+}
+
+struct ClockTable;
+
+struct ClockSlot {
+  // State, CLOCK bit and references
+  std::atomic<uint64_t> meta;
+  // Entries whose probe sequence passes this slot
+  std::atomic<uint32_t> displacements;
+  // Also read by lookups before they reference it
+  std::atomic<uint32_t> hash;
+  ClockTable* table;        // NULL if allocated apart, the table being full
+  void* value;
+  void (*deleter)(const Slice&, void* value);
+  size_t charge;
+  size_t key_length;
+  char* key_data;
+
+  ClockSlot()
+      : meta(0), displacements(0), hash(0), table(NULL), value(NULL),
+        deleter(NULL), charge(0), key_length(0), key_data(NULL) {
+  }
+
+  Slice key() const { return Slice(key_data, key_length); }
+};
+
+struct ClockTable {
+  ClockSlot* slots;
+  size_t length;
+  size_t mask;
+  size_t max_occupancy;
+  std::atomic<size_t> occupancy;   // Slots not empty
+  ClockTable* older;               // Given up for this one
+
+  explicit ClockTable(size_t num_slots)
+      : slots(new ClockSlot[num_slots]),
+        length(num_slots),
+        mask(num_slots - 1),
+        max_occupancy(num_slots - num_slots / 8),
+        occupancy(0),
+        older(NULL) {
+    for (size_t i = 0; i < num_slots; i++) {
+      slots[i].table = this;
+    }
+  }
+  ~ClockTable() {
+    delete[] slots;
+  }
+
+  size_t Probe(uint32_t hash, size_t i) const {
+    // An odd step visits every slot of the power of two sized table
+    return (hash + i * ((hash >> 16) | 1)) & mask;
+  }
+};
+
+class ClockCacheShard {
+ public:
+  ClockCacheShard();
+  ~ClockCacheShard();
+
+  // Separate from constructor so caller can easily make an array of shards
+  void Init(size_t num_slots, size_t capacity);
+  // Grows the table to num_slots if it is smaller
+  void SetCapacity(size_t capacity, size_t num_slots);
+
+  // Like Cache methods, but with an extra "hash" parameter.
+  Cache::Handle* Insert(const Slice& key, uint32_t hash,
+                        void* value, size_t charge,
+                        void (*deleter)(const Slice& key, void* value));
+  Cache::Handle* Lookup(const Slice& key, uint32_t hash);
+  void Release(Cache::Handle* handle);
+  void Erase(const Slice& key, uint32_t hash);
+  size_t TotalCharge() const { return AtomicLoad(&usage_); }
+
+ private:
+  void Unref(ClockSlot* s);
+  void Free(ClockSlot* s);
+  void Remove(ClockSlot* s);
+  void EraseLocked(const Slice& key, uint32_t hash);
+  void EvictLocked();
+  ClockSlot* ClaimLocked(ClockTable* t, uint32_t hash);
+  void GrowLocked(size_t num_slots);
+
+  // Only replaced under mutex_, lookups load it unlocked
+  std::atomic<ClockTable*> table_;
+
+  // Changed atomically, the last Release() of a slot freeing it unlocked
+  std::atomic<size_t> usage_;
+
+  // mutex_ protects the following state.
+  port::Mutex mutex_;
+  size_t capacity_;
+  size_t hand_;        // Next slot looked at by the CLOCK sweep
+};
+
+ClockCacheShard::ClockCacheShard()
+    : table_(NULL),
+      usage_(0),
+      capacity_(0),
+      hand_(0) {
+}
+
+ClockCacheShard::~ClockCacheShard() {
+  ClockTable* t = AtomicLoad(&table_);
+  for (size_t i = 0; i < t->length; i++) {
+    ClockSlot* s = &t->slots[i];
+    const uint64_t meta = AtomicLoad(&s->meta);
+    if (StateOf(meta) != kEmpty) {
+      assert(StateOf(meta) == kVisible);
+      assert(RefsOf(meta) == 0);  // Error if caller has an unreleased handle
+      (*s->deleter)(s->key(), s->value);
+      free(s->key_data);
+    }
+  }
+  while (t != NULL) {
+    // The entries of the older tables were all moved or freed
+    ClockTable* older = t->older;
+    delete t;
+    t = older;
+  }
+}
+
+void ClockCacheShard::Init(size_t num_slots, size_t capacity) {
+  AtomicStore(&table_, new ClockTable(num_slots));
+  capacity_ = capacity;
+}
+
+void ClockCacheShard::SetCapacity(size_t capacity, size_t num_slots) {
+  MutexLock l(&mutex_);
+  capacity_ = capacity;
+  if (num_slots > AtomicLoad(&table_)->length) {
+    GrowLocked(num_slots);
+  }
+  EvictLocked();
+}
+
+void ClockCacheShard::Unref(ClockSlot* s) {
+  uint64_t meta = AtomicFetchSub(&s->meta, static_cast<uint64_t>(1)) - 1;
+  if (StateOf(meta) == kInvisible && RefsOf(meta) == 0) {
+    // Whoever takes it from invisible frees it: a lookup referencing it
+    // meanwhile releases it again and retries this
+    if (AtomicCompareExchange(&s->meta, &meta,
+                              WithState(meta, kConstruction))) {
+      Free(s);
+    }
+  }
+}
+
+// REQUIRES: s is in construction and owned by the caller
+void ClockCacheShard::Free(ClockSlot* s) {
+  (*s->deleter)(s->key(), s->value);
+  free(s->key_data);
+  AtomicFetchSub(&usage_, s->charge);
+  ClockTable* t = s->table;
+  if (t == NULL) {
+    delete s;
+    return;
+  }
+
+  // Lookups of the keys placed further no longer need to probe past the
+  // slots before this one.  The slot may be in a table given up since.
+  const uint32_t hash = AtomicLoad(&s->hash);
+  for (size_t i = 0; &t->slots[t->Probe(hash, i)] != s; i++) {
+    AtomicFetchSub(&t->slots[t->Probe(hash, i)].displacements, 1u);
+  }
+  AtomicFetchSub(&t->occupancy, static_cast<size_t>(1));
+
+  uint64_t meta = AtomicLoad(&s->meta);
+  while (!AtomicCompareExchange(&s->meta, &meta,
+                                WithState(meta & ~kClockBit, kEmpty))) {
+  }
+}
+
+// Take s from the table: free it at once, or when its last handle goes.
+// REQUIRES: mutex_ held, s is visible
+void ClockCacheShard::Remove(ClockSlot* s) {
+  uint64_t meta = AtomicLoad(&s->meta);
+  for (;;) {
+    if (RefsOf(meta) == 0) {
+      if (AtomicCompareExchange(&s->meta, &meta,
+                                WithState(meta, kConstruction))) {
+        Free(s);
+        return;
+      }
+    } else if (AtomicCompareExchange(&s->meta, &meta,
+                                     WithState(meta, kInvisible))) {
+      // The references are perhaps all from lookups missing it: the last
+      // of them frees it
+      return;
+    }
+  }
+}
+
+void ClockCacheShard::EraseLocked(const Slice& key, uint32_t hash) {
+  mutex_.AssertHeld();
+  ClockTable* t = AtomicLoad(&table_);
+  for (size_t i = 0; i < t->length; i++) {
+    ClockSlot* s = &t->slots[t->Probe(hash, i)];
+    // Visible slots only leave that state under mutex_
+    if (StateOf(AtomicLoad(&s->meta)) == kVisible &&
+        AtomicLoad(&s->hash) == hash && s->key() == key) {
+      Remove(s);
+      return;
+    }
+    if (AtomicLoad(&s->displacements) == 0) {
+      return;
+    }
+  }
+}
+
+void ClockCacheShard::EvictLocked() {
+  mutex_.AssertHeld();
+  ClockTable* t = AtomicLoad(&table_);
+  // Two turns clear every CLOCK bit: give up past them, all the entries
+  // being in use
+  for (size_t n = 0; n < 2 * t->length; n++) {
+    if (AtomicLoad(&usage_) <= capacity_ &&
+        AtomicLoad(&t->occupancy) < t->max_occupancy) {
+      return;
+    }
+    ClockSlot* s = &t->slots[hand_];
+    hand_ = (hand_ + 1) & t->mask;
+    uint64_t meta = AtomicLoad(&s->meta);
+    if (StateOf(meta) != kVisible || RefsOf(meta) != 0) {
+      continue;
+    }
+    if (meta & kClockBit) {
+      // Failing to clear it means a lookup just got to it: keep it too
+      AtomicCompareExchange(&s->meta, &meta, meta & ~kClockBit);
+    } else if (AtomicCompareExchange(&s->meta, &meta,
+                                     WithState(meta, kConstruction))) {
+      Free(s);
+    }
+  }
+}
+
+// Take an empty slot of t for hash, in construction.
+// REQUIRES: mutex_ held, t below its maximum occupancy
+ClockSlot* ClockCacheShard::ClaimLocked(ClockTable* t, uint32_t hash) {
+  mutex_.AssertHeld();
+  ClockSlot* s = NULL;
+  for (size_t i = 0; i < t->length; i++) {
+    ClockSlot* slot = &t->slots[t->Probe(hash, i)];
+    uint64_t meta = AtomicLoad(&slot->meta);
+    if (StateOf(meta) == kEmpty &&
+        AtomicCompareExchange(&slot->meta, &meta,
+                              WithState(meta, kConstruction))) {
+      s = slot;
+      break;
+    }
+    // Visible to lookups before the slot is, as frees unregister from
+    // the probe sequence only after the slot is visible
+    AtomicFetchAdd(&slot->displacements, 1u);
+  }
+  // Below max_occupancy, an empty slot is always found
+  assert(s != NULL);
+  AtomicFetchAdd(&t->occupancy, static_cast<size_t>(1));
+  return s;
+}
+
+void ClockCacheShard::GrowLocked(size_t num_slots) {
+  mutex_.AssertHeld();
+  ClockTable* old = AtomicLoad(&table_);
+  ClockTable* t = new ClockTable(num_slots);
+  for (size_t i = 0; i < old->length; i++) {
+    ClockSlot* s = &old->slots[i];
+    uint64_t meta = AtomicLoad(&s->meta);
+    while (StateOf(meta) == kVisible) {
+      if (RefsOf(meta) != 0) {
+        // Freed by its last Release(), like an erased entry
+        if (AtomicCompareExchange(&s->meta, &meta,
+                                  WithState(meta, kInvisible))) {
+          break;
+        }
+      } else if (AtomicCompareExchange(&s->meta, &meta,
+                                       WithState(meta, kConstruction))) {
+        // Left in construction, the old slot is never used again
+        ClockSlot* moved = ClaimLocked(t, AtomicLoad(&s->hash));
+        moved->value = s->value;
+        moved->deleter = s->deleter;
+        moved->charge = s->charge;
+        moved->key_length = s->key_length;
+        moved->key_data = s->key_data;
+        AtomicStore(&moved->hash, AtomicLoad(&s->hash));
+        AtomicStore(&moved->meta, WithState(meta & kClockBit, kVisible));
+        break;
+      }
+    }
+  }
+  // Lookups still probing the old table miss the moved entries at worst
+  t->older = old;
+  AtomicStore(&table_, t);
+  hand_ = 0;
+}
+
+Cache::Handle* ClockCacheShard::Lookup(const Slice& key, uint32_t hash) {
+  ClockTable* t = AtomicLoad(&table_);
+  for (size_t i = 0; i < t->length; i++) {
+    ClockSlot* s = &t->slots[t->Probe(hash, i)];
+    const uint64_t meta = AtomicLoad(&s->meta);
+    if (StateOf(meta) == kVisible && AtomicLoad(&s->hash) == hash) {
+      const uint64_t old = AtomicFetchAdd(&s->meta, static_cast<uint64_t>(1));
+      // Referenced, the slot can not be freed and refilled under us
+      if (StateOf(old) == kVisible && s->key() == key) {
+        if ((old & kClockBit) == 0) {
+          // Only a hint for the sweep
+          s->meta.fetch_or(kClockBit, std::memory_order_relaxed);
+        }
+        return reinterpret_cast<Cache::Handle*>(s);
+      }
+      Unref(s);
+    }
+    if (AtomicLoad(&s->displacements) == 0) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+void ClockCacheShard::Release(Cache::Handle* handle) {
+  Unref(reinterpret_cast<ClockSlot*>(handle));
+}
+
+Cache::Handle* ClockCacheShard::Insert(
+    const Slice& key, uint32_t hash, void* value, size_t charge,
+    void (*deleter)(const Slice& key, void* value)) {
+  MutexLock l(&mutex_);
+  EraseLocked(key, hash);
+  AtomicFetchAdd(&usage_, charge);
+  EvictLocked();
+
+  ClockTable* t = AtomicLoad(&table_);
+  ClockSlot* s = NULL;
+  if (AtomicLoad(&t->occupancy) < t->max_occupancy) {
+    s = ClaimLocked(t, hash);
+  } else {
+    // Every entry is in use: hand out one the cache does not keep
+    s = new ClockSlot;
+    AtomicStore(&s->meta, WithState(0, kInvisible) | 1);
+  }
+  s->value = value;
+  s->deleter = deleter;
+  s->charge = charge;
+  s->key_length = key.size();
+  s->key_data = reinterpret_cast<char*>(malloc(key.size()));
+  memcpy(s->key_data, key.data(), key.size());
+  AtomicStore(&s->hash, hash);
+
+  if (s->table != NULL) {
+    // One reference for the returned handle, and a hit for the sweep
+    uint64_t meta = AtomicLoad(&s->meta);
+    while (!AtomicCompareExchange(
+               &s->meta, &meta, WithState(meta + 1, kVisible) | kClockBit)) {
+    }
+  }
+  return reinterpret_cast<Cache::Handle*>(s);
+}
+
+void ClockCacheShard::Erase(const Slice& key, uint32_t hash) {
+  MutexLock l(&mutex_);
+  EraseLocked(key, hash);
+}
+
+static const int kMaxNumShardBits = 6;
+
+// Shards holding fewer entries than this evict too early.
+static const size_t kMinShardEntries = 32;
+
+class ShardedClockCache : public Cache {
+ private:
+  ClockCacheShard* shards_;
+  int num_shard_bits_;
+  mutable port::Mutex id_mutex_;
+  uint64_t last_id_;
+  size_t estimated_entry_charge_;
+  size_t capacity_;   // Guarded by id_mutex_
+
+  static inline uint32_t HashSlice(const Slice& s) {
+    return Hash(s.data(), s.size(), 0);
+  }
+
+  uint32_t Shard(uint32_t hash) const {
+    return num_shard_bits_ > 0 ? hash >> (32 - num_shard_bits_) : 0;
+  }
+
+  size_t PerShard(size_t capacity) const {
+    const size_t n = static_cast<size_t>(1) << num_shard_bits_;
+    return (capacity + (n - 1)) / n;
+  }
+
+  size_t TableLength(size_t capacity) const {
+    // Tables at most 70% full
+    const size_t per_shard_entries =
+        ((capacity / estimated_entry_charge_) >> num_shard_bits_) + 1;
+    size_t num_slots = 16;
+    while (num_slots * 7 < per_shard_entries * 10) {
+      num_slots *= 2;
+    }
+    return num_slots;
+  }
+
+ public:
+  ShardedClockCache(size_t capacity, size_t estimated_entry_charge)
+      : num_shard_bits_(0),
+        last_id_(0),
+        estimated_entry_charge_(estimated_entry_charge > 0 ?
+                                estimated_entry_charge : 1),
+        capacity_(capacity) {
+    const size_t entries = capacity / estimated_entry_charge_;
+
+    // Twice as many shards as processors, as long as they are not too small
+    const int cpus = port::NumCPUs();
+    while (num_shard_bits_ < kMaxNumShardBits &&
+           (1 << num_shard_bits_) < 2 * cpus &&
+           (entries >> (num_shard_bits_ + 1)) >= kMinShardEntries) {
+      num_shard_bits_++;
+    }
+
+    const int n = 1 << num_shard_bits_;
+    shards_ = new ClockCacheShard[n];
+    for (int i = 0; i < n; i++) {
+      shards_[i].Init(TableLength(capacity), PerShard(capacity));
+    }
+  }
+  virtual ~ShardedClockCache() {
+    delete[] shards_;
+  }
+  virtual Handle* Insert(const Slice& key, void* value, size_t charge,
+                         void (*deleter)(const Slice& key, void* value)) {
+    const uint32_t hash = HashSlice(key);
+    return shards_[Shard(hash)].Insert(key, hash, value, charge, deleter);
+  }
+  virtual Handle* Lookup(const Slice& key) {
+    const uint32_t hash = HashSlice(key);
+    return shards_[Shard(hash)].Lookup(key, hash);
+  }
+  virtual void Release(Handle* handle) {
+    ClockSlot* s = reinterpret_cast<ClockSlot*>(handle);
+    shards_[Shard(s->hash)].Release(handle);
+  }
+  virtual void Erase(const Slice& key) {
+    const uint32_t hash = HashSlice(key);
+    shards_[Shard(hash)].Erase(key, hash);
+  }
+  virtual void* Value(Handle* handle) {
+    return reinterpret_cast<ClockSlot*>(handle)->value;
+  }
+  virtual uint64_t NewId() {
+    MutexLock l(&id_mutex_);
+    return ++(last_id_);
+  }
+  virtual size_t TotalCharge() const {
+    size_t total = 0;
+    for (int s = 0; s < (1 << num_shard_bits_); s++) {
+      total += shards_[s].TotalCharge();
+    }
+    return total;
+  }
+  virtual void SetCapacity(size_t capacity) {
+    MutexLock l(&id_mutex_);
+    capacity_ = capacity;
+    for (int s = 0; s < (1 << num_shard_bits_); s++) {
+      shards_[s].SetCapacity(PerShard(capacity), TableLength(capacity));
+    }
+  }
+  virtual size_t GetCapacity() const {
+    MutexLock l(&id_mutex_);
+    return capacity_;
+  }
+};
+
+}  // end anonymous namespace
+
+Cache* NewClockCache(size_t capacity, size_t estimated_entry_charge) {
+  return new ShardedClockCache(capacity, estimated_entry_charge);
+}
+
+}  // namespace leveldb
@@ -3,13 +3,20 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 //
 // A portable implementation of crc32c, optimized to handle
-// four bytes at a time.
+// four bytes at a time, and one using the crc32 instruction of SSE4.2
+// when the CPU has it.
 
 #include "util/crc32c.h"
 
 #include <stdint.h>
 #include "util/coding.h"
 
+#if defined(__GNUC__) && defined(__x86_64__)
+#define LEVELDB_CRC32C_SSE42 1
+#include <nmmintrin.h>
+#include <wmmintrin.h>
+#endif
+
 namespace leveldb {
 namespace crc32c {
 
@@ -283,7 +290,7 @@ static inline uint32_t LE_LOAD32(const uint8_t *p) {
   return DecodeFixed32(reinterpret_cast<const char*>(p));
 }
 
-uint32_t Extend(uint32_t crc, const char* buf, size_t size) {
+uint32_t ExtendPortable(uint32_t crc, const char* buf, size_t size) {
   const uint8_t *p = reinterpret_cast<const uint8_t *>(buf);
   const uint8_t *e = p + size;
   uint32_t l = crc ^ 0xffffffffu;
@@ -328,5 +335,117 @@ uint32_t Extend(uint32_t crc, const char* buf, size_t size) {
   return l ^ 0xffffffffu;
 }
 
+#ifdef LEVELDB_CRC32C_SSE42
+
+// The crc32 instruction has a latency of three cycles but a throughput
+// of one per cycle: large buffers are cut in three streams checksummed
+// together, whose crcs are then combined with carry-less multiplications.
+// A stream is kLongStream bytes long, or kShortStream near the end of a
+// buffer.
+static const size_t kLongStream = 8192;
+static const size_t kShortStream = 256;
+
+// x^(8*n-33) mod P, bit reflected, shifting a crc over n bytes (see
+// Shift()), for n of kLongStream, 2*kLongStream, kShortStream and
+// 2*kShortStream.
+static uint32_t kXPow[4];
+
+// Return x^n mod P, bit reflected.
+static uint32_t XPowMod(size_t n) {
+  uint32_t v = 0x80000000u;   // x^0
+  while (n-- > 0) {
+    v = (v & 1) ? (v >> 1) ^ 0x82f63b78u : (v >> 1);
+  }
+  return v;
+}
+
+// Return the crc of crc followed by n zero bytes, xpow being x^(8*n-33).
+// The product of two reflected values is their product times x, the crc32
+// instruction multiplies it by x^32 mod P.
+__attribute__((target("sse4.2,pclmul")))
+static inline uint64_t Shift(uint64_t crc, uint32_t xpow) {
+  const __m128i product = _mm_clmulepi64_si128(_mm_cvtsi64_si128(crc),
+                                               _mm_cvtsi64_si128(xpow), 0x00);
+  return _mm_crc32_u64(0, _mm_cvtsi128_si64(product));
+}
+
+// Checksum 3*n bytes at p as three streams of n bytes.
+__attribute__((target("sse4.2,pclmul")))
+static inline uint64_t Extend3(uint64_t crc, const uint8_t* p, size_t n,
+                               const uint32_t* xpow) {
+  const char* a = reinterpret_cast<const char*>(p);
+  const char* b = a + n;
+  const char* c = b + n;
+  uint64_t crc_b = 0;
+  uint64_t crc_c = 0;
+  for (size_t i = 0; i < n; i += 8) {
+    crc = _mm_crc32_u64(crc, DecodeFixed64(a + i));
+    crc_b = _mm_crc32_u64(crc_b, DecodeFixed64(b + i));
+    crc_c = _mm_crc32_u64(crc_c, DecodeFixed64(c + i));
+  }
+  return Shift(crc, xpow[1]) ^ Shift(crc_b, xpow[0]) ^ crc_c;
+}
+
+__attribute__((target("sse4.2,pclmul")))
+static uint32_t ExtendSSE42(uint32_t crc, const char* buf, size_t size) {
+  const uint8_t *p = reinterpret_cast<const uint8_t *>(buf);
+  const uint8_t *e = p + size;
+  uint64_t l = crc ^ 0xffffffffu;
+
+  // Process bytes until finished or p is 8-byte aligned
+  while (p != e && (reinterpret_cast<uintptr_t>(p) & 7) != 0) {
+    l = _mm_crc32_u8(static_cast<uint32_t>(l), *p++);
+  }
+  while (static_cast<size_t>(e - p) >= 3 * kLongStream) {
+    l = Extend3(l, p, kLongStream, &kXPow[0]);
+    p += 3 * kLongStream;
+  }
+  while (static_cast<size_t>(e - p) >= 3 * kShortStream) {
+    l = Extend3(l, p, kShortStream, &kXPow[2]);
+    p += 3 * kShortStream;
+  }
+  // Process bytes 8 at a time
+  while ((e - p) >= 8) {
+    l = _mm_crc32_u64(l, DecodeFixed64(reinterpret_cast<const char*>(p)));
+    p += 8;
+  }
+  // Process the last few bytes
+  while (p != e) {
+    l = _mm_crc32_u8(static_cast<uint32_t>(l), *p++);
+  }
+  return static_cast<uint32_t>(l) ^ 0xffffffffu;
+}
+
+#endif  // LEVELDB_CRC32C_SSE42
+
+typedef uint32_t (*ExtendFunction)(uint32_t, const char*, size_t);
+
+static ExtendFunction ChooseExtend() {
+#ifdef LEVELDB_CRC32C_SSE42
+  if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("pclmul")) {
+    kXPow[0] = XPowMod(8 * kLongStream - 33);
+    kXPow[1] = XPowMod(16 * kLongStream - 33);
+    kXPow[2] = XPowMod(8 * kShortStream - 33);
+    kXPow[3] = XPowMod(16 * kShortStream - 33);
+    return ExtendSSE42;
+  }
+#endif
+  return ExtendPortable;
+}
+
+// Chosen at the first call, once the cpu features are known
+static ExtendFunction GetExtend() {
+  static const ExtendFunction extend = ChooseExtend();
+  return extend;
+}
+
+uint32_t Extend(uint32_t crc, const char* buf, size_t size) {
+  return (*GetExtend())(crc, buf, size);
+}
+
+bool IsHardwareAccelerated() {
+  return GetExtend() != ExtendPortable;
+}
+
 }  // namespace crc32c
 }  // namespace leveldb
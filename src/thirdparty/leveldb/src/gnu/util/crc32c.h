@@ -16,6 +16,13 @@ namespace crc32c {
 // crc32c of a stream of data.
 extern uint32_t Extend(uint32_t init_crc, const char* data, size_t n);
 
+// Same as Extend(), with the table driven implementation Extend() falls
+// back to when the CPU has no crc32 instruction.
+extern uint32_t ExtendPortable(uint32_t init_crc, const char* data, size_t n);
+
+// Return true if Extend() uses the crc32 instruction of the CPU.
+extern bool IsHardwareAccelerated();
+
 // Return the crc32c of data[0,n-1]
 inline uint32_t Value(const char* data, size_t n) {
   return Extend(0, data, n);
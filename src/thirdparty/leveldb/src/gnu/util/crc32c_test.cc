@@ -3,6 +3,7 @@
 // found in the LICENSE file. See the AUTHORS file for names of contributors.
 
 #include "util/crc32c.h"
+#include "util/random.h"
 #include "util/testharness.h"
 
 namespace leveldb {
@@ -56,6 +57,34 @@ TEST(CRC, Extend) {
             Extend(Value("hello ", 6), "world", 5));
 }
 
+TEST(CRC, Portable) {
+  fprintf(stderr, "crc32c: %s\n",
+          IsHardwareAccelerated() ? "SSE4.2" : "portable");
+  Random rnd(301);
+  std::string data(4 * 3 * 8192 + 100, '\0');
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = static_cast<char>(rnd.Uniform(256));
+  }
+  // Every alignment, the sizes around the ones of the streams
+  const size_t sizes[] = { 0, 1, 7, 8, 9, 100, 767, 768, 769, 4096,
+                           3 * 8192 - 1, 3 * 8192, 3 * 8192 + 9,
+                           4 * 3 * 8192 };
+  for (size_t offset = 0; offset < 16; offset++) {
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+      const char* p = data.data() + offset;
+      ASSERT_EQ(ExtendPortable(0, p, sizes[i]), Extend(0, p, sizes[i]));
+      ASSERT_EQ(ExtendPortable(0x12345678, p, sizes[i]),
+                Extend(0x12345678, p, sizes[i]));
+    }
+  }
+  for (int i = 0; i < 1000; i++) {
+    const size_t offset = rnd.Uniform(100);
+    const size_t size = rnd.Uniform(data.size() - offset);
+    const char* p = data.data() + offset;
+    ASSERT_EQ(ExtendPortable(0, p, size), Value(p, size));
+  }
+}
+
 TEST(CRC, Mask) {
   uint32_t crc = Value("foo", 3);
   ASSERT_NE(crc, Mask(crc));
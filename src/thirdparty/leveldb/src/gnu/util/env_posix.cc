@@ -463,6 +463,11 @@ class PosixEnv : public Env {
 
   virtual void Schedule(void (*function)(void*), void* arg);
 
+  virtual void ScheduleWithPriority(void (*function)(void*), void* arg,
+                                    Priority pri);
+
+  virtual void SetBackgroundThreads(int number, Priority pri);
+
   virtual void StartThread(void (*function)(void* arg), void* arg);
 
   virtual Status GetTestDirectory(std::string* result) {
@@ -515,68 +520,100 @@ class PosixEnv : public Env {
     }
   }
 
-  // BGThread() is the body of the background thread
-  void BGThread();
+  // Entry per Schedule() call
+  struct BGItem { void* arg; void (*function)(void*); };
+  typedef std::deque<BGItem> BGQueue;
+
+  // Threads running the work of a priority, started as work comes.
+  struct BGPool {
+    PosixEnv* env;
+    pthread_cond_t bgsignal;
+    int max_threads;
+    int started_threads;
+    int idle_threads;
+    BGQueue queue;
+  };
+
+  // BGThread() is the body of the background threads of "pool"
+  void BGThread(BGPool* pool);
   static void* BGThreadWrapper(void* arg) {
-    reinterpret_cast<PosixEnv*>(arg)->BGThread();
+    BGPool* pool = reinterpret_cast<BGPool*>(arg);
+    pool->env->BGThread(pool);
     return NULL;
   }
 
   pthread_mutex_t mu_;
-  pthread_cond_t bgsignal_;
-  pthread_t bgthread_;
-  bool started_bgthread_;
-
-  // Entry per Schedule() call
-  struct BGItem { void* arg; void (*function)(void*); };
-  typedef std::deque<BGItem> BGQueue;
-  BGQueue queue_;
+  BGPool pools_[2];  // Indexed by Priority
 
   PosixLockTable locks_;
   MmapLimiter mmap_limit_;
 };
 
-PosixEnv::PosixEnv() : started_bgthread_(false) {
+PosixEnv::PosixEnv() {
   PthreadCall("mutex_init", pthread_mutex_init(&mu_, NULL));
-  PthreadCall("cvar_init", pthread_cond_init(&bgsignal_, NULL));
+  for (int pri = LOW; pri <= HIGH; pri++) {
+    BGPool* pool = &pools_[pri];
+    pool->env = this;
+    PthreadCall("cvar_init", pthread_cond_init(&pool->bgsignal, NULL));
+    pool->max_threads = 1;
+    pool->started_threads = 0;
+    pool->idle_threads = 0;
+  }
 }
 
 void PosixEnv::Schedule(void (*function)(void*), void* arg) {
+  ScheduleWithPriority(function, arg, LOW);
+}
+
+void PosixEnv::ScheduleWithPriority(void (*function)(void*), void* arg,
+                                    Priority pri) {
   PthreadCall("lock", pthread_mutex_lock(&mu_));
+  BGPool* pool = &pools_[pri];
 
-  // Start background thread if necessary
-  if (!started_bgthread_) {
-    started_bgthread_ = true;
+  // Start a background thread if none is waiting and the pool may grow
+  if (pool->idle_threads <= static_cast<int>(pool->queue.size()) &&
+      pool->started_threads < pool->max_threads) {
+    pool->started_threads++;
+    pthread_t t;
     PthreadCall(
         "create thread",
-        pthread_create(&bgthread_, NULL,  &PosixEnv::BGThreadWrapper, this));
-  }
-
-  // If the queue is currently empty, the background thread may currently be
-  // waiting.
-  if (queue_.empty()) {
-    PthreadCall("signal", pthread_cond_signal(&bgsignal_));
+        pthread_create(&t, NULL,  &PosixEnv::BGThreadWrapper, pool));
+    PthreadCall("detach thread", pthread_detach(t));
   }
 
   // Add to priority queue
-  queue_.push_back(BGItem());
-  queue_.back().function = function;
-  queue_.back().arg = arg;
+  pool->queue.push_back(BGItem());
+  pool->queue.back().function = function;
+  pool->queue.back().arg = arg;
+
+  // Wake up a waiting background thread, if any
+  PthreadCall("signal", pthread_cond_signal(&pool->bgsignal));
 
   PthreadCall("unlock", pthread_mutex_unlock(&mu_));
 }
 
-void PosixEnv::BGThread() {
+void PosixEnv::SetBackgroundThreads(int number, Priority pri) {
+  PthreadCall("lock", pthread_mutex_lock(&mu_));
+  BGPool* pool = &pools_[pri];
+  if (number > pool->max_threads) {
+    pool->max_threads = number;
+  }
+  PthreadCall("unlock", pthread_mutex_unlock(&mu_));
+}
+
+void PosixEnv::BGThread(BGPool* pool) {
   while (true) {
     // Wait until there is an item that is ready to run
     PthreadCall("lock", pthread_mutex_lock(&mu_));
-    while (queue_.empty()) {
-      PthreadCall("wait", pthread_cond_wait(&bgsignal_, &mu_));
+    pool->idle_threads++;
+    while (pool->queue.empty()) {
+      PthreadCall("wait", pthread_cond_wait(&pool->bgsignal, &mu_));
     }
+    pool->idle_threads--;
 
-    void (*function)(void*) = queue_.front().function;
-    void* arg = queue_.front().arg;
-    queue_.pop_front();
+    void (*function)(void*) = pool->queue.front().function;
+    void* arg = pool->queue.front().arg;
+    pool->queue.pop_front();
 
     PthreadCall("unlock", pthread_mutex_unlock(&mu_));
     (*function)(arg);
@@ -97,6 +97,37 @@ TEST(EnvPosixTest, StartThread) {
   ASSERT_EQ(state.val, 3);
 }
 
+static void WaitForRelease(void* arg) {
+  port::AtomicPointer* release = reinterpret_cast<port::AtomicPointer*>(arg);
+  while (release->Acquire_Load() == NULL) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+  release->Release_Store(NULL);
+}
+
+TEST(EnvPosixTest, Priorities) {
+  port::AtomicPointer release(NULL);
+  env_->ScheduleWithPriority(&WaitForRelease, &release, Env::LOW);
+
+  // Does not wait behind the blocked LOW thread
+  port::AtomicPointer high(NULL);
+  env_->ScheduleWithPriority(&SetBool, &high, Env::HIGH);
+  Env::Default()->SleepForMicroseconds(kDelayMicros);
+  ASSERT_TRUE(high.NoBarrier_Load() != NULL);
+
+  // A second LOW thread runs beside the blocked one
+  port::AtomicPointer low(NULL);
+  env_->SetBackgroundThreads(2, Env::LOW);
+  env_->ScheduleWithPriority(&SetBool, &low, Env::LOW);
+  Env::Default()->SleepForMicroseconds(kDelayMicros);
+  ASSERT_TRUE(low.NoBarrier_Load() != NULL);
+
+  release.Release_Store(&release);
+  while (release.Acquire_Load() != NULL) {
+    Env::Default()->SleepForMicroseconds(1000);
+  }
+}
+
 }  // namespace leveldb
 
 int main(int argc, char** argv) {
@@ -22,7 +22,18 @@ Options::Options()
       block_size(4096),
       block_restart_interval(16),
       compression(kSnappyCompression),
-      filter_policy(NULL) {
+      filter_policy(NULL),
+      whole_table_filter(false),
+      filter_partition_keys(0),
+      group_commit_delay_micros(0),
+      max_write_group_size(1<<20),
+      concurrent_memtable_writes(false),
+      pipelined_writes(false),
+      value_log_threshold(0),
+      value_log_gc_ratio(0.5),
+      max_background_compactions(1),
+      max_subcompactions(1),
+      rate_limiter(NULL) {
 }
 
 
@@ -0,0 +1,197 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/rate_limiter.h"
+
+#include <algorithm>
+#include "port/port.h"
+#include "util/mutexlock.h"
+
+namespace leveldb {
+
+RateLimiter::~RateLimiter() {
+}
+
+void RateLimiter::ReportLoad(uint64_t read_micros, uint64_t pending_bytes) {
+}
+
+namespace {
+
+// Bytes saved up while idle are limited to this much time at full rate.
+static const int64_t kBurstMicros = 100000;
+
+// The debt left by the requests of priority HIGH is limited to this much
+// time at full rate.
+static const int64_t kHighDebtMicros = 250000;
+
+// A token bucket: the bytes requested are taken from the tokens earned at
+// the current rate.  A request may overdraw the bucket, then waits for
+// the tokens it lacks; the following requests wait for the debt as well.
+// A HIGH request never waits, and the bytes it takes beyond
+// kHighDebtMicros of debt are not charged: a large memtable compaction
+// would otherwise stall the compactions for as long as it took.
+class TokenBucket : public RateLimiter {
+ public:
+  TokenBucket(Env* env, int64_t bytes_per_second)
+      : env_(env),
+        rate_(bytes_per_second > 0 ? bytes_per_second : 1),
+        available_(0),
+        last_refill_micros_(env->NowMicros()),
+        total_(0) {
+  }
+
+  virtual void Request(int64_t bytes, Env::Priority pri) {
+    int64_t wait_micros = 0;
+    {
+      MutexLock l(&mu_);
+      Refill();
+      total_ += bytes;
+      if (pri == Env::HIGH) {
+        const int64_t floor = -rate_ * kHighDebtMicros / 1000000;
+        if (available_ > floor) {
+          available_ = std::max(available_ - bytes, floor);
+        }
+      } else {
+        available_ -= bytes;
+        if (available_ < 0) {
+          wait_micros = -available_ * 1000000 / rate_;
+        }
+      }
+    }
+    if (wait_micros > 0) {
+      env_->SleepForMicroseconds(static_cast<int>(wait_micros));
+    }
+  }
+
+  virtual void SetBytesPerSecond(int64_t bytes_per_second) {
+    MutexLock l(&mu_);
+    Refill();
+    rate_ = bytes_per_second > 0 ? bytes_per_second : 1;
+  }
+
+  virtual int64_t GetBytesPerSecond() const {
+    MutexLock l(&mu_);
+    return rate_;
+  }
+
+  virtual int64_t GetTotalBytesThrough() const {
+    MutexLock l(&mu_);
+    return total_;
+  }
+
+ protected:
+  void Refill() {
+    mu_.AssertHeld();
+    const uint64_t now = env_->NowMicros();
+    int64_t elapsed = static_cast<int64_t>(now - last_refill_micros_);
+    last_refill_micros_ = now;
+    if (elapsed > 10 * 1000000) {
+      elapsed = 10 * 1000000;   // Keeps the product below from overflowing
+    }
+    available_ += elapsed * rate_ / 1000000;
+    const int64_t burst = rate_ * kBurstMicros / 1000000;
+    if (available_ > burst) {
+      available_ = burst;
+    }
+  }
+
+  Env* const env_;
+  mutable port::Mutex mu_;
+  int64_t rate_;                  // Bytes per second
+  int64_t available_;             // Tokens, negative when overdrawn
+  uint64_t last_refill_micros_;
+  int64_t total_;
+};
+
+class AutoTunedTokenBucket : public TokenBucket {
+ public:
+  AutoTunedTokenBucket(Env* env,
+                       int64_t min_bytes_per_second,
+                       int64_t max_bytes_per_second,
+                       uint64_t target_read_micros,
+                       uint64_t max_pending_bytes)
+      : TokenBucket(env, max_bytes_per_second),
+        min_rate_(min_bytes_per_second > 0 ? min_bytes_per_second : 1),
+        max_rate_(max_bytes_per_second > min_rate_ ?
+                  max_bytes_per_second : min_rate_),
+        target_read_micros_(target_read_micros),
+        max_pending_bytes_(max_pending_bytes) {
+  }
+
+  virtual void ReportLoad(uint64_t read_micros, uint64_t pending_bytes) {
+    MutexLock l(&mu_);
+    Refill();
+    int64_t rate = rate_;
+    if (pending_bytes > max_pending_bytes_) {
+      // Writes are going to stall on the compactions: catch up first
+      rate += rate / 4;
+    } else if (read_micros > target_read_micros_) {
+      // The compactions slow the reads down
+      rate -= rate / 4;
+    } else if (read_micros < target_read_micros_ / 2) {
+      rate += rate / 20;
+    }
+    if (rate < min_rate_) {
+      rate = min_rate_;
+    }
+    if (rate > max_rate_) {
+      rate = max_rate_;
+    }
+    rate_ = rate;
+  }
+
+ private:
+  const int64_t min_rate_;
+  const int64_t max_rate_;
+  const uint64_t target_read_micros_;
+  const uint64_t max_pending_bytes_;
+};
+
+class RateLimitedFile : public WritableFile {
+ public:
+  RateLimitedFile(WritableFile* base, RateLimiter* limiter, Env::Priority pri)
+      : base_(base), limiter_(limiter), pri_(pri) {
+  }
+
+  virtual ~RateLimitedFile() {
+    delete base_;
+  }
+
+  virtual Status Append(const Slice& data) {
+    limiter_->Request(data.size(), pri_);
+    return base_->Append(data);
+  }
+
+  virtual Status Close() { return base_->Close(); }
+  virtual Status Flush() { return base_->Flush(); }
+  virtual Status Sync() { return base_->Sync(); }
+
+ private:
+  WritableFile* const base_;
+  RateLimiter* const limiter_;
+  const Env::Priority pri_;
+};
+
+}  // namespace
+
+RateLimiter* NewRateLimiter(int64_t bytes_per_second) {
+  return new TokenBucket(Env::Default(), bytes_per_second);
+}
+
+RateLimiter* NewAutoTunedRateLimiter(int64_t min_bytes_per_second,
+                                     int64_t max_bytes_per_second,
+                                     uint64_t target_read_micros,
+                                     uint64_t max_pending_bytes) {
+  return new AutoTunedTokenBucket(Env::Default(),
+                                  min_bytes_per_second, max_bytes_per_second,
+                                  target_read_micros, max_pending_bytes);
+}
+
+WritableFile* NewRateLimitedFile(WritableFile* base,
+                                 RateLimiter* limiter,
+                                 Env::Priority pri) {
+  return new RateLimitedFile(base, limiter, pri);
+}
+
+}  // namespace leveldb
@@ -0,0 +1,101 @@
+// Copyright (c) 2011 The LevelDB Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file. See the AUTHORS file for names of contributors.
+
+#include "leveldb/rate_limiter.h"
+
+#include "leveldb/env.h"
+#include "util/testharness.h"
+
+namespace leveldb {
+
+class RateLimiterTest { };
+
+TEST(RateLimiterTest, Rate) {
+  RateLimiter* limiter = NewRateLimiter(4 << 20);
+  Env* env = Env::Default();
+  const uint64_t start = env->NowMicros();
+  for (int i = 0; i < 16; i++) {
+    limiter->Request(64 << 10, Env::LOW);
+  }
+  const uint64_t elapsed = env->NowMicros() - start;
+  // 1MB at 4MB/s, nothing saved up beforehand
+  ASSERT_GE(elapsed, 200000);
+  ASSERT_LT(elapsed, 2000000);
+  ASSERT_EQ(1 << 20, limiter->GetTotalBytesThrough());
+  delete limiter;
+}
+
+TEST(RateLimiterTest, HighPriority) {
+  RateLimiter* limiter = NewRateLimiter(4 << 20);
+  Env* env = Env::Default();
+  uint64_t start = env->NowMicros();
+  limiter->Request(1 << 20, Env::HIGH);
+  ASSERT_LT(env->NowMicros() - start, 100000);
+
+  // The next requests pay for it
+  start = env->NowMicros();
+  limiter->Request(1, Env::LOW);
+  ASSERT_GE(env->NowMicros() - start, 200000);
+  delete limiter;
+}
+
+TEST(RateLimiterTest, HighPriorityDebt) {
+  RateLimiter* limiter = NewRateLimiter(4 << 20);
+  Env* env = Env::Default();
+  uint64_t start = env->NowMicros();
+  for (int i = 0; i < 16; i++) {
+    limiter->Request(1 << 20, Env::HIGH);
+  }
+  ASSERT_LT(env->NowMicros() - start, 100000);
+  ASSERT_EQ(16 << 20, limiter->GetTotalBytesThrough());
+
+  // 4s at 4MB/s, but the next requests only pay for a bounded debt
+  start = env->NowMicros();
+  limiter->Request(1, Env::LOW);
+  const uint64_t elapsed = env->NowMicros() - start;
+  ASSERT_GE(elapsed, 100000);
+  ASSERT_LT(elapsed, 1000000);
+  delete limiter;
+}
+
+TEST(RateLimiterTest, AutoTuned) {
+  RateLimiter* limiter = NewAutoTunedRateLimiter(1 << 20, 64 << 20,
+                                                 2000, 1 << 30);
+  ASSERT_EQ(64 << 20, limiter->GetBytesPerSecond());
+
+  // Slow reads lower the rate, down to the minimum
+  limiter->ReportLoad(10000, 0);
+  ASSERT_LT(limiter->GetBytesPerSecond(), 64 << 20);
+  for (int i = 0; i < 100; i++) {
+    limiter->ReportLoad(10000, 0);
+  }
+  ASSERT_EQ(1 << 20, limiter->GetBytesPerSecond());
+
+  // Steady reads keep it
+  limiter->ReportLoad(1500, 0);
+  ASSERT_EQ(1 << 20, limiter->GetBytesPerSecond());
+
+  // Compactions falling behind raise it, even with slow reads
+  limiter->ReportLoad(10000, 2u << 30);
+  ASSERT_GT(limiter->GetBytesPerSecond(), 1 << 20);
+
+  // Fast reads raise it slowly, up to the maximum
+  for (int i = 0; i < 200; i++) {
+    limiter->ReportLoad(100, 0);
+  }
+  ASSERT_EQ(64 << 20, limiter->GetBytesPerSecond());
+  delete limiter;
+
+  // A fixed rate ignores the load
+  limiter = NewRateLimiter(8 << 20);
+  limiter->ReportLoad(10000, 0);
+  ASSERT_EQ(8 << 20, limiter->GetBytesPerSecond());
+  delete limiter;
+}
+
+}  // namespace leveldb
+
+int main(int argc, char** argv) {
+  return leveldb::test::RunAllTests();
+}
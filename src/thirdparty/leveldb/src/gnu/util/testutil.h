@@ -7,6 +7,7 @@
 
 #include "leveldb/env.h"
 #include "leveldb/slice.h"
+#include "util/arena.h"
 #include "util/random.h"
 
 namespace leveldb {
@@ -47,6 +48,13 @@ class ErrorEnv : public EnvWrapper {
   }
 };
 
+// An Arena the tests may keep on the stack: Arena itself is only
+// deleted by destroy().
+class TestArena : public Arena {
+ public:
+  ~TestArena() { }
+};
+
 }  // namespace test
 }  // namespace leveldb
 